@@ -0,0 +1,274 @@
+#include "decompress.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+
+// Compares the optimized decoders with the reference ones : output must be identical, then both are timed.
+// The encoders below are simple, only meant to produce valid streams with realistic content.
+
+typedef bool (*DecompressFunction)(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+static void WriteHeader(std::vector<uint8_t>& out, uint8_t type, size_t size) {
+	out.push_back(type);
+	out.push_back(size & 0xFF);
+	out.push_back((size >> 8) & 0xFF);
+	out.push_back((size >> 16) & 0xFF);
+}
+
+// LZ10 : lengths 3 to 18. LZ11 : up to 10110h, in 2, 3 or 4 bytes.
+static std::vector<uint8_t> CompressLZ(const std::vector<uint8_t>& data, bool extended) {
+	std::vector<uint8_t> out;
+	WriteHeader(out, extended ? COMPRESSION_LZ11_HEADER : COMPRESSION_LZ10_HEADER, data.size());
+	const size_t maxLength = extended ? 0x10110 : 18;
+
+	// Single candidate per 3 byte hash
+	std::vector<int64_t> lastPosition(1 << 16, -1);
+	size_t pos = 0;
+	while (pos < data.size()) {
+		size_t flagsIndex = out.size();
+		out.push_back(0);
+		for (int i = 0; (i < 8) && (pos < data.size()); i++) {
+			size_t length = 0;
+			size_t distance = 0;
+			if (pos + 3 <= data.size()) {
+				uint32_t hash = ((data[pos] << 8) ^ (data[pos + 1] << 4) ^ data[pos + 2]) & 0xFFFF;
+				int64_t candidate = lastPosition[hash];
+				lastPosition[hash] = pos;
+				if ((candidate >= 0) && (pos - candidate <= 0x1000)) {
+					while ((length < maxLength) && (pos + length < data.size()) && (data[candidate + length] == data[pos + length])) length++;
+					distance = pos - candidate;
+				}
+			}
+
+			if (length < 3) {
+				out.push_back(data[pos++]);
+				continue;
+			}
+
+			out[flagsIndex] |= 0x80 >> i;
+			size_t d = distance - 1;
+			if (!extended || (length <= 0x10)) {
+				out.push_back(static_cast<uint8_t>(((length - (extended ? 1 : 3)) << 4) | (d >> 8)));
+			}
+			else if (length <= 0x110) {
+				out.push_back(static_cast<uint8_t>((length - 0x11) >> 4));
+				out.push_back(static_cast<uint8_t>((((length - 0x11) & 0xF) << 4) | (d >> 8)));
+			}
+			else {
+				out.push_back(static_cast<uint8_t>(0x10 | ((length - 0x111) >> 12)));
+				out.push_back(static_cast<uint8_t>((length - 0x111) >> 4));
+				out.push_back(static_cast<uint8_t>((((length - 0x111) & 0xF) << 4) | (d >> 8)));
+			}
+			out.push_back(static_cast<uint8_t>(d));
+			pos += length;
+		}
+	}
+	return out;
+}
+
+static std::vector<uint8_t> CompressRLE(const std::vector<uint8_t>& data) {
+	std::vector<uint8_t> out;
+	WriteHeader(out, COMPRESSION_RLE << 4, data.size());
+
+	size_t pos = 0;
+	while (pos < data.size()) {
+		size_t run = 1;
+		while ((run < 130) && (pos + run < data.size()) && (data[pos + run] == data[pos])) run++;
+		if (run >= 3) {
+			out.push_back(static_cast<uint8_t>(0x80 | (run - 3)));
+			out.push_back(data[pos]);
+			pos += run;
+			continue;
+		}
+
+		size_t start = pos;
+		while ((pos < data.size()) && (pos - start < 128)) {
+			if ((pos + 2 < data.size()) && (data[pos] == data[pos + 1]) && (data[pos] == data[pos + 2])) break;
+			pos++;
+		}
+		out.push_back(static_cast<uint8_t>(pos - start - 1));
+		out.insert(out.end(), data.begin() + start, data.begin() + pos);
+	}
+	return out;
+}
+
+// 4 or 8 bit symbols, tree stored breadth first so child offsets stay small. Returns nothing if an offset
+// does not fit in 6 bits, which needs a smarter layout than this one.
+static std::vector<uint8_t> CompressHuffman(const std::vector<uint8_t>& data, int symbolBits) {
+	struct Node {
+		int symbol;
+		int children[2];
+	};
+	std::vector<Node> nodes;
+
+	const int symbolCount = 1 << symbolBits;
+	std::vector<uint64_t> frequencies(symbolCount);
+	for (uint8_t value : data) {
+		if (symbolBits == 8) {
+			frequencies[value]++;
+			continue;
+		}
+		frequencies[value & 0xF]++;
+		frequencies[value >> 4]++;
+	}
+
+	typedef std::pair<uint64_t, int> Weighted;
+	std::priority_queue<Weighted, std::vector<Weighted>, std::greater<Weighted>> queue;
+	for (int i = 0; i < symbolCount; i++) {
+		// 4 bit : every symbol gets a code. 8 bit : symbols in use only, the tree needs at least two leaves.
+		if ((symbolBits == 8) && (frequencies[i] == 0) && (i >= 2)) continue;
+		nodes.push_back({ i, { -1, -1 } });
+		queue.push({ frequencies[i] + 1, static_cast<int>(nodes.size() - 1) });
+	}
+	while (queue.size() > 1) {
+		Weighted a = queue.top(); queue.pop();
+		Weighted b = queue.top(); queue.pop();
+		nodes.push_back({ -1, { a.second, b.second } });
+		queue.push({ a.first + b.first, static_cast<int>(nodes.size() - 1) });
+	}
+	int root = queue.top().second;
+
+	// Codes, MSB first
+	std::vector<std::pair<uint32_t, int>> codes(symbolCount);
+	std::vector<std::pair<int, std::pair<uint32_t, int>>> stack{ { root, { 0, 0 } } };
+	while (!stack.empty()) {
+		auto [index, code] = stack.back();
+		stack.pop_back();
+		if (nodes[index].symbol >= 0) {
+			codes[nodes[index].symbol] = code;
+			continue;
+		}
+		for (int side = 0; side < 2; side++) stack.push_back({ nodes[index].children[side], { (code.first << 1) | side, code.second + 1 } });
+	}
+
+	// Breadth first layout : root at 1, each internal node's children stored as the next free pair
+	std::vector<uint8_t> tree(2, 0);
+	std::vector<std::pair<int, size_t>> pending{ { root, 1 } };
+	for (size_t i = 0; i < pending.size(); i++) {
+		auto [index, position] = pending[i];
+		const Node& node = nodes[index];
+		if (node.symbol >= 0) {
+			tree[position] = static_cast<uint8_t>(node.symbol);
+			continue;
+		}
+		size_t childPosition = tree.size();
+		tree.resize(tree.size() + 2);
+		size_t offset = (childPosition - (position & ~static_cast<size_t>(1)) - 2) / 2;
+		if (offset > 0x3F) return {};
+		tree[position] = static_cast<uint8_t>(offset
+			| ((nodes[node.children[0]].symbol >= 0) ? 0x80 : 0)
+			| ((nodes[node.children[1]].symbol >= 0) ? 0x40 : 0));
+		pending.push_back({ node.children[0], childPosition });
+		pending.push_back({ node.children[1], childPosition + 1 });
+	}
+	if (tree.size() > 0x200) return {};
+	while (tree.size() % 4 != 0) tree.push_back(0);
+	tree[0] = static_cast<uint8_t>(tree.size() / 2 - 1);
+
+	std::vector<uint8_t> out;
+	WriteHeader(out, static_cast<uint8_t>((COMPRESSION_HUFFMAN << 4) | symbolBits), data.size());
+	out.insert(out.end(), tree.begin(), tree.end());
+
+	uint32_t word = 0;
+	int bits = 0;
+	auto flush = [&]() {
+		for (int i = 0; i < 4; i++) out.push_back(static_cast<uint8_t>(word >> (i * 8)));
+		word = 0;
+		bits = 0;
+	};
+	auto emit = [&](uint32_t symbol) {
+		for (int i = codes[symbol].second - 1; i >= 0; i--) {
+			word |= ((codes[symbol].first >> i) & 0x1) << (31 - bits);
+			if (++bits == 32) flush();
+		}
+	};
+	for (uint8_t value : data) {
+		if (symbolBits == 8) {
+			emit(value);
+			continue;
+		}
+		emit(value & 0xF);
+		emit(value >> 4);
+	}
+	if (bits > 0) flush();
+	return out;
+}
+
+// Sprite-like data : runs, repeated tiles and some noise
+static std::vector<uint8_t> GenerateData(size_t size) {
+	std::mt19937 random(1234);
+	std::vector<uint8_t> data;
+	data.reserve(size);
+	while (data.size() < size) {
+		switch (random() % 4) {
+		case 0:
+			data.insert(data.end(), random() % 64 + 1, static_cast<uint8_t>(random() % 4));
+			break;
+		case 1:
+			if (data.size() > 64) {
+				size_t distance = random() % 64 + 1;
+				size_t length = random() % 32 + 3;
+				for (size_t i = 0; i < length; i++) data.push_back(data[data.size() - distance]);
+			}
+			break;
+		default:
+			for (int i = random() % 16; i >= 0; i--) data.push_back(static_cast<uint8_t>(random() % 16));
+			break;
+		}
+	}
+	data.resize(size);
+	return data;
+}
+
+static bool Run(const char* name, const std::vector<uint8_t>& data, const std::vector<uint8_t>& compressed,
+		DecompressFunction reference, DecompressFunction optimized) {
+	const int iterations = 50;
+	std::vector<uint8_t> referenceOut(data.size());
+	std::vector<uint8_t> optimizedOut(data.size());
+
+	if (compressed.empty()) {
+		std::cout << name << " : could not compress the test data" << std::endl;
+		return false;
+	}
+
+	if (!reference(compressed.data(), compressed.size(), referenceOut.data(), referenceOut.size()) || (referenceOut != data)) {
+		std::cout << name << " : reference decoder failed" << std::endl;
+		return false;
+	}
+	if (!optimized(compressed.data(), compressed.size(), optimizedOut.data(), optimizedOut.size()) || (optimizedOut != referenceOut)) {
+		std::cout << name << " : optimized decoder output differs from the reference" << std::endl;
+		return false;
+	}
+
+	auto measure = [&](DecompressFunction function, std::vector<uint8_t>& out) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) function(compressed.data(), compressed.size(), out.data(), out.size());
+		auto end = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+		return (static_cast<double>(data.size()) * iterations) / (seconds * 1024 * 1024);
+	};
+	double referenceSpeed = measure(reference, referenceOut);
+	double optimizedSpeed = measure(optimized, optimizedOut);
+
+	std::cout << name << " : " << compressed.size() << " -> " << data.size() << " bytes, reference "
+		<< referenceSpeed << " MB/s, optimized " << optimizedSpeed << " MB/s (x" << optimizedSpeed / referenceSpeed << ")" << std::endl;
+	return true;
+}
+
+int main() {
+	std::vector<uint8_t> data = GenerateData(4 * 1024 * 1024);
+
+	bool ok = true;
+	ok &= Run("LZ10", data, CompressLZ(data, false), DecompressLZ10Reference, DecompressLZ10);
+	ok &= Run("LZ11", data, CompressLZ(data, true), DecompressLZ11Reference, DecompressLZ11);
+	ok &= Run("RLE", data, CompressRLE(data), DecompressRLEReference, DecompressRLE);
+	ok &= Run("Huffman 4bit", data, CompressHuffman(data, 4), DecompressHuffmanReference, DecompressHuffman);
+	ok &= Run("Huffman 8bit", data, CompressHuffman(data, 8), DecompressHuffmanReference, DecompressHuffman);
+
+	return ok ? 0 : 1;
+}
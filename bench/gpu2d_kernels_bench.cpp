@@ -0,0 +1,168 @@
+#include "gpu2d_kernels.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Compares every 2D kernel table with the scalar one on random scanlines : output must be identical, then all are
+// timed. Inputs cover the whole value ranges, ties between keys included. Coefficients stay within 0-16, GPU2D
+// clamps them before calling the kernels.
+
+static const int TRIALS = 2000;
+static const int ITERATIONS = 20000;
+
+struct LineInputs {
+	std::vector<uint16_t> indices;
+	std::vector<uint16_t> palette;
+	std::vector<uint16_t> colors;
+	std::vector<uint16_t> keys;
+	std::vector<uint16_t> flags;
+	std::vector<uint16_t> window;
+	std::vector<uint16_t> objEva;
+	std::vector<uint16_t> objEvb;
+	GPU2DLineStack stack;
+	GPU2DBlendParams params;
+	uint16_t key;
+	uint16_t layer;
+	int count;
+	int brightnessMode;
+	int brightnessFactor;
+};
+
+static void Randomize(LineInputs& in, std::mt19937& random) {
+	auto fill = [&random](std::vector<uint16_t>& values, size_t count, uint32_t modulo) {
+		values.resize(count);
+		for (uint16_t& value : values) value = static_cast<uint16_t>(random() % modulo);
+	};
+
+	// Palettes have 2 readable bytes after their last entry (see PaletteLookupAVX2)
+	fill(in.indices, GPU2D_LINE_WIDTH, 0x10000);
+	fill(in.palette, 0x8000 + 1, 0x10000);
+	fill(in.colors, GPU2D_LINE_WIDTH, 0x10000);
+	fill(in.keys, GPU2D_LINE_WIDTH, 8 * 4);
+	fill(in.flags, GPU2D_LINE_WIDTH, 2);
+	for (uint16_t& flag : in.flags) flag *= GPU2D_LAYER_OBJ_BLEND;
+	fill(in.window, GPU2D_LINE_WIDTH, 0x40);
+	fill(in.objEva, GPU2D_LINE_WIDTH, 17);
+	fill(in.objEvb, GPU2D_LINE_WIDTH, 17);
+
+	for (int x = 0; x < GPU2D_LINE_WIDTH; x++) {
+		in.stack.topColor[x] = static_cast<uint16_t>(random());
+		in.stack.topKey[x] = static_cast<uint16_t>(random() % (8 * 4 + 1));
+		in.stack.topLayer[x] = static_cast<uint16_t>(random() & 0x13F);
+		in.stack.secondColor[x] = static_cast<uint16_t>(random());
+		in.stack.secondKey[x] = static_cast<uint16_t>(in.stack.topKey[x] + random() % 8);
+		in.stack.secondLayer[x] = static_cast<uint16_t>(random() & 0x3F);
+	}
+
+	in.params.effect = static_cast<uint16_t>(random() % 4);
+	in.params.firstTargets = static_cast<uint16_t>(random() & 0x3F);
+	in.params.secondTargets = static_cast<uint16_t>(random() & 0x3F);
+	in.params.eva = static_cast<uint16_t>(random() % 17);
+	in.params.evb = static_cast<uint16_t>(random() % 17);
+	in.params.evy = static_cast<uint16_t>(random() % 17);
+	in.key = static_cast<uint16_t>(random() % (8 * 4));
+	in.layer = static_cast<uint16_t>(1 << (random() % 5));
+	in.count = ((random() % 4) == 0) ? static_cast<int>(random() % GPU2D_LINE_WIDTH) : GPU2D_LINE_WIDTH;
+	in.brightnessMode = static_cast<int>(random() % 4);
+	in.brightnessFactor = static_cast<int>(random() % 17);
+}
+
+struct LineOutputs {
+	std::vector<uint16_t> colors;
+	GPU2DLineStack stack;
+	GPU2DLineStack stackPerPixel;
+	std::vector<uint16_t> blended;
+	std::vector<uint32_t> rgba;
+};
+
+static void RunKernels(const GPU2DKernels& kernels, const LineInputs& in, LineOutputs& out) {
+	out.colors.assign(GPU2D_LINE_WIDTH, 0xDEAD);
+	kernels.paletteLookup(in.indices.data(), in.palette.data(), out.colors.data(), in.count);
+
+	// Once with a single key and no flags (BGs), once with per pixel keys and flags (OBJs)
+	out.stack = in.stack;
+	kernels.insertLayer(out.stack, in.colors.data(), nullptr, in.key, in.layer, nullptr, in.window.data());
+	out.stackPerPixel = in.stack;
+	kernels.insertLayer(out.stackPerPixel, in.colors.data(), in.keys.data(), 0, GPU2D_LAYER_OBJ, in.flags.data(), in.window.data());
+
+	out.blended.assign(GPU2D_LINE_WIDTH, 0);
+	kernels.blend(in.stack, in.window.data(), in.objEva.data(), in.objEvb.data(), in.params, out.blended.data());
+
+	// SIMD conversions work on whole vectors : full lines only
+	out.rgba.assign(GPU2D_LINE_WIDTH, 0);
+	kernels.convert(in.colors.data(), out.rgba.data(), GPU2D_LINE_WIDTH, in.brightnessMode, in.brightnessFactor);
+}
+
+static bool SameStack(const GPU2DLineStack& a, const GPU2DLineStack& b) {
+	return memcmp(&a, &b, sizeof(GPU2DLineStack)) == 0;
+}
+
+static bool Compare(const GPU2DKernels& kernels, std::mt19937& random) {
+	const GPU2DKernels& reference = GetGPU2DKernels(SIMD_SCALAR);
+	LineInputs in;
+	LineOutputs expected;
+	LineOutputs actual;
+
+	for (int trial = 0; trial < TRIALS; trial++) {
+		Randomize(in, random);
+		RunKernels(reference, in, expected);
+		RunKernels(kernels, in, actual);
+
+		const char* failed = nullptr;
+		if (actual.colors != expected.colors) failed = "paletteLookup";
+		else if (!SameStack(actual.stack, expected.stack) || !SameStack(actual.stackPerPixel, expected.stackPerPixel)) failed = "insertLayer";
+		else if (actual.blended != expected.blended) failed = "blend";
+		else if (actual.rgba != expected.rgba) failed = "convert";
+		if (failed != nullptr) {
+			std::cout << kernels.name << " : " << failed << " differs from the scalar kernel (trial " << trial << ")" << std::endl;
+			return false;
+		}
+	}
+	std::cout << kernels.name << " : same output as the scalar kernels on " << TRIALS << " random lines" << std::endl;
+	return true;
+}
+
+// Nanoseconds per 256 pixel line of every kernel
+static void Measure(const GPU2DKernels& kernels, std::mt19937& random) {
+	LineInputs in;
+	Randomize(in, random);
+	in.count = GPU2D_LINE_WIDTH;
+	LineOutputs out;
+	RunKernels(kernels, in, out);
+
+	auto time = [](auto function) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < ITERATIONS; i++) function();
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+	};
+	double lookup = time([&]() { kernels.paletteLookup(in.indices.data(), in.palette.data(), out.colors.data(), GPU2D_LINE_WIDTH); });
+	double insert = time([&]() { kernels.insertLayer(out.stack, in.colors.data(), in.keys.data(), 0, GPU2D_LAYER_OBJ, in.flags.data(), in.window.data()); });
+	double blend = time([&]() { kernels.blend(in.stack, in.window.data(), in.objEva.data(), in.objEvb.data(), in.params, out.blended.data()); });
+	double convert = time([&]() { kernels.convert(in.colors.data(), out.rgba.data(), GPU2D_LINE_WIDTH, in.brightnessMode, in.brightnessFactor); });
+
+	std::cout << kernels.name << " : paletteLookup " << lookup << " ns, insertLayer " << insert << " ns, blend " << blend
+		<< " ns, convert " << convert << " ns per line" << std::endl;
+}
+
+int main() {
+	std::mt19937 random(1234);
+
+	// Levels the host does not support give a lower table : each table is only checked once
+	std::vector<const GPU2DKernels*> tables;
+	for (eSIMDLevel level : { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 }) {
+		const GPU2DKernels* kernels = &GetGPU2DKernels(level);
+		if ((tables.empty()) || (tables.back() != kernels)) tables.push_back(kernels);
+	}
+
+	bool ok = true;
+	for (const GPU2DKernels* kernels : tables) {
+		if (kernels != tables.front()) ok &= Compare(*kernels, random);
+	}
+	for (const GPU2DKernels* kernels : tables) Measure(*kernels, random);
+
+	return ok ? 0 : 1;
+}
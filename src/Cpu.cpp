@@ -1,4 +1,5 @@
 #include "Cpu.h"
+#include <cstring>
 
 #pragma region Debug
 
@@ -72,6 +73,7 @@ Cpu::Cpu(ARMInstructionSet instructionSet) {
 	Reset();
 
 	this->instructionSet = instructionSet;
+	cycleLength = (instructionSet == ARMv5_ARM9) ? 1 : ARM7_CYCLE_LENGTH;
 }
 
 bool Cpu::SetBootAddr(uint32_t bootAddr) {
@@ -84,6 +86,15 @@ bool Cpu::SetBootAddr(uint32_t bootAddr) {
 
 void Cpu::SetMMU(ARM_mem* ptr) {
 	memory = ptr;
+
+	irq.Attach(*memory, &scheduler, [this]() { if (IsHalted()) WakeUp(); });
+
+	if (instructionSet == ARMv4_ARM7) {
+		memory->SetIOWriteHandler(HALTCNT_ADDR, [this](uint32_t value, uint32_t mask) {
+			// HALTCNT bits 6-7 : 2 = Halt (Sleep is handled as Halt)
+			if (((mask & 0xFF00) != 0) && (((value >> 14) & 0x3) >= 2)) Halt();
+		});
+	}
 }
 
 CpuMode Cpu::GetCurrentCpuMode() const {
@@ -240,24 +251,128 @@ void Cpu::RestoreCPSR() {
 	default:
 		throw EXCEPTION_SPSR_UNKNOWN_MODE;
 	}
+
+	// IRQs may have been enabled again : end the current block to check them
+	if ((cpsr.bits.I == 0) && irq.IsPending()) scheduler.BreakLoop();
+}
+
+void Cpu::SetSPSR(uint32_t value) {
+	switch (GetCurrentCpuMode()) {
+	case System:
+	case User:
+		throw EXCEPTION_SPSR_MODE_IS_USER_OR_SYSTEM;
+	case Supervisor:
+		spsr_svc.value = value;
+		break;
+	case Abort:
+		spsr_abt.value = value;
+		break;
+	case IRQ:
+		spsr_irq.value = value;
+		break;
+	case Undefined:
+		spsr_und.value = value;
+		break;
+	case FIQ:
+		spsr_fiq.value = value;
+		break;
+	default:
+		throw EXCEPTION_SPSR_UNKNOWN_MODE;
+	}
 }
 
+#pragma region Exceptions
+
+uint32_t Cpu::GetExceptionBase() const {
+	if (instructionSet == ARMv4_ARM7) return 0x00000000;
+
+	// CP15 control register bit 13 : high vectors
+	return ((cp15Control & (1 << 13)) != 0) ? 0xFFFF0000 : 0x00000000;
+}
+
+void Cpu::EnterException(CpuMode mode, uint32_t vectorOffset, uint32_t returnAddr) {
+	uint32_t oldCPSR = cpsr.value;
+
+	cpsr.bits.Mode = mode;
+	cpsr.bits.T = 0;
+	cpsr.bits.I = 1;
+	if ((mode == FIQ) || (vectorOffset == VECTOR_RESET)) cpsr.bits.F = 1;
+
+	SetSPSR(oldCPSR);
+	SetReg(REG_LR, returnAddr);
+	SetReg(REG_PC, GetExceptionBase() + vectorOffset);
+}
+
+void Cpu::ThrowSWI() {
+	// PC already points to the next instruction
+	EnterException(Supervisor, VECTOR_SWI, GetReg(REG_PC));
+}
+
+void Cpu::ThrowIRQ() {
+	if (hleBios) {
+		HLEEnterIRQ();
+		return;
+	}
+
+	// Handlers return with SUBS PC, LR, #4
+	EnterException(IRQ, VECTOR_IRQ, GetReg(REG_PC) + 4);
+}
+
+void Cpu::ThrowFIQ() {
+	EnterException(FIQ, VECTOR_FIQ, GetReg(REG_PC) + 4);
+}
+
+#pragma endregion
+
 void Cpu::Reset() {
 	cpsr.value = 0;
 	cpsr.bits.Mode = Supervisor;
 	cpsr.bits.I = 1;
 	cpsr.bits.F = 1;
+	cp15Control = 0x00002078;
+	halted.store(false, std::memory_order_relaxed);
+	stalled = false;
 
-	memset(reg, 0, 16);
-	memset(reg_fiq, 0, 7);
-	memset(reg_svc, 0, 2);
-	memset(reg_abt, 0, 2);
-	memset(reg_und, 0, 2);
-	memset(reg_irq, 0, 2);
+	memset(reg, 0, sizeof(reg));
+	memset(reg_fiq, 0, sizeof(reg_fiq));
+	memset(reg_svc, 0, sizeof(reg_svc));
+	memset(reg_abt, 0, sizeof(reg_abt));
+	memset(reg_und, 0, sizeof(reg_und));
+	memset(reg_irq, 0, sizeof(reg_irq));
 
 	SetReg(REG_PC, bootAddress);
 }
 
+void Cpu::DirectBoot(uint32_t entryAddr) {
+	bootAddress = entryAddr;
+	Reset();
+
+	// The BIOS leaves the CPU in System mode with interrupts disabled
+	cpsr.bits.Mode = System;
+
+	if (instructionSet == ARMv5_ARM9) {
+		SetReg(REG_SP, 0x03002F7C, System);
+		SetReg(REG_SP, 0x03003F80, IRQ);
+		SetReg(REG_SP, 0x03003FC0, Supervisor);
+
+		// Protection unit, caches and TCMs as set up by the BIOS
+		CP15Write(0x100, 0x00012078);
+		CP15Write(0x910, 0x0300000A);
+		CP15Write(0x911, 0x00000020);
+		static const uint32_t regions[8] = { 0x04000033, 0x0200002B, 0x00000000, 0x08000035, 0x0300001B, 0x00000000, 0xFFFF001D, 0x027FF017 };
+		for (int i = 0; i < 8; i++) CP15Write(0x600 | (i << 4), regions[i]);
+	}
+	else {
+		SetReg(REG_SP, 0x0380FD80, System);
+		SetReg(REG_SP, 0x0380FF80, IRQ);
+		SetReg(REG_SP, 0x0380FFC0, Supervisor);
+	}
+
+	SetReg(12, entryAddr);
+	SetReg(REG_LR, entryAddr);
+	SetReg(REG_PC, entryAddr);
+}
+
 void Cpu::DebugStep() {
 	if (started) return;
 
@@ -281,21 +396,104 @@ void Cpu::runThreadFunc() {
 	using namespace std::chrono;
 
 	execInstr = 0;
+	idleCycles = 0;
+	haltedCycles = 0;
+	idleLoopBranchAddr = 0xFFFFFFFF;
+	idleLoopDetected = false;
 	uint32_t pc = GetReg(REG_PC);
-	start = high_resolution_clock::now();
+	start = steady_clock::now();
 	while (started) {
-		if (breakpoint.Check(pc)) {
-			started = false;
-			break;
+		if (halted.load(std::memory_order_relaxed) || stalled) {
+			haltedCycles += FastForward();
+		}
+		else {
+			// Run a block of instructions, up to the next event or a break request
+			while (started && !scheduler.IsEventDue()) {
+				if (breakpoint.Check(pc)) {
+					started = false;
+					break;
+				}
+				step();
+				execInstr++;
+				scheduler.AddCycles(cycleLength);
+				if (idleLoopDetected) SkipIdleLoop();
+				pc = GetReg(REG_PC);
+			}
+			scheduler.RunEvents();
 		}
-		step();
-		execInstr++;
+
+		// Interrupts are only checked between blocks
+		if (irq.IsPending() && (cpsr.bits.I == 0) && !stalled) ThrowIRQ();
 		pc = GetReg(REG_PC);
 	}
-	end = high_resolution_clock::now();
+	end = steady_clock::now();
 
 	std::cout << (instructionSet == ARMv5_ARM9 ? "ARM9: " : "ARM7: ") << "Stopping.\n";
-	std::cout << (instructionSet == ARMv5_ARM9 ? "ARM9: " : "ARM7: ") << "Executed " << execInstr << " instructions in " << duration_cast<microseconds>(end - start) << "\n";
+	std::cout << (instructionSet == ARMv5_ARM9 ? "ARM9: " : "ARM7: ") << "Executed " << execInstr << " instructions in " << duration_cast<microseconds>(end - start).count() << "us\n";
+	std::cout << (instructionSet == ARMv5_ARM9 ? "ARM9: " : "ARM7: ") << "Skipped " << idleCycles << " idle cycles, " << haltedCycles << " halted cycles\n";
+}
+
+void Cpu::CheckIdleLoop(uint32_t branchAddr) {
+	if (!IdleLoopDetection) return;
+
+	bool sameState = (branchAddr == idleLoopBranchAddr) && (!memoryWritten) && (cpsr.value == idleLoopCPSR);
+	for (int i = 0; (i < 15) && sameState; i++) {
+		sameState = (GetReg(i) == idleLoopRegs[i]);
+	}
+
+	if (sameState) {
+		idleLoopDetected = true;
+		return;
+	}
+
+	// New candidate : remember the state at this branch
+	idleLoopBranchAddr = branchAddr;
+	idleLoopCPSR = cpsr.value;
+	for (int i = 0; i < 15; i++) {
+		idleLoopRegs[i] = GetReg(i);
+	}
+	memoryWritten = false;
+}
+
+void Cpu::SkipIdleLoop() {
+	idleLoopDetected = false;
+	idleCycles += FastForward();
+}
+
+uint64_t Cpu::FastForward() {
+	if (scheduler.GetNextEventTime() == Scheduler::NO_EVENT) {
+		// Nothing on this CPU can change its state, leave the host core to the other CPU
+		std::this_thread::yield();
+		return 0;
+	}
+
+	return scheduler.SkipToNextEvent();
+}
+
+void Cpu::Halt() {
+	// Halt is left on (IE & IF) != 0 : an interrupt already requested does not halt at all. Checked after setting
+	// the state, so a request from the other CPU in between still wakes it up.
+	halted.store(true, std::memory_order_relaxed);
+	if ((irq.GetIE() & irq.GetIF()) != 0) {
+		halted.store(false, std::memory_order_relaxed);
+		return;
+	}
+	scheduler.BreakLoop();
+}
+
+void Cpu::WakeUp() {
+	halted.store(false, std::memory_order_relaxed);
+	scheduler.BreakLoop();
+}
+
+void Cpu::Stall() {
+	stalled = true;
+	scheduler.BreakLoop();
+}
+
+void Cpu::Resume() {
+	stalled = false;
+	scheduler.BreakLoop();
 }
 
 void Cpu::Run() {
@@ -435,9 +633,8 @@ void Cpu::DecodeInstructions() {
 		this->instruction.SetDecode(INSTRUCT_COPROC_LOAD_STORE_DOUBLE_REG_TRANSF);
 	}
 	else if (instruction.IsCoprocRegTransf()) {
-		this->instruction.SetDecode(INSTRUCT_COPROC_REG_TRANSF);
-	}
-	else if (instruction.IsCoprocRegTransf()) {
+		Rd = this->instruction.pCoprocRegTransf->Rd;
+
 		this->instruction.SetDecode(INSTRUCT_COPROC_REG_TRANSF);
 	}
 	else if (instruction.IsSoftwareInterrupt()) {
@@ -500,12 +697,12 @@ void Cpu::Execute() {
 	//case INSTRUCT_COPROC_DATA_PROC:
 	//	CoprocDataProc(this->instruction.pCoprocDataProc);
 	//	break;
-	//case INSTRUCT_COPROC_REG_TRANSF:
-	//	CoprocRegTransf(this->instruction.pCoprocRegTransf);
-	//	break;
-	//case INSTRUCT_SOFTWARE_INTERRUPT:
-	//	SoftwareInterrupt(this->instruction.pSoftwareInterrupt);
-	//	break;
+	case INSTRUCT_COPROC_REG_TRANSF:
+		CoprocRegTransf(this->instruction.pCoprocRegTransf);
+		break;
+	case INSTRUCT_SOFTWARE_INTERRUPT:
+		SoftwareInterrupt(this->instruction.pSoftwareInterrupt);
+		break;
 		// ======== Misc ========
 	//case INSTRUCT_MOVE_STATUS_REG_TO_REG:
 	//	MoveStatusRegToReg(this->instruction.pMoveStatusRegToReg);
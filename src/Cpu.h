@@ -5,9 +5,12 @@
 #include <iomanip>
 #include <thread>
 #include <chrono>
+#include <atomic>
 #include "arm_mem.h"
 #include "instructions.h"
 #include "breakpoints.h"
+#include "scheduler.h"
+#include "interrupts.h"
 
 constexpr auto REG_SP = 13;
 constexpr auto REG_LR = 14;
@@ -23,6 +26,22 @@ constexpr auto EXCEPTION_ALU_BITSHIFT_UNKNOWN_SHIFTTYPE = 7;
 constexpr auto EXCEPTION_EXEC_MEM_REG_PC_UNAUTHORIZE = 8;
 constexpr auto EXCEPTION_EXEC_MEM_DECODE_FAILURE = 9;
 
+constexpr auto VECTOR_RESET = 0x00;
+constexpr auto VECTOR_UNDEFINED = 0x04;
+constexpr auto VECTOR_SWI = 0x08;
+constexpr auto VECTOR_PREFETCH_ABORT = 0x0C;
+constexpr auto VECTOR_DATA_ABORT = 0x10;
+constexpr auto VECTOR_IRQ = 0x18;
+constexpr auto VECTOR_FIQ = 0x1C;
+
+// ARM7 HALTCNT register (byte at 04000301h)
+constexpr auto HALTCNT_ADDR = 0x04000300;
+
+// Longest backward jump (in bytes) considered when looking for idle loops
+constexpr auto HLE_IRQ_RETURN_OFFSET = 0x100;	// Offset in BIOS of the SWI ending HLE interrupt handlers
+constexpr auto HLE_IRQ_RETURN_SWI = 0xFF;
+constexpr auto IDLE_LOOP_MAX_SIZE = 0x40;
+
 union CPSR {
 	struct {
 		uint32_t Mode : 5;	// Current operating mode
@@ -80,6 +99,53 @@ private:
 	void runThreadFunc();
 	void step();
 
+	Scheduler scheduler;
+	InterruptController irq;
+	uint32_t cycleLength{ 1 };
+
+	// Idle loop detection : a short backward branch reached twice with the same registers
+	// and no memory write in between can only exit through an external event.
+	uint32_t idleLoopBranchAddr{ 0xFFFFFFFF };
+	uint32_t idleLoopRegs[15]{ 0 };
+	uint32_t idleLoopCPSR{ 0 };
+	bool memoryWritten{ false };
+	bool idleLoopDetected{ false };
+	uint64_t idleCycles{ 0 };
+
+	void CheckIdleLoop(uint32_t branchAddr);
+	void SkipIdleLoop();
+
+	// Halted until the next interrupt (HALTCNT or CP15 wait for interrupt)
+	std::atomic<bool> halted{ false };
+	uint64_t haltedCycles{ 0 };
+
+	// Waiting for a device to take a write (full geometry FIFO) : interrupts wait too
+	bool stalled{ false };
+
+	uint64_t FastForward();
+
+	// CP15 - System control coprocessor (ARM9 only)
+	uint32_t cp15Control{ 0x00002078 };	// High exception vectors at reset
+	uint32_t cp15DTCMSetting{ 0 };
+	uint32_t cp15ITCMSetting{ 0 };
+	uint32_t cp15ProtectionRegions[8]{ 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	uint32_t CP15Read(uint32_t cpReg) const;
+	void CP15Write(uint32_t cpReg, uint32_t value);
+
+	// High level emulated BIOS : SWIs run natively, IRQs are dispatched to the user handler without BIOS code
+	bool hleBios{ false };
+
+	uint32_t GetBiosAddress() const;
+	void HLESoftwareInterrupt(uint32_t function);
+	void HLEEnterIRQ();
+	void HLEReturnFromIRQ();
+	void HLECpuSet(bool fast);
+	void HLEIntrWait(bool discardOld, uint32_t flags);
+	void HLEDecompress();
+	void HLEBitUnPack();
+	void HLEDiffUnFilter(uint32_t unit);
+
 	// Registers
 	uint32_t reg[16]{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 	uint32_t reg_fiq[7]{ 0, 0, 0, 0, 0, 0, 0 };
@@ -125,6 +191,7 @@ private:
 
 	void SaveCPSR();
 	void RestoreCPSR();
+	void SetSPSR(uint32_t value);
 
 	void Fetch();
 	void Decode();
@@ -133,6 +200,8 @@ private:
 	bool IsConditionOK() const;
 
 	// ========== EXCEPTIONS ============
+	uint32_t GetExceptionBase() const;
+	void EnterException(CpuMode mode, uint32_t vectorOffset, uint32_t returnAddr);
 	void ThrowReset();
 	void ThrowUndefined();
 	void ThrowSWI();
@@ -220,6 +289,7 @@ private:
 
 public:
 	bool Debug{ false };
+	bool IdleLoopDetection{ true };
 
 	Cpu(ARMInstructionSet instructionSet);
 
@@ -236,6 +306,22 @@ public:
 	/// <param name="ptr">Pointer to virtual memory object</param>
 	void SetMMU(ARM_mem* ptr);
 
+	/// <summary>
+	/// Returns the event scheduler driven by this CPU clock
+	/// </summary>
+	/// <returns>Pointer to the CPU scheduler</returns>
+	Scheduler* GetScheduler() {
+		return &scheduler;
+	}
+
+	/// <summary>
+	/// Returns the interrupt controller of this CPU (IME / IE / IF)
+	/// </summary>
+	/// <returns>Pointer to the CPU interrupt controller</returns>
+	InterruptController* GetInterruptController() {
+		return &irq;
+	}
+
 	/// <summary>
 	/// Returns the current CPU profile mode (User, FIQ, IRQ, Supervisor, Abort, Undefined, System)
 	/// </summary>
@@ -247,6 +333,18 @@ public:
 	/// </summary>
 	void Reset();
 
+	/// <summary>
+	/// Run BIOS functions natively instead of executing BIOS code. A small stub is written in BIOS memory.
+	/// </summary>
+	/// <param name="enable">true to enable HLE BIOS</param>
+	void SetHLEBios(bool enable);
+
+	/// <summary>
+	/// Reset the CPU into the state the BIOS boot sequence leaves it in (System mode, stacks, CP15), with PC at entry address
+	/// </summary>
+	/// <param name="entryAddr">Entry point of the program loaded in memory</param>
+	void DirectBoot(uint32_t entryAddr);
+
 	/// <summary>
 	/// Start executing instructions
 	/// </summary>
@@ -263,6 +361,32 @@ public:
 	/// <returns>True if instructions are executed, else false</returns>
 	bool IsRunning() const;
 
+	/// <summary>
+	/// Stop executing instructions until the next interrupt, nothing if one is already requested (IE & IF).
+	/// The CPU clock jumps from event to event meanwhile.
+	/// </summary>
+	void Halt();
+
+	/// <summary>
+	/// Leave the halted state. Can be called from another thread.
+	/// </summary>
+	void WakeUp();
+
+	bool IsHalted() const {
+		return halted.load(std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Stop executing instructions, interrupts included, until Resume : the last write waits for its device.
+	/// The CPU clock jumps from event to event meanwhile. Only called from the CPU thread (I/O handlers, events).
+	/// </summary>
+	void Stall();
+
+	/// <summary>
+	/// Leave the stalled state
+	/// </summary>
+	void Resume();
+
 	/// <summary>
 	/// Execute Fetch/Decode/Execute all at ones, one time
 	/// </summary>
@@ -9,11 +9,35 @@ static void InitArm9Memory(ARM9_mem &mem);
 static void InitArm7Memory(ARM7_mem& mem, ARM9_mem &mem9);
 
 static bool LoadBios(ARM_mem& mem, std::string biospath, uint32_t biosAddr, uint32_t biosSize);
+static void SetupDirectBoot(NDSRom& nds);
+static bool ParseOptions(int argc, char* argv[]);
 
 static Cpu* arm9 = new Cpu(ARMv5_ARM9);
 static Cpu* arm7 = new Cpu(ARMv4_ARM7);
 static ARM9_mem mem9;
 static ARM7_mem mem7;
+static LCD lcd9;
+static LCD lcd7;
+static IPC ipc9;
+static IPC ipc7;
+static DMA dma9;
+static DMA dma7;
+static Timers timers9;
+static Timers timers7;
+static DivSqrt divSqrt;
+static Cartridge cart9;
+static Cartridge cart7;
+static SaveMemory saveMemory;
+static VRAM vram;
+static GPU gpu;
+static GeometryEngine geometry;
+static FrameSink frameSink;
+
+// Start the game at its entry points, as left by the BIOS boot sequence, instead of running the BIOS (--direct-boot)
+static bool directBoot{ false };
+
+// Threads rasterizing the 3D scene, 0 for one per host core (--3d-threads)
+static int renderThreads{ 0 };
 
 static uint64_t execInstr{ 0 };
 static std::chrono::steady_clock::time_point start;
@@ -36,7 +60,7 @@ static void LoadCustomTestProg(ARM9_mem &mem) {
 	ARM_mem::SetWordAtPointer(ptr, 0xE12FFF10);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	using namespace std::chrono;
 
@@ -49,14 +73,68 @@ int main()
 	InitArm9Memory(mem9);
 	arm7->SetMMU(&mem7);
 	InitArm7Memory(mem7, mem9);
+	vram.Attach(mem9, mem7);
+
+	lcd9.Attach(arm9->GetScheduler(), mem9, arm9->GetInterruptController());
+	lcd7.Attach(arm7->GetScheduler(), mem7, arm7->GetInterruptController());
+
+	IPC::Connect(ipc9, ipc7);
+	ipc9.Attach(mem9, arm9->GetScheduler(), arm9->GetInterruptController());
+	ipc7.Attach(mem7, arm7->GetScheduler(), arm7->GetInterruptController());
+
+	timers9.Attach(mem9, arm9->GetScheduler(), arm9->GetInterruptController());
+	timers7.Attach(mem7, arm7->GetScheduler(), arm7->GetInterruptController());
+	divSqrt.Attach(mem9, arm9->GetScheduler());
+
+	dma9.Attach(mem9, arm9->GetScheduler(), arm9->GetInterruptController(), true);
+	dma7.Attach(mem7, arm7->GetScheduler(), arm7->GetInterruptController(), false);
+	lcd9.AddCallback(LCD_CALLBACK_VBLANK, [](uint16_t line) { dma9.Trigger(DMA_START_VBLANK); });
+	lcd9.AddCallback(LCD_CALLBACK_HBLANK, [](uint16_t line) { if (line < LCD::VISIBLE_LINES) dma9.Trigger(DMA_START_HBLANK); });
+	lcd9.AddCallback(LCD_CALLBACK_LINE_START, [](uint16_t line) {
+		if (line < LCD::VISIBLE_LINES) {
+			dma9.Trigger(DMA_START_DISPLAY);
+			dma9.Trigger(DMA_START_DISPLAY_FIFO);
+		}
+	});
+	lcd7.AddCallback(LCD_CALLBACK_VBLANK, [](uint16_t line) { dma7.Trigger(DMA_START_VBLANK); });
+
+	gpu.Attach(mem9, vram, lcd9, geometry);
+	gpu.SetThreaded(std::thread::hardware_concurrency() > 1);
+	std::cout << "2D engines : " << gpu.GetEngineA().GetKernels().name << " kernels, " << (gpu.IsThreaded() ? "render thread" : "inline rendering") << "\n";
+	geometry.Attach(mem9, arm9->GetScheduler(), arm9->GetInterruptController(), &dma9, lcd9, [](bool stall) {
+		if (stall) arm9->Stall();
+		else arm9->Resume();
+	});
+	std::cout << "Geometry engine : " << geometry.GetKernels().name << " matrix kernels\n";
+	frameSink.Attach(gpu);
+	if (!ParseOptions(argc, argv)) return 1;
+	gpu.GetRenderer3D().SetThreadCount(renderThreads);
+	std::cout << "3D renderer : " << gpu.GetRenderer3D().GetThreadCount() << " threads\n";
+
+	cart9.Attach(mem9, arm9->GetInterruptController(), &dma9);
+	cart7.Attach(mem7, arm7->GetInterruptController(), &dma7);
 
 	NDSRom nds("..\\NDS-Files\\TinyFB.nds");
 	if (nds.IsOpened()) {
 		std::cout << "TinyFB.nds successfully opened :\n";
+		const NDSRomValidation& validation = nds.GetValidation();
+		std::cout << "\t- Header CRC : " << (validation.headerValid ? "OK" : "BAD") << ", logo CRC : " << (validation.logoValid ? "OK" : "BAD");
+		if (validation.hasSecureArea) std::cout << ", secure area CRC : " << (validation.secureAreaValid ? "OK" : "BAD");
+		std::cout << "\n";
 		nds.WriteProgramToARM9Memory(mem9);
 		std::cout << "\t- ARM9 Start address : 0x" << std::hex << nds.GetARM9StartAddress() << std::dec << "\n";
 		nds.WriteProgramToARM7Memory(mem7);
 		std::cout << "\t- ARM7 Start address : 0x" << std::hex << nds.GetARM7StartAddress() << std::dec << "\n";
+		NitroFS nitroFS(nds);
+		std::cout << "\t- NitroFS : " << nitroFS.GetFileCount() << " files, " << nitroFS.GetARM9Overlays().size() << " ARM9 overlays\n";
+		cart9.SetROM(&nds);
+		cart7.SetROM(&nds);
+		cart9.EnableReadAhead(true);
+		cart7.EnableReadAhead(true);
+		if (saveMemory.Open("..\\NDS-Files\\TinyFB.sav")) {
+			cart9.SetSaveMemory(&saveMemory);
+			cart7.SetSaveMemory(&saveMemory);
+		}
 	}
 	else {
 		std::cout << "Could not load TinyFB.nds file\n";
@@ -66,20 +144,34 @@ int main()
 		std::cout << "ARM9 bios successfully loaded\n";
 	}
 	else {
-		std::cout << "Could not load ARM9 bios file\n";
+		arm9->SetHLEBios(true);
+		std::cout << "Could not load ARM9 bios file, using HLE BIOS\n";
 	}
 
-	if (LoadBios(mem7, "..\\NDS-Files\\Bios\\biosnds7.rom", mem7.BIOS_ADDR, mem7.BIOS_SIZE)) {
+	bool arm7BiosLoaded = LoadBios(mem7, "..\\NDS-Files\\Bios\\biosnds7.rom", mem7.BIOS_ADDR, mem7.BIOS_SIZE);
+	if (arm7BiosLoaded) {
 		std::cout << "ARM7 bios successfully loaded\n";
 	}
 	else {
-		std::cout << "Could not load ARM7 bios file\n";
+		arm7->SetHLEBios(true);
+		std::cout << "Could not load ARM7 bios file, using HLE BIOS\n";
 	}
 
-	arm9->SetBootAddr(mem9.BIOS_ADDR);
-	std::cout << "ARM9 boot address set to : 0x" << std::hex << mem9.BIOS_ADDR << std::dec << "\n";
-	arm7->SetBootAddr(mem7.BIOS_ADDR);
-	std::cout << "ARM7 boot address set to : 0x" << std::hex << mem7.BIOS_ADDR << std::dec << "\n";
+	if (directBoot && nds.IsOpened()) {
+		// The BIOS boot code would decrypt the secure area, the program copied at load time is reloaded with the decrypted one
+		if (arm7BiosLoaded && nds.DecryptSecureArea(mem7.GetPointerFromAddr(mem7.BIOS_ADDR))) {
+			nds.WriteProgramToARM9Memory(mem9);
+			std::cout << "Secure area decrypted\n";
+		}
+		SetupDirectBoot(nds);
+		std::cout << "Direct boot : ARM9 at 0x" << std::hex << nds.GetARM9StartAddress() << ", ARM7 at 0x" << nds.GetARM7StartAddress() << std::dec << "\n";
+	}
+	else {
+		arm9->SetBootAddr(mem9.BIOS_ADDR);
+		std::cout << "ARM9 boot address set to : 0x" << std::hex << mem9.BIOS_ADDR << std::dec << "\n";
+		arm7->SetBootAddr(mem7.BIOS_ADDR);
+		std::cout << "ARM7 boot address set to : 0x" << std::hex << mem7.BIOS_ADDR << std::dec << "\n";
+	}
 
 	std::cout << "Selected CPU : ARM9\n";
 	Cpu* selectedCpu = arm9;
@@ -228,6 +320,10 @@ int main()
 		std::cout << "> ";
 	}
 
+	// The ROM is closed when main returns, the cartridge buses (and their read-ahead threads) live longer
+	cart9.SetROM(nullptr);
+	cart7.SetROM(nullptr);
+
 	delete arm9;
 	delete arm7;
 	return 0;
@@ -249,16 +345,6 @@ static void InitArm9Memory(ARM9_mem &mem) {
 
 	mem.SetPalettes(static_cast<uint8_t*>(malloc(mem.PALETTES_SIZE)));
 	ClearMemReg(mem, mem.PALETTES_ADDR, mem.PALETTES_SIZE);
-	mem.SetVRAM_A_BG(static_cast<uint8_t*>(malloc(mem.VRAMABG_SIZE)));
-	ClearMemReg(mem, mem.VRAMABG_ADDR, mem.VRAMABG_SIZE);
-	mem.SetVRAM_B_BG(static_cast<uint8_t*>(malloc(mem.VRAMBBG_SIZE)));
-	ClearMemReg(mem, mem.VRAMBBG_ADDR, mem.VRAMBBG_SIZE);
-	mem.SetVRAM_A_OBJ(static_cast<uint8_t*>(malloc(mem.VRAMAOBJ_SIZE)));
-	ClearMemReg(mem, mem.VRAMAOBJ_ADDR, mem.VRAMAOBJ_SIZE);
-	mem.SetVRAM_B_OBJ(static_cast<uint8_t*>(malloc(mem.VRAMBOBJ_SIZE)));
-	ClearMemReg(mem, mem.VRAMBOBJ_ADDR, mem.VRAMBOBJ_SIZE);
-	mem.SetVRAM_LCDC(static_cast<uint8_t*>(malloc(mem.VRAMLCDC_SIZE)));
-	ClearMemReg(mem, mem.VRAMLCDC_ADDR, mem.VRAMLCDC_SIZE);
 	mem.SetOAM_A(static_cast<uint8_t*>(malloc(mem.OAM_SIZE)));
 	ClearMemReg(mem, mem.OAMA_ADDR, mem.OAM_SIZE);
 	mem.SetOAM_B(static_cast<uint8_t*>(malloc(mem.OAM_SIZE)));
@@ -288,9 +374,6 @@ static void InitArm7Memory(ARM7_mem &mem, ARM9_mem &mem9) {
 	mem.SetWiFiIOMaps(static_cast<uint8_t*>(malloc(mem.IOWIFI_SIZE)));
 	ClearMemReg(mem, mem.IOWIFI_ADDR, mem.IOWIFI_SIZE);
 
-	mem.SetVRAMasWRAM(static_cast<uint8_t*>(malloc(mem.VRAM_AS_WRAM_SIZE)));
-	ClearMemReg(mem, mem.VRAM_AS_WRAM_ADDR, mem.VRAM_AS_WRAM_SIZE);
-
 	mem.SetGBARAM(mem9.GetPointerFromAddr(mem9.GBARAM_ADDR));
 	mem.SetGBAROM(mem9.GetPointerFromAddr(mem9.GBAROM_ADDR));
 }
@@ -328,3 +411,81 @@ static bool LoadBios(ARM_mem &mem, std::string biospath, uint32_t biosAddr, uint
 
 	return true;
 }
+
+static void SetupDirectBoot(NDSRom& nds) {
+	const NDSHeader& header = nds.GetHeader();
+	uint32_t chipId = cart9.GetChipId();
+
+	// Programs are already at their RAM address. Header copy & boot information left in main memory by the BIOS / firmware
+	nds.CopyToMemory(mem9, 0, 0x027FFE00, 0x170);
+	ARM_mem::SetWordAtPointer(mem9.GetPointerFromAddr(0x027FF800), chipId);
+	ARM_mem::SetWordAtPointer(mem9.GetPointerFromAddr(0x027FF804), chipId);
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x027FF808), header.HeaderChecksum);
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x027FF80A), header.SecureAreaChecksum);
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x027FF850), 0x5835);
+	ARM_mem::SetWordAtPointer(mem9.GetPointerFromAddr(0x027FFC00), chipId);
+	ARM_mem::SetWordAtPointer(mem9.GetPointerFromAddr(0x027FFC04), chipId);
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x027FFC08), header.HeaderChecksum);
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x027FFC0A), header.SecureAreaChecksum);
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x027FFC10), 0x5835);
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x027FFC30), 0xFFFF);
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x027FFC40), 0x0001);	// Booted from cartridge
+
+	// I/O state : POSTFLG, WRAMCNT (all shared WRAM to ARM7), POWCNT1, key inputs released
+	*mem9.GetPointerFromAddr(0x04000300) = 0x01;
+	*mem7.GetPointerFromAddr(0x04000300) = 0x01;
+	*mem9.GetPointerFromAddr(0x04000247) = 0x03;
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x04000304), 0x0001);
+	ARM_mem::SetHalfWordAtPointer(mem9.GetPointerFromAddr(0x04000130), 0x03FF);
+	ARM_mem::SetHalfWordAtPointer(mem7.GetPointerFromAddr(0x04000130), 0x03FF);
+	ARM_mem::SetHalfWordAtPointer(mem7.GetPointerFromAddr(0x04000136), 0x007F);
+
+	arm9->DirectBoot(header.ARM9_EntryAddress);
+	arm7->DirectBoot(header.ARM7_EntryAddress);
+}
+
+// Boot : --direct-boot. 3D renderer : --3d-threads <count, 0 = one per core>. Headless output : --hash <log file>, --dump <frame> <file (.png or raw RGB)>, --stream <file or named pipe>
+static bool ParseOptions(int argc, char* argv[]) {
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+
+		if (option == "--direct-boot") {
+			directBoot = true;
+		}
+		else if ((option == "--3d-threads") && (i + 1 < argc)) {
+			renderThreads = static_cast<int>(strtol(argv[++i], nullptr, 10));
+			if (renderThreads < 0) {
+				std::cout << "Invalid 3D thread count '" << argv[i] << "'\n";
+				return false;
+			}
+		}
+		else if ((option == "--hash") && (i + 1 < argc)) {
+			std::string logPath = argv[++i];
+			if (!frameSink.EnableHashing(logPath)) {
+				std::cout << "Could not create hash log '" << logPath << "'\n";
+				return false;
+			}
+			std::cout << "Frame hashes written to " << logPath << "\n";
+		}
+		else if ((option == "--dump") && (i + 2 < argc)) {
+			uint64_t frame = strtoull(argv[i + 1], nullptr, 10);
+			frameSink.DumpFrame(frame, argv[i + 2]);
+			std::cout << "Frame " << frame << " will be written to " << argv[i + 2] << "\n";
+			i += 2;
+		}
+		else if ((option == "--stream") && (i + 1 < argc)) {
+			std::string path = argv[++i];
+			if (!frameSink.OpenStream(path)) {
+				std::cout << "Could not open frame stream '" << path << "'\n";
+				return false;
+			}
+			std::cout << "Frames streamed to " << path << " (raw RGB, " << FrameSink::WIDTH << "x" << FrameSink::HEIGHT << ")\n";
+		}
+		else {
+			std::cout << "Unknown option '" << option << "'\n";
+			std::cout << "Options : --direct-boot / --3d-threads <count> / --hash <log file> / --dump <frame> <file.png or raw RGB file> / --stream <file or named pipe>\n";
+			return false;
+		}
+	}
+	return true;
+}
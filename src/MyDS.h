@@ -8,8 +8,22 @@
 #include "arm7_mem.h"
 #include "arm9_mem.h"
 
+#ifdef _WIN32
 #include <process.h>
+#endif
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <chrono>
 #include "ndsrom.h"
+#include "lcd.h"
+#include "ipc.h"
+#include "dma.h"
+#include "timers.h"
+#include "divsqrt.h"
+#include "cartridge.h"
+#include "nitrofs.h"
+#include "vram.h"
+#include "gpu.h"
+#include "gpu3d_geometry.h"
+#include "framesink.h"
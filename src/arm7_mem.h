@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include "arm_mem.h"
 
@@ -15,7 +16,7 @@ private:
 	uint8_t* io; // 04000000h to 04100013h
 	uint8_t* io_wifi; // 04800000h to 0480BFFFh
 
-	uint8_t* vram_as_wram; // 06000000h to 0603FFFFh max
+	const std::atomic<uint8_t*>* vram_pages{ nullptr }; // 06000000h to 0603FFFFh max, banks C and D mapped by the ARM9 (16KB pages)
 
 	uint8_t* gba_rom; // 08000000h to 09FFFFFFh max
 	uint8_t* gba_ram; // 0A000000h to 0A00FFFFh max
@@ -26,9 +27,11 @@ public:
 
 	static const uint32_t MAINMEMORY_ADDR = 0x02000000;
 	static const uint32_t MAINMEMORY_SIZE = 0x400000;
+	static const uint32_t MAINMEMORY_MIRROR_SIZE = 0x1000000;	// Mirrored up to 02FFFFFFh
 
 	static const uint32_t SHAREDWRAM_ADDR = 0x03000000;
 	static const uint32_t SHAREDWRAM_SIZE = 0x8000;
+	static const uint32_t SHAREDWRAM_MIRROR_SIZE = 0x800000;	// Mirrored up to 037FFFFFh
 	static const uint32_t WRAM_ADDR = 0x03800000;
 	static const uint32_t WRAM_SIZE = 0x10000;
 
@@ -67,8 +70,8 @@ public:
 		io_wifi = ptr;
 	}
 
-	void SetVRAMasWRAM(uint8_t* ptr) {
-		vram_as_wram = ptr;
+	void SetVRAMPages(const std::atomic<uint8_t*>* pages) {
+		vram_pages = pages;
 	}
 
 	void SetGBAROM(uint8_t* ptr) {
@@ -18,11 +18,7 @@ private:
 	uint8_t* myds_debug; // 04FFFAxxh ... if needed
 
 	uint8_t* palettes; // 05000000h to 050007FFh
-	uint8_t* vram_A_bg; // 06000000h to 0607FFFFh max
-	uint8_t* vram_B_bg; // 06200000h to 0621FFFFh max
-	uint8_t* vram_A_obj; // 06400000h to 0643FFFFh max
-	uint8_t* vram_B_obj; // 06600000h to 0661FFFFh max
-	uint8_t* vram_lcdc; // 06800000h to 068A3FFFh
+	uint8_t* const* vram_pages{ nullptr }; // 06000000h to 06FFFFFFh, 16KB pages mapped by VRAMCNT
 	uint8_t* oam_A; // 07000000h to 070003FFh
 	uint8_t* oam_B; // 07000400h to 070007FFh
 
@@ -39,6 +35,7 @@ public:
 	static const size_t DTCM_SIZE = 0x4000;
 	static const uint32_t MAINMEMORY_ADDR = 0x2000000;
 	static const size_t MAINMEMORY_SIZE = 0x400000;
+	static const size_t MAINMEMORY_MIRROR_SIZE = 0x1000000;	// Mirrored up to 02FFFFFFh
 	static const uint32_t SHAREDWRAM_ADDR = 0x03000000;
 	static const size_t SHAREDWRAM_SIZE = 0x8000;
 
@@ -103,21 +100,8 @@ public:
 		palettes = ptr;
 	}
 
-	void SetVRAM_A_BG(uint8_t* ptr) {
-		vram_A_bg = ptr;
-	}
-	void SetVRAM_B_BG(uint8_t* ptr) {
-		vram_B_bg = ptr;
-	}
-	void SetVRAM_A_OBJ(uint8_t* ptr) {
-		vram_A_obj = ptr;
-	}
-	void SetVRAM_B_OBJ(uint8_t* ptr) {
-		vram_B_obj = ptr;
-	}
-
-	void SetVRAM_LCDC(uint8_t* ptr) {
-		vram_lcdc = ptr;
+	void SetVRAMPages(uint8_t* const* pages) {
+		vram_pages = pages;
 	}
 
 	void SetOAM_A(uint8_t* ptr) {
@@ -1,5 +1,7 @@
 #include "arm7_mem.h"
 #include "arm9_mem.h"
+#include <algorithm>
+#include <cstring>
 
 #define RETURN_PTR_IF_IN_RANGE(address, startRangeAddress, rangeSize, rangePtr) if ((address >= startRangeAddress) && (address < (startRangeAddress + rangeSize))) return rangePtr + ((address - startRangeAddress) % rangeSize);
 
@@ -14,8 +16,8 @@ uint8_t* ARM9_mem::GetPointerFromAddr(uint32_t address) {
 	RETURN_PTR_IF_IN_RANGE(address, DTCM_ADDR, DTCM_SIZE, dtcm);
 
 	// MAIN
-	RETURN_PTR_IF_IN_RANGE(address, MAINMEMORY_ADDR, MAINMEMORY_SIZE, main);
 	RETURN_PTR_IF_IN_RANGE(address, MAINMEMCTRL_ADDR, MAINMEMCTRL_SIZE, mainMemControl);
+	if ((address >= MAINMEMORY_ADDR) && (address < (MAINMEMORY_ADDR + MAINMEMORY_MIRROR_SIZE))) return main + ((address - MAINMEMORY_ADDR) % MAINMEMORY_SIZE);
 
 	// Shared WRAM
 	RETURN_PTR_IF_IN_RANGE(address, SHAREDWRAM_ADDR, SHAREDWRAM_SIZE, shared_wram);
@@ -31,12 +33,11 @@ uint8_t* ARM9_mem::GetPointerFromAddr(uint32_t address) {
 	if ((address >= (PALETTES_ADDR)) && (address < (PALETTES_ADDR + PALETTES_SIZE))) return palettes + ((address - PALETTES_ADDR) % PALETTES_SIZE);
 	RETURN_PTR_IF_IN_RANGE(address, IO_ADDR, IO_SIZE, io);
 
-	// VRAMs - TODO : check ?
-	RETURN_PTR_IF_IN_RANGE(address, VRAMABG_ADDR, VRAMABG_SIZE, vram_A_bg);
-	RETURN_PTR_IF_IN_RANGE(address, VRAMBBG_ADDR, VRAMBBG_SIZE, vram_B_bg);
-	RETURN_PTR_IF_IN_RANGE(address, VRAMAOBJ_ADDR, VRAMAOBJ_SIZE, vram_A_obj);
-	RETURN_PTR_IF_IN_RANGE(address, VRAMBOBJ_ADDR, VRAMBOBJ_SIZE, vram_B_obj);
-	RETURN_PTR_IF_IN_RANGE(address, VRAMLCDC_ADDR, VRAMLCDC_SIZE, vram_lcdc);
+	// VRAM, as mapped by VRAMCNT
+	if ((address >> 24) == 0x06) {
+		uint8_t* page = vram_pages[(address >> 14) & 0x3FF];
+		return (page != nullptr) ? page + (address & 0x3FFF) : nullptr;
+	}
 
 	// OAM
 	RETURN_PTR_IF_IN_RANGE(address, OAMA_ADDR, OAM_SIZE, oam_A);
@@ -58,18 +59,21 @@ uint8_t* ARM7_mem::GetPointerFromAddr(uint32_t address) {
 	RETURN_PTR_IF_IN_RANGE(address, BIOS_ADDR, BIOS_SIZE, bios);
 
 	// MAIN
-	RETURN_PTR_IF_IN_RANGE(address, MAINMEMORY_ADDR, MAINMEMORY_SIZE, main);
+	if ((address >= MAINMEMORY_ADDR) && (address < (MAINMEMORY_ADDR + MAINMEMORY_MIRROR_SIZE))) return main + ((address - MAINMEMORY_ADDR) % MAINMEMORY_SIZE);
 
 	// WRAM & Shared WRAM
-	RETURN_PTR_IF_IN_RANGE(address, SHAREDWRAM_ADDR, SHAREDWRAM_SIZE, shared_wram);
+	if ((address >= SHAREDWRAM_ADDR) && (address < (SHAREDWRAM_ADDR + SHAREDWRAM_MIRROR_SIZE))) return shared_wram + ((address - SHAREDWRAM_ADDR) % SHAREDWRAM_SIZE);
 	RETURN_PTR_IF_IN_RANGE(address, WRAM_ADDR, WRAM_SIZE, wram);
 
 	// IO
 	RETURN_PTR_IF_IN_RANGE(address, IO_ADDR, IO_SIZE, io);
 	RETURN_PTR_IF_IN_RANGE(address, IOWIFI_ADDR, IOWIFI_SIZE, io_wifi);
 
-	// VRAM as WRAM
-	RETURN_PTR_IF_IN_RANGE(address, VRAM_AS_WRAM_ADDR, VRAM_AS_WRAM_SIZE, vram_as_wram);
+	// VRAM as WRAM, mirrored up to 06FFFFFFh
+	if ((address >> 24) == 0x06) {
+		uint8_t* page = vram_pages[(address >> 14) & 0xF].load(std::memory_order_acquire);
+		return (page != nullptr) ? page + (address & 0x3FFF) : nullptr;
+	}
 
 	// GBA
 	RETURN_PTR_IF_IN_RANGE(address, GBAROM_ADDR, GBAROM_SIZE, gba_rom);
@@ -79,6 +83,128 @@ uint8_t* ARM7_mem::GetPointerFromAddr(uint32_t address) {
 	return nullptr;
 }
 
+void ARM_mem::SetIOReadHandler(uint32_t address, IOReadHandler handler) {
+	int index = GetIOIndex(address);
+	if (index >= 0) ioRead[index] = handler;
+}
+
+void ARM_mem::SetIOWriteHandler(uint32_t address, IOWriteHandler handler) {
+	int index = GetIOIndex(address);
+	if (index >= 0) ioWrite[index] = handler;
+}
+
+void ARM_mem::AddWriteWatch(uint32_t address, uint32_t length, WriteWatchHandler handler) {
+	writeWatches.push_back({ address, address + length, handler });
+	watchStart = std::min(watchStart, address);
+	watchEnd = std::max(watchEnd, address + length);
+}
+
+void ARM_mem::CallWriteWatches(uint32_t address, uint32_t length) {
+	for (auto& watch : writeWatches) {
+		if ((address < watch.end) && (static_cast<uint64_t>(address) + length > watch.start)) watch.handler(address, length);
+	}
+}
+
+uint32_t ARM_mem::Read32(uint32_t address) {
+	address &= ~0x3;
+	int index = GetIOIndex(address);
+	if ((index >= 0) && ioRead[index]) return ioRead[index]();
+
+	return GetWordAtPointer(GetPointerFromAddr(address));
+}
+
+uint16_t ARM_mem::Read16(uint32_t address) {
+	address &= ~0x1;
+	int index = GetIOIndex(address);
+	if ((index >= 0) && ioRead[index]) return static_cast<uint16_t>(ioRead[index]() >> ((address & 0x2) * 8));
+
+	return GetHalfWordAtPointer(GetPointerFromAddr(address));
+}
+
+uint8_t ARM_mem::Read8(uint32_t address) {
+	int index = GetIOIndex(address);
+	if ((index >= 0) && ioRead[index]) return static_cast<uint8_t>(ioRead[index]() >> ((address & 0x3) * 8));
+
+	uint8_t* ptr = GetPointerFromAddr(address);
+	return (ptr != nullptr) ? *ptr : 0;
+}
+
+void ARM_mem::Write32(uint32_t address, uint32_t value) {
+	address &= ~0x3;
+	uint8_t* ptr = GetPointerFromAddr(address);
+	if (ptr != nullptr) SetWordAtPointer(ptr, value);
+	NotifyWrite(address, 4);
+
+	int index = GetIOIndex(address);
+	if ((index >= 0) && ioWrite[index]) ioWrite[index](value, 0xFFFFFFFF);
+}
+
+void ARM_mem::Write16(uint32_t address, uint16_t value) {
+	address &= ~0x1;
+	uint8_t* ptr = GetPointerFromAddr(address);
+	if (ptr != nullptr) SetHalfWordAtPointer(ptr, value);
+	NotifyWrite(address, 2);
+
+	int index = GetIOIndex(address);
+	if ((index >= 0) && ioWrite[index]) {
+		int shift = (address & 0x2) * 8;
+		ioWrite[index](static_cast<uint32_t>(value) << shift, 0xFFFF << shift);
+	}
+}
+
+void ARM_mem::Write8(uint32_t address, uint8_t value) {
+	uint8_t* ptr = GetPointerFromAddr(address);
+	if (ptr != nullptr) *ptr = value;
+	NotifyWrite(address, 1);
+
+	int index = GetIOIndex(address);
+	if ((index >= 0) && ioWrite[index]) {
+		int shift = (address & 0x3) * 8;
+		ioWrite[index](static_cast<uint32_t>(value) << shift, 0xFF << shift);
+	}
+}
+
+// Every memory region is aligned on 4KB
+static const uint32_t BLOCK_PAGE_SIZE = 0x1000;
+
+size_t ARM_mem::GetContiguousLength(uint32_t address, size_t maxLength) {
+	uint8_t* start = GetPointerFromAddr(address);
+	if (start == nullptr) return 0;
+
+	size_t length = std::min<size_t>(maxLength, BLOCK_PAGE_SIZE - (address & (BLOCK_PAGE_SIZE - 1)));
+	while ((length < maxLength) && (static_cast<uint64_t>(address) + length <= 0xFFFFFFFF)) {
+		if (GetPointerFromAddr(static_cast<uint32_t>(address + length)) != start + length) break;
+		length = std::min<size_t>(maxLength, length + BLOCK_PAGE_SIZE);
+	}
+	return length;
+}
+
+void ARM_mem::ReadBlock(uint32_t address, uint8_t* dst, size_t length) {
+	while (length > 0) {
+		size_t chunk = std::min<size_t>(length, BLOCK_PAGE_SIZE - (address & (BLOCK_PAGE_SIZE - 1)));
+		uint8_t* ptr = GetPointerFromAddr(address);
+		if (ptr != nullptr) memcpy(dst, ptr, chunk);
+		else memset(dst, 0, chunk);
+
+		address += static_cast<uint32_t>(chunk);
+		dst += chunk;
+		length -= chunk;
+	}
+}
+
+void ARM_mem::WriteBlock(uint32_t address, const uint8_t* src, size_t length) {
+	NotifyWrite(address, length);
+	while (length > 0) {
+		size_t chunk = std::min<size_t>(length, BLOCK_PAGE_SIZE - (address & (BLOCK_PAGE_SIZE - 1)));
+		uint8_t* ptr = GetPointerFromAddr(address);
+		if (ptr != nullptr) memcpy(ptr, src, chunk);
+
+		address += static_cast<uint32_t>(chunk);
+		src += chunk;
+		length -= chunk;
+	}
+}
+
 uint64_t ARM_mem::GetBytesAtPointer(uint8_t* startPtr, int size) {
 	if (startPtr == nullptr) {
 		return 0;
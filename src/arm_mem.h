@@ -1,8 +1,44 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+#include <cstddef>
+#include <vector>
+
+using IOReadHandler = std::function<uint32_t()>;
+using IOWriteHandler = std::function<void(uint32_t value, uint32_t mask)>;
+using WriteWatchHandler = std::function<void(uint32_t address, uint32_t length)>;
 
 class ARM_mem {
+private:
+	// I/O table : one entry per 32bit register, 04000000h to 04001FFFh then 04100000h to 0410003Fh
+	static const int IO_TABLE_LOW_SIZE = 0x800;
+	static const int IO_TABLE_HIGH_SIZE = 0x10;
+	static const int IO_TABLE_SIZE = IO_TABLE_LOW_SIZE + IO_TABLE_HIGH_SIZE;
+
+	IOReadHandler ioRead[IO_TABLE_SIZE];
+	IOWriteHandler ioWrite[IO_TABLE_SIZE];
+
+	static int GetIOIndex(uint32_t address) {
+		if ((address & 0xFF000000) != 0x04000000) return -1;
+		if (address < 0x04002000) return (address & 0x1FFF) >> 2;
+		if ((address >= 0x04100000) && (address < 0x04100040)) return IO_TABLE_LOW_SIZE + ((address & 0x3F) >> 2);
+		return -1;
+	}
+
+	struct WriteWatch {
+		uint32_t start;
+		uint32_t end;
+		WriteWatchHandler handler;
+	};
+
+	// Bounds of all watched ranges, to reject most writes with one test
+	std::vector<WriteWatch> writeWatches;
+	uint32_t watchStart{ 0xFFFFFFFF };
+	uint32_t watchEnd{ 0 };
+
+	void CallWriteWatches(uint32_t address, uint32_t length);
+
 public:
 	/// <summary>
 	/// Get memory pointer from virtual memory address
@@ -11,6 +47,79 @@ public:
 	/// <returns>Pointer to the first byte of the provided address</returns>
 	virtual uint8_t* GetPointerFromAddr(uint32_t address) = 0;
 
+	/// <summary>
+	/// Register a function called when an I/O register is read, instead of reading I/O memory
+	/// </summary>
+	/// <param name="address">Address of the 32bit register</param>
+	/// <param name="handler">Function returning the whole 32bit register value</param>
+	void SetIOReadHandler(uint32_t address, IOReadHandler handler);
+
+	/// <summary>
+	/// Register a function called after an I/O register has been written
+	/// </summary>
+	/// <param name="address">Address of the 32bit register</param>
+	/// <param name="handler">Function receiving the written value (at its position in the register) and the mask of written bits</param>
+	void SetIOWriteHandler(uint32_t address, IOWriteHandler handler);
+
+	/// <summary>
+	/// Register a function called after memory in a range has been written, by the bus or by a bulk copy
+	/// </summary>
+	/// <param name="address">Start of the watched range</param>
+	/// <param name="length">Length of the watched range</param>
+	/// <param name="handler">Function receiving the written address and length (may extend outside the range)</param>
+	void AddWriteWatch(uint32_t address, uint32_t length, WriteWatchHandler handler);
+
+	/// <summary>
+	/// Report a write made through a host pointer (block copies, DMA, HLE BIOS) to the write watches
+	/// </summary>
+	/// <param name="address">Virtual ARM memory address</param>
+	/// <param name="length">Number of bytes written</param>
+	void NotifyWrite(uint32_t address, size_t length) {
+		if ((address < watchEnd) && (static_cast<uint64_t>(address) + length > watchStart)) CallWriteWatches(address, static_cast<uint32_t>(length));
+	}
+
+	/// <summary>
+	/// Read a 32bit word from the bus, going through I/O handlers when needed
+	/// </summary>
+	/// <param name="address">Virtual ARM memory address (forced to word alignment)</param>
+	/// <returns>32bit Word</returns>
+	uint32_t Read32(uint32_t address);
+	uint16_t Read16(uint32_t address);
+	uint8_t Read8(uint32_t address);
+
+	/// <summary>
+	/// Write a 32bit word on the bus, going through I/O handlers when needed
+	/// </summary>
+	/// <param name="address">Virtual ARM memory address (forced to word alignment)</param>
+	/// <param name="value">32bit Word</param>
+	void Write32(uint32_t address, uint32_t value);
+	void Write16(uint32_t address, uint16_t value);
+	void Write8(uint32_t address, uint8_t value);
+
+	/// <summary>
+	/// Get the number of bytes from address that are contiguous in host memory
+	/// </summary>
+	/// <param name="address">Virtual ARM memory address</param>
+	/// <param name="maxLength">Maximum length to check</param>
+	/// <returns>Contiguous length, 0 if address is not mapped</returns>
+	size_t GetContiguousLength(uint32_t address, size_t maxLength);
+
+	/// <summary>
+	/// Copy a block from virtual memory, page by page. I/O handlers are not called.
+	/// </summary>
+	/// <param name="address">Virtual ARM memory address</param>
+	/// <param name="dst">Destination buffer</param>
+	/// <param name="length">Number of bytes (unmapped bytes read as 0)</param>
+	void ReadBlock(uint32_t address, uint8_t* dst, size_t length);
+
+	/// <summary>
+	/// Copy a block into virtual memory, page by page. I/O handlers are not called.
+	/// </summary>
+	/// <param name="address">Virtual ARM memory address</param>
+	/// <param name="src">Source buffer</param>
+	/// <param name="length">Number of bytes (unmapped bytes are dropped)</param>
+	void WriteBlock(uint32_t address, const uint8_t* src, size_t length);
+
 	/// <summary>
 	/// Get bytes as long word at pointer (little endian). Argument pointer will not be changed during execution.
 	/// </summary>
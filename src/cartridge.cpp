@@ -0,0 +1,220 @@
+#include "cartridge.h"
+#include <algorithm>
+#include <cstring>
+
+Cartridge::~Cartridge() {
+	EnableReadAhead(false);
+}
+
+void Cartridge::Attach(ARM_mem& mem, InterruptController* irqCtrl, DMA* dmaCtrl) {
+	memory = &mem;
+	irq = irqCtrl;
+	dma = dmaCtrl;
+
+	auxSpiControl = mem.GetPointerFromAddr(AUXSPICNT_ADDR);
+	romControl = mem.GetPointerFromAddr(ROMCTRL_ADDR);
+	command = mem.GetPointerFromAddr(COMMAND_ADDR);
+
+	mem.SetIOWriteHandler(AUXSPICNT_ADDR, [this](uint32_t value, uint32_t mask) { WriteAuxSpi(value, mask); });
+	mem.SetIOWriteHandler(ROMCTRL_ADDR, [this](uint32_t value, uint32_t mask) { WriteControl(); });
+	mem.SetIOReadHandler(DATA_ADDR, [this]() { return ReadDataPort(); });
+
+	dma->SetStreamSource(DATA_ADDR, [this](uint8_t* dst, uint32_t length) {
+		ReadData(dst, length);
+		if (transferPos >= transferLength) FinishTransfer();
+	});
+}
+
+void Cartridge::SetROM(const NDSRom* ndsRom) {
+	{
+		std::lock_guard<std::mutex> lock(romMutex);
+		rom = ndsRom;
+	}
+	if (rom == nullptr) return;
+
+	// Chip size is 128KB << DeviceCapacity
+	uint32_t chipSize = 0x20000u << std::min<uint8_t>(rom->GetHeader().DeviceCapacity, 14);
+	romMask = chipSize - 1;
+	// Macronix style ID : size in MB - 1 in the second byte
+	uint32_t sizeMB = chipSize >> 20;
+	chipId = 0xC2 | (((sizeMB > 0) ? sizeMB - 1 : 0) << 8);
+}
+
+void Cartridge::WriteAuxSpi(uint32_t value, uint32_t mask) {
+	// Only AUXSPIDATA writes start a transfer, they complete immediately
+	if ((mask & 0x00FF0000) == 0) return;
+
+	uint16_t control = ARM_mem::GetHalfWordAtPointer(auxSpiControl);
+	uint8_t response = 0xFF;
+	if ((save != nullptr) && ((control & AUXSPICNT_ENABLE) != 0) && ((control & AUXSPICNT_SPI_MODE) != 0)) {
+		response = save->Transfer(static_cast<uint8_t>(value >> 16));
+		if ((control & AUXSPICNT_HOLD) == 0) save->Deselect();
+	}
+	auxSpiControl[AUXSPIDATA_ADDR - AUXSPICNT_ADDR] = response;
+}
+
+void Cartridge::WriteControl() {
+	uint32_t control = ARM_mem::GetWordAtPointer(romControl);
+
+	// Data ready is read only
+	control &= ~ROMCTRL_DATA_READY;
+	if (transferActive) control |= ROMCTRL_DATA_READY;
+	ARM_mem::SetWordAtPointer(romControl, control);
+
+	if (((control & ROMCTRL_START) != 0) && !transferActive) StartTransfer();
+}
+
+void Cartridge::StartTransfer() {
+	uint32_t control = ARM_mem::GetWordAtPointer(romControl);
+
+	// Block size : 0 = none, 1 to 6 = 100h SHL n, 7 = 4 bytes
+	uint32_t blockSize = (control >> 24) & 0x7;
+	transferLength = (blockSize == 0) ? 0 : ((blockSize == 7) ? 4 : (0x100u << blockSize));
+	transferPos = 0;
+	transferCommand = command[0];
+	transferAddr = (command[1] << 24) | (command[2] << 16) | (command[3] << 8) | command[4];
+
+	if (transferLength == 0) {
+		FinishTransfer();
+		return;
+	}
+
+	transferActive = true;
+	ARM_mem::SetWordAtPointer(romControl, control | ROMCTRL_DATA_READY);
+
+	if (transferCommand == CMD_DATA) RequestReadAhead((transferAddr & romMask) + transferLength);
+
+	// A DMA waiting for the cartridge takes the whole block at once
+	if (dma->IsWaiting(DMA_START_CARTRIDGE)) dma->TriggerStream(DMA_START_CARTRIDGE, (transferLength - transferPos) / 4);
+}
+
+void Cartridge::FinishTransfer() {
+	transferActive = false;
+
+	uint32_t control = ARM_mem::GetWordAtPointer(romControl);
+	ARM_mem::SetWordAtPointer(romControl, control & ~(ROMCTRL_START | ROMCTRL_DATA_READY));
+
+	if ((ARM_mem::GetHalfWordAtPointer(auxSpiControl) & AUXSPICNT_TRANSFER_IRQ) != 0) irq->Raise(IRQ_CARDTRANSFER);
+}
+
+uint32_t Cartridge::ReadDataPort() {
+	if (!transferActive) return 0xFFFFFFFF;
+
+	uint8_t data[4];
+	ReadData(data, 4);
+	if (transferPos >= transferLength) FinishTransfer();
+	return ARM_mem::GetWordAtPointer(data);
+}
+
+void Cartridge::ReadData(uint8_t* dst, uint32_t length) {
+	length = std::min(length, transferLength - transferPos);
+
+	switch (transferCommand) {
+	case CMD_DATA:
+		ReadROM(dst, length);
+		break;
+
+	case CMD_HEADER:
+		// The header is repeated every 4KB
+		for (uint32_t i = 0; i < length; ) {
+			uint32_t offset = (transferPos + i) & (PAGE_SIZE - 1);
+			uint32_t chunk = std::min(length - i, PAGE_SIZE - offset);
+			if (rom != nullptr) rom->Read(offset, dst + i, chunk);
+			else memset(dst + i, 0xFF, chunk);
+			i += chunk;
+		}
+		break;
+
+	case CMD_CHIPID_RAW:
+	case CMD_CHIPID:
+		for (uint32_t i = 0; i < length; i++) dst[i] = static_cast<uint8_t>(chipId >> (((transferPos + i) & 0x3) * 8));
+		break;
+
+	default:
+		memset(dst, 0xFF, length);
+		break;
+	}
+
+	transferPos += length;
+}
+
+void Cartridge::ReadROM(uint8_t* dst, uint32_t length) {
+	if (rom == nullptr) {
+		memset(dst, 0xFF, length);
+		return;
+	}
+
+	uint32_t addr = transferAddr & romMask;
+	// The secure area can't be read once booted, it reads the area after it instead
+	if (addr < 0x8000) addr = 0x8000 + (addr & 0x1FF);
+
+	// Reads wrap around at the end of the 4KB page they started in
+	uint32_t pageBase = addr & ~(PAGE_SIZE - 1);
+	for (uint32_t i = 0; i < length; ) {
+		uint32_t offset = ((addr & (PAGE_SIZE - 1)) + transferPos + i) & (PAGE_SIZE - 1);
+		uint32_t chunk = std::min(length - i, PAGE_SIZE - offset);
+		rom->Read(pageBase + offset, dst + i, chunk);
+		i += chunk;
+	}
+}
+
+#pragma region Read-ahead
+
+void Cartridge::EnableReadAhead(bool enable) {
+	if (enable == readAheadThread.joinable()) return;
+
+	if (enable) {
+		readAheadStop = false;
+		readAheadThread = std::thread(&Cartridge::ReadAheadLoop, this);
+	}
+	else {
+		{
+			std::lock_guard<std::mutex> lock(readAheadMutex);
+			readAheadStop = true;
+		}
+		readAheadCondition.notify_one();
+		readAheadThread.join();
+	}
+}
+
+void Cartridge::RequestReadAhead(uint32_t offset) {
+	if (!readAheadThread.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(readAheadMutex);
+		readAheadOffset = offset;
+		readAheadRequested = true;
+	}
+	readAheadCondition.notify_one();
+}
+
+void Cartridge::ReadAheadLoop() {
+	uint32_t lastOffset = UINT32_MAX;
+
+	while (true) {
+		uint32_t offset;
+		{
+			std::unique_lock<std::mutex> lock(readAheadMutex);
+			readAheadCondition.wait(lock, [this]() { return readAheadRequested || readAheadStop; });
+			if (readAheadStop) return;
+			readAheadRequested = false;
+			offset = readAheadOffset;
+		}
+
+		// Sequential streaming asks for the same pages again and again, skip them
+		if ((lastOffset != UINT32_MAX) && (offset >= lastOffset) && (offset + PAGE_SIZE <= lastOffset + READ_AHEAD_SIZE)) continue;
+		lastOffset = offset;
+
+		// Touching one byte per page is enough to get it into the page cache
+		std::lock_guard<std::mutex> lock(romMutex);
+		if (rom == nullptr) continue;
+		volatile uint8_t sink = 0;
+		for (uint32_t o = offset & ~(PAGE_SIZE - 1); o < offset + READ_AHEAD_SIZE; o += PAGE_SIZE) {
+			const uint8_t* ptr = rom->GetPointer(o);
+			if (ptr == nullptr) break;
+			sink = sink + *ptr;
+		}
+	}
+}
+
+#pragma endregion
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "arm_mem.h"
+#include "interrupts.h"
+#include "dma.h"
+#include "ndsrom.h"
+#include "savememory.h"
+
+/// <summary>
+/// DS cartridge bus of one CPU : ROMCTRL, command registers and the data port.
+/// Data is copied straight from the ROM mapping, DMA transfers are done in one block.
+/// </summary>
+class Cartridge {
+private:
+	ARM_mem* memory{ nullptr };
+	InterruptController* irq{ nullptr };
+	DMA* dma{ nullptr };
+	const NDSRom* rom{ nullptr };
+	SaveMemory* save{ nullptr };
+	uint32_t chipId{ 0 };
+	uint32_t romMask{ 0 };
+
+	uint8_t* auxSpiControl{ nullptr };
+	uint8_t* romControl{ nullptr };
+	uint8_t* command{ nullptr };
+
+	// Current block transfer
+	bool transferActive{ false };
+	uint8_t transferCommand{ 0 };
+	uint32_t transferAddr{ 0 };
+	uint32_t transferLength{ 0 };
+	uint32_t transferPos{ 0 };
+
+	// Read-ahead : a background thread touching the ROM pages following the last transfer,
+	// so page faults on slow storage happen before the game asks for the data
+	std::thread readAheadThread;
+	std::mutex romMutex;		// Held by the read-ahead thread while it touches the ROM, and while the ROM is replaced
+	std::mutex readAheadMutex;
+	std::condition_variable readAheadCondition;
+	uint32_t readAheadOffset{ 0 };
+	bool readAheadRequested{ false };
+	bool readAheadStop{ false };
+
+	void WriteAuxSpi(uint32_t value, uint32_t mask);
+	void WriteControl();
+	void StartTransfer();
+	void FinishTransfer();
+	uint32_t ReadDataPort();
+	void ReadData(uint8_t* dst, uint32_t length);
+	void ReadROM(uint8_t* dst, uint32_t length);
+	void RequestReadAhead(uint32_t offset);
+	void ReadAheadLoop();
+
+public:
+	static const uint32_t AUXSPICNT_ADDR = 0x040001A0;
+	static const uint32_t ROMCTRL_ADDR = 0x040001A4;
+	static const uint32_t COMMAND_ADDR = 0x040001A8;
+	static const uint32_t DATA_ADDR = 0x04100010;
+
+	static const uint32_t AUXSPIDATA_ADDR = 0x040001A2;
+
+	static const uint16_t AUXSPICNT_HOLD = 1 << 6;
+	static const uint16_t AUXSPICNT_SPI_MODE = 1 << 13;
+	static const uint16_t AUXSPICNT_TRANSFER_IRQ = 1 << 14;
+	static const uint16_t AUXSPICNT_ENABLE = 1 << 15;
+	static const uint32_t ROMCTRL_DATA_READY = 1 << 23;
+	static const uint32_t ROMCTRL_START = 1u << 31;
+
+	static const uint8_t CMD_HEADER = 0x00;
+	static const uint8_t CMD_CHIPID_RAW = 0x90;
+	static const uint8_t CMD_DATA = 0xB7;
+	static const uint8_t CMD_CHIPID = 0xB8;
+
+	static const uint32_t READ_AHEAD_SIZE = 0x40000;
+	static const uint32_t PAGE_SIZE = 0x1000;
+
+	~Cartridge();
+
+	/// <summary>
+	/// Map the cartridge registers into the CPU I/O table
+	/// </summary>
+	/// <param name="mem">Virtual memory of the CPU</param>
+	/// <param name="irqCtrl">Interrupt controller of the CPU</param>
+	/// <param name="dmaCtrl">DMA controller of the CPU, used for block transfers</param>
+	void Attach(ARM_mem& mem, InterruptController* irqCtrl, DMA* dmaCtrl);
+
+	/// <summary>
+	/// Insert a cartridge
+	/// </summary>
+	/// <param name="ndsRom">Opened ROM, must outlive the cartridge bus or be removed with nullptr. Once this returns,
+	/// the read-ahead thread no longer uses the previous one.</param>
+	void SetROM(const NDSRom* ndsRom);
+
+	/// <summary>
+	/// Connect the save chip to the AUXSPI bus
+	/// </summary>
+	/// <param name="saveMemory">Save chip, nullptr for none</param>
+	void SetSaveMemory(SaveMemory* saveMemory) {
+		save = saveMemory;
+	}
+
+	uint32_t GetChipId() const {
+		return chipId;
+	}
+
+	/// <summary>
+	/// Start or stop the read-ahead thread, useful when the ROM file is on slow storage
+	/// </summary>
+	/// <param name="enable">true to start the thread</param>
+	void EnableReadAhead(bool enable);
+};
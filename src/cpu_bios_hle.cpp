@@ -0,0 +1,379 @@
+#include "Cpu.h"
+#include "arm9_mem.h"
+#include "arm7_mem.h"
+#include "divsqrt.h"
+#include "decompress.h"
+#include "crc16.h"
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <cstring>
+
+#pragma region HLE BIOS
+// BIOS function numbers are in bits 16-23 of the ARM SWI comment field
+
+// Set by the game : interrupt check flags (IntrWait) and user interrupt handler.
+// ARM9 : at the end of DTCM / ARM7 : at the end of WRAM (mirrored at 03FFFFF8h)
+static const uint32_t ARM9_IRQ_VARS_OFFSET = 0x3FF8;
+static const uint32_t ARM7_IRQ_VARS_ADDR = 0x0380FFF8;
+
+// Registers saved by the BIOS interrupt handler, in stack order
+static const int IRQ_SAVED_REGS[6] = { 0, 1, 2, 3, 12, REG_LR };
+
+// ARM7 sound tables, built from the curves the BIOS ones follow, rounded to the nearest
+// Sine : a quarter wave in 64 steps, times 7FFFh
+static const std::array<uint16_t, 0x40> SINE_TABLE = []() {
+	std::array<uint16_t, 0x40> table{};
+	for (size_t i = 0; i < table.size(); i++) table[i] = static_cast<uint16_t>(std::lround(std::sin(i * std::numbers::pi / 128) * 0x7FFF));
+	return table;
+}();
+
+// Pitch : 2^(i / 768) - 1, one octave in 768 steps, 0.16 fixed point
+static const std::array<uint16_t, 0x300> PITCH_TABLE = []() {
+	std::array<uint16_t, 0x300> table{};
+	for (size_t i = 0; i < table.size(); i++) table[i] = static_cast<uint16_t>(std::lround((std::exp2(i / 768.0) - 1) * 0x10000));
+	return table;
+}();
+
+// Volume : 127 * 10^(dB / 20) for dB = (i - 723) / 10, from -72.3 to 0. Below -6, -12 and -24dB the sound driver
+// also sets the channel divider to 2, 4 and 16 : the value is scaled up by as much.
+static const std::array<uint8_t, 0x2D4> VOLUME_TABLE = []() {
+	std::array<uint8_t, 0x2D4> table{};
+	for (size_t i = 0; i < table.size(); i++) {
+		int tenths = static_cast<int>(i) - 723;
+		int divider = (tenths < -240) ? 16 : ((tenths < -120) ? 4 : ((tenths < -60) ? 2 : 1));
+		table[i] = static_cast<uint8_t>(std::lround(127 * std::pow(10.0, tenths / 200.0) * divider));
+	}
+	return table;
+}();
+
+void Cpu::SetHLEBios(bool enable) {
+	hleBios = enable;
+	if (!enable) return;
+
+	// User interrupt handlers return here, to a SWI that restores the interrupted state
+	uint8_t* ptr = memory->GetPointerFromAddr(GetBiosAddress() + HLE_IRQ_RETURN_OFFSET);
+	if (ptr != nullptr) ARM_mem::SetWordAtPointer(ptr, 0xEF000000 | (HLE_IRQ_RETURN_SWI << 16));
+}
+
+uint32_t Cpu::GetBiosAddress() const {
+	return (instructionSet == ARMv5_ARM9) ? ARM9_mem::BIOS_ADDR : ARM7_mem::BIOS_ADDR;
+}
+
+static uint32_t GetIRQVarsAddress(ARMInstructionSet instructionSet) {
+	return (instructionSet == ARMv5_ARM9) ? ARM9_mem::DTCM_ADDR + ARM9_IRQ_VARS_OFFSET : ARM7_IRQ_VARS_ADDR;
+}
+
+void Cpu::HLEEnterIRQ() {
+	EnterException(IRQ, VECTOR_IRQ, GetReg(REG_PC) + 4);
+
+	// Same as the BIOS handler : STMFD SP!, {R0-R3, R12, LR} then call the user handler
+	uint32_t sp = GetReg(REG_SP) - 24;
+	for (int i = 0; i < 6; i++) memory->Write32(sp + i * 4, GetReg(IRQ_SAVED_REGS[i]));
+	SetReg(REG_SP, sp);
+
+	uint32_t handler = memory->Read32(GetIRQVarsAddress(instructionSet) + 4);
+	SetReg(REG_LR, GetBiosAddress() + HLE_IRQ_RETURN_OFFSET);
+	cpsr.bits.T = handler & 0x1;
+	SetReg(REG_PC, handler & ~0x1);
+}
+
+void Cpu::HLEReturnFromIRQ() {
+	// LDMFD SP!, {R0-R3, R12, LR} then SUBS PC, LR, #4
+	uint32_t sp = GetReg(REG_SP);
+	for (int i = 0; i < 6; i++) SetReg(IRQ_SAVED_REGS[i], memory->Read32(sp + i * 4));
+	SetReg(REG_SP, sp + 24);
+
+	uint32_t returnAddr = GetReg(REG_LR) - 4;
+	RestoreCPSR();
+	SetReg(REG_PC, returnAddr);
+}
+
+void Cpu::HLESoftwareInterrupt(uint32_t function) {
+	switch (function) {
+	case 0x03: {
+		// WaitByLoop : 4 cycles per iteration
+		scheduler.AddCycles(static_cast<uint64_t>(GetReg(0)) * 4 * cycleLength);
+		SetReg(0, 0);
+		break;
+	}
+	case 0x04:
+		HLEIntrWait(GetReg(0) != 0, GetReg(1));
+		break;
+	case 0x05:
+		// VBlankIntrWait
+		SetReg(0, 1);
+		SetReg(1, 1);
+		HLEIntrWait(true, 1);
+		break;
+	case 0x06:	// Halt
+	case 0x07:	// Sleep (ARM7)
+		Halt();
+		break;
+	case 0x09: {
+		// Div : R0 = R0 / R1, R1 = R0 % R1, R3 = abs(R0 / R1)
+		int64_t quotient;
+		int64_t remainder;
+		DivSqrt::Div64(static_cast<int32_t>(GetReg(0)), static_cast<int32_t>(GetReg(1)), quotient, remainder);
+		SetReg(0, static_cast<uint32_t>(quotient));
+		SetReg(1, static_cast<uint32_t>(remainder));
+		SetReg(3, static_cast<uint32_t>((quotient < 0) ? -quotient : quotient));
+		break;
+	}
+	case 0x0B:
+		HLECpuSet(false);
+		break;
+	case 0x0C:
+		HLECpuSet(true);
+		break;
+	case 0x0D:
+		SetReg(0, DivSqrt::Sqrt64(GetReg(0)));
+		break;
+	case 0x0E: {
+		// GetCRC16 : R0 initial value, R1 address, R2 length in bytes
+		uint32_t address = GetReg(1);
+		uint32_t length = GetReg(2);
+		uint16_t crc = static_cast<uint16_t>(GetReg(0));
+		if (memory->GetContiguousLength(address, length) == length) {
+			crc = CRC16(crc, memory->GetPointerFromAddr(address), length);
+		}
+		else {
+			std::vector<uint8_t> data(length);
+			memory->ReadBlock(address, data.data(), length);
+			crc = CRC16(crc, data.data(), length);
+		}
+		SetReg(0, crc);
+		break;
+	}
+	case 0x0F:
+		// IsDebugger
+		SetReg(0, 0);
+		break;
+	case 0x10:
+		HLEBitUnPack();
+		break;
+	case 0x11:	// LZ77UnCompReadNormalWrite8bit
+	case 0x12:	// LZ77UnCompReadByCallbackWrite16bit
+	case 0x13:	// HuffUnCompReadByCallback
+	case 0x14:	// RLUnCompReadNormalWrite8bit
+	case 0x15:	// RLUnCompReadByCallbackWrite16bit
+		HLEDecompress();
+		break;
+	case 0x16:
+		HLEDiffUnFilter(1);
+		break;
+	case 0x18:
+		HLEDiffUnFilter(2);
+		break;
+	case 0x1A:
+	case 0x1B:
+	case 0x1C: {
+		// ARM7 GetSineTable, GetPitchTable, GetVolumeTable : R0 = table[R0]. Indices past the end read the last entry.
+		if (instructionSet != ARMv4_ARM7) break;
+		uint32_t index = GetReg(0);
+		if (function == 0x1A) SetReg(0, SINE_TABLE[std::min<size_t>(index, SINE_TABLE.size() - 1)]);
+		else if (function == 0x1B) SetReg(0, PITCH_TABLE[std::min<size_t>(index, PITCH_TABLE.size() - 1)]);
+		else SetReg(0, VOLUME_TABLE[std::min<size_t>(index, VOLUME_TABLE.size() - 1)]);
+		break;
+	}
+	case HLE_IRQ_RETURN_SWI:
+		HLEReturnFromIRQ();
+		break;
+	default:
+		// SoftReset, SoundBias & CustomPost : nothing to do
+		break;
+	}
+}
+
+void Cpu::HLEIntrWait(bool discardOld, uint32_t flags) {
+	uint32_t flagsAddr = GetIRQVarsAddress(instructionSet);
+	memory->Write32(InterruptController::IME_ADDR, 1);
+
+	uint32_t checkFlags = memory->Read32(flagsAddr);
+	if (discardOld) checkFlags &= ~flags;
+
+	if ((checkFlags & flags) != 0) {
+		memory->Write32(flagsAddr, checkFlags & ~flags);
+		return;
+	}
+	memory->Write32(flagsAddr, checkFlags);
+
+	// With IRQs disabled the user handler never runs to set the check flags : the requested interrupts are taken
+	// from IF instead, and acknowledged
+	if (cpsr.bits.I != 0) {
+		uint32_t requested = irq.GetIE() & irq.GetIF() & flags;
+		if (requested != 0) {
+			memory->Write32(InterruptController::IF_ADDR, requested);
+			return;
+		}
+	}
+
+	// Wait for the next interrupt, then run this SWI again (old flags must not be discarded again)
+	SetReg(0, 0);
+	SetReg(REG_PC, GetReg(REG_PC) - 4);
+	Halt();
+}
+
+void Cpu::HLECpuSet(bool fast) {
+	uint32_t src = GetReg(0);
+	uint32_t dst = GetReg(1);
+	uint32_t control = GetReg(2);
+
+	// Bits 0-20 : count, bit 24 : fill with the first source unit, bit 26 : 32bit units (always for CpuFastSet)
+	bool fill = (control & (1 << 24)) != 0;
+	bool word = fast || ((control & (1 << 26)) != 0);
+	uint32_t unit = word ? 4 : 2;
+	uint32_t count = control & 0x1FFFFF;
+	if (fast) count = (count + 7) & ~0x7;
+	if (count == 0) return;
+
+	src &= ~(unit - 1);
+	dst &= ~(unit - 1);
+	size_t length = static_cast<size_t>(count) * unit;
+
+	// Native copy when neither side is I/O and both are contiguous in host memory
+	auto getPlainPointer = [this, length](uint32_t address) -> uint8_t* {
+		if ((address & 0xFF000000) == 0x04000000) return nullptr;
+		return (memory->GetContiguousLength(address, length) == length) ? memory->GetPointerFromAddr(address) : nullptr;
+	};
+	uint8_t* dstPtr = getPlainPointer(dst);
+
+	if (fill) {
+		uint32_t value = word ? memory->Read32(src) : memory->Read16(src);
+		for (size_t i = 0; i < length; i += unit) {
+			if (dstPtr != nullptr) {
+				if (word) ARM_mem::SetWordAtPointer(dstPtr + i, value);
+				else ARM_mem::SetHalfWordAtPointer(dstPtr + i, static_cast<uint16_t>(value));
+			}
+			else {
+				if (word) memory->Write32(dst + static_cast<uint32_t>(i), value);
+				else memory->Write16(dst + static_cast<uint32_t>(i), static_cast<uint16_t>(value));
+			}
+		}
+		if (dstPtr != nullptr) memory->NotifyWrite(dst, length);
+	}
+	else {
+		uint8_t* srcPtr = getPlainPointer(src);
+		if ((srcPtr != nullptr) && (dstPtr != nullptr)) {
+			// The BIOS copies forward one unit at a time : when the destination starts inside the source, units written
+			// first are read again later, which memmove does not do
+			if ((dstPtr > srcPtr) && (dstPtr < srcPtr + length)) {
+				for (size_t i = 0; i < length; i += unit) memcpy(dstPtr + i, srcPtr + i, unit);
+			}
+			else {
+				memmove(dstPtr, srcPtr, length);
+			}
+			memory->NotifyWrite(dst, length);
+		}
+		else {
+			for (size_t i = 0; i < length; i += unit) {
+				uint32_t offset = static_cast<uint32_t>(i);
+				if (word) memory->Write32(dst + offset, memory->Read32(src + offset));
+				else memory->Write16(dst + offset, memory->Read16(src + offset));
+			}
+		}
+	}
+
+	scheduler.AddCycles(static_cast<uint64_t>(count) * cycleLength);
+}
+
+void Cpu::HLEDecompress() {
+	// Callback variants read the source through game functions, which in practice read memory : the source is read directly
+	uint32_t src = GetReg(0);
+	uint32_t dst = GetReg(1);
+
+	uint8_t header[4];
+	memory->ReadBlock(src, header, 4);
+	uint32_t size = GetDecompressedSize(header);
+	if (size == 0) return;
+
+	std::vector<uint8_t> dstCopy;
+	uint8_t* dstPtr = (memory->GetContiguousLength(dst, size) == size) ? memory->GetPointerFromAddr(dst) : nullptr;
+	if (dstPtr == nullptr) {
+		dstCopy.resize(size);
+		dstPtr = dstCopy.data();
+	}
+
+	// Decompress in place from the memory region holding the source, the decoders stop at its end. A stream running
+	// into the next region is decompressed again from a copy, extended by one region at a time.
+	size_t addressSpace = static_cast<size_t>(0x100000000ULL - src);
+	size_t srcLength = memory->GetContiguousLength(src, addressSpace);
+	bool done = (srcLength > 0) && Decompress(memory->GetPointerFromAddr(src), srcLength, dstPtr, size);
+	std::vector<uint8_t> srcCopy;
+	while (!done && (srcLength > 0) && (srcLength < addressSpace)) {
+		size_t next = memory->GetContiguousLength(src + static_cast<uint32_t>(srcLength), addressSpace - srcLength);
+		if (next == 0) break;
+		srcLength += next;
+		srcCopy.resize(srcLength);
+		memory->ReadBlock(src, srcCopy.data(), srcLength);
+		done = Decompress(srcCopy.data(), srcLength, dstPtr, size);
+	}
+
+	if (!dstCopy.empty()) memory->WriteBlock(dst, dstCopy.data(), size);
+	else memory->NotifyWrite(dst, size);
+	scheduler.AddCycles(static_cast<uint64_t>(size) * cycleLength);
+}
+
+void Cpu::HLEBitUnPack() {
+	uint32_t src = GetReg(0);
+	uint32_t dst = GetReg(1);
+	uint32_t info = GetReg(2);
+
+	// Info : source length, source width, destination width, data offset (bit 31 : add offset to zeroes too)
+	uint32_t srcLength = memory->Read16(info);
+	uint32_t srcWidth = memory->Read8(info + 2);
+	uint32_t dstWidth = memory->Read8(info + 3);
+	uint32_t dataOffset = memory->Read32(info + 4);
+	bool offsetZero = (dataOffset & 0x80000000) != 0;
+	dataOffset &= 0x7FFFFFFF;
+	if ((srcWidth == 0) || (srcWidth > 8) || (dstWidth == 0) || (dstWidth > 32)) return;
+
+	uint32_t srcMask = (1 << srcWidth) - 1;
+	uint32_t dstMask = (dstWidth == 32) ? 0xFFFFFFFF : ((1u << dstWidth) - 1);
+	uint32_t outWord = 0;
+	uint32_t outBits = 0;
+
+	for (uint32_t i = 0; i < srcLength; i++) {
+		uint8_t byte = memory->Read8(src + i);
+		for (uint32_t bit = 0; bit < 8; bit += srcWidth) {
+			uint32_t value = (byte >> bit) & srcMask;
+			if ((value != 0) || offsetZero) value += dataOffset;
+
+			outWord |= (value & dstMask) << outBits;
+			outBits += dstWidth;
+			if (outBits >= 32) {
+				memory->Write32(dst, outWord);
+				dst += 4;
+				outWord = 0;
+				outBits = 0;
+			}
+		}
+	}
+}
+
+void Cpu::HLEDiffUnFilter(uint32_t unit) {
+	uint32_t src = GetReg(0);
+	uint32_t dst = GetReg(1);
+
+	uint32_t size = memory->Read32(src) >> 8;
+	std::vector<uint8_t> data(size);
+	memory->ReadBlock(src + 4, data.data(), size);
+
+	if (unit == 1) {
+		for (uint32_t i = 1; i < size; i++) data[i] = static_cast<uint8_t>(data[i] + data[i - 1]);
+	}
+	else {
+		uint16_t previous = 0;
+		for (uint32_t i = 0; i + 1 < size; i += 2) {
+			previous = static_cast<uint16_t>(previous + (data[i] | (data[i + 1] << 8)));
+			data[i] = static_cast<uint8_t>(previous);
+			data[i + 1] = static_cast<uint8_t>(previous >> 8);
+		}
+	}
+
+	memory->WriteBlock(dst, data.data(), size);
+}
+
+#pragma endregion
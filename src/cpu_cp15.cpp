@@ -0,0 +1,45 @@
+#include "Cpu.h"
+#include "arm9_mem.h"
+
+#pragma region CP15
+// Register numbering : CRn << 8 | CRm << 4 | opcode2
+
+uint32_t Cpu::CP15Read(uint32_t cpReg) const {
+	switch (cpReg) {
+	case 0x000:	return 0x41059461;	// Main ID : ARM946E-S
+	case 0x001:	return 0x0F0D2112;	// Cache type
+	case 0x002:	return 0x00140180;	// TCM size
+	case 0x100:	return cp15Control;
+	case 0x910:	return cp15DTCMSetting;
+	case 0x911:	return cp15ITCMSetting;
+	default:
+		if ((cpReg & 0xF0F) == 0x600) return cp15ProtectionRegions[(cpReg >> 4) & 0x7];
+		return 0;
+	}
+}
+
+void Cpu::CP15Write(uint32_t cpReg, uint32_t value) {
+	switch (cpReg) {
+	case 0x100:
+		cp15Control = (cp15Control & ~0x000FF085) | (value & 0x000FF085);
+		break;
+	case 0x704:	// Wait for interrupt
+	case 0x782:
+		Halt();
+		break;
+	case 0x910:
+		cp15DTCMSetting = value;
+		// Bits 12-31 : DTCM base address
+		ARM9_mem::DTCM_ADDR = value & 0xFFFFF000;
+		break;
+	case 0x911:
+		cp15ITCMSetting = value;
+		break;
+	default:
+		if ((cpReg & 0xF0F) == 0x600) cp15ProtectionRegions[(cpReg >> 4) & 0x7] = value;
+		// Cache, write buffer and access permission operations have no effect here
+		break;
+	}
+}
+
+#pragma endregion
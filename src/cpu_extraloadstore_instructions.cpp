@@ -69,15 +69,15 @@ void Cpu::SwapInstruction(sSwapInstruction* instruction) {
 
 	bool B_byte = instruction->B;
 
-	uint8_t* ptr = memory->GetPointerFromAddr(Rn_value);
 	uint32_t data = 0;
+	memoryWritten = true;
 	if (B_byte) {
-		data = *ptr;
-		*ptr = (Rm_value & 0xFF);
+		data = memory->Read8(Rn_value);
+		memory->Write8(Rn_value, Rm_value & 0xFF);
 	}
 	else {
-		data = memory->GetWordAtPointer(ptr);
-		memory->SetWordAtPointer(ptr, Rm_value);
+		data = memory->Read32(Rn_value);
+		memory->Write32(Rn_value, Rm_value);
 	}
 	SetReg(Rd, data);
 }
@@ -109,27 +109,20 @@ void Cpu::LoadStoreHalfwordImmOffset(sLoadStoreHalfwordImmOffset* instruction) {
 		if (W_writeBack) SetReg(Rn, operandAddr);
 	}
 
-	uint8_t* startPtr = memory->GetPointerFromAddr(operandAddr);
-	Operand = memory->GetWordAtPointer(startPtr);
-
 	if (!P_offsetAddress) {
-		if (U_added) {
-			Operand += Offset;
-		}
-		else {
-			Operand -= Offset;
-		}
 		// WriteBack always enabled
-		SetReg(Rn, U_added ? Rn_value + Operand : Rn_value - Operand);
+		SetReg(Rn, U_added ? Rn_value + Offset : Rn_value - Offset);
 	}
 
 	if (L_load) {
-		SetReg(Rd, static_cast<uint16_t>(Operand));
+		Operand = memory->Read16(operandAddr);
+		SetReg(Rd, Operand);
 	}
 	else {
 		if (Rd == REG_PC) Rd_value += 8; // PC+12
 
-		memory->SetHalfWordAtPointer(startPtr, Rd_value);
+		memoryWritten = true;
+		memory->Write16(operandAddr, static_cast<uint16_t>(Rd_value));
 	}
 
 	if (false) {
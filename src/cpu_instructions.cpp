@@ -45,8 +45,6 @@ void Cpu::LoadStoreImmOffset(sLoadStoreImmOffset* instruction) {
 	bool W_userMemAccess = instruction->W;	// if P = 0
 	bool L_load = instruction->L;
 
-	int size = B_byte ? 1 : 4;
-
 	// If Pre index
 	uint32_t operandAddr = Rn_value;
 	if (Rn == REG_PC) operandAddr += 4; // PC+8
@@ -63,35 +61,29 @@ void Cpu::LoadStoreImmOffset(sLoadStoreImmOffset* instruction) {
 	if (!P_preindexed && W_userMemAccess) {
 		// TODO : Check if memory is User accessible
 	}
-	uint8_t* startPtr = memory->GetPointerFromAddr(operandAddr);
-	Operand = static_cast<uint32_t>(ARM_mem::GetBytesAtPointer(startPtr, size));
 
 	// If Post index
 	if (!P_preindexed) {
-		if (U_add) {
-			Operand += Immediate;
-		}
-		else {
-			Operand -= Immediate;
-		}
 		// WriteBack always enabled
-		SetReg(Rn, U_add ? Rn_value + Operand : Rn_value - Operand);
+		SetReg(Rn, U_add ? Rn_value + Immediate : Rn_value - Immediate);
 	}
 
 	// Execute...
 	if (L_load) {	// ... load
 		// TODO : LDR PC, <op> sets CPSR.T <op> bit0 (LSB) for ARMv5
+		Operand = B_byte ? memory->Read8(operandAddr) : memory->Read32(operandAddr);
 
-		SetReg(Rd, B_byte ? static_cast<uint8_t>(Operand) : Operand);
+		SetReg(Rd, Operand);
 	}
 	else {			// ... store
 		if (Rd == REG_PC) Rd_value += 8; // PC+12
 
+		memoryWritten = true;
 		if (B_byte) {
-			*startPtr = static_cast<uint8_t>(Rd_value);
+			memory->Write8(operandAddr, static_cast<uint8_t>(Rd_value));
 		}
 		else {
-			ARM_mem::SetWordAtPointer(startPtr, Rd_value);
+			memory->Write32(operandAddr, Rd_value);
 		}
 	}
 }
@@ -125,8 +117,6 @@ void Cpu::LoadStoreMultiple(sLoadStoreMultiple* instruction) {
 	uint32_t bitShift = 1;
 	CpuMode forceCpuModeAccess = Current;
 	for (int i = (U_upward ? 0 : 15); i < (U_upward ? 15 : 0); (U_upward ? i++ : i--)) {
-		uint8_t* ptr = memory->GetPointerFromAddr(Rn_value);
-
 		if ((instruction->registerList & bitShift) != 0) {
 			if (L_load) {
 				// Load
@@ -136,14 +126,15 @@ void Cpu::LoadStoreMultiple(sLoadStoreMultiple* instruction) {
 				else if (S_useUserReg && (i != REG_PC)) {
 					forceCpuModeAccess = User;
 				}
-				SetReg(i, memory->GetWordAtPointer(ptr), forceCpuModeAccess);
+				SetReg(i, memory->Read32(Rn_value), forceCpuModeAccess);
 			}
 			else {
 				// Store
+				memoryWritten = true;
 				if (S_useUserReg) {
 					forceCpuModeAccess = User;
 				}
-				memory->SetWordAtPointer(ptr, GetReg(i, forceCpuModeAccess));
+				memory->Write32(Rn_value, GetReg(i, forceCpuModeAccess));
 			}
 
 			if (U_upward) {
@@ -225,5 +216,44 @@ void Cpu::Branch(sBranchInstruction* instruction) {
 		// Branch with Link
 		SetReg(REG_LR, oldPC);
 	}
+	else if ((newPC <= oldPC - 4) && (oldPC - 4 - newPC <= IDLE_LOOP_MAX_SIZE)) {
+		CheckIdleLoop(oldPC - 4);
+	}
 	SetReg(REG_PC, newPC);
+}
+
+void Cpu::CoprocRegTransf(sCoprocRegTransf* instruction) {
+	if (!IsConditionOK()) return;
+
+	// Only the ARM9 has a system control coprocessor (CP15), other coprocessors are absent
+	if ((instructionSet != ARMv5_ARM9) || (instruction->cp_num != 15)) return;
+
+	uint32_t cpReg = (instruction->CRn << 8) | (instruction->CRm << 4) | instruction->opcode2;
+
+	if (instruction->L) {
+		// MRC
+		uint32_t value = CP15Read(cpReg);
+		if (Rd == REG_PC) {
+			// Only flags are updated
+			cpsr.value = (cpsr.value & 0x0FFFFFFF) | (value & 0xF0000000);
+		}
+		else {
+			SetReg(Rd, value);
+		}
+	}
+	else {
+		// MCR
+		if (Rd == REG_PC) Rd_value += 8; // PC+12
+		CP15Write(cpReg, Rd_value);
+	}
+}
+
+void Cpu::SoftwareInterrupt(sSoftwareInterrupt* instruction) {
+	if (!IsConditionOK()) return;
+
+	if (hleBios) {
+		HLESoftwareInterrupt((instruction->swiNumber >> 16) & 0xFF);
+		return;
+	}
+	ThrowSWI();
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "crc16.h"
+#include <cstring>
+
+// Slice-by-8 : values[k][n] is the CRC of byte n followed by k zero bytes,
+// so 8 input bytes are folded with 8 independent table lookups
+struct CRC16Table {
+	uint16_t values[8][256];
+
+	CRC16Table() {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint16_t crc = static_cast<uint16_t>(i);
+			for (int bit = 0; bit < 8; bit++) crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+			values[0][i] = crc;
+		}
+		for (uint32_t i = 0; i < 256; i++) {
+			for (int k = 1; k < 8; k++) values[k][i] = (values[k - 1][i] >> 8) ^ values[0][values[k - 1][i] & 0xFF];
+		}
+	}
+};
+
+static const CRC16Table table;
+
+uint16_t CRC16(uint16_t crc, const uint8_t* data, size_t length) {
+	while (length >= 8) {
+		uint32_t low;
+		uint32_t high;
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+		low ^= crc;
+
+		crc = table.values[7][low & 0xFF] ^ table.values[6][(low >> 8) & 0xFF]
+			^ table.values[5][(low >> 16) & 0xFF] ^ table.values[4][low >> 24]
+			^ table.values[3][high & 0xFF] ^ table.values[2][(high >> 8) & 0xFF]
+			^ table.values[1][(high >> 16) & 0xFF] ^ table.values[0][high >> 24];
+
+		data += 8;
+		length -= 8;
+	}
+
+	for (size_t i = 0; i < length; i++) crc = (crc >> 8) ^ table.values[0][(crc ^ data[i]) & 0xFF];
+	return crc;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/// <summary>
+/// CRC-16 as computed by the DS BIOS (reflected polynomial A001h), used by ROM headers and GetCRC16
+/// </summary>
+/// <param name="crc">Initial value (FFFFh for ROM headers)</param>
+/// <param name="data">Data to process</param>
+/// <param name="length">Number of bytes</param>
+/// <returns>Updated CRC</returns>
+uint16_t CRC16(uint16_t crc, const uint8_t* data, size_t length);
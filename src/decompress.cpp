@@ -0,0 +1,286 @@
+#include "decompress.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#pragma region LZ77
+
+// Copy a back reference. Sources at least 8 bytes behind are copied 8 bytes at a time : the copies never overlap,
+// the last one may write up to 7 bytes past the match if the buffer has room for them. Closer sources are repeated
+// patterns, expanded by doubling the already copied part.
+static inline void CopyMatch(uint8_t* dst, size_t distance, size_t length, size_t room) {
+	const uint8_t* src = dst - distance;
+
+	if (distance >= 8) {
+		size_t i = 0;
+		if (length + 7 <= room) {
+			for (; i < length; i += 8) memcpy(dst + i, src + i, 8);
+			return;
+		}
+		for (; i + 8 <= length; i += 8) memcpy(dst + i, src + i, 8);
+		for (; i < length; i++) dst[i] = src[i];
+		return;
+	}
+
+	if (distance == 1) {
+		memset(dst, *src, length);
+		return;
+	}
+
+	size_t copied = (distance < length) ? distance : length;
+	memcpy(dst, src, copied);
+	while (copied < length) {
+		size_t chunk = (copied < length - copied) ? copied : length - copied;
+		memcpy(dst + copied, dst, chunk);
+		copied += chunk;
+	}
+}
+
+template <bool extended>
+static bool DecompressLZ(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	size_t size;
+	size_t in;
+	if (!ReadCompressionHeader(src, srcSize, size, in) || (size > dstSize)) return false;
+
+	size_t out = 0;
+	while (out < size) {
+		if (in >= srcSize) return false;
+		uint32_t flags = src[in++];
+
+		// 8 blocks per flag byte, MSB first : 0 = literal byte, 1 = back reference
+		for (int i = 0; (i < 8) && (out < size); ) {
+			if ((flags & 0x80) == 0) {
+				// Literals up to the next back reference, copied as one 8 byte word if both buffers have room for it
+				size_t run = std::min<size_t>(std::countl_zero(static_cast<uint8_t>(flags)), 8 - i);
+				run = std::min(run, size - out);
+				if ((in + 8 <= srcSize) && (out + 8 <= size)) {
+					memcpy(dst + out, src + in, 8);
+				}
+				else {
+					if (in + run > srcSize) return false;
+					memcpy(dst + out, src + in, run);
+				}
+				in += run;
+				out += run;
+				i += static_cast<int>(run);
+				flags <<= run;
+				continue;
+			}
+
+			if (in + 2 > srcSize) return false;
+			size_t length;
+			size_t distance;
+			if (!extended) {
+				length = (src[in] >> 4) + 3;
+				distance = (((src[in] & 0xF) << 8) | src[in + 1]) + 1;
+				in += 2;
+			}
+			else {
+				switch (src[in] >> 4) {
+				case 0:
+					if (in + 3 > srcSize) return false;
+					length = (((src[in] & 0xF) << 4) | (src[in + 1] >> 4)) + 0x11;
+					distance = (((src[in + 1] & 0xF) << 8) | src[in + 2]) + 1;
+					in += 3;
+					break;
+				case 1:
+					if (in + 4 > srcSize) return false;
+					length = (((src[in] & 0xF) << 12) | (src[in + 1] << 4) | (src[in + 2] >> 4)) + 0x111;
+					distance = (((src[in + 2] & 0xF) << 8) | src[in + 3]) + 1;
+					in += 4;
+					break;
+				default:
+					length = (src[in] >> 4) + 1;
+					distance = (((src[in] & 0xF) << 8) | src[in + 1]) + 1;
+					in += 2;
+					break;
+				}
+			}
+			if (distance > out) return false;
+			if (length > size - out) length = size - out;
+
+			CopyMatch(dst + out, distance, length, size - out);
+			out += length;
+			i++;
+			flags <<= 1;
+		}
+	}
+
+	return true;
+}
+
+bool DecompressLZ10(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	return DecompressLZ<false>(src, srcSize, dst, dstSize);
+}
+
+bool DecompressLZ11(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	return DecompressLZ<true>(src, srcSize, dst, dstSize);
+}
+
+#pragma endregion
+
+#pragma region RLE
+
+bool DecompressRLE(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	size_t size;
+	size_t in;
+	if (!ReadCompressionHeader(src, srcSize, size, in) || (size > dstSize)) return false;
+
+	size_t out = 0;
+	while (out < size) {
+		if (in >= srcSize) return false;
+		uint8_t flag = src[in++];
+
+		size_t length = (flag & 0x80) ? (flag & 0x7F) + 3 : (flag & 0x7F) + 1;
+		if (length > size - out) length = size - out;
+
+		if ((flag & 0x80) != 0) {
+			if (in >= srcSize) return false;
+			memset(dst + out, src[in++], length);
+		}
+		else {
+			if (in + (flag & 0x7F) + 1 > srcSize) return false;
+			memcpy(dst + out, src + in, length);
+			in += (flag & 0x7F) + 1;
+		}
+		out += length;
+	}
+
+	return true;
+}
+
+#pragma endregion
+
+#pragma region Huffman
+
+// Codes are decoded LOOKUP_BITS at a time from the root : each table entry gives either the symbol
+// and the length of its code, or the node reached after LOOKUP_BITS bits for longer codes. Invalid nodes
+// only fail the decoding once the bit stream reaches them : their entry stops at the node before.
+static const int LOOKUP_BITS = 8;
+
+struct HuffmanLookup {
+	uint16_t node;		// Symbol if leaf, node index otherwise
+	uint8_t bits;
+	bool leaf;
+};
+
+bool DecompressHuffman(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	size_t size;
+	size_t headerSize;
+	if (!ReadCompressionHeader(src, srcSize, size, headerSize) || (size > dstSize) || (headerSize >= srcSize)) return false;
+
+	uint32_t symbolBits = src[0] & 0xF;
+	if ((symbolBits != 4) && (symbolBits != 8)) return false;
+
+	const uint8_t* tree = src + headerSize;
+	size_t treeSize = (static_cast<size_t>(tree[0]) + 1) * 2;
+	if (headerSize + treeSize > srcSize) return false;
+
+	// Children of a node : bits 0-5 = offset, bit 7 = left child is a symbol, bit 6 = right child is a symbol
+	auto walk = [tree, treeSize](size_t node, uint32_t direction, size_t& child) -> int {
+		uint8_t value = tree[node];
+		child = (node & ~static_cast<size_t>(1)) + (value & 0x3F) * 2 + 2 + direction;
+		if (child >= treeSize) return -1;
+		return ((value & (direction ? 0x40 : 0x80)) != 0) ? 1 : 0;
+	};
+
+	HuffmanLookup lookup[1 << LOOKUP_BITS];
+	for (uint32_t code = 0; code < (1 << LOOKUP_BITS); code++) {
+		size_t node = 1;
+		HuffmanLookup& entry = lookup[code];
+		entry = { 1, LOOKUP_BITS, false };
+		for (int bit = 0; bit < LOOKUP_BITS; bit++) {
+			size_t child;
+			int result = walk(node, (code >> (LOOKUP_BITS - 1 - bit)) & 0x1, child);
+			if (result < 0) {
+				entry.bits = static_cast<uint8_t>(bit);
+				break;
+			}
+			if (result == 1) {
+				entry = { tree[child], static_cast<uint8_t>(bit + 1), true };
+				break;
+			}
+			node = child;
+			entry.node = static_cast<uint16_t>(node);
+		}
+	}
+
+	// Bit stream : 32bit little endian words, MSB first, kept left aligned in a 64bit buffer
+	size_t in = headerSize + treeSize;
+	uint64_t bitBuffer = 0;
+	int bitCount = 0;
+	auto refill = [&]() {
+		while ((bitCount <= 32) && (in + 4 <= srcSize)) {
+			uint64_t word = src[in] | (src[in + 1] << 8) | (src[in + 2] << 16) | (static_cast<uint32_t>(src[in + 3]) << 24);
+			bitBuffer |= word << (32 - bitCount);
+			bitCount += 32;
+			in += 4;
+		}
+	};
+
+	size_t out = 0;
+	uint32_t outWord = 0;
+	uint32_t outBits = 0;
+	while (out < size) {
+		refill();
+
+		size_t node = 1;
+		uint8_t symbol = 0;
+		bool found = false;
+
+		// Near the end of the stream the buffer may hold fewer bits than the table entry needs : walk from the root
+		const HuffmanLookup& entry = lookup[bitBuffer >> (64 - LOOKUP_BITS)];
+		if (entry.bits <= bitCount) {
+			bitBuffer <<= entry.bits;
+			bitCount -= entry.bits;
+			if (entry.leaf) {
+				symbol = static_cast<uint8_t>(entry.node);
+				found = true;
+			}
+			else {
+				node = entry.node;
+			}
+		}
+
+		while (!found) {
+			if (bitCount == 0) {
+				refill();
+				if (bitCount == 0) return false;
+			}
+			size_t child;
+			int result = walk(node, static_cast<uint32_t>(bitBuffer >> 63), child);
+			bitBuffer <<= 1;
+			bitCount--;
+			if (result < 0) return false;
+			if (result == 1) {
+				symbol = tree[child];
+				found = true;
+			}
+			node = child;
+		}
+
+		// Symbols are packed LSB first in 32bit words. Same as the reference decoder, 4 bit symbols are not masked.
+		outWord |= static_cast<uint32_t>(symbol) << outBits;
+		outBits += symbolBits;
+		if ((outBits == 32) || ((out * 8 + outBits) >= size * 8)) {
+			for (int i = 0; (i < 4) && (out < size); i++) dst[out++] = static_cast<uint8_t>(outWord >> (i * 8));
+			outWord = 0;
+			outBits = 0;
+		}
+	}
+
+	return true;
+}
+
+#pragma endregion
+
+bool Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	if (srcSize < 4) return false;
+
+	switch (src[0] >> 4) {
+	case COMPRESSION_LZ77:		return (src[0] == COMPRESSION_LZ11_HEADER) ? DecompressLZ11(src, srcSize, dst, dstSize) : DecompressLZ10(src, srcSize, dst, dstSize);
+	case COMPRESSION_HUFFMAN:	return DecompressHuffman(src, srcSize, dst, dstSize);
+	case COMPRESSION_RLE:		return DecompressRLE(src, srcSize, dst, dstSize);
+	default:					return false;
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Compressed data formats of the DS BIOS and SDK. Every stream starts with a 32bit header :
+// bits 0-3 type specific, bits 4-7 compression type, bits 8-31 decompressed size.
+// A decompressed size of 0 means the real size follows as a 32bit word.
+// This module has no dependency on the emulator : HLE BIOS, NitroFS and offline tools can all use it.
+enum eCompressionType : uint8_t {
+	COMPRESSION_LZ77 = 0x1,
+	COMPRESSION_HUFFMAN = 0x2,
+	COMPRESSION_RLE = 0x3,
+};
+
+constexpr uint8_t COMPRESSION_LZ10_HEADER = 0x10;
+constexpr uint8_t COMPRESSION_LZ11_HEADER = 0x11;
+
+/// <summary>
+/// Read the decompressed size from a compressed stream header
+/// </summary>
+/// <param name="src">Compressed stream (at least 4 bytes)</param>
+/// <returns>Decompressed size in bytes</returns>
+inline uint32_t GetDecompressedSize(const uint8_t* src) {
+	return src[1] | (src[2] << 8) | (src[3] << 16);
+}
+
+/// <summary>
+/// Read a compressed stream header, with its optional 32bit extended size
+/// </summary>
+/// <param name="src">Compressed stream</param>
+/// <param name="srcSize">Bytes available in src</param>
+/// <param name="size">Receives the decompressed size</param>
+/// <param name="headerSize">Receives the header size (4 or 8)</param>
+/// <returns>false if src is too short</returns>
+inline bool ReadCompressionHeader(const uint8_t* src, size_t srcSize, size_t& size, size_t& headerSize) {
+	if (srcSize < 4) return false;
+
+	size = GetDecompressedSize(src);
+	headerSize = 4;
+	if (size == 0) {
+		if (srcSize < 8) return false;
+		size = src[4] | (src[5] << 8) | (src[6] << 16) | (static_cast<size_t>(src[7]) << 24);
+		headerSize = 8;
+	}
+	return true;
+}
+
+/// <summary>
+/// Decompress a LZ77 stream, BIOS format (header 10h, BIOS functions 11h / 12h)
+/// </summary>
+/// <param name="src">Compressed stream, header included</param>
+/// <param name="srcSize">Bytes available in src</param>
+/// <param name="dst">Destination buffer</param>
+/// <param name="dstSize">Size of dst, at least the decompressed size</param>
+/// <returns>false if the stream is invalid or truncated</returns>
+bool DecompressLZ10(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+/// <summary>
+/// Decompress a LZ77 stream with extended lengths (header 11h, not supported by the BIOS)
+/// </summary>
+bool DecompressLZ11(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+/// <summary>
+/// Decompress a run-length encoded stream (BIOS functions 14h / 15h)
+/// </summary>
+bool DecompressRLE(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+/// <summary>
+/// Decompress a Huffman stream with 4 or 8 bit symbols (BIOS function 13h)
+/// </summary>
+bool DecompressHuffman(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+/// <summary>
+/// Decompress any supported stream, according to the type in its header
+/// </summary>
+bool Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+// Reference decoders : byte by byte, one tree walk per bit, used to validate and benchmark the optimized ones.
+// Both accept the same streams and write the same output, malformed streams included (invalid tree nodes that are
+// never reached, 4 bit Huffman symbols above 15). When a stream is rejected, the optimized LZ77 decoders may have
+// written past the last decoded byte : the destination contents are unspecified.
+bool DecompressLZ10Reference(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+bool DecompressLZ11Reference(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+bool DecompressRLEReference(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+bool DecompressHuffmanReference(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
@@ -0,0 +1,163 @@
+#include "decompress.h"
+
+// Straightforward byte by byte decoders, kept as the reference for the optimized ones
+
+bool DecompressLZ10Reference(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	size_t size;
+	size_t in;
+	if (!ReadCompressionHeader(src, srcSize, size, in) || (size > dstSize)) return false;
+
+	size_t out = 0;
+	while (out < size) {
+		if (in >= srcSize) return false;
+		uint8_t flags = src[in++];
+
+		// 8 blocks per flag byte, MSB first : 0 = literal byte, 1 = back reference
+		for (int i = 0; (i < 8) && (out < size); i++, flags <<= 1) {
+			if ((flags & 0x80) == 0) {
+				if (in >= srcSize) return false;
+				dst[out++] = src[in++];
+				continue;
+			}
+
+			if (in + 2 > srcSize) return false;
+			size_t length = (src[in] >> 4) + 3;
+			size_t distance = (((src[in] & 0xF) << 8) | src[in + 1]) + 1;
+			in += 2;
+			if (distance > out) return false;
+
+			// Byte by byte : the reference may overlap the bytes being written
+			for (size_t j = 0; (j < length) && (out < size); j++, out++) dst[out] = dst[out - distance];
+		}
+	}
+
+	return true;
+}
+
+bool DecompressRLEReference(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	size_t size;
+	size_t in;
+	if (!ReadCompressionHeader(src, srcSize, size, in) || (size > dstSize)) return false;
+
+	size_t out = 0;
+	while (out < size) {
+		if (in >= srcSize) return false;
+		uint8_t flag = src[in++];
+
+		if ((flag & 0x80) != 0) {
+			// Run of one byte
+			if (in >= srcSize) return false;
+			size_t length = (flag & 0x7F) + 3;
+			uint8_t value = src[in++];
+			for (size_t j = 0; (j < length) && (out < size); j++) dst[out++] = value;
+		}
+		else {
+			// Literal bytes
+			size_t length = (flag & 0x7F) + 1;
+			if (in + length > srcSize) return false;
+			for (size_t j = 0; (j < length) && (out < size); j++) dst[out++] = src[in++];
+		}
+	}
+
+	return true;
+}
+
+bool DecompressHuffmanReference(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	size_t size;
+	size_t headerSize;
+	if (!ReadCompressionHeader(src, srcSize, size, headerSize) || (size > dstSize) || (headerSize >= srcSize)) return false;
+
+	uint32_t symbolBits = src[0] & 0xF;
+	if ((symbolBits != 4) && (symbolBits != 8)) return false;
+
+	// Tree : size byte, then nodes. Node bits 0-5 = offset to children, bit 6 = right child is a symbol, bit 7 = left child is a symbol
+	const uint8_t* tree = src + headerSize;
+	size_t treeSize = (static_cast<size_t>(tree[0]) + 1) * 2;
+	if (headerSize + treeSize > srcSize) return false;
+
+	size_t in = headerSize + treeSize;
+	size_t out = 0;
+	size_t node = 1;
+	uint32_t outWord = 0;
+	uint32_t outBits = 0;
+
+	while (out < size) {
+		// Bit stream in 32bit little endian words, read MSB first
+		if (in + 4 > srcSize) return false;
+		uint32_t word = src[in] | (src[in + 1] << 8) | (src[in + 2] << 16) | (static_cast<uint32_t>(src[in + 3]) << 24);
+		in += 4;
+
+		for (int bit = 31; (bit >= 0) && (out < size); bit--) {
+			uint32_t direction = (word >> bit) & 0x1;
+			uint8_t value = tree[node];
+			size_t child = (node & ~static_cast<size_t>(1)) + (value & 0x3F) * 2 + 2 + direction;
+			if (child >= treeSize) return false;
+
+			if ((value & (direction ? 0x40 : 0x80)) == 0) {
+				node = child;
+				continue;
+			}
+
+			// Symbols are packed LSB first
+			outWord |= static_cast<uint32_t>(tree[child]) << outBits;
+			outBits += symbolBits;
+			node = 1;
+
+			if ((outBits == 32) || ((out * 8 + outBits) >= size * 8)) {
+				for (int i = 0; (i < 4) && (out < size); i++) dst[out++] = static_cast<uint8_t>(outWord >> (i * 8));
+				outWord = 0;
+				outBits = 0;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool DecompressLZ11Reference(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	size_t size;
+	size_t in;
+	if (!ReadCompressionHeader(src, srcSize, size, in) || (size > dstSize)) return false;
+
+	size_t out = 0;
+	while (out < size) {
+		if (in >= srcSize) return false;
+		uint8_t flags = src[in++];
+
+		for (int i = 0; (i < 8) && (out < size); i++, flags <<= 1) {
+			if ((flags & 0x80) == 0) {
+				if (in >= srcSize) return false;
+				dst[out++] = src[in++];
+				continue;
+			}
+
+			size_t length;
+			size_t distance;
+			if (in + 2 > srcSize) return false;
+			switch (src[in] >> 4) {
+			case 0:
+				if (in + 3 > srcSize) return false;
+				length = (((src[in] & 0xF) << 4) | (src[in + 1] >> 4)) + 0x11;
+				distance = (((src[in + 1] & 0xF) << 8) | src[in + 2]) + 1;
+				in += 3;
+				break;
+			case 1:
+				if (in + 4 > srcSize) return false;
+				length = (((src[in] & 0xF) << 12) | (src[in + 1] << 4) | (src[in + 2] >> 4)) + 0x111;
+				distance = (((src[in + 2] & 0xF) << 8) | src[in + 3]) + 1;
+				in += 4;
+				break;
+			default:
+				length = (src[in] >> 4) + 1;
+				distance = (((src[in] & 0xF) << 8) | src[in + 1]) + 1;
+				in += 2;
+				break;
+			}
+			if (distance > out) return false;
+
+			for (size_t j = 0; (j < length) && (out < size); j++, out++) dst[out] = dst[out - distance];
+		}
+	}
+
+	return true;
+}
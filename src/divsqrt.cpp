@@ -0,0 +1,131 @@
+#include "divsqrt.h"
+#include <cmath>
+
+void DivSqrt::Attach(ARM_mem& mem, Scheduler* sched) {
+	scheduler = sched;
+	io = mem.GetPointerFromAddr(DIVCNT_ADDR);
+
+	auto startDiv = [this](uint32_t value, uint32_t mask) { StartDiv(); };
+	auto startSqrt = [this](uint32_t value, uint32_t mask) { StartSqrt(); };
+
+	mem.SetIOWriteHandler(DIVCNT_ADDR, startDiv);
+	mem.SetIOWriteHandler(DIV_NUMER_ADDR, startDiv);
+	mem.SetIOWriteHandler(DIV_NUMER_ADDR + 4, startDiv);
+	mem.SetIOWriteHandler(DIV_DENOM_ADDR, startDiv);
+	mem.SetIOWriteHandler(DIV_DENOM_ADDR + 4, startDiv);
+	mem.SetIOWriteHandler(SQRTCNT_ADDR, startSqrt);
+	mem.SetIOWriteHandler(SQRT_PARAM_ADDR, startSqrt);
+	mem.SetIOWriteHandler(SQRT_PARAM_ADDR + 4, startSqrt);
+
+	mem.SetIOReadHandler(DIVCNT_ADDR, [this]() {
+		uint32_t cnt = ARM_mem::GetWordAtPointer(GetRegister(DIVCNT_ADDR)) & 0x3;
+		// Set when the full 64bit denominator is zero, whatever the mode
+		if (ARM_mem::GetBytesAtPointer(GetRegister(DIV_DENOM_ADDR), 8) == 0) cnt |= CNT_DIV_BY_ZERO;
+		if (scheduler->IsScheduled(EVENT_DIV)) cnt |= CNT_BUSY;
+		return cnt;
+	});
+	for (uint32_t addr = DIV_RESULT_ADDR; addr < SQRTCNT_ADDR; addr += 4) {
+		mem.SetIOReadHandler(addr, [this, addr]() {
+			if (divDirty) ComputeDiv();
+			return ARM_mem::GetWordAtPointer(GetRegister(addr));
+		});
+	}
+
+	mem.SetIOReadHandler(SQRTCNT_ADDR, [this]() {
+		uint32_t cnt = ARM_mem::GetWordAtPointer(GetRegister(SQRTCNT_ADDR)) & 0x1;
+		if (scheduler->IsScheduled(EVENT_SQRT)) cnt |= CNT_BUSY;
+		return cnt;
+	});
+	mem.SetIOReadHandler(SQRT_RESULT_ADDR, [this]() {
+		if (sqrtDirty) ComputeSqrt();
+		return ARM_mem::GetWordAtPointer(GetRegister(SQRT_RESULT_ADDR));
+	});
+}
+
+void DivSqrt::StartDiv() {
+	divDirty = true;
+	uint32_t mode = ARM_mem::GetWordAtPointer(GetRegister(DIVCNT_ADDR)) & 0x3;
+	scheduler->Schedule(EVENT_DIV, (mode == 0) ? DIV32_CYCLES : DIV64_CYCLES);
+}
+
+void DivSqrt::StartSqrt() {
+	sqrtDirty = true;
+	scheduler->Schedule(EVENT_SQRT, SQRT_CYCLES);
+}
+
+void DivSqrt::Div64(int64_t numer, int64_t denom, int64_t& quotient, int64_t& remainder) {
+	if (denom == 0) {
+		quotient = (numer < 0) ? 1 : -1;
+		remainder = numer;
+	}
+	else if ((numer == INT64_MIN) && (denom == -1)) {
+		quotient = INT64_MIN;
+		remainder = 0;
+	}
+	else {
+		quotient = numer / denom;
+		remainder = numer % denom;
+	}
+}
+
+void DivSqrt::ComputeDiv() {
+	divDirty = false;
+
+	uint32_t mode = ARM_mem::GetWordAtPointer(GetRegister(DIVCNT_ADDR)) & 0x3;
+	int64_t numer = static_cast<int64_t>(ARM_mem::GetBytesAtPointer(GetRegister(DIV_NUMER_ADDR), 8));
+	int64_t denom = static_cast<int64_t>(ARM_mem::GetBytesAtPointer(GetRegister(DIV_DENOM_ADDR), 8));
+	int64_t quotient;
+	int64_t remainder;
+
+	if (mode == 0) {
+		// 32bit / 32bit
+		int32_t numer32 = static_cast<int32_t>(numer);
+		int32_t denom32 = static_cast<int32_t>(denom);
+		if (denom32 == 0) {
+			// +/-1 with the upper word inverted : -1 for a positive numerator, +1 for a negative one
+			quotient = (numer32 < 0) ? static_cast<int64_t>(0xFFFFFFFF00000001) : static_cast<int64_t>(0x00000000FFFFFFFF);
+			remainder = numer32;
+		}
+		else if ((numer32 == INT32_MIN) && (denom32 == -1)) {
+			quotient = 0x80000000;
+			remainder = 0;
+		}
+		else {
+			quotient = numer32 / denom32;
+			remainder = numer32 % denom32;
+		}
+	}
+	else if (mode == 2) {
+		// 64bit / 64bit
+		Div64(numer, denom, quotient, remainder);
+	}
+	else {
+		// 64bit / 32bit
+		Div64(numer, static_cast<int32_t>(denom), quotient, remainder);
+	}
+
+	uint8_t* result = GetRegister(DIV_RESULT_ADDR);
+	uint8_t* rem = GetRegister(DIVREM_RESULT_ADDR);
+	ARM_mem::SetWordAtPointer(result, static_cast<uint32_t>(quotient));
+	ARM_mem::SetWordAtPointer(result + 4, static_cast<uint32_t>(static_cast<uint64_t>(quotient) >> 32));
+	ARM_mem::SetWordAtPointer(rem, static_cast<uint32_t>(remainder));
+	ARM_mem::SetWordAtPointer(rem + 4, static_cast<uint32_t>(static_cast<uint64_t>(remainder) >> 32));
+}
+
+uint32_t DivSqrt::Sqrt64(uint64_t value) {
+	// Floating point estimate, then fix the rounding of large values
+	uint64_t root = static_cast<uint64_t>(std::sqrt(static_cast<double>(value)));
+	if (root > 0xFFFFFFFF) root = 0xFFFFFFFF;
+	while (root * root > value) root--;
+	while ((root < 0xFFFFFFFF) && ((root + 1) * (root + 1) <= value)) root++;
+	return static_cast<uint32_t>(root);
+}
+
+void DivSqrt::ComputeSqrt() {
+	sqrtDirty = false;
+
+	uint64_t param = ARM_mem::GetBytesAtPointer(GetRegister(SQRT_PARAM_ADDR), 8);
+	if ((ARM_mem::GetWordAtPointer(GetRegister(SQRTCNT_ADDR)) & 0x1) == 0) param &= 0xFFFFFFFF;
+
+	ARM_mem::SetWordAtPointer(GetRegister(SQRT_RESULT_ADDR), Sqrt64(param));
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include "arm_mem.h"
+#include "scheduler.h"
+
+/// <summary>
+/// ARM9 hardware divider and square root unit.
+/// Results are computed once, when first read after a parameter change. The busy flag is
+/// only a scheduled event marking the end of the hardware latency.
+/// </summary>
+class DivSqrt {
+private:
+	Scheduler* scheduler{ nullptr };
+	uint8_t* io{ nullptr };	// I/O memory at DIVCNT_ADDR
+
+	bool divDirty{ false };
+	bool sqrtDirty{ false };
+
+	uint8_t* GetRegister(uint32_t address) const {
+		return io + (address - DIVCNT_ADDR);
+	}
+
+	void StartDiv();
+	void StartSqrt();
+	void ComputeDiv();
+	void ComputeSqrt();
+
+public:
+	static const uint32_t DIVCNT_ADDR = 0x04000280;
+	static const uint32_t DIV_NUMER_ADDR = 0x04000290;
+	static const uint32_t DIV_DENOM_ADDR = 0x04000298;
+	static const uint32_t DIV_RESULT_ADDR = 0x040002A0;
+	static const uint32_t DIVREM_RESULT_ADDR = 0x040002A8;
+	static const uint32_t SQRTCNT_ADDR = 0x040002B0;
+	static const uint32_t SQRT_RESULT_ADDR = 0x040002B4;
+	static const uint32_t SQRT_PARAM_ADDR = 0x040002B8;
+
+	static const uint32_t CNT_DIV_BY_ZERO = 1 << 14;
+	static const uint32_t CNT_BUSY = 1 << 15;
+
+	// Latency in scheduler cycles (18 / 34 / 13 bus cycles)
+	static const uint64_t DIV32_CYCLES = 36;
+	static const uint64_t DIV64_CYCLES = 68;
+	static const uint64_t SQRT_CYCLES = 26;
+
+	/// <summary>
+	/// Map the divider and square root registers into the ARM9 I/O table
+	/// </summary>
+	/// <param name="mem">ARM9 virtual memory</param>
+	/// <param name="sched">ARM9 scheduler</param>
+	void Attach(ARM_mem& mem, Scheduler* sched);
+
+	/// <summary>
+	/// Integer square root, rounded down
+	/// </summary>
+	static uint32_t Sqrt64(uint64_t value);
+
+	/// <summary>
+	/// Signed division with the hardware results for division by zero and overflow
+	/// </summary>
+	static void Div64(int64_t numer, int64_t denom, int64_t& quotient, int64_t& remainder);
+};
@@ -0,0 +1,246 @@
+#include "dma.h"
+#include <cstring>
+#include <algorithm>
+
+void DMA::Attach(ARM_mem& mem, Scheduler* sched, InterruptController* irqCtrl, bool isARM9) {
+	memory = &mem;
+	scheduler = sched;
+	irq = irqCtrl;
+	arm9 = isARM9;
+
+	for (int ch = 0; ch < 4; ch++) {
+		uint32_t cntAddr = DMA_BASE_ADDR + ch * DMA_CHANNEL_SIZE + 8;
+		channels[ch].cnt = mem.GetPointerFromAddr(cntAddr);
+		mem.SetIOWriteHandler(cntAddr, [this, ch](uint32_t value, uint32_t mask) { WriteControl(ch); });
+	}
+}
+
+eDMAStart DMA::GetStartMode(int ch, uint32_t control) const {
+	if (arm9) {
+		static const eDMAStart arm9Modes[8] = {
+			DMA_START_IMMEDIATE, DMA_START_VBLANK, DMA_START_HBLANK, DMA_START_DISPLAY,
+			DMA_START_DISPLAY_FIFO, DMA_START_CARTRIDGE, DMA_START_GBA_CARTRIDGE, DMA_START_GXFIFO
+		};
+		return arm9Modes[(control >> 27) & 0x7];
+	}
+
+	switch ((control >> 28) & 0x3) {
+	case 0: return DMA_START_IMMEDIATE;
+	case 1: return DMA_START_VBLANK;
+	case 2: return DMA_START_CARTRIDGE;
+	default: return ((ch & 0x1) == 0) ? DMA_START_WIFI : DMA_START_GBA_CARTRIDGE;
+	}
+}
+
+uint32_t DMA::GetMaxCount(int ch) const {
+	if (arm9) return 0x200000;
+	return (ch == 3) ? 0x10000 : 0x4000;
+}
+
+uint32_t DMA::GetCount(int ch, uint32_t control) const {
+	uint32_t count = control & (GetMaxCount(ch) - 1);
+	return (count == 0) ? GetMaxCount(ch) : count;
+}
+
+void DMA::WriteControl(int ch) {
+	Channel& c = channels[ch];
+	uint32_t control = ARM_mem::GetWordAtPointer(c.cnt);
+
+	if ((control & CNT_ENABLE) == 0) {
+		c.running = false;
+		c.start = DMA_START_NONE;
+		return;
+	}
+
+	c.start = GetStartMode(ch, control);
+
+	// Addresses & count are latched when the channel gets enabled
+	if (!c.running) {
+		c.running = true;
+		uint32_t channelAddr = DMA_BASE_ADDR + ch * DMA_CHANNEL_SIZE;
+		c.srcAddr = ARM_mem::GetWordAtPointer(memory->GetPointerFromAddr(channelAddr));
+		c.dstAddr = ARM_mem::GetWordAtPointer(memory->GetPointerFromAddr(channelAddr + 4));
+	}
+	c.count = GetCount(ch, control);
+
+	// GXFIFO transfers start at once : the geometry engine takes what fits in its FIFO, and triggers the channel
+	// again when it has room (see GeometryEngine)
+	if ((c.start == DMA_START_IMMEDIATE) || (c.start == DMA_START_GXFIFO)) Run(ch);
+}
+
+void DMA::Trigger(eDMAStart start) {
+	for (int ch = 0; ch < 4; ch++) {
+		if (channels[ch].running && (channels[ch].start == start)) Run(ch);
+	}
+}
+
+bool DMA::IsWaiting(eDMAStart start) const {
+	for (int ch = 0; ch < 4; ch++) {
+		if (channels[ch].running && (channels[ch].start == start)) return true;
+	}
+	return false;
+}
+
+static bool IsPlainMemory(uint32_t address) {
+	return (address & 0xFF000000) != 0x04000000;
+}
+
+uint8_t* DMA::GetContiguousPointer(uint32_t address, uint32_t length) {
+	if (!IsPlainMemory(address)) return nullptr;
+
+	// The whole range must be contiguous in host memory (same region, no mirroring inside)
+	uint8_t* ptr = memory->GetPointerFromAddr(address);
+	if (ptr == nullptr) return nullptr;
+	if (memory->GetPointerFromAddr(address + length - 1) != ptr + length - 1) return nullptr;
+	return ptr;
+}
+
+bool DMA::BulkCopy(uint32_t dstAddr, uint32_t srcAddr, uint32_t length) {
+	uint8_t* src = GetContiguousPointer(srcAddr, length);
+	uint8_t* dst = GetContiguousPointer(dstAddr, length);
+	if ((src == nullptr) || (dst == nullptr)) return false;
+
+	// DMA copies one unit at a time in increasing address order : when the destination starts inside the source, units
+	// written first are read again later, which memmove does not do. The unit loop does. Below the source, both agree.
+	if ((dst > src) && (dst < src + length)) return false;
+
+	memmove(dst, src, length);
+	memory->NotifyWrite(dstAddr, length);
+	return true;
+}
+
+void DMA::Run(int ch) {
+	Channel& c = channels[ch];
+	uint32_t control = ARM_mem::GetWordAtPointer(c.cnt);
+
+	bool word = (control & CNT_WORD) != 0;
+	uint32_t unit = word ? 4 : 2;
+	eDMAAddrControl dstControl = static_cast<eDMAAddrControl>((control >> 21) & 0x3);
+	eDMAAddrControl srcControl = static_cast<eDMAAddrControl>((control >> 23) & 0x3);
+
+	auto step = [unit](eDMAAddrControl addrControl) -> int32_t {
+		switch (addrControl) {
+		case DMA_ADDR_DECREMENT: return -static_cast<int32_t>(unit);
+		case DMA_ADDR_FIXED: return 0;
+		default: return unit;
+		}
+	};
+	int32_t srcStep = step(srcControl);
+	int32_t dstStep = step(dstControl);
+
+	c.srcAddr &= ~(unit - 1);
+	c.dstAddr &= ~(unit - 1);
+	uint32_t length = c.count * unit;
+
+	// Fast paths : RAM to RAM with incrementing addresses is a single copy, words to a stream sink are a single call
+	uint32_t units = c.count;
+	if (streamSink && word && (dstStep == 0) && (c.dstAddr == sinkAddr)) {
+		const uint8_t* sinkSrc = (srcStep > 0) ? GetContiguousPointer(c.srcAddr, length) : nullptr;
+		if (sinkSrc != nullptr) {
+			units = streamSink(sinkSrc, length) / unit;
+			c.srcAddr += units * srcStep;
+		}
+		else {
+			// Other sources are read one word at a time, none past the first the sink refuses : reads may have side effects
+			for (units = 0; units < c.count; units++) {
+				uint8_t data[4];
+				ARM_mem::SetWordAtPointer(data, memory->Read32(c.srcAddr));
+				if (streamSink(data, 4) == 0) break;
+				c.srcAddr += srcStep;
+			}
+		}
+	}
+	else if ((srcStep > 0) && (dstStep > 0) && BulkCopy(c.dstAddr, c.srcAddr, length)) {
+		c.srcAddr += length;
+		c.dstAddr += length;
+	}
+	else {
+		for (uint32_t i = 0; i < c.count; i++) {
+			if (word) {
+				memory->Write32(c.dstAddr, memory->Read32(c.srcAddr));
+			}
+			else {
+				memory->Write16(c.dstAddr, memory->Read16(c.srcAddr));
+			}
+			c.srcAddr += srcStep;
+			c.dstAddr += dstStep;
+		}
+	}
+
+	// The CPU is stalled while the DMA owns the bus
+	scheduler->AddCycles(SETUP_CYCLES + units * UNIT_CYCLES);
+
+	// The sink is full : the rest waits for the next start
+	if (units < c.count) {
+		c.count -= units;
+		return;
+	}
+
+	EndTransfer(ch, control);
+}
+
+void DMA::EndTransfer(int ch, uint32_t control) {
+	Channel& c = channels[ch];
+
+	if (((control & CNT_REPEAT) != 0) && (c.start != DMA_START_IMMEDIATE)) {
+		c.count = GetCount(ch, control);
+		if (((control >> 21) & 0x3) == DMA_ADDR_INCREMENT_RELOAD) {
+			c.dstAddr = ARM_mem::GetWordAtPointer(memory->GetPointerFromAddr(DMA_BASE_ADDR + ch * DMA_CHANNEL_SIZE + 4));
+		}
+	}
+	else {
+		c.running = false;
+		c.start = DMA_START_NONE;
+		ARM_mem::SetWordAtPointer(c.cnt, control & ~CNT_ENABLE);
+	}
+
+	if ((control & CNT_IRQ) != 0) irq->Raise(static_cast<eIRQ>(IRQ_DMA0 + ch));
+}
+
+void DMA::SetStreamSink(uint32_t address, DMAStreamSink sink) {
+	sinkAddr = address;
+	streamSink = sink;
+}
+
+void DMA::SetStreamSource(uint32_t address, DMAStreamSource source) {
+	streamAddr = address;
+	streamSource = source;
+}
+
+uint32_t DMA::TriggerStream(eDMAStart start, uint32_t words) {
+	for (int ch = 0; ch < 4; ch++) {
+		Channel& c = channels[ch];
+		if (!streamSource || !c.running || (c.start != start) || ((c.srcAddr & ~0x3) != streamAddr)) continue;
+
+		uint32_t control = ARM_mem::GetWordAtPointer(c.cnt);
+		eDMAAddrControl dstControl = static_cast<eDMAAddrControl>((control >> 21) & 0x3);
+		if ((control & CNT_WORD) == 0) continue;
+
+		// A repeating channel is restarted for every word the device provides : run all the repeats at once
+		uint32_t count = ((control & CNT_REPEAT) != 0) ? words : std::min(words, c.count);
+		uint32_t length = count * 4;
+		c.dstAddr &= ~0x3;
+
+		uint8_t* dst = nullptr;
+		if ((dstControl == DMA_ADDR_INCREMENT) || (dstControl == DMA_ADDR_INCREMENT_RELOAD)) dst = GetContiguousPointer(c.dstAddr, length);
+
+		if (dst != nullptr) {
+			streamSource(dst, length);
+			memory->NotifyWrite(c.dstAddr, length);
+			c.dstAddr += length;
+		}
+		else {
+			int32_t dstStep = (dstControl == DMA_ADDR_FIXED) ? 0 : ((dstControl == DMA_ADDR_DECREMENT) ? -4 : 4);
+			for (uint32_t i = 0; i < count; i++) {
+				memory->Write32(c.dstAddr, memory->Read32(streamAddr));
+				c.dstAddr += dstStep;
+			}
+		}
+
+		scheduler->AddCycles(SETUP_CYCLES + count * UNIT_CYCLES);
+		EndTransfer(ch, control);
+		return count;
+	}
+
+	return 0;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include "arm_mem.h"
+#include "scheduler.h"
+#include "interrupts.h"
+
+enum eDMAStart : int {
+	DMA_START_IMMEDIATE,
+	DMA_START_VBLANK,
+	DMA_START_HBLANK,
+	DMA_START_DISPLAY,			// ARM9 only : start of each displayed line
+	DMA_START_DISPLAY_FIFO,		// ARM9 only : main memory display FIFO
+	DMA_START_CARTRIDGE,
+	DMA_START_GBA_CARTRIDGE,	// ARM9 only
+	DMA_START_GXFIFO,			// ARM9 only
+	DMA_START_WIFI,				// ARM7 only
+	DMA_START_NONE,
+};
+
+enum eDMAAddrControl : uint32_t {
+	DMA_ADDR_INCREMENT = 0,
+	DMA_ADDR_DECREMENT = 1,
+	DMA_ADDR_FIXED = 2,
+	DMA_ADDR_INCREMENT_RELOAD = 3,	// Destination only
+};
+
+using DMAStreamSource = std::function<void(uint8_t* dst, uint32_t length)>;
+using DMAStreamSink = std::function<uint32_t(const uint8_t* src, uint32_t length)>;
+
+/// <summary>
+/// The four DMA channels of one CPU
+/// </summary>
+class DMA {
+private:
+	struct Channel {
+		uint8_t* cnt{ nullptr };	// DMAxCNT in I/O memory
+		eDMAStart start{ DMA_START_NONE };
+		uint32_t srcAddr{ 0 };
+		uint32_t dstAddr{ 0 };
+		uint32_t count{ 0 };
+		bool running{ false };
+	};
+
+	ARM_mem* memory{ nullptr };
+	Scheduler* scheduler{ nullptr };
+	InterruptController* irq{ nullptr };
+	bool arm9{ true };
+
+	Channel channels[4];
+
+	// Device data port that can provide a whole block in one call
+	uint32_t streamAddr{ 0 };
+	DMAStreamSource streamSource;
+
+	// Device data port that can take a whole block in one call
+	uint32_t sinkAddr{ 0 };
+	DMAStreamSink streamSink;
+
+	eDMAStart GetStartMode(int ch, uint32_t control) const;
+	uint32_t GetMaxCount(int ch) const;
+	uint32_t GetCount(int ch, uint32_t control) const;
+	void WriteControl(int ch);
+	void Run(int ch);
+	void EndTransfer(int ch, uint32_t control);
+	uint8_t* GetContiguousPointer(uint32_t address, uint32_t length);
+	bool BulkCopy(uint32_t dstAddr, uint32_t srcAddr, uint32_t length);
+
+public:
+	static const uint32_t DMA_BASE_ADDR = 0x040000B0;
+	static const uint32_t DMA_CHANNEL_SIZE = 12;
+
+	static const uint32_t CNT_WORD = 1 << 26;
+	static const uint32_t CNT_REPEAT = 1 << 25;
+	static const uint32_t CNT_IRQ = 1 << 30;
+	static const uint32_t CNT_ENABLE = 1u << 31;
+
+	// Bus cycles per transferred unit, in scheduler cycles
+	static const uint64_t UNIT_CYCLES = 4;
+	static const uint64_t SETUP_CYCLES = 8;
+
+	/// <summary>
+	/// Map the DMA registers into the CPU I/O table
+	/// </summary>
+	/// <param name="mem">Virtual memory of the CPU</param>
+	/// <param name="sched">Scheduler of the CPU, DMA cycles are charged to it</param>
+	/// <param name="irqCtrl">Interrupt controller of the CPU</param>
+	/// <param name="isARM9">true for the ARM9 DMA controller (different start modes and sizes)</param>
+	void Attach(ARM_mem& mem, Scheduler* sched, InterruptController* irqCtrl, bool isARM9);
+
+	/// <summary>
+	/// Start every enabled channel waiting for this start condition
+	/// </summary>
+	/// <param name="start">Start condition</param>
+	void Trigger(eDMAStart start);
+
+	/// <summary>
+	/// Register the data port of a device able to copy a whole block at once (cartridge)
+	/// </summary>
+	/// <param name="address">Address of the 32bit data port</param>
+	/// <param name="source">Function copying the next bytes of the device into dst</param>
+	void SetStreamSource(uint32_t address, DMAStreamSource source);
+
+	/// <summary>
+	/// Register the data port of a device able to take a whole block at once (geometry FIFO).
+	/// Word transfers to this fixed address call it once, instead of writing every unit. When the device does not
+	/// take everything, the channel sends the rest at its next start.
+	/// </summary>
+	/// <param name="address">Address of the 32bit data port</param>
+	/// <param name="sink">Function receiving the transferred bytes, returns the number of bytes taken</param>
+	void SetStreamSink(uint32_t address, DMAStreamSink sink);
+
+	/// <summary>
+	/// Device side start : the channel waiting for this start condition and reading the stream data port
+	/// transfers up to 'words' words, in a single copy when the destination is plain memory
+	/// </summary>
+	/// <param name="start">Start condition</param>
+	/// <param name="words">Number of words available on the data port</param>
+	/// <returns>Number of words transferred</returns>
+	uint32_t TriggerStream(eDMAStart start, uint32_t words);
+
+	/// <summary>
+	/// Returns true if an enabled channel waits for this start condition
+	/// </summary>
+	bool IsWaiting(eDMAStart start) const;
+};
@@ -0,0 +1,308 @@
+#include "framesink.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+static const size_t FRAME_PIXELS = static_cast<size_t>(FrameSink::WIDTH) * FrameSink::HEIGHT;
+
+FrameSink::FrameSink() {
+	for (int i = 0; i < BUFFER_COUNT; i++) freeBuffers.push_back(std::make_unique<uint32_t[]>(FRAME_PIXELS));
+	thread = std::thread(&FrameSink::Run, this);
+}
+
+FrameSink::~FrameSink() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	changed.notify_all();
+	thread.join();
+
+	if (hashLog != nullptr) fclose(hashLog);
+	if (stream != nullptr) fclose(stream);
+}
+
+void FrameSink::Attach(GPU& gpuScreens) {
+	gpu = &gpuScreens;
+	gpuScreens.AddFrameCallback([this](const uint32_t* top, const uint32_t* bottom) { OnFrame(top, bottom); });
+}
+
+bool FrameSink::EnableHashing(const std::string& logPath) {
+	FILE* log = nullptr;
+	if (!logPath.empty()) {
+		log = fopen(logPath.c_str(), "w");
+		if (log == nullptr) return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (log != nullptr) {
+		if (hashLog != nullptr) fclose(hashLog);
+		hashLog = log;
+	}
+	hashing = true;
+	return true;
+}
+
+void FrameSink::DumpFrame(uint64_t frame, const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	dumps[frame] = path;
+}
+
+bool FrameSink::OpenStream(const std::string& path) {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr) return false;
+
+	std::lock_guard<std::mutex> writeLock(streamMutex);
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stream != nullptr) fclose(stream);
+	stream = file;
+	return true;
+}
+
+void FrameSink::Flush() {
+	std::unique_lock<std::mutex> lock(mutex);
+	changed.wait(lock, [this]() { return jobs.empty() && (busyJobs == 0); });
+}
+
+std::vector<uint64_t> FrameSink::GetHashes() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return hashes;
+}
+
+void FrameSink::OnFrame(const uint32_t* top, const uint32_t* bottom) {
+	// Emulation thread : only the copy of the screens, once a buffer is free
+	Job job;
+	job.frame = gpu->GetFrameCount();
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		auto dump = dumps.find(job.frame);
+		if (dump != dumps.end()) {
+			job.dumpPath = dump->second;
+			dumps.erase(dump);
+		}
+		job.hash = hashing;
+		job.stream = stream != nullptr;
+		if (!job.hash && !job.stream && job.dumpPath.empty()) return;
+
+		changed.wait(lock, [this]() { return !freeBuffers.empty(); });
+		job.pixels = std::move(freeBuffers.back());
+		freeBuffers.pop_back();
+	}
+
+	const size_t screenPixels = static_cast<size_t>(GPU::SCREEN_WIDTH) * GPU::SCREEN_HEIGHT;
+	memcpy(job.pixels.get(), top, screenPixels * sizeof(uint32_t));
+	memcpy(job.pixels.get() + screenPixels, bottom, screenPixels * sizeof(uint32_t));
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+	changed.notify_all();
+}
+
+void FrameSink::Run() {
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this]() { return stop || !jobs.empty(); });
+			if (jobs.empty()) return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			busyJobs++;
+		}
+
+		Process(job);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			freeBuffers.push_back(std::move(job.pixels));
+			busyJobs--;
+		}
+		changed.notify_all();
+	}
+}
+
+void FrameSink::Process(const Job& job) {
+	const uint32_t* pixels = job.pixels.get();
+
+	if (job.hash) {
+		uint64_t hash = Hash(pixels);
+		std::lock_guard<std::mutex> lock(mutex);
+		hashes.push_back(hash);
+		if (hashLog != nullptr) {
+			fprintf(hashLog, "%llu %016llx\n", static_cast<unsigned long long>(job.frame), static_cast<unsigned long long>(hash));
+			fflush(hashLog);
+		}
+	}
+
+	const std::string extension = ".png";
+	bool png = (job.dumpPath.size() >= extension.size())
+		&& std::equal(extension.rbegin(), extension.rend(), job.dumpPath.rbegin(), [](char a, char b) { return a == tolower(b); });
+	if (png && !WritePNG(job.dumpPath, pixels)) {
+		fprintf(stderr, "Frame %llu : could not write %s\n", static_cast<unsigned long long>(job.frame), job.dumpPath.c_str());
+	}
+	if (!job.stream && (png || job.dumpPath.empty())) return;
+
+	std::vector<uint8_t> rgb(FRAME_PIXELS * 3);
+	for (size_t i = 0; i < FRAME_PIXELS; i++) {
+		rgb[i * 3] = static_cast<uint8_t>(pixels[i]);
+		rgb[i * 3 + 1] = static_cast<uint8_t>(pixels[i] >> 8);
+		rgb[i * 3 + 2] = static_cast<uint8_t>(pixels[i] >> 16);
+	}
+
+	if (!png && !job.dumpPath.empty()) {
+		FILE* file = fopen(job.dumpPath.c_str(), "wb");
+		bool written = (file != nullptr) && (fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size());
+		if ((file == nullptr) || (fclose(file) != 0) || !written) {
+			fprintf(stderr, "Frame %llu : could not write %s\n", static_cast<unsigned long long>(job.frame), job.dumpPath.c_str());
+		}
+	}
+
+	if (job.stream) {
+		// Writing to a pipe may block until it is read : the emulation thread can still hand off frames meanwhile
+		std::lock_guard<std::mutex> writeLock(streamMutex);
+		if (stream != nullptr) {
+			fwrite(rgb.data(), 1, rgb.size(), stream);
+			fflush(stream);
+		}
+	}
+}
+
+#pragma region XXH64
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+
+static uint64_t RotateLeft(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t Round(uint64_t acc, uint64_t input) {
+	return RotateLeft(acc + input * PRIME64_2, 31) * PRIME64_1;
+}
+
+static uint64_t MergeRound(uint64_t acc, uint64_t value) {
+	return (acc ^ Round(0, value)) * PRIME64_1 + PRIME64_4;
+}
+
+static uint64_t Read64(const uint8_t* ptr) {
+	uint64_t value;
+	memcpy(&value, ptr, 8);
+	return value;
+}
+
+uint64_t FrameSink::Hash(const uint32_t* pixels) {
+	// Four independent lanes over 32 byte stripes. A frame is a whole number of stripes.
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(pixels);
+	const size_t length = FRAME_PIXELS * sizeof(uint32_t);
+	uint64_t v1 = PRIME64_1 + PRIME64_2;
+	uint64_t v2 = PRIME64_2;
+	uint64_t v3 = 0;
+	uint64_t v4 = 0 - PRIME64_1;
+	for (size_t i = 0; i < length; i += 32) {
+		v1 = Round(v1, Read64(data + i));
+		v2 = Round(v2, Read64(data + i + 8));
+		v3 = Round(v3, Read64(data + i + 16));
+		v4 = Round(v4, Read64(data + i + 24));
+	}
+
+	uint64_t hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+	hash = MergeRound(hash, v1);
+	hash = MergeRound(hash, v2);
+	hash = MergeRound(hash, v3);
+	hash = MergeRound(hash, v4);
+	hash += length;
+
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+#pragma endregion
+
+#pragma region PNG
+struct CRC32Table {
+	uint32_t values[256];
+
+	CRC32Table() {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++) crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+			values[i] = crc;
+		}
+	}
+};
+
+static const CRC32Table crcTable;
+
+static void AppendBE32(std::vector<uint8_t>& out, uint32_t value) {
+	for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(value >> shift));
+}
+
+static void AppendChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+	AppendBE32(out, static_cast<uint32_t>(data.size()));
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = start; i < out.size(); i++) crc = (crc >> 8) ^ crcTable.values[(crc ^ out[i]) & 0xFF];
+	AppendBE32(out, crc ^ 0xFFFFFFFF);
+}
+
+bool FrameSink::WritePNG(const std::string& path, const uint32_t* pixels) {
+	// Rows of RGB bytes, each after its filter type (0 : none)
+	const size_t rowSize = WIDTH * 3 + 1;
+	std::vector<uint8_t> raw(rowSize * HEIGHT);
+	for (int y = 0; y < HEIGHT; y++) {
+		uint8_t* row = raw.data() + y * rowSize;
+		row[0] = 0;
+		for (int x = 0; x < WIDTH; x++) {
+			uint32_t pixel = pixels[y * WIDTH + x];
+			row[1 + x * 3] = static_cast<uint8_t>(pixel);
+			row[2 + x * 3] = static_cast<uint8_t>(pixel >> 8);
+			row[3 + x * 3] = static_cast<uint8_t>(pixel >> 16);
+		}
+	}
+
+	// zlib stream of stored deflate blocks : frames are compared by hash, the files only need to open anywhere
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	uint32_t adlerA = 1;
+	uint32_t adlerB = 0;
+	for (size_t offset = 0; offset < raw.size(); offset += 0xFFFF) {
+		uint16_t blockSize = static_cast<uint16_t>(std::min<size_t>(0xFFFF, raw.size() - offset));
+		bool last = offset + blockSize == raw.size();
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back(static_cast<uint8_t>(blockSize));
+		zlib.push_back(static_cast<uint8_t>(blockSize >> 8));
+		uint16_t complement = static_cast<uint16_t>(~blockSize);
+		zlib.push_back(static_cast<uint8_t>(complement));
+		zlib.push_back(static_cast<uint8_t>(complement >> 8));
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+		for (size_t i = offset; i < offset + blockSize; i++) {
+			adlerA = (adlerA + raw[i]) % 65521;
+			adlerB = (adlerB + adlerA) % 65521;
+		}
+	}
+	AppendBE32(zlib, (adlerB << 16) | adlerA);
+
+	std::vector<uint8_t> header;
+	AppendBE32(header, WIDTH);
+	AppendBE32(header, HEIGHT);
+	header.insert(header.end(), { 8, 2, 0, 0, 0 });	// 8 bits per channel, RGB, deflate, adaptive filters, not interlaced
+
+	std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	AppendChunk(png, "IHDR", header);
+	AppendChunk(png, "IDAT", zlib);
+	AppendChunk(png, "IEND", {});
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr) return false;
+	bool written = fwrite(png.data(), 1, png.size(), file) == png.size();
+	return (fclose(file) == 0) && written;
+}
+#pragma endregion
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gpu.h"
+
+/// <summary>
+/// Headless output of the screens, for regression testing : a hash of every frame, frames dumped as PNG or raw RGB
+/// files, and raw frames streamed to a file or pipe. The emulation thread only copies the screens into a free buffer,
+/// hashing and encoding are done on the sink thread. A frame is both screens, the top one above the bottom one.
+/// </summary>
+class FrameSink {
+private:
+	static const int BUFFER_COUNT = 8;	// Frames handed off and not processed yet, the emulation waits above that
+
+	struct Job {
+		uint64_t frame;
+		bool hash;
+		bool stream;
+		std::string dumpPath;
+		std::unique_ptr<uint32_t[]> pixels;
+	};
+
+	const GPU* gpu{ nullptr };
+
+	// Requested output, set from any thread
+	bool hashing{ false };
+	FILE* hashLog{ nullptr };
+	FILE* stream{ nullptr };
+	std::map<uint64_t, std::string> dumps;
+
+	std::vector<std::unique_ptr<uint32_t[]>> freeBuffers;
+	std::deque<Job> jobs;
+	int busyJobs{ 0 };
+	std::vector<uint64_t> hashes;
+	bool stop{ false };
+	std::mutex mutex;
+	std::mutex streamMutex;		// Held while writing to the stream, which is only replaced under both locks
+	std::condition_variable changed;
+	std::thread thread;
+
+	void OnFrame(const uint32_t* top, const uint32_t* bottom);
+	void Run();
+	void Process(const Job& job);
+
+public:
+	static const int WIDTH = GPU::SCREEN_WIDTH;
+	static const int HEIGHT = GPU::SCREEN_HEIGHT * 2;
+
+	FrameSink();
+	~FrameSink();
+
+	/// <summary>
+	/// Receive the frames completed by the GPU
+	/// </summary>
+	void Attach(GPU& gpuScreens);
+
+	/// <summary>
+	/// Hash every frame from now on
+	/// </summary>
+	/// <param name="logPath">File where "frame hash" lines are written, none if empty</param>
+	/// <returns>false if the log file could not be created</returns>
+	bool EnableHashing(const std::string& logPath = "");
+
+	/// <summary>
+	/// Write a frame to a file once it is complete
+	/// </summary>
+	/// <param name="frame">Frame number, as counted by GPU::GetFrameCount (the first frame is 1)</param>
+	/// <param name="path">Output file : PNG if it ends with ".png", raw RGB (8 bits per channel) otherwise</param>
+	void DumpFrame(uint64_t frame, const std::string& path);
+
+	/// <summary>
+	/// Write every frame from now on as raw RGB, 8 bits per channel, 256x384
+	/// </summary>
+	/// <param name="path">File or named pipe</param>
+	/// <returns>false if it could not be opened</returns>
+	bool OpenStream(const std::string& path);
+
+	/// <summary>
+	/// Wait until every frame handed off so far has been processed
+	/// </summary>
+	void Flush();
+
+	/// <summary>
+	/// Get the hashes of the processed frames, since hashing was enabled
+	/// </summary>
+	std::vector<uint64_t> GetHashes();
+
+	/// <summary>
+	/// XXH64 (seed 0) of both screens, RGBA8888 as stored in memory, the top screen first
+	/// </summary>
+	static uint64_t Hash(const uint32_t* pixels);
+
+	/// <summary>
+	/// Write a frame as a PNG file, uncompressed (stored deflate blocks)
+	/// </summary>
+	/// <param name="pixels">256x384 RGBA8888 pixels</param>
+	/// <returns>false if the file could not be written</returns>
+	static bool WritePNG(const std::string& path, const uint32_t* pixels);
+};
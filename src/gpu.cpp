@@ -0,0 +1,126 @@
+#include "gpu.h"
+#include <algorithm>
+
+void GPU::Attach(ARM9_mem& mem, VRAM& vramBanks, LCD& lcd, const GeometryEngine& geometry) {
+	engineA.Attach(mem, vramBanks, tileCache, false);
+	engineB.Attach(mem, vramBanks, tileCache, true);
+	renderer3D.Attach(mem, vramBanks, geometry);
+	engineA.Set3DRenderer(&renderer3D);
+	memory = &mem;
+	vram = &vramBanks;
+	powcnt = mem.GetPointerFromAddr(POWCNT1_ADDR);
+
+	for (int i = 0; i < 2; i++) {
+		screens[i] = std::make_unique<uint32_t[]>(SCREEN_WIDTH * SCREEN_HEIGHT);
+		std::fill(screens[i].get(), screens[i].get() + SCREEN_WIDTH * SCREEN_HEIGHT, 0xFF000000);
+	}
+
+	// Writes to palettes, OAM and VRAM banks are carried to the render thread copy, or seen by the renderer right away
+	auto written = [this](uint32_t address, uint32_t length) {
+		if (renderThread) renderThread->MarkWritten(address, length);
+		else VideoMemoryChanged(address, length);
+	};
+	mem.AddWriteWatch(ARM9_mem::PALETTES_ADDR, static_cast<uint32_t>(ARM9_mem::PALETTES_SIZE), written);
+	mem.AddWriteWatch(ARM9_mem::OAMA_ADDR, static_cast<uint32_t>(ARM9_mem::OAM_SIZE * 2), written);
+	vramBanks.AddWriteWatch([this](uint32_t offset, uint32_t length) {
+		if (renderThread) renderThread->MarkWritten(ARM9_mem::VRAMLCDC_ADDR + offset, length);
+		else VideoMemoryChanged(ARM9_mem::VRAMLCDC_ADDR + offset, length);
+	});
+
+	lcd.AddCallback(LCD_CALLBACK_HBLANK, [this](uint16_t line) {
+		if (line >= LCD::VISIBLE_LINES) return;
+		GPULineJob job;
+		PrepareLine(line, job);
+		if (renderThread) renderThread->Queue(job);
+		else RenderLine(job);
+	});
+	lcd.AddCallback(LCD_CALLBACK_VBLANK, [this](uint16_t line) { EndFrame(); });
+	lcd.AddCallback(LCD_CALLBACK_LINE_START, [this](uint16_t line) {
+		if (line == RENDER_3D_LINE) Render3D();
+	});
+}
+
+void GPU::AddFrameCallback(std::function<void(const uint32_t* top, const uint32_t* bottom)> callback) {
+	frameCallbacks.push_back(callback);
+}
+
+void GPU::SetThreaded(bool threaded) {
+	if (threaded == IsThreaded()) return;
+
+	if (threaded) {
+		tileCache.Clear();
+		renderThread = std::make_unique<GPURenderThread>(*memory, *vram, [this](const GPULineJob& job) { RenderLine(job); },
+			[this](uint32_t address, uint32_t length) { VideoMemoryChanged(address, length); });
+		MapMemory([this](uint32_t address) { return renderThread->GetPointer(address); }, renderThread->GetPointer(ARM9_mem::VRAMLCDC_ADDR));
+	}
+	else {
+		// The render thread copy may lag behind the live memory
+		renderThread.reset();
+		tileCache.Clear();
+		MapMemory([this](uint32_t address) -> const uint8_t* { return memory->GetPointerFromAddr(address); }, vram->GetBanks());
+	}
+}
+
+void GPU::VideoMemoryChanged(uint32_t address, uint32_t length) {
+	// Render side : the memory the engines read has changed
+	if (address >= ARM9_mem::VRAMLCDC_ADDR) tileCache.VRAMWritten(address - ARM9_mem::VRAMLCDC_ADDR, length);
+	else if (address - ARM9_mem::PALETTES_ADDR < ARM9_mem::PALETTES_SIZE) tileCache.PaletteWritten(address - ARM9_mem::PALETTES_ADDR, length);
+}
+
+void GPU::MapMemory(const std::function<const uint8_t*(uint32_t address)>& translate, const uint8_t* banks) {
+	const uint8_t* palettes = translate(ARM9_mem::PALETTES_ADDR);
+	const uint8_t* oamA = translate(ARM9_mem::OAMA_ADDR);
+	const uint8_t* oamB = translate(ARM9_mem::OAMB_ADDR);
+	engineA.MapMemory(palettes, oamA, oamB, banks);
+	engineB.MapMemory(palettes, oamA, oamB, banks);
+}
+
+void GPU::PrepareLine(uint16_t line, GPULineJob& job) {
+	uint16_t power = ARM_mem::GetHalfWordAtPointer(powcnt);
+	job.line = line;
+	job.screen[0] = ((power & POWCNT1_SWAP) != 0) ? 0 : 1;
+	job.screen[1] = 1 - job.screen[0];
+	for (int i = 0; i < 2; i++) job.output[i] = screens[job.screen[i]].get() + line * SCREEN_WIDTH;
+	job.enabled[0] = (power & POWCNT1_ENGINE_A) != 0;
+	job.enabled[1] = (power & POWCNT1_ENGINE_B) != 0;
+
+	if (job.enabled[0]) engineA.CaptureLine(line, job.state[0]);
+	if (job.enabled[1]) engineB.CaptureLine(line, job.state[1]);
+}
+
+void GPU::RenderLine(const GPULineJob& job) {
+	GPU2D* engines[2] = { &engineA, &engineB };
+	for (int i = 0; i < 2; i++) {
+		// Engines may keep unchanged lines from the previous frame : only if nothing else wrote them since
+		const GPU2D*& writer = lineWriters[job.screen[i]][job.line];
+		if (writer != engines[i]) engines[i]->InvalidateOutputLine(job.line);
+
+		// A disabled engine outputs black
+		if (job.enabled[i]) {
+			engines[i]->RenderLine(job.state[i], job.output[i]);
+			writer = engines[i];
+		}
+		else {
+			std::fill(job.output[i], job.output[i] + SCREEN_WIDTH, 0xFF000000);
+			writer = nullptr;
+		}
+	}
+}
+
+void GPU::EndFrame() {
+	if (renderThread) renderThread->Wait();
+
+	frameCount++;
+	for (auto& callback : frameCallbacks) callback(screens[0].get(), screens[1].get());
+
+	engineA.StartFrame();
+	engineB.StartFrame();
+}
+
+void GPU::Render3D() {
+	// No line is rendered during VBlank : the render thread is idle, and the emulation thread owns the 3D frame
+	uint16_t power = ARM_mem::GetHalfWordAtPointer(powcnt);
+	uint32_t dispcnt = ARM_mem::GetWordAtPointer(memory->GetPointerFromAddr(GPU2D::ENGINE_A_IO_ADDR));
+	if (((power & POWCNT1_RENDERING_3D) == 0) || ((dispcnt & 0x8) == 0)) return;
+	renderer3D.Render();
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "arm9_mem.h"
+#include "lcd.h"
+#include "gpu2d.h"
+#include "gpu3d_renderer.h"
+#include "gpu_thread.h"
+
+/// <summary>
+/// Both 2D engines, the 3D rendering engine and the two screens. Lines are latched at HBlank and rendered then, or on
+/// the render thread. Frames are complete at VBlank. The 3D frame shown by the next one is rendered during VBlank.
+/// </summary>
+class GPU {
+private:
+	GPU2D engineA;
+	GPU2D engineB;
+	GPU2DTileCache tileCache;
+	GPU3DRenderer renderer3D;
+	ARM9_mem* memory{ nullptr };
+	VRAM* vram{ nullptr };
+	uint8_t* powcnt{ nullptr };
+	std::unique_ptr<GPURenderThread> renderThread;
+	std::unique_ptr<uint32_t[]> screens[2];
+	const GPU2D* lineWriters[2][LCD::VISIBLE_LINES]{};	// Render side : engine that last wrote each screen line
+	uint64_t frameCount{ 0 };
+
+	std::vector<std::function<void(const uint32_t* top, const uint32_t* bottom)>> frameCallbacks;
+
+	void VideoMemoryChanged(uint32_t address, uint32_t length);
+	void MapMemory(const std::function<const uint8_t*(uint32_t address)>& translate, const uint8_t* banks);
+	void PrepareLine(uint16_t line, GPULineJob& job);
+	void RenderLine(const GPULineJob& job);
+	void EndFrame();
+	void Render3D();
+
+public:
+	static const int SCREEN_WIDTH = 256;
+	static const int SCREEN_HEIGHT = 192;
+
+	static const uint32_t POWCNT1_ADDR = 0x04000304;
+	static const uint16_t POWCNT1_ENGINE_A = 1 << 1;
+	static const uint16_t POWCNT1_RENDERING_3D = 1 << 3;
+	static const uint16_t POWCNT1_ENGINE_B = 1 << 9;
+	static const uint16_t POWCNT1_SWAP = 1 << 15;	// Set : engine A on the top screen
+
+	// 3D frames are rendered 48 lines before the first visible line, once the VBlank handlers have run
+	static const uint16_t RENDER_3D_LINE = LCD::TOTAL_LINES - 48;
+
+	/// <summary>
+	/// Bind both engines to ARM9 memory and render along the ARM9 display timing
+	/// </summary>
+	/// <param name="mem">ARM9 memory</param>
+	/// <param name="vramBanks">VRAM bank controller</param>
+	/// <param name="lcd">ARM9 display timing</param>
+	/// <param name="geometry">Geometry engine, whose lists are rendered as BG0 of engine A</param>
+	void Attach(ARM9_mem& mem, VRAM& vramBanks, LCD& lcd, const GeometryEngine& geometry);
+
+	/// <summary>
+	/// Render on a separate thread, or at HBlank on the emulation thread. The output is the same.
+	/// </summary>
+	/// <param name="threaded">true to render on a separate thread</param>
+	void SetThreaded(bool threaded);
+
+	bool IsThreaded() const {
+		return renderThread != nullptr;
+	}
+
+	/// <summary>
+	/// Register a function called with both screens once a frame is complete
+	/// </summary>
+	/// <param name="callback">Function receiving the top and bottom screens (256x192 RGBA8888 each)</param>
+	void AddFrameCallback(std::function<void(const uint32_t* top, const uint32_t* bottom)> callback);
+
+	/// <summary>
+	/// Get a screen, as last rendered (complete from VBlank to the first HBlank)
+	/// </summary>
+	/// <param name="screen">0 for the top screen, 1 for the bottom one</param>
+	/// <returns>256x192 RGBA8888 pixels</returns>
+	const uint32_t* GetScreen(int screen) const {
+		return screens[screen].get();
+	}
+
+	GPU2D& GetEngineA() {
+		return engineA;
+	}
+
+	GPU2D& GetEngineB() {
+		return engineB;
+	}
+
+	GPU3DRenderer& GetRenderer3D() {
+		return renderer3D;
+	}
+
+	uint64_t GetFrameCount() const {
+		return frameCount;
+	}
+};
@@ -0,0 +1,635 @@
+#include "gpu2d.h"
+#include <algorithm>
+#include <cstring>
+
+// Unmapped VRAM pages read as 0
+static const uint8_t zeroPage[0x4000 + 4] = {};
+
+// OBJ sizes in pixels, by shape (square, horizontal, vertical) and size
+static const uint8_t OBJ_WIDTH[3][4] = { { 8, 16, 32, 64 }, { 16, 32, 32, 64 }, { 8, 8, 16, 32 } };
+static const uint8_t OBJ_HEIGHT[3][4] = { { 8, 16, 32, 64 }, { 8, 8, 16, 32 }, { 16, 32, 32, 64 } };
+
+void GPU2D::Attach(ARM9_mem& mem, VRAM& vramBanks, GPU2DTileCache& cache, bool isEngineB) {
+	engineB = isEngineB;
+	tileCache = &cache;
+	io = mem.GetPointerFromAddr(engineB ? ENGINE_B_IO_ADDR : ENGINE_A_IO_ADDR);
+	vram = &vramBanks;
+	kernels = &GetGPU2DKernels();
+	MapMemory(mem.GetPointerFromAddr(ARM9_mem::PALETTES_ADDR), mem.GetPointerFromAddr(ARM9_mem::OAMA_ADDR), mem.GetPointerFromAddr(ARM9_mem::OAMB_ADDR), vramBanks.GetBanks());
+
+	// Only engine A displays VRAM
+	std::fill(std::begin(lcdcWritten), std::end(lcdcWritten), ~0ULL);
+	for (auto& line : lcdcOutput) line.valid = false;
+	if (!engineB) {
+		vramBanks.AddWriteWatch([this](uint32_t offset, uint32_t length) {
+			if (offset >= VRAM::BANKS_SIZE) return;
+			uint32_t end = std::min<uint32_t>(offset + length, VRAM::BANKS_SIZE);
+			for (uint32_t line = offset / (GPU2D_LINE_WIDTH * 2); line <= (end - 1) / (GPU2D_LINE_WIDTH * 2); line++) lcdcWritten[line / 64] |= 1ULL << (line % 64);
+		});
+	}
+
+	// Writing a reference point reloads the internal one, even mid-frame
+	uint32_t base = engineB ? ENGINE_B_IO_ADDR : ENGINE_A_IO_ADDR;
+	for (int bg = 0; bg < 2; bg++) {
+		auto reload = [this, bg](uint32_t value, uint32_t mask) { pendingAffineReload |= 1 << bg; };
+		mem.SetIOWriteHandler(base + BGAFFINE + bg * 0x10 + 0x8, reload);
+		mem.SetIOWriteHandler(base + BGAFFINE + bg * 0x10 + 0xC, reload);
+	}
+}
+
+void GPU2D::MapMemory(const uint8_t* palettes, const uint8_t* oamA, const uint8_t* oamB, const uint8_t* vramBanks) {
+	palette = palettes + (engineB ? 0x400 : 0);
+	oam = engineB ? oamB : oamA;
+	banks = vramBanks;
+}
+
+const uint8_t* GPU2D::GetPage(uint32_t offset) const {
+	return (offset != VRAM::UNMAPPED) ? banks + offset : nullptr;
+}
+
+void GPU2D::ResolveVRAM(const GPU2DVRAMMap& map) {
+	for (int i = 0; i < BG_PAGES; i++) {
+		const uint8_t* page = GetPage(map.bg[i]);
+		bgPages[i] = (page != nullptr) ? page : zeroPage;
+	}
+	for (int i = 0; i < OBJ_PAGES; i++) {
+		const uint8_t* page = GetPage(map.obj[i]);
+		objPages[i] = (page != nullptr) ? page : zeroPage;
+	}
+	for (int i = 0; i < EXT_PALETTE_SLOTS; i++) bgExtPalettes[i] = GetPage(map.bgExtPalettes[i]);
+	objExtPalette = GetPage(map.objExtPalette);
+}
+
+void GPU2D::StartFrame() {
+	pendingAffineReload = 0x3;
+}
+
+void GPU2D::CaptureLine(uint16_t line, GPU2DLineState& state) {
+	memcpy(state.registers, io, GPU2DLineState::REGISTERS_SIZE);
+	state.line = line;
+	state.affineReload = pendingAffineReload;
+	pendingAffineReload = 0;
+
+	// Engine B sees 128KB of BG and OBJ VRAM, mirrored
+	const uint32_t* bg = vram->GetView(engineB ? VRAM_VIEW_BBG : VRAM_VIEW_ABG);
+	const uint32_t* obj = vram->GetView(engineB ? VRAM_VIEW_BOBJ : VRAM_VIEW_AOBJ);
+	int bgPageCount = VRAM::GetViewPages(engineB ? VRAM_VIEW_BBG : VRAM_VIEW_ABG);
+	int objPageCount = VRAM::GetViewPages(engineB ? VRAM_VIEW_BOBJ : VRAM_VIEW_AOBJ);
+	for (int i = 0; i < BG_PAGES; i++) state.vram.bg[i] = bg[i % bgPageCount];
+	for (int i = 0; i < OBJ_PAGES; i++) state.vram.obj[i] = obj[i % objPageCount];
+
+	// Extended palettes : 8KB slots in 16KB pages
+	const uint32_t* bgExt = vram->GetView(engineB ? VRAM_VIEW_BBG_EXTPAL : VRAM_VIEW_ABG_EXTPAL);
+	for (int slot = 0; slot < EXT_PALETTE_SLOTS; slot++) {
+		uint32_t page = bgExt[slot / 2];
+		state.vram.bgExtPalettes[slot] = (page != VRAM::UNMAPPED) ? page + (slot % 2) * 0x2000 : VRAM::UNMAPPED;
+	}
+	state.vram.objExtPalette = vram->GetView(engineB ? VRAM_VIEW_BOBJ_EXTPAL : VRAM_VIEW_AOBJ_EXTPAL)[0];
+
+	state.lcdcLineWritten = true;
+	uint32_t dispcnt = state.Get32(DISPCNT);
+	if (!engineB && (((dispcnt >> 16) & 0x3) == 2)) {
+		uint32_t lcdcLine = ((dispcnt >> 18) & 0x3) * 256 + line;
+		state.lcdcLineWritten = ((lcdcWritten[lcdcLine / 64] >> (lcdcLine % 64)) & 1) != 0;
+		lcdcWritten[lcdcLine / 64] &= ~(1ULL << (lcdcLine % 64));
+	}
+}
+
+GPU2D::eBGType GPU2D::GetBGType(const GPU2DLineState& state, int bg) const {
+	static const eBGType BG_TYPES[8][4] = {
+		{ BG_TEXT, BG_TEXT, BG_TEXT, BG_TEXT },
+		{ BG_TEXT, BG_TEXT, BG_TEXT, BG_AFFINE },
+		{ BG_TEXT, BG_TEXT, BG_AFFINE, BG_AFFINE },
+		{ BG_TEXT, BG_TEXT, BG_TEXT, BG_EXTENDED },
+		{ BG_TEXT, BG_TEXT, BG_AFFINE, BG_EXTENDED },
+		{ BG_TEXT, BG_TEXT, BG_EXTENDED, BG_EXTENDED },
+		{ BG_TEXT, BG_NONE, BG_LARGE, BG_NONE },
+		{ BG_NONE, BG_NONE, BG_NONE, BG_NONE },
+	};
+
+	uint32_t dispcnt = state.Get32(DISPCNT);
+	if ((bg == 0) && !engineB && ((dispcnt & 0x8) != 0)) return BG_3D;
+	if (engineB && ((dispcnt & 0x7) == 6)) return BG_NONE;
+	return BG_TYPES[dispcnt & 0x7][bg];
+}
+
+void GPU2D::RenderLine(const GPU2DLineState& state, uint32_t* output) {
+	uint32_t dispcnt = state.Get32(DISPCNT);
+	uint16_t masterBright = state.Get16(MASTER_BRIGHT);
+	int brightnessMode = masterBright >> 14;
+	int brightnessFactor = std::min(masterBright & 0x1F, 16);
+
+	for (int bg = 0; bg < 2; bg++) {
+		if ((state.affineReload & (1 << bg)) != 0) {
+			// 28bit signed values
+			affineX[bg] = static_cast<int32_t>(state.Get32(BGAFFINE + bg * 0x10 + 0x8) << 4) >> 4;
+			affineY[bg] = static_cast<int32_t>(state.Get32(BGAFFINE + bg * 0x10 + 0xC) << 4) >> 4;
+		}
+	}
+
+	// Display mode : 0 = off (white), 1 = graphics, 2 = VRAM (engine A), 3 = main memory FIFO (not supported, black)
+	uint32_t displayMode = (dispcnt >> 16) & (engineB ? 0x1 : 0x3);
+	bool outputKept = false;
+	switch (displayMode) {
+	case 0:
+		std::fill(output, output + GPU2D_LINE_WIDTH, 0xFFFFFFFF);
+		break;
+
+	case 1:
+		if ((dispcnt & 0x80) != 0) {
+			// Forced blank
+			std::fill(output, output + GPU2D_LINE_WIDTH, 0xFFFFFFFF);
+			break;
+		}
+		RenderGraphics(state, blended);
+		kernels->convert(blended, output, GPU2D_LINE_WIDTH, brightnessMode, brightnessFactor);
+		break;
+
+	case 2: {
+		// LCDC bank A to D, selected by DISPCNT bits 18-19. Lines that have not changed since the last frame are kept.
+		uint32_t lcdcLine = ((dispcnt >> 18) & 0x3) * 256 + state.line;
+		LCDCOutputLine& previous = lcdcOutput[state.line];
+		outputKept = true;
+		if (!state.lcdcLineWritten && previous.valid && (previous.output == output) && (previous.lcdcLine == lcdcLine) && (previous.masterBright == masterBright)) break;
+
+		// VRAM holds little endian BGR555 pixels, as does the host : convert in place
+		const uint16_t* pixels = reinterpret_cast<const uint16_t*>(banks + lcdcLine * GPU2D_LINE_WIDTH * 2);
+		kernels->convert(pixels, output, GPU2D_LINE_WIDTH, brightnessMode, brightnessFactor);
+		previous = { output, lcdcLine, masterBright, true };
+		break;
+	}
+
+	default:
+		std::fill(output, output + GPU2D_LINE_WIDTH, 0xFF000000);
+		break;
+	}
+	if (!outputKept && (state.line < VISIBLE_LINES)) lcdcOutput[state.line].valid = false;
+
+	AdvanceAffine(state);
+}
+
+void GPU2D::AdvanceAffine(const GPU2DLineState& state) {
+	// Reference points move by PB / PD every line, whatever the BG mode
+	for (int bg = 0; bg < 2; bg++) {
+		affineX[bg] += static_cast<int16_t>(state.Get16(BGAFFINE + bg * 0x10 + 0x2));
+		affineY[bg] += static_cast<int16_t>(state.Get16(BGAFFINE + bg * 0x10 + 0x6));
+	}
+}
+
+void GPU2D::RenderGraphics(const GPU2DLineState& state, uint16_t* output) {
+	uint32_t dispcnt = state.Get32(DISPCNT);
+	ResolveVRAM(state.vram);
+	memcpy(paletteCopy, palette, 0x400);
+
+	// Backdrop : BG palette entry 0, always behind everything
+	uint16_t backdrop = paletteCopy[0] | GPU2D_OPAQUE;
+	std::fill(stack.topColor, stack.topColor + GPU2D_LINE_WIDTH, backdrop);
+	std::fill(stack.topKey, stack.topKey + GPU2D_LINE_WIDTH, 0x7FFF);
+	std::fill(stack.topLayer, stack.topLayer + GPU2D_LINE_WIDTH, GPU2D_LAYER_BACKDROP);
+	std::fill(stack.secondColor, stack.secondColor + GPU2D_LINE_WIDTH, backdrop);
+	std::fill(stack.secondKey, stack.secondKey + GPU2D_LINE_WIDTH, 0x7FFF);
+	std::fill(stack.secondLayer, stack.secondLayer + GPU2D_LINE_WIDTH, GPU2D_LAYER_BACKDROP);
+
+	// The OBJ window is needed before any layer
+	bool objEnabled = (dispcnt & (1 << 12)) != 0;
+	if (objEnabled) RenderOBJ(state);
+	else memset(objWindow, 0, sizeof(objWindow));
+	BuildWindow(state);
+
+	for (int bg = 0; bg < 4; bg++) {
+		if ((dispcnt & (1 << (8 + bg))) == 0) continue;
+
+		eBGType type = GetBGType(state, bg);
+		switch (type) {
+		case BG_TEXT:
+			RenderTextBG(state, bg);
+			break;
+		case BG_AFFINE:
+		case BG_EXTENDED:
+		case BG_LARGE:
+			RenderAffineBG(state, bg, type);
+			break;
+		case BG_3D:
+			if (renderer3D == nullptr) continue;
+			Render3DBG(state);
+			break;
+		default:
+			continue;
+		}
+
+		// Same priority : lower BG number in front, OBJs in front of all BGs
+		uint16_t key = static_cast<uint16_t>((state.Get16(BGCNT + bg * 2) & 0x3) * 8 + 1 + bg);
+		kernels->insertLayer(stack, colors, nullptr, key, static_cast<uint16_t>(1 << bg), (type == BG_3D) ? flags3D : nullptr, window);
+	}
+
+	if (objEnabled) kernels->insertLayer(stack, objColor, objKey, 0, GPU2D_LAYER_OBJ, objFlags, window);
+
+	// Translucent 3D pixels in front are blended with their own alpha, as semi-transparent OBJs are
+	if ((GetBGType(state, 0) == BG_3D) && ((dispcnt & (1 << 8)) != 0) && (renderer3D != nullptr)) {
+		const uint16_t blend3D = GPU2D_LAYER_BG0 | GPU2D_LAYER_OBJ_BLEND;
+		for (int x = 0; x < GPU2D_LINE_WIDTH; x++) {
+			if (stack.topLayer[x] != blend3D) continue;
+			objEva[x] = eva3D[x];
+			objEvb[x] = 16 - eva3D[x];
+		}
+	}
+
+	uint16_t bldcnt = state.Get16(BLDCNT);
+	uint16_t bldalpha = state.Get16(BLDALPHA);
+	GPU2DBlendParams params;
+	params.effect = (bldcnt >> 6) & 0x3;
+	params.firstTargets = bldcnt & 0x3F;
+	params.secondTargets = (bldcnt >> 8) & 0x3F;
+	params.eva = std::min(bldalpha & 0x1F, 16);
+	params.evb = std::min((bldalpha >> 8) & 0x1F, 16);
+	params.evy = std::min(state.Get16(BLDY) & 0x1F, 16);
+	kernels->blend(stack, window, objEva, objEvb, params, output);
+}
+
+void GPU2D::Render3DBG(const GPU2DLineState& state) {
+	// BG0 HOFS scrolls the 3D frame, pixels scrolled in from outside are transparent
+	const uint32_t* pixels = renderer3D->GetLine(state.line);
+	uint32_t hofs = state.Get16(BGOFS) & 0x1FF;
+	for (int x = 0; x < GPU2D_LINE_WIDTH; x++) {
+		uint32_t sx = (x + hofs) & 0x1FF;
+		uint32_t pixel = (sx < GPU2D_LINE_WIDTH) ? pixels[sx] : 0;
+		uint32_t alpha = (pixel >> 16) & 0x1F;
+		colors[x] = (alpha != 0) ? static_cast<uint16_t>((pixel & 0x7FFF) | GPU2D_OPAQUE) : 0;
+
+		// 3D alpha is 5 bits, blending coefficients are 1/16th
+		flags3D[x] = ((alpha != 0) && (alpha != 31)) ? GPU2D_LAYER_OBJ_BLEND : 0;
+		eva3D[x] = static_cast<uint16_t>((alpha + 1) >> 1);
+	}
+}
+
+void GPU2D::BuildWindow(const GPU2DLineState& state) {
+	uint32_t dispcnt = state.Get32(DISPCNT);
+	uint16_t winin = state.Get16(WININ);
+	uint16_t winout = state.Get16(WINOUT);
+
+	// No window : everything visible, effects enabled
+	if ((dispcnt & 0xE000) == 0) {
+		std::fill(window, window + GPU2D_LINE_WIDTH, 0x3F);
+		return;
+	}
+
+	std::fill(window, window + GPU2D_LINE_WIDTH, winout & 0x3F);
+
+	if ((dispcnt & (1 << 15)) != 0) {
+		uint16_t objWin = (winout >> 8) & 0x3F;
+		for (int x = 0; x < GPU2D_LINE_WIDTH; x++) {
+			if (objWindow[x] != 0) window[x] = objWin;
+		}
+	}
+
+	// Window 1 first, window 0 has priority over it
+	for (int win = 1; win >= 0; win--) {
+		if ((dispcnt & (1 << (13 + win))) == 0) continue;
+
+		uint16_t h = state.Get16(win ? WIN1H : WIN0H);
+		uint16_t v = state.Get16(win ? WIN1V : WIN0V);
+		int x1 = h >> 8, x2 = h & 0xFF;
+		int y1 = v >> 8, y2 = v & 0xFF;
+		int y = state.line;
+
+		// Ranges with the start after the end wrap around
+		bool inside = (y1 <= y2) ? ((y >= y1) && (y < y2)) : ((y >= y1) || (y < y2));
+		if (!inside) continue;
+
+		uint16_t value = (winin >> (win * 8)) & 0x3F;
+		if (x1 <= x2) {
+			std::fill(window + x1, window + x2, value);
+		}
+		else {
+			std::fill(window, window + x2, value);
+			std::fill(window + x1, window + GPU2D_LINE_WIDTH, value);
+		}
+	}
+}
+
+void GPU2D::RenderTextBG(const GPU2DLineState& state, int bg) {
+	uint32_t dispcnt = state.Get32(DISPCNT);
+	uint16_t bgcnt = state.Get16(BGCNT + bg * 2);
+	uint32_t hofs = state.Get16(BGOFS + bg * 4) & 0x1FF;
+	uint32_t vofs = state.Get16(BGOFS + bg * 4 + 2) & 0x1FF;
+
+	uint32_t width = ((bgcnt & 0x4000) != 0) ? 512 : 256;
+	uint32_t height = ((bgcnt & 0x8000) != 0) ? 512 : 256;
+	uint32_t y = (state.line + vofs) & (height - 1);
+
+	// Engine A adds 64KB steps from DISPCNT to the map and tile bases
+	uint32_t screenBase = ((bgcnt >> 8) & 0x1F) * 0x800;
+	uint32_t charBase = ((bgcnt >> 2) & 0xF) * 0x4000;
+	if (!engineB) {
+		screenBase += ((dispcnt >> 27) & 0x7) * 0x10000;
+		charBase += ((dispcnt >> 24) & 0x7) * 0x10000;
+	}
+
+	// Map blocks are 32x32 entries : the bottom half of a 512 pixels high map starts after one (or two) blocks
+	uint32_t rowBase = screenBase + ((y >> 3) & 0x1F) * 64;
+	if (y >= 256) rowBase += (width == 512) ? 0x1000 : 0x800;
+
+	bool bpp8 = (bgcnt & 0x80) != 0;
+	const uint16_t* pal = paletteCopy;
+	if (bpp8 && ((dispcnt & (1 << 30)) != 0)) {
+		// Extended palettes : BG0 / BG1 may use slots 2 / 3
+		int slot = ((bg < 2) && ((bgcnt & 0x2000) != 0)) ? bg + 2 : bg;
+		pal = reinterpret_cast<const uint16_t*>(bgExtPalettes[slot]);
+		if (pal == nullptr) {
+			std::fill(colors, colors + GPU2D_LINE_WIDTH, 0);
+			return;
+		}
+	}
+	bool extPalette = pal != paletteCopy;
+
+	// Palettes are identified by the offset of their first entry, in palette memory or in bank memory
+	uint32_t paletteKey = engineB ? 0x400 : 0;
+	if (extPalette) paletteKey = GPU2DTileCache::PALETTE_IN_VRAM | static_cast<uint32_t>(reinterpret_cast<const uint8_t*>(pal) - banks);
+
+	// Whole tiles from the cache, from the one holding the first pixel
+	alignas(32) uint16_t tiles[GPU2D_LINE_WIDTH + 8];
+	static const uint16_t transparentTile[64] = {};
+	for (int i = 0; i <= GPU2D_LINE_WIDTH / 8; i++) {
+		uint32_t tx = ((hofs & ~7u) + i * 8) & (width - 1);
+		uint32_t entryAddr = rowBase + ((tx >> 3) & 0x1F) * 2 + ((tx >= 256) ? 0x800 : 0);
+		uint16_t entry = BGRead16(entryAddr);
+		uint32_t row = ((entry & 0x800) != 0) ? 7 - (y & 7) : (y & 7);
+
+		const uint8_t* tileData = BGAddress(charBase + (entry & 0x3FF) * (bpp8 ? 64 : 32));
+		const uint16_t* pixels = transparentTile;
+		if ((tileData >= banks) && (tileData < banks + VRAM::BANKS_SIZE)) {
+			uint32_t tileOffset = static_cast<uint32_t>(tileData - banks);
+			if (!bpp8) pixels = tileCache->GetTile(tileData, tileOffset, false, pal + (entry >> 12) * 16, paletteKey + (entry >> 12) * 32);
+			else if (extPalette) pixels = tileCache->GetTile(tileData, tileOffset, true, pal + (entry >> 12) * 256, paletteKey + (entry >> 12) * 512);
+			else pixels = tileCache->GetTile(tileData, tileOffset, true, pal, paletteKey);
+		}
+
+		pixels += row * 8;
+		uint16_t* out = tiles + i * 8;
+		if ((entry & 0x400) != 0) {
+			for (int c = 0; c < 8; c++) out[c] = pixels[7 - c];
+		}
+		else {
+			memcpy(out, pixels, 8 * sizeof(uint16_t));
+		}
+	}
+
+	memcpy(colors, tiles + (hofs & 7), GPU2D_LINE_WIDTH * sizeof(uint16_t));
+}
+
+void GPU2D::RenderAffineBG(const GPU2DLineState& state, int bg, eBGType type) {
+	uint32_t dispcnt = state.Get32(DISPCNT);
+	uint16_t bgcnt = state.Get16(BGCNT + bg * 2);
+	int affine = bg - 2;
+	int32_t pa = static_cast<int16_t>(state.Get16(BGAFFINE + affine * 0x10));
+	int32_t pc = static_cast<int16_t>(state.Get16(BGAFFINE + affine * 0x10 + 0x4));
+	int32_t refX = affineX[affine];
+	int32_t refY = affineY[affine];
+	bool wrap = (bgcnt & 0x2000) != 0;
+
+	uint32_t screenBase = ((bgcnt >> 8) & 0x1F) * 0x800;
+	uint32_t charBase = ((bgcnt >> 2) & 0xF) * 0x4000;
+	if (!engineB) {
+		screenBase += ((dispcnt >> 27) & 0x7) * 0x10000;
+		charBase += ((dispcnt >> 24) & 0x7) * 0x10000;
+	}
+
+	// Extended BGs : bit 7 selects bitmaps, then bit 2 selects direct colors
+	enum { MAP_8BIT, MAP_16BIT, BITMAP_256, BITMAP_DIRECT } format = MAP_8BIT;
+	uint32_t width = 128u << ((bgcnt >> 14) & 0x3);
+	uint32_t height = width;
+	if (type == BG_EXTENDED) {
+		if ((bgcnt & 0x80) == 0) {
+			format = MAP_16BIT;
+		}
+		else {
+			static const uint32_t BITMAP_WIDTH[4] = { 128, 256, 512, 512 };
+			static const uint32_t BITMAP_HEIGHT[4] = { 128, 256, 256, 512 };
+			format = ((bgcnt & 0x4) != 0) ? BITMAP_DIRECT : BITMAP_256;
+			width = BITMAP_WIDTH[(bgcnt >> 14) & 0x3];
+			height = BITMAP_HEIGHT[(bgcnt >> 14) & 0x3];
+			screenBase = ((bgcnt >> 8) & 0x1F) * 0x4000;
+		}
+	}
+	else if (type == BG_LARGE) {
+		format = BITMAP_256;
+		width = ((bgcnt & 0x4000) != 0) ? 1024 : 512;
+		height = ((bgcnt & 0x4000) != 0) ? 512 : 1024;
+		screenBase = 0;
+	}
+
+	const uint16_t* pal = paletteCopy;
+	bool extPalette = (format == MAP_16BIT) && ((dispcnt & (1 << 30)) != 0);
+	if (extPalette) {
+		pal = reinterpret_cast<const uint16_t*>(bgExtPalettes[bg]);
+		if (pal == nullptr) {
+			std::fill(colors, colors + GPU2D_LINE_WIDTH, 0);
+			return;
+		}
+	}
+
+	for (int x = 0; x < GPU2D_LINE_WIDTH; x++, refX += pa, refY += pc) {
+		int32_t tx = refX >> 8;
+		int32_t ty = refY >> 8;
+		if (wrap) {
+			tx &= width - 1;
+			ty &= height - 1;
+		}
+		else if ((tx < 0) || (ty < 0) || (tx >= static_cast<int32_t>(width)) || (ty >= static_cast<int32_t>(height))) {
+			indices[x] = 0;
+			colors[x] = 0;
+			continue;
+		}
+
+		uint8_t pixel;
+		uint16_t paletteBase = 0;
+		switch (format) {
+		case MAP_8BIT: {
+			uint8_t tile = *BGAddress(screenBase + (ty >> 3) * (width >> 3) + (tx >> 3));
+			pixel = *BGAddress(charBase + tile * 64 + (ty & 7) * 8 + (tx & 7));
+			break;
+		}
+		case MAP_16BIT: {
+			uint16_t entry = BGRead16(screenBase + ((ty >> 3) * (width >> 3) + (tx >> 3)) * 2);
+			uint32_t column = ((entry & 0x400) != 0) ? 7 - (tx & 7) : (tx & 7);
+			uint32_t row = ((entry & 0x800) != 0) ? 7 - (ty & 7) : (ty & 7);
+			pixel = *BGAddress(charBase + (entry & 0x3FF) * 64 + row * 8 + column);
+			if (extPalette) paletteBase = (entry >> 12) * 256;
+			break;
+		}
+		case BITMAP_256:
+			pixel = *BGAddress(screenBase + ty * width + tx);
+			break;
+		default: {
+			// Direct color, bit 15 set for opaque pixels : no palette
+			uint16_t color = BGRead16(screenBase + (ty * width + tx) * 2);
+			indices[x] = 0;
+			colors[x] = ((color & GPU2D_OPAQUE) != 0) ? color : 0;
+			continue;
+		}
+		}
+		indices[x] = (pixel != 0) ? ((paletteBase + pixel) | GPU2D_OPAQUE) : 0;
+	}
+
+	if (format != BITMAP_DIRECT) kernels->paletteLookup(indices, pal, colors, GPU2D_LINE_WIDTH);
+}
+
+void GPU2D::RenderOBJ(const GPU2DLineState& state) {
+	memset(objColor, 0, sizeof(objColor));
+	memset(objFlags, 0, sizeof(objFlags));
+	memset(objEva, 0, sizeof(objEva));
+	memset(objEvb, 0, sizeof(objEvb));
+	memset(objWindow, 0, sizeof(objWindow));
+	memset(objPriority, 0xFF, sizeof(objPriority));
+
+	for (int i = 0; i < 128; i++) RenderSprite(state, i);
+
+	for (int x = 0; x < GPU2D_LINE_WIDTH; x++) objKey[x] = static_cast<uint16_t>((objPriority[x] & 0x3) * 8);
+}
+
+void GPU2D::RenderSprite(const GPU2DLineState& state, int index) {
+	const uint8_t* entry = oam + index * 8;
+	uint16_t attr0 = static_cast<uint16_t>(entry[0] | (entry[1] << 8));
+	uint16_t attr1 = static_cast<uint16_t>(entry[2] | (entry[3] << 8));
+	uint16_t attr2 = static_cast<uint16_t>(entry[4] | (entry[5] << 8));
+
+	bool affine = (attr0 & 0x100) != 0;
+	if (!affine && ((attr0 & 0x200) != 0)) return;	// Disabled
+	uint32_t shape = (attr0 >> 14) & 0x3;
+	if (shape == 3) return;
+
+	int width = OBJ_WIDTH[shape][attr1 >> 14];
+	int height = OBJ_HEIGHT[shape][attr1 >> 14];
+	bool doubleSize = affine && ((attr0 & 0x200) != 0);
+	int boxWidth = doubleSize ? width * 2 : width;
+	int boxHeight = doubleSize ? height * 2 : height;
+
+	int y = attr0 & 0xFF;
+	if (y >= 192) y -= 256;
+	int line = state.line;
+	if ((line < y) || (line >= y + boxHeight)) return;
+
+	int x = attr1 & 0x1FF;
+	if (x >= 256) x -= 512;
+	if ((x + boxWidth <= 0) || (x >= GPU2D_LINE_WIDTH)) return;
+
+	uint32_t dispcnt = state.Get32(DISPCNT);
+	uint32_t mode = (attr0 >> 10) & 0x3;
+	uint32_t priority = (attr2 >> 10) & 0x3;
+	uint32_t tile = attr2 & 0x3FF;
+	uint32_t paletteNumber = attr2 >> 12;
+	bool bpp8 = (attr0 & 0x2000) != 0;
+
+	// Affine parameters from the OAM group, 8.8 fixed point
+	int32_t pa = 0x100, pb = 0, pc = 0, pd = 0x100;
+	if (affine) {
+		const uint8_t* group = oam + ((attr1 >> 9) & 0x1F) * 32;
+		pa = static_cast<int16_t>(group[0x06] | (group[0x07] << 8));
+		pb = static_cast<int16_t>(group[0x0E] | (group[0x0F] << 8));
+		pc = static_cast<int16_t>(group[0x16] | (group[0x17] << 8));
+		pd = static_cast<int16_t>(group[0x1E] | (group[0x1F] << 8));
+	}
+	bool hflip = !affine && ((attr1 & 0x1000) != 0);
+	bool vflip = !affine && ((attr1 & 0x2000) != 0);
+
+	// Semi-transparent OBJs blend with BLDALPHA, bitmap OBJs with their own alpha
+	uint16_t flags = 0;
+	uint16_t eva = 0, evb = 0;
+	if (mode == 1) {
+		uint16_t bldalpha = state.Get16(BLDALPHA);
+		flags = GPU2D_LAYER_OBJ_BLEND;
+		eva = std::min(bldalpha & 0x1F, 16);
+		evb = std::min((bldalpha >> 8) & 0x1F, 16);
+	}
+	else if (mode == 3) {
+		if (paletteNumber == 0) return;
+		flags = GPU2D_LAYER_OBJ_BLEND;
+		eva = static_cast<uint16_t>(paletteNumber + 1);
+		evb = static_cast<uint16_t>(16 - eva);
+	}
+
+	// Tile data
+	bool mapping1D = (dispcnt & 0x10) != 0;
+	uint32_t tileBase;
+	uint32_t rowStride;	// Bytes between rows of 8x8 tiles
+	if (mode == 3) {
+		if ((dispcnt & 0x40) != 0) {
+			tileBase = tile * (((dispcnt & (1 << 22)) != 0) ? 256 : 128);
+			rowStride = width * 2;
+		}
+		else {
+			uint32_t mask = ((dispcnt & 0x20) != 0) ? 0x1F : 0xF;
+			tileBase = (tile & mask) * 16 + (tile & ~mask) * 128;
+			rowStride = ((dispcnt & 0x20) != 0) ? 512 : 256;
+		}
+	}
+	else if (mapping1D) {
+		tileBase = tile * (32u << ((dispcnt >> 20) & 0x3));
+		rowStride = (width / 8) * (bpp8 ? 64 : 32);
+	}
+	else {
+		tileBase = (bpp8 ? (tile & ~1u) : tile) * 32;
+		rowStride = 32 * 32;
+	}
+
+	const uint16_t* objPalette = reinterpret_cast<const uint16_t*>(paletteCopy) + 0x100;
+	uint32_t paletteBase = bpp8 ? 0 : paletteNumber * 16;
+	if (bpp8 && ((dispcnt & (1u << 31)) != 0)) {
+		if (objExtPalette == nullptr) return;
+		objPalette = reinterpret_cast<const uint16_t*>(objExtPalette);
+		paletteBase = paletteNumber * 256;
+	}
+
+	int centerX = boxWidth / 2;
+	int centerY = boxHeight / 2;
+	int iy = line - y - centerY;
+	for (int bx = std::max(0, -x); bx < boxWidth; bx++) {
+		int px = x + bx;
+		if (px >= GPU2D_LINE_WIDTH) break;
+
+		int tx, ty;
+		if (affine) {
+			int ix = bx - centerX;
+			tx = ((pa * ix + pb * iy) >> 8) + width / 2;
+			ty = ((pc * ix + pd * iy) >> 8) + height / 2;
+			if ((tx < 0) || (ty < 0) || (tx >= width) || (ty >= height)) continue;
+		}
+		else {
+			tx = hflip ? width - 1 - bx : bx;
+			ty = vflip ? height - 1 - (line - y) : (line - y);
+		}
+
+		uint16_t color;
+		if (mode == 3) {
+			const uint8_t* ptr = OBJAddress(tileBase + ty * rowStride + tx * 2);
+			color = static_cast<uint16_t>(ptr[0] | (ptr[1] << 8));
+			if ((color & GPU2D_OPAQUE) == 0) continue;
+		}
+		else {
+			uint32_t offset = tileBase + (ty >> 3) * rowStride;
+			uint8_t pixel;
+			if (bpp8) {
+				pixel = *OBJAddress(offset + (tx >> 3) * 64 + (ty & 7) * 8 + (tx & 7));
+			}
+			else {
+				pixel = *OBJAddress(offset + (tx >> 3) * 32 + (ty & 7) * 4 + ((tx & 7) >> 1));
+				pixel = (pixel >> ((tx & 1) * 4)) & 0xF;
+			}
+			if (pixel == 0) continue;
+			color = objPalette[paletteBase + pixel] | GPU2D_OPAQUE;
+		}
+
+		if (mode == 2) {
+			objWindow[px] = 1;
+			continue;
+		}
+
+		// Lower OAM index wins between OBJs of the same priority
+		if (priority >= objPriority[px]) continue;
+		objPriority[px] = static_cast<uint8_t>(priority);
+		objColor[px] = color;
+		objFlags[px] = flags;
+		objEva[px] = eva;
+		objEvb[px] = evb;
+	}
+}
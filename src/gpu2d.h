@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include "arm9_mem.h"
+#include "vram.h"
+#include "gpu2d_kernels.h"
+#include "gpu2d_tilecache.h"
+#include "gpu3d_renderer.h"
+
+/// <summary>
+/// VRAM seen by one 2D engine, as offsets in bank memory (VRAM::UNMAPPED if nothing is mapped)
+/// </summary>
+struct GPU2DVRAMMap {
+	static const int BG_PAGES = 32;		// 16KB pages, 512KB
+	static const int OBJ_PAGES = 16;	// 256KB
+	static const int EXT_PALETTE_SLOTS = 4;
+
+	uint32_t bg[BG_PAGES];
+	uint32_t obj[OBJ_PAGES];
+	uint32_t bgExtPalettes[EXT_PALETTE_SLOTS];	// 8KB each
+	uint32_t objExtPalette;
+};
+
+/// <summary>
+/// Registers of one 2D engine (DISPCNT to BLDY, and MASTER_BRIGHT) and its VRAM mapping, latched at the start of a scanline
+/// </summary>
+struct GPU2DLineState {
+	static const uint32_t REGISTERS_SIZE = 0x70;
+
+	uint8_t registers[REGISTERS_SIZE];
+	GPU2DVRAMMap vram;
+	uint16_t line;
+	uint8_t affineReload;	// Bit 0 : BG2 reference point written, bit 1 : BG3
+	bool lcdcLineWritten;	// VRAM display mode : the displayed VRAM line was written since it was last latched
+
+	uint16_t Get16(uint32_t offset) const {
+		return static_cast<uint16_t>(registers[offset] | (registers[offset + 1] << 8));
+	}
+
+	uint32_t Get32(uint32_t offset) const {
+		return Get16(offset) | (static_cast<uint32_t>(Get16(offset + 2)) << 16);
+	}
+};
+
+/// <summary>
+/// One of the two 2D engines : text, affine and bitmap backgrounds, sprites, windows, color effects and master brightness.
+/// Renders one scanline at a time to RGBA8888.
+/// </summary>
+class GPU2D {
+private:
+	// Register offsets, from 04000000h (engine A) or 04001000h (engine B)
+	static const uint32_t DISPCNT = 0x00;
+	static const uint32_t BGCNT = 0x08;
+	static const uint32_t BGOFS = 0x10;
+	static const uint32_t BGAFFINE = 0x20;	// BG2PA, then BG3PA at +10h
+	static const uint32_t WIN0H = 0x40;
+	static const uint32_t WIN1H = 0x42;
+	static const uint32_t WIN0V = 0x44;
+	static const uint32_t WIN1V = 0x46;
+	static const uint32_t WININ = 0x48;
+	static const uint32_t WINOUT = 0x4A;
+	static const uint32_t BLDCNT = 0x50;
+	static const uint32_t BLDALPHA = 0x52;
+	static const uint32_t BLDY = 0x54;
+	static const uint32_t MASTER_BRIGHT = 0x6C;
+
+	// VRAM is seen through 16KB pages, so banks can be mapped anywhere
+	static const uint32_t PAGE_SHIFT = VRAM::PAGE_SHIFT;
+	static const uint32_t PAGE_SIZE = VRAM::PAGE_SIZE;
+	static const int BG_PAGES = GPU2DVRAMMap::BG_PAGES;
+	static const int OBJ_PAGES = GPU2DVRAMMap::OBJ_PAGES;
+	static const int EXT_PALETTE_SLOTS = GPU2DVRAMMap::EXT_PALETTE_SLOTS;
+	static const int VISIBLE_LINES = 192;
+
+	enum eBGType {
+		BG_NONE,
+		BG_TEXT,
+		BG_AFFINE,
+		BG_EXTENDED,
+		BG_LARGE,
+		BG_3D,
+	};
+
+	bool engineB{ false };
+	uint8_t* io{ nullptr };
+	const VRAM* vram{ nullptr };
+	const uint8_t* palette{ nullptr };	// BG palette, OBJ palette at +200h
+	const uint8_t* oam{ nullptr };
+	const uint8_t* banks{ nullptr };
+	const GPU2DKernels* kernels{ nullptr };
+	GPU2DTileCache* tileCache{ nullptr };
+	const GPU3DRenderer* renderer3D{ nullptr };
+
+	// Pages of the line being rendered, from its VRAM map
+	const uint8_t* bgPages[BG_PAGES]{};
+	const uint8_t* objPages[OBJ_PAGES]{};
+	const uint8_t* bgExtPalettes[EXT_PALETTE_SLOTS]{};
+	const uint8_t* objExtPalette{ nullptr };
+
+	// VRAM display mode : lines written since they were last displayed, 512 bytes each, over the whole LCDC area
+	static const int LCDC_LINES = static_cast<int>(ARM9_mem::VRAMLCDC_SIZE / (GPU2D_LINE_WIDTH * 2));
+	uint64_t lcdcWritten[(LCDC_LINES + 63) / 64];
+
+	// VRAM display mode : what each output line holds, to skip lines that did not change
+	struct LCDCOutputLine {
+		const uint32_t* output;
+		uint32_t lcdcLine;
+		uint16_t masterBright;
+		bool valid;
+	};
+	LCDCOutputLine lcdcOutput[VISIBLE_LINES];
+
+	// Internal affine reference points, 20.8 fixed point
+	int32_t affineX[2]{};
+	int32_t affineY[2]{};
+	uint8_t pendingAffineReload{ 0 };
+
+	// Line buffers
+	alignas(32) uint16_t indices[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t colors[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t window[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t objColor[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t objKey[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t objFlags[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t objEva[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t objEvb[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t blended[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t flags3D[GPU2D_LINE_WIDTH];
+	uint16_t eva3D[GPU2D_LINE_WIDTH];
+	uint8_t objPriority[GPU2D_LINE_WIDTH];
+	uint8_t objWindow[GPU2D_LINE_WIDTH];
+	GPU2DLineStack stack;
+
+	// 2 readable bytes after the last palette entry, for the AVX2 gathers
+	alignas(32) uint16_t paletteCopy[0x200 + 2];
+
+	const uint8_t* BGAddress(uint32_t offset) const {
+		return bgPages[(offset >> PAGE_SHIFT) & (BG_PAGES - 1)] + (offset & (PAGE_SIZE - 1));
+	}
+
+	const uint8_t* OBJAddress(uint32_t offset) const {
+		return objPages[(offset >> PAGE_SHIFT) & (OBJ_PAGES - 1)] + (offset & (PAGE_SIZE - 1));
+	}
+
+	uint16_t BGRead16(uint32_t offset) const {
+		const uint8_t* ptr = BGAddress(offset);
+		return static_cast<uint16_t>(ptr[0] | (ptr[1] << 8));
+	}
+
+	const uint8_t* GetPage(uint32_t offset) const;
+	void ResolveVRAM(const GPU2DVRAMMap& map);
+	eBGType GetBGType(const GPU2DLineState& state, int bg) const;
+	void RenderGraphics(const GPU2DLineState& state, uint16_t* output);
+	void BuildWindow(const GPU2DLineState& state);
+	void RenderTextBG(const GPU2DLineState& state, int bg);
+	void RenderAffineBG(const GPU2DLineState& state, int bg, eBGType type);
+	void Render3DBG(const GPU2DLineState& state);
+	void RenderOBJ(const GPU2DLineState& state);
+	void RenderSprite(const GPU2DLineState& state, int index);
+	void AdvanceAffine(const GPU2DLineState& state);
+
+public:
+	static const uint32_t ENGINE_A_IO_ADDR = 0x04000000;
+	static const uint32_t ENGINE_B_IO_ADDR = 0x04001000;
+
+	/// <summary>
+	/// Bind the engine to its registers, palette, OAM and VRAM
+	/// </summary>
+	/// <param name="mem">ARM9 memory</param>
+	/// <param name="vramBanks">VRAM bank controller</param>
+	/// <param name="cache">Decoded tiles, shared by both engines and told about video memory writes by the owner</param>
+	/// <param name="isEngineB">false for the main engine (A), true for the sub engine (B)</param>
+	void Attach(ARM9_mem& mem, VRAM& vramBanks, GPU2DTileCache& cache, bool isEngineB);
+
+	/// <summary>
+	/// Read palette, OAM and VRAM from another copy of video memory
+	/// </summary>
+	/// <param name="palettes">Palettes of both engines (800h bytes)</param>
+	/// <param name="oamA">OAM of engine A</param>
+	/// <param name="oamB">OAM of engine B</param>
+	/// <param name="vramBanks">VRAM bank memory, laid out as in LCDC mode</param>
+	void MapMemory(const uint8_t* palettes, const uint8_t* oamA, const uint8_t* oamB, const uint8_t* vramBanks);
+
+	/// <summary>
+	/// Show the frames of the 3D rendering engine as BG0 (engine A)
+	/// </summary>
+	void Set3DRenderer(const GPU3DRenderer* renderer) {
+		renderer3D = renderer;
+	}
+
+	/// <summary>
+	/// Select the kernels used for pixel processing, mainly to compare them
+	/// </summary>
+	void SetSIMDLevel(eSIMDLevel level) {
+		kernels = &GetGPU2DKernels(level);
+	}
+
+	const GPU2DKernels& GetKernels() const {
+		return *kernels;
+	}
+
+	/// <summary>
+	/// Forget what an output line holds, after something else has written it
+	/// </summary>
+	/// <param name="line">Line number (0 to 191)</param>
+	void InvalidateOutputLine(uint16_t line) {
+		lcdcOutput[line].valid = false;
+	}
+
+	/// <summary>
+	/// Reload the affine reference points, at the start of every frame
+	/// </summary>
+	void StartFrame();
+
+	/// <summary>
+	/// Latch the registers used to render a line
+	/// </summary>
+	/// <param name="line">Line number (0 to 191)</param>
+	/// <param name="state">Receives the registers</param>
+	void CaptureLine(uint16_t line, GPU2DLineState& state);
+
+	/// <summary>
+	/// Render a line from latched registers and the current palette, OAM and VRAM
+	/// </summary>
+	/// <param name="state">Registers from CaptureLine</param>
+	/// <param name="output">256 RGBA8888 pixels</param>
+	void RenderLine(const GPU2DLineState& state, uint32_t* output);
+
+	/// <summary>
+	/// Latch the registers and render a line
+	/// </summary>
+	void RenderLine(uint16_t line, uint32_t* output) {
+		GPU2DLineState state;
+		CaptureLine(line, state);
+		RenderLine(state, output);
+	}
+};
@@ -0,0 +1,163 @@
+#include "gpu2d_kernels.h"
+#include <algorithm>
+
+#ifdef SIMD_HAS_X86_KERNELS
+#include <emmintrin.h>
+#include "gpu2d_kernels_impl.h"
+#endif
+
+#pragma region Scalar
+
+static void PaletteLookupScalar(const uint16_t* indices, const uint16_t* palette, uint16_t* colors, int count) {
+	for (int x = 0; x < count; x++) {
+		uint16_t index = indices[x];
+		colors[x] = ((index & GPU2D_OPAQUE) != 0) ? (palette[index & 0x7FFF] | GPU2D_OPAQUE) : 0;
+	}
+}
+
+static void InsertLayerScalar(GPU2DLineStack& stack, const uint16_t* colors, const uint16_t* keys, uint16_t key,
+		uint16_t layer, const uint16_t* flags, const uint16_t* window) {
+	for (int x = 0; x < GPU2D_LINE_WIDTH; x++) {
+		if (((colors[x] & GPU2D_OPAQUE) == 0) || ((window[x] & layer & 0x3F) == 0)) continue;
+
+		uint16_t pixelKey = (keys != nullptr) ? keys[x] : key;
+		uint16_t pixelLayer = (flags != nullptr) ? (layer | flags[x]) : layer;
+		if (pixelKey < stack.topKey[x]) {
+			stack.secondColor[x] = stack.topColor[x];
+			stack.secondKey[x] = stack.topKey[x];
+			stack.secondLayer[x] = stack.topLayer[x];
+			stack.topColor[x] = colors[x];
+			stack.topKey[x] = pixelKey;
+			stack.topLayer[x] = pixelLayer;
+		}
+		else if (pixelKey < stack.secondKey[x]) {
+			stack.secondColor[x] = colors[x];
+			stack.secondKey[x] = pixelKey;
+			stack.secondLayer[x] = pixelLayer;
+		}
+	}
+}
+
+static void BlendScalar(const GPU2DLineStack& stack, const uint16_t* window, const uint16_t* objEva, const uint16_t* objEvb,
+		const GPU2DBlendParams& params, uint16_t* output) {
+	for (int x = 0; x < GPU2D_LINE_WIDTH; x++) {
+		uint16_t a = stack.topColor[x] & 0x7FFF;
+		uint16_t b = stack.secondColor[x] & 0x7FFF;
+		bool isSecond = (stack.secondLayer[x] & params.secondTargets) != 0;
+		bool isFirst = ((stack.topLayer[x] & params.firstTargets) != 0) && ((window[x] & GPU2D_WINDOW_EFFECTS) != 0);
+		bool objAlpha = ((stack.topLayer[x] & GPU2D_LAYER_OBJ_BLEND) != 0) && isSecond;
+
+		uint16_t effect = GPU2D_EFFECT_NONE;
+		if (objAlpha || (isFirst && isSecond && (params.effect == GPU2D_EFFECT_ALPHA))) effect = GPU2D_EFFECT_ALPHA;
+		else if (isFirst && (params.effect != GPU2D_EFFECT_ALPHA)) effect = params.effect;
+
+		uint16_t eva = objAlpha ? objEva[x] : params.eva;
+		uint16_t evb = objAlpha ? objEvb[x] : params.evb;
+
+		uint16_t result = 0;
+		for (int shift = 0; shift <= 10; shift += 5) {
+			int ca = (a >> shift) & 0x1F;
+			int cb = (b >> shift) & 0x1F;
+			int c = ca;
+			switch (effect) {
+			case GPU2D_EFFECT_ALPHA:	c = std::min(0x1F, (ca * eva + cb * evb) >> 4); break;
+			case GPU2D_EFFECT_BRIGHTEN:	c = ca + (((0x1F - ca) * params.evy) >> 4); break;
+			case GPU2D_EFFECT_DARKEN:	c = ca - ((ca * params.evy) >> 4); break;
+			default:					break;
+			}
+			result |= c << shift;
+		}
+		output[x] = result;
+	}
+}
+
+static void ConvertScalar(const uint16_t* colors, uint32_t* output, int count, int brightnessMode, int brightnessFactor) {
+	for (int x = 0; x < count; x++) {
+		uint32_t rgba = 0xFF000000;
+		for (int channel = 0; channel < 3; channel++) {
+			int c = (colors[x] >> (channel * 5)) & 0x1F;
+			if (brightnessMode == 1) c += ((0x1F - c) * brightnessFactor) >> 4;
+			else if (brightnessMode == 2) c -= (c * brightnessFactor) >> 4;
+			rgba |= static_cast<uint32_t>((c << 3) | (c >> 2)) << (channel * 8);
+		}
+		output[x] = rgba;
+	}
+}
+
+static const GPU2DKernels scalarKernels = { "scalar", PaletteLookupScalar, InsertLayerScalar, BlendScalar, ConvertScalar };
+
+#pragma endregion
+
+#ifdef SIMD_HAS_X86_KERNELS
+#pragma region SSE2
+
+struct SSE2Vector {
+	using T = __m128i;
+	static const int LANES = 8;
+
+	static T Load(const uint16_t* ptr) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)); }
+	static void Store(uint16_t* ptr, T value) { _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), value); }
+	static T Set1(uint16_t value) { return _mm_set1_epi16(static_cast<short>(value)); }
+	static T Zero() { return _mm_setzero_si128(); }
+	static T Ones() { return _mm_set1_epi32(-1); }
+	static T And(T a, T b) { return _mm_and_si128(a, b); }
+	static T Or(T a, T b) { return _mm_or_si128(a, b); }
+	static T AndNot(T a, T b) { return _mm_andnot_si128(a, b); }
+	static T Select(T mask, T a, T b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+	static T CmpEq(T a, T b) { return _mm_cmpeq_epi16(a, b); }
+	static T CmpLt(T a, T b) { return _mm_cmplt_epi16(a, b); }
+	static T Add(T a, T b) { return _mm_add_epi16(a, b); }
+	static T Sub(T a, T b) { return _mm_sub_epi16(a, b); }
+	static T Mullo(T a, T b) { return _mm_mullo_epi16(a, b); }
+	static T Min(T a, T b) { return _mm_min_epi16(a, b); }
+	template <int n> static T Srl(T a) { return _mm_srli_epi16(a, n); }
+	template <int n> static T Sll(T a) { return _mm_slli_epi16(a, n); }
+	template <int n> static T Sra(T a) { return _mm_srai_epi16(a, n); }
+
+	static void StoreRGBA(uint32_t* ptr, T rg, T ba) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(ptr + 4), _mm_unpackhi_epi16(rg, ba));
+	}
+};
+
+static void PaletteLookupSSE2(const uint16_t* indices, const uint16_t* palette, uint16_t* colors, int count) {
+	// No gather before AVX2 : entries are read one by one, masks and flags are applied 8 pixels at a time.
+	// Transparent pixels read entry 0, their index bits may be out of the palette.
+	const __m128i indexMask = _mm_set1_epi16(0x7FFF);
+	const __m128i opaque = _mm_set1_epi16(static_cast<short>(GPU2D_OPAQUE));
+
+	int x = 0;
+	for (; x + 8 <= count; x += 8) {
+		__m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + x));
+		__m128i isOpaque = _mm_srai_epi16(index, 15);
+		index = _mm_and_si128(index, _mm_and_si128(isOpaque, indexMask));
+		__m128i entries = _mm_setr_epi16(
+			static_cast<short>(palette[_mm_extract_epi16(index, 0)]), static_cast<short>(palette[_mm_extract_epi16(index, 1)]),
+			static_cast<short>(palette[_mm_extract_epi16(index, 2)]), static_cast<short>(palette[_mm_extract_epi16(index, 3)]),
+			static_cast<short>(palette[_mm_extract_epi16(index, 4)]), static_cast<short>(palette[_mm_extract_epi16(index, 5)]),
+			static_cast<short>(palette[_mm_extract_epi16(index, 6)]), static_cast<short>(palette[_mm_extract_epi16(index, 7)]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(colors + x), _mm_and_si128(_mm_or_si128(entries, opaque), isOpaque));
+	}
+	PaletteLookupScalar(indices + x, palette, colors + x, count - x);
+}
+
+static const GPU2DKernels sse2Kernels = {
+	"SSE2",
+	PaletteLookupSSE2,
+	GPU2DSIMDKernels<SSE2Vector>::InsertLayer,
+	GPU2DSIMDKernels<SSE2Vector>::Blend,
+	GPU2DSIMDKernels<SSE2Vector>::Convert,
+};
+
+#pragma endregion
+
+#endif
+
+const GPU2DKernels& GetGPU2DKernels(eSIMDLevel level) {
+#ifdef SIMD_HAS_X86_KERNELS
+	static const bool avx2 = HostSupportsAVX2();
+	if (((level == SIMD_BEST) || (level == SIMD_AVX2)) && avx2) return GetGPU2DKernelsAVX2();
+	if (level != SIMD_SCALAR) return sse2Kernels;
+#endif
+	return scalarKernels;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "simd.h"
+
+// Pixel processing steps of the 2D engines, working on one scanline at a time.
+// Colors are BGR555 halfwords, bit 15 set for opaque pixels.
+
+static const int GPU2D_LINE_WIDTH = 256;
+
+// Layer bits, in the BLDCNT / WININ / WINOUT order
+enum eGPU2DLayer : uint16_t {
+	GPU2D_LAYER_BG0 = 0x01,
+	GPU2D_LAYER_BG1 = 0x02,
+	GPU2D_LAYER_BG2 = 0x04,
+	GPU2D_LAYER_BG3 = 0x08,
+	GPU2D_LAYER_OBJ = 0x10,
+	GPU2D_LAYER_BACKDROP = 0x20,
+	GPU2D_WINDOW_EFFECTS = 0x20,	// In window masks, bit 5 enables color effects
+	GPU2D_LAYER_OBJ_BLEND = 0x100,	// Semi-transparent or bitmap OBJ : alpha blended with its own coefficients
+};
+
+static const uint16_t GPU2D_OPAQUE = 0x8000;
+
+/// <summary>
+/// The two front-most pixels of every column, kept while layers are added from any order.
+/// Keys are priority * 8 + layer order, the lowest key is in front.
+/// </summary>
+struct GPU2DLineStack {
+	alignas(32) uint16_t topColor[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t topKey[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t topLayer[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t secondColor[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t secondKey[GPU2D_LINE_WIDTH];
+	alignas(32) uint16_t secondLayer[GPU2D_LINE_WIDTH];
+};
+
+enum eGPU2DEffect : uint16_t {
+	GPU2D_EFFECT_NONE,
+	GPU2D_EFFECT_ALPHA,
+	GPU2D_EFFECT_BRIGHTEN,
+	GPU2D_EFFECT_DARKEN,
+};
+
+/// <summary>
+/// BLDCNT / BLDALPHA / BLDY, coefficients already clamped to 16
+/// </summary>
+struct GPU2DBlendParams {
+	uint16_t effect;
+	uint16_t firstTargets;
+	uint16_t secondTargets;
+	uint16_t eva;
+	uint16_t evb;
+	uint16_t evy;
+};
+
+/// <summary>
+/// One implementation of every step. All implementations give the same results, bit for bit.
+/// </summary>
+struct GPU2DKernels {
+	const char* name;
+
+	/// <summary>
+	/// Resolve palette indices (bit 15 = opaque) to colors. Transparent pixels give 0.
+	/// </summary>
+	void (*paletteLookup)(const uint16_t* indices, const uint16_t* palette, uint16_t* colors, int count);
+
+	/// <summary>
+	/// Add a layer to the stack. The key is per pixel if keys is not null, flags are ORed with the layer bit if not null.
+	/// </summary>
+	void (*insertLayer)(GPU2DLineStack& stack, const uint16_t* colors, const uint16_t* keys, uint16_t key,
+		uint16_t layer, const uint16_t* flags, const uint16_t* window);
+
+	/// <summary>
+	/// Apply color effects to the stack, objEva / objEvb hold the coefficients of OBJ_BLEND pixels
+	/// </summary>
+	void (*blend)(const GPU2DLineStack& stack, const uint16_t* window, const uint16_t* objEva, const uint16_t* objEvb,
+		const GPU2DBlendParams& params, uint16_t* output);
+
+	/// <summary>
+	/// Apply master brightness (MASTER_BRIGHT mode 1 up, 2 down) and convert to RGBA8888
+	/// </summary>
+	void (*convert)(const uint16_t* colors, uint32_t* output, int count, int brightnessMode, int brightnessFactor);
+};
+
+/// <summary>
+/// Get the kernels for a SIMD level, lowered to what the host CPU and the build support
+/// </summary>
+/// <param name="level">Requested level</param>
+/// <returns>Kernel table, valid until the end of the program</returns>
+const GPU2DKernels& GetGPU2DKernels(eSIMDLevel level = SIMD_BEST);
+
+#ifdef SIMD_HAS_X86_KERNELS
+const GPU2DKernels& GetGPU2DKernelsAVX2();
+#endif
@@ -0,0 +1,75 @@
+// Built with AVX2 enabled (see CMakeLists.txt), only called after checking the host CPU
+#include "gpu2d_kernels.h"
+
+#ifdef SIMD_HAS_X86_KERNELS
+#include <immintrin.h>
+#include "gpu2d_kernels_impl.h"
+
+struct AVX2Vector {
+	using T = __m256i;
+	static const int LANES = 16;
+
+	static T Load(const uint16_t* ptr) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)); }
+	static void Store(uint16_t* ptr, T value) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr), value); }
+	static T Set1(uint16_t value) { return _mm256_set1_epi16(static_cast<short>(value)); }
+	static T Zero() { return _mm256_setzero_si256(); }
+	static T Ones() { return _mm256_set1_epi32(-1); }
+	static T And(T a, T b) { return _mm256_and_si256(a, b); }
+	static T Or(T a, T b) { return _mm256_or_si256(a, b); }
+	static T AndNot(T a, T b) { return _mm256_andnot_si256(a, b); }
+	static T Select(T mask, T a, T b) { return _mm256_blendv_epi8(b, a, mask); }
+	static T CmpEq(T a, T b) { return _mm256_cmpeq_epi16(a, b); }
+	static T CmpLt(T a, T b) { return _mm256_cmpgt_epi16(b, a); }
+	static T Add(T a, T b) { return _mm256_add_epi16(a, b); }
+	static T Sub(T a, T b) { return _mm256_sub_epi16(a, b); }
+	static T Mullo(T a, T b) { return _mm256_mullo_epi16(a, b); }
+	static T Min(T a, T b) { return _mm256_min_epi16(a, b); }
+	template <int n> static T Srl(T a) { return _mm256_srli_epi16(a, n); }
+	template <int n> static T Sll(T a) { return _mm256_slli_epi16(a, n); }
+	template <int n> static T Sra(T a) { return _mm256_srai_epi16(a, n); }
+
+	static void StoreRGBA(uint32_t* ptr, T rg, T ba) {
+		// Unpacks work within 128bit lanes : put the 4 quarters back in order
+		T low = _mm256_unpacklo_epi16(rg, ba);
+		T high = _mm256_unpackhi_epi16(rg, ba);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr), _mm256_permute2x128_si256(low, high, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr + 8), _mm256_permute2x128_si256(low, high, 0x31));
+	}
+};
+
+static void PaletteLookupAVX2(const uint16_t* indices, const uint16_t* palette, uint16_t* colors, int count) {
+	// Gathers read 32 bits per entry : palettes must have 2 readable bytes after their last entry
+	const __m256i indexMask = _mm256_set1_epi32(0x7FFF);
+	const __m256i opaque = _mm256_set1_epi32(GPU2D_OPAQUE);
+	const __m256i colorMask = _mm256_set1_epi32(0xFFFF);
+	const int* base = reinterpret_cast<const int*>(palette);
+
+	int x = 0;
+	for (; x + 8 <= count; x += 8) {
+		__m256i index = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + x)));
+		__m256i isOpaque = _mm256_cmpeq_epi32(_mm256_and_si256(index, opaque), opaque);
+		__m256i entries = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), base, _mm256_and_si256(index, indexMask), isOpaque, 2);
+		__m256i color = _mm256_and_si256(_mm256_or_si256(_mm256_and_si256(entries, colorMask), opaque), isOpaque);
+
+		// 32bit lanes back to 16bit : both 128bit halves pack to their low 64 bits
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(color, color), 0x08);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(colors + x), _mm256_castsi256_si128(packed));
+	}
+	for (; x < count; x++) {
+		uint16_t index = indices[x];
+		colors[x] = ((index & GPU2D_OPAQUE) != 0) ? (palette[index & 0x7FFF] | GPU2D_OPAQUE) : 0;
+	}
+}
+
+static const GPU2DKernels avx2Kernels = {
+	"AVX2",
+	PaletteLookupAVX2,
+	GPU2DSIMDKernels<AVX2Vector>::InsertLayer,
+	GPU2DSIMDKernels<AVX2Vector>::Blend,
+	GPU2DSIMDKernels<AVX2Vector>::Convert,
+};
+
+const GPU2DKernels& GetGPU2DKernelsAVX2() {
+	return avx2Kernels;
+}
+#endif
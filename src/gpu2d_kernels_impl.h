@@ -0,0 +1,128 @@
+#pragma once
+
+// SIMD kernels written once for any vector width. Included by the SSE2 and AVX2 translation units,
+// each providing a vector type V with 16bit lanes (see SSE2Vector in gpu2d_kernels.cpp).
+
+#include "gpu2d_kernels.h"
+
+template <class V>
+struct GPU2DSIMDKernels {
+	using T = typename V::T;
+
+	static T NotZero(T value) {
+		return V::AndNot(V::CmpEq(value, V::Zero()), V::Ones());
+	}
+
+	static void InsertLayer(GPU2DLineStack& stack, const uint16_t* colors, const uint16_t* keys, uint16_t key,
+			uint16_t layer, const uint16_t* flags, const uint16_t* window) {
+		const T layerBit = V::Set1(layer & 0x3F);
+		for (int x = 0; x < GPU2D_LINE_WIDTH; x += V::LANES) {
+			T color = V::Load(colors + x);
+			T pixelKey = (keys != nullptr) ? V::Load(keys + x) : V::Set1(key);
+			T pixelLayer = V::Set1(layer);
+			if (flags != nullptr) pixelLayer = V::Or(pixelLayer, V::Load(flags + x));
+
+			T visible = V::And(V::template Sra<15>(color), NotZero(V::And(V::Load(window + x), layerBit)));
+			T topKey = V::Load(stack.topKey + x);
+			T secondKey = V::Load(stack.secondKey + x);
+			T aboveTop = V::And(visible, V::CmpLt(pixelKey, topKey));
+			T aboveSecond = V::And(V::AndNot(aboveTop, visible), V::CmpLt(pixelKey, secondKey));
+
+			T topColor = V::Load(stack.topColor + x);
+			T topLayer = V::Load(stack.topLayer + x);
+			V::Store(stack.secondColor + x, V::Select(aboveTop, topColor, V::Select(aboveSecond, color, V::Load(stack.secondColor + x))));
+			V::Store(stack.secondKey + x, V::Select(aboveTop, topKey, V::Select(aboveSecond, pixelKey, secondKey)));
+			V::Store(stack.secondLayer + x, V::Select(aboveTop, topLayer, V::Select(aboveSecond, pixelLayer, V::Load(stack.secondLayer + x))));
+			V::Store(stack.topColor + x, V::Select(aboveTop, color, topColor));
+			V::Store(stack.topKey + x, V::Select(aboveTop, pixelKey, topKey));
+			V::Store(stack.topLayer + x, V::Select(aboveTop, pixelLayer, topLayer));
+		}
+	}
+
+	// One 5bit channel of a and b at shift, 16bit lanes
+	template <int shift>
+	static T Channel(T color) {
+		return V::And(V::template Srl<shift>(color), V::Set1(0x1F));
+	}
+
+	template <int shift>
+	static T BlendChannel(T a, T b, T eva, T evb, T evy, T useAlpha, T useBrighten, T useDarken) {
+		const T max = V::Set1(0x1F);
+		T ca = Channel<shift>(a);
+		T cb = Channel<shift>(b);
+		T alpha = V::Min(max, V::template Srl<4>(V::Add(V::Mullo(ca, eva), V::Mullo(cb, evb))));
+		T brighten = V::Add(ca, V::template Srl<4>(V::Mullo(V::Sub(max, ca), evy)));
+		T darken = V::Sub(ca, V::template Srl<4>(V::Mullo(ca, evy)));
+		T result = V::Select(useAlpha, alpha, V::Select(useBrighten, brighten, V::Select(useDarken, darken, ca)));
+		return V::template Sll<shift>(result);
+	}
+
+	static void Blend(const GPU2DLineStack& stack, const uint16_t* window, const uint16_t* objEva, const uint16_t* objEvb,
+			const GPU2DBlendParams& params, uint16_t* output) {
+		const T colorMask = V::Set1(0x7FFF);
+		const T firstTargets = V::Set1(params.firstTargets);
+		const T secondTargets = V::Set1(params.secondTargets);
+		const T effects = V::Set1(GPU2D_WINDOW_EFFECTS);
+		const T objBlendBit = V::Set1(GPU2D_LAYER_OBJ_BLEND);
+		const T modeAlpha = V::Set1((params.effect == GPU2D_EFFECT_ALPHA) ? 0xFFFF : 0);
+		const T modeBrighten = V::Set1((params.effect == GPU2D_EFFECT_BRIGHTEN) ? 0xFFFF : 0);
+		const T modeDarken = V::Set1((params.effect == GPU2D_EFFECT_DARKEN) ? 0xFFFF : 0);
+		const T eva = V::Set1(params.eva);
+		const T evb = V::Set1(params.evb);
+		const T evy = V::Set1(params.evy);
+
+		for (int x = 0; x < GPU2D_LINE_WIDTH; x += V::LANES) {
+			T a = V::And(V::Load(stack.topColor + x), colorMask);
+			T b = V::And(V::Load(stack.secondColor + x), colorMask);
+			T topLayer = V::Load(stack.topLayer + x);
+
+			T isSecond = NotZero(V::And(V::Load(stack.secondLayer + x), secondTargets));
+			T isFirst = V::And(NotZero(V::And(topLayer, firstTargets)), NotZero(V::And(V::Load(window + x), effects)));
+			T objAlpha = V::And(NotZero(V::And(topLayer, objBlendBit)), isSecond);
+
+			T useAlpha = V::Or(objAlpha, V::And(V::And(isFirst, isSecond), modeAlpha));
+			T useBrighten = V::AndNot(objAlpha, V::And(isFirst, modeBrighten));
+			T useDarken = V::AndNot(objAlpha, V::And(isFirst, modeDarken));
+			T pixelEva = V::Select(objAlpha, V::Load(objEva + x), eva);
+			T pixelEvb = V::Select(objAlpha, V::Load(objEvb + x), evb);
+
+			T result = BlendChannel<0>(a, b, pixelEva, pixelEvb, evy, useAlpha, useBrighten, useDarken);
+			result = V::Or(result, BlendChannel<5>(a, b, pixelEva, pixelEvb, evy, useAlpha, useBrighten, useDarken));
+			result = V::Or(result, BlendChannel<10>(a, b, pixelEva, pixelEvb, evy, useAlpha, useBrighten, useDarken));
+			V::Store(output + x, result);
+		}
+	}
+
+	// 5bit to 8bit : replicate the high bits into the low ones
+	static T Expand(T channel) {
+		return V::Or(V::template Sll<3>(channel), V::template Srl<2>(channel));
+	}
+
+	static void Convert(const uint16_t* colors, uint32_t* output, int count, int brightnessMode, int brightnessFactor) {
+		const T max = V::Set1(0x1F);
+		const T factor = V::Set1(static_cast<uint16_t>(brightnessFactor));
+		const T alpha = V::Set1(0xFF00);
+
+		for (int x = 0; x < count; x += V::LANES) {
+			T color = V::Load(colors + x);
+			T r = Channel<0>(color);
+			T g = Channel<5>(color);
+			T b = Channel<10>(color);
+
+			if (brightnessMode == 1) {
+				r = V::Add(r, V::template Srl<4>(V::Mullo(V::Sub(max, r), factor)));
+				g = V::Add(g, V::template Srl<4>(V::Mullo(V::Sub(max, g), factor)));
+				b = V::Add(b, V::template Srl<4>(V::Mullo(V::Sub(max, b), factor)));
+			}
+			else if (brightnessMode == 2) {
+				r = V::Sub(r, V::template Srl<4>(V::Mullo(r, factor)));
+				g = V::Sub(g, V::template Srl<4>(V::Mullo(g, factor)));
+				b = V::Sub(b, V::template Srl<4>(V::Mullo(b, factor)));
+			}
+
+			T rg = V::Or(Expand(r), V::template Sll<8>(Expand(g)));
+			T ba = V::Or(Expand(b), alpha);
+			V::StoreRGBA(output + x, rg, ba);
+		}
+	}
+};
@@ -0,0 +1,59 @@
+#include "gpu2d_tilecache.h"
+#include <algorithm>
+
+GPU2DTileCache::GPU2DTileCache() {
+	entries = std::make_unique<Entry[]>(ENTRY_COUNT);
+	Clear();
+	tileGenerations = std::make_unique<uint32_t[]>(VRAM_SIZE >> TILE_BLOCK_SHIFT);
+	vramPaletteGenerations = std::make_unique<uint32_t[]>(VRAM_SIZE >> PALETTE_BLOCK_SHIFT);
+}
+
+void GPU2DTileCache::Clear() {
+	for (int i = 0; i < ENTRY_COUNT; i++) entries[i].tile = NONE;
+}
+
+void GPU2DTileCache::Bump(uint32_t* generations, uint32_t offset, uint32_t length, uint32_t shift, uint32_t size) {
+	if ((length == 0) || (offset >= size)) return;
+	uint32_t last = (std::min(offset + length, size) - 1) >> shift;
+	for (uint32_t block = offset >> shift; block <= last; block++) generations[block]++;
+}
+
+void GPU2DTileCache::VRAMWritten(uint32_t offset, uint32_t length) {
+	Bump(tileGenerations.get(), offset, length, TILE_BLOCK_SHIFT, VRAM_SIZE);
+	Bump(vramPaletteGenerations.get(), offset, length, PALETTE_BLOCK_SHIFT, VRAM_SIZE);
+}
+
+void GPU2DTileCache::PaletteWritten(uint32_t offset, uint32_t length) {
+	Bump(paletteRowGenerations, offset, length, PALETTE_ROW_SHIFT, PALETTES_SIZE);
+	Bump(paletteBlockGenerations, offset, length, PALETTE_BLOCK_SHIFT, PALETTES_SIZE);
+}
+
+const uint16_t* GPU2DTileCache::GetTile(const uint8_t* data, uint32_t tileOffset, bool bpp8, const uint16_t* palette, uint32_t paletteKey) {
+	uint32_t tile = tileOffset | (bpp8 ? 0x80000000 : 0);
+	uint32_t block = tileOffset >> TILE_BLOCK_SHIFT;
+
+	// Generations only grow : the sum over both blocks of an 8bpp tile changes on any write
+	uint32_t tileGeneration = tileGenerations[block] + (bpp8 ? tileGenerations[block + 1] : 0);
+	uint32_t paletteGeneration;
+	if ((paletteKey & PALETTE_IN_VRAM) != 0) paletteGeneration = vramPaletteGenerations[(paletteKey & ~PALETTE_IN_VRAM) >> PALETTE_BLOCK_SHIFT];
+	else if (bpp8) paletteGeneration = paletteBlockGenerations[paletteKey >> PALETTE_BLOCK_SHIFT];
+	else paletteGeneration = paletteRowGenerations[paletteKey >> PALETTE_ROW_SHIFT];
+
+	uint32_t hash = (block * 0x9E3779B1u) ^ (paletteKey * 0x85EBCA6Bu);
+	Entry& entry = entries[hash >> (32 - ENTRY_BITS)];
+	if ((entry.tile == tile) && (entry.palette == paletteKey) && (entry.tileGeneration == tileGeneration) && (entry.paletteGeneration == paletteGeneration)) {
+		hits++;
+		return entry.pixels;
+	}
+
+	misses++;
+	entry.tile = tile;
+	entry.palette = paletteKey;
+	entry.tileGeneration = tileGeneration;
+	entry.paletteGeneration = paletteGeneration;
+	for (int i = 0; i < 64; i++) {
+		uint8_t pixel = bpp8 ? data[i] : ((data[i >> 1] >> ((i & 1) * 4)) & 0xF);
+		entry.pixels[i] = (pixel != 0) ? (palette[pixel] | GPU2D_OPAQUE) : 0;
+	}
+	return entry.pixels;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "gpu2d_kernels.h"
+
+/// <summary>
+/// 8x8 tiles decoded to colors (BGR555 with GPU2D_OPAQUE, 0 for transparent), keyed by their VRAM bank offset and palette.
+/// Writes bump a generation counter per 32 byte tile block and per palette row, so one write invalidates every decoding
+/// of a tile, whatever its palette. Written ranges must be reported on the thread that renders, in order with rendering.
+/// </summary>
+class GPU2DTileCache {
+private:
+	static const int ENTRY_BITS = 12;
+	static const int ENTRY_COUNT = 1 << ENTRY_BITS;
+	static const uint32_t TILE_BLOCK_SHIFT = 5;			// 4bpp tile size, 8bpp tiles use 2 blocks
+	static const uint32_t PALETTE_ROW_SHIFT = 5;		// 16 colors
+	static const uint32_t PALETTE_BLOCK_SHIFT = 9;		// 256 colors
+	static const uint32_t VRAM_SIZE = 0xA4000;
+	static const uint32_t PALETTES_SIZE = 0x800;
+	static const uint32_t NONE = 0xFFFFFFFF;
+
+	struct Entry {
+		uint32_t tile;			// Bank offset, bit 31 set for 8bpp
+		uint32_t palette;		// Offset of the first entry, bit 31 set for VRAM (extended palettes)
+		uint32_t tileGeneration;
+		uint32_t paletteGeneration;
+		alignas(16) uint16_t pixels[64];
+	};
+
+	std::unique_ptr<Entry[]> entries;
+	std::unique_ptr<uint32_t[]> tileGenerations;			// VRAM, per 32 bytes
+	std::unique_ptr<uint32_t[]> vramPaletteGenerations;		// VRAM, per 512 bytes
+	uint32_t paletteRowGenerations[PALETTES_SIZE >> PALETTE_ROW_SHIFT]{};
+	uint32_t paletteBlockGenerations[PALETTES_SIZE >> PALETTE_BLOCK_SHIFT]{};
+
+	uint64_t hits{ 0 };
+	uint64_t misses{ 0 };
+
+	static void Bump(uint32_t* generations, uint32_t offset, uint32_t length, uint32_t shift, uint32_t size);
+
+public:
+	static const uint32_t PALETTE_IN_VRAM = 0x80000000;
+
+	GPU2DTileCache();
+
+	/// <summary>
+	/// Forget every decoded tile
+	/// </summary>
+	void Clear();
+
+	/// <summary>
+	/// Report written VRAM bank memory
+	/// </summary>
+	void VRAMWritten(uint32_t offset, uint32_t length);
+
+	/// <summary>
+	/// Report written palette memory (offset from 05000000h)
+	/// </summary>
+	void PaletteWritten(uint32_t offset, uint32_t length);
+
+	/// <summary>
+	/// Get a decoded tile, decoding it if needed
+	/// </summary>
+	/// <param name="data">Tile data</param>
+	/// <param name="tileOffset">Bank offset of the tile data</param>
+	/// <param name="bpp8">true for 8bpp tiles, false for 4bpp</param>
+	/// <param name="palette">Palette colors, from paletteBase</param>
+	/// <param name="paletteKey">Offset of the first palette entry used in palette memory, or in bank memory with PALETTE_IN_VRAM</param>
+	/// <returns>64 colors, row by row</returns>
+	const uint16_t* GetTile(const uint8_t* data, uint32_t tileOffset, bool bpp8, const uint16_t* palette, uint32_t paletteKey);
+
+	uint64_t GetHits() const {
+		return hits;
+	}
+
+	uint64_t GetMisses() const {
+		return misses;
+	}
+};
@@ -0,0 +1,931 @@
+#include "gpu3d_geometry.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+
+// Parameter words and execution time of every command, 0 parameters for unused command numbers.
+// Times are in bus cycles, like the ARM7 ones : 2 scheduler cycles each.
+struct GeometryCommand {
+	uint8_t params;
+	uint16_t cycles;
+};
+
+static const std::array<GeometryCommand, 256> COMMANDS = []() {
+	std::array<GeometryCommand, 256> commands{};
+	commands[0x10] = { 1, 1 };		// MTX_MODE
+	commands[0x11] = { 0, 17 };		// MTX_PUSH
+	commands[0x12] = { 1, 36 };		// MTX_POP
+	commands[0x13] = { 1, 17 };		// MTX_STORE
+	commands[0x14] = { 1, 36 };		// MTX_RESTORE
+	commands[0x15] = { 0, 19 };		// MTX_IDENTITY
+	commands[0x16] = { 16, 34 };	// MTX_LOAD_4x4
+	commands[0x17] = { 12, 30 };	// MTX_LOAD_4x3
+	commands[0x18] = { 16, 35 };	// MTX_MULT_4x4
+	commands[0x19] = { 12, 31 };	// MTX_MULT_4x3
+	commands[0x1A] = { 9, 28 };		// MTX_MULT_3x3
+	commands[0x1B] = { 3, 22 };		// MTX_SCALE
+	commands[0x1C] = { 3, 22 };		// MTX_TRANS
+	commands[0x20] = { 1, 1 };		// COLOR
+	commands[0x21] = { 1, 9 };		// NORMAL
+	commands[0x22] = { 1, 1 };		// TEXCOORD
+	commands[0x23] = { 2, 9 };		// VTX_16
+	commands[0x24] = { 1, 8 };		// VTX_10
+	commands[0x25] = { 1, 8 };		// VTX_XY
+	commands[0x26] = { 1, 8 };		// VTX_XZ
+	commands[0x27] = { 1, 8 };		// VTX_YZ
+	commands[0x28] = { 1, 8 };		// VTX_DIFF
+	commands[0x29] = { 1, 1 };		// POLYGON_ATTR
+	commands[0x2A] = { 1, 1 };		// TEXIMAGE_PARAM
+	commands[0x2B] = { 1, 1 };		// PLTT_BASE
+	commands[0x30] = { 1, 4 };		// DIF_AMB
+	commands[0x31] = { 1, 4 };		// SPE_EMI
+	commands[0x32] = { 1, 6 };		// LIGHT_VECTOR
+	commands[0x33] = { 1, 1 };		// LIGHT_COLOR
+	commands[0x34] = { 32, 32 };	// SHININESS
+	commands[0x40] = { 1, 1 };		// BEGIN_VTXS
+	commands[0x41] = { 0, 1 };		// END_VTXS
+	commands[0x50] = { 1, 392 };	// SWAP_BUFFERS
+	commands[0x60] = { 1, 1 };		// VIEWPORT
+	commands[0x70] = { 3, 103 };	// BOX_TEST
+	commands[0x71] = { 2, 9 };		// POS_TEST
+	commands[0x72] = { 1, 5 };		// VEC_TEST
+	return commands;
+}();
+
+// Commands with a port : every command above, except the unused numbers
+static bool HasPort(uint8_t cmd) {
+	return (cmd == 0x11) || (cmd == 0x15) || (cmd == 0x41) || (COMMANDS[cmd].params != 0);
+}
+
+static const int32_t IDENTITY[16] = { 0x1000, 0, 0, 0, 0, 0x1000, 0, 0, 0, 0, 0x1000, 0, 0, 0, 0, 0x1000 };
+
+static int32_t SignExtend(uint32_t value, int bits) {
+	return static_cast<int32_t>(value << (32 - bits)) >> (32 - bits);
+}
+
+// 5bit color to the 6bit vertex color
+static int32_t ExpandColor(int32_t c) {
+	return (c != 0) ? c * 2 + 1 : 0;
+}
+
+void GeometryEngine::Attach(ARM9_mem& mem, Scheduler* sched, InterruptController* irqCtrl, DMA* dmaCtrl, LCD& lcd, std::function<void(bool stall)> stallFunc) {
+	scheduler = sched;
+	irq = irqCtrl;
+	dma = dmaCtrl;
+	stallCpu = stallFunc;
+	io = mem.GetPointerFromAddr(GXFIFO_ADDR);
+	kernels = &GetGPU3DMatrixKernels();
+	for (auto& scene : scenes) {
+		scene.vertices.reserve(GPU3DScene::MAX_VERTICES);
+		scene.polygons.reserve(GPU3DScene::MAX_POLYGONS);
+	}
+	fifo.reserve(FIFO_SIZE);
+	memcpy(projection, IDENTITY, sizeof(IDENTITY));
+	memcpy(position, IDENTITY, sizeof(IDENTITY));
+	memcpy(vector, IDENTITY, sizeof(IDENTITY));
+	memcpy(texture, IDENTITY, sizeof(IDENTITY));
+
+	for (uint32_t addr = GXFIFO_ADDR; addr < GXFIFO_ADDR + GXFIFO_MIRROR_SIZE; addr += 4) {
+		mem.SetIOWriteHandler(addr, [this](uint32_t value, uint32_t mask) {
+			uint8_t data[4];
+			ARM_mem::SetWordAtPointer(data, value);
+			WriteFIFO(data, 1, false);
+		});
+	}
+	for (int cmd = 0x10; cmd <= 0x72; cmd++) {
+		if (!HasPort(static_cast<uint8_t>(cmd))) continue;
+		mem.SetIOWriteHandler(GXFIFO_ADDR + cmd * 4, [this, cmd](uint32_t value, uint32_t mask) { WritePort(static_cast<uint8_t>(cmd), value); });
+	}
+	dmaCtrl->SetStreamSink(GXFIFO_ADDR, [this](const uint8_t* src, uint32_t length) { return WriteFIFO(src, length / 4, true) * 4; });
+	sched->SetCallback(EVENT_GXFIFO, [this]() { UpdateIRQ(); });
+
+	mem.SetIOReadHandler(GXSTAT_ADDR, [this]() { return ReadStatus(); });
+	mem.SetIOWriteHandler(GXSTAT_ADDR, [this](uint32_t value, uint32_t mask) { WriteStatus(value, mask); });
+	mem.SetIOReadHandler(RAM_COUNT_ADDR, [this]() {
+		const GPU3DScene& scene = scenes[buildScene];
+		return static_cast<uint32_t>(scene.polygons.size() | (scene.vertices.size() << 16));
+	});
+	for (int i = 0; i < 16; i++) {
+		mem.SetIOReadHandler(CLIPMTX_RESULT_ADDR + i * 4, [this, i]() { return static_cast<uint32_t>(GetClipMatrix()[i]); });
+	}
+	for (int i = 0; i < 9; i++) {
+		mem.SetIOReadHandler(VECMTX_RESULT_ADDR + i * 4, [this, i]() { return static_cast<uint32_t>(vector[(i / 3) * 4 + (i % 3)]); });
+	}
+
+	lcd.AddCallback(LCD_CALLBACK_VBLANK, [this](uint16_t line) {
+		if (swapPending) Swap();
+	});
+}
+
+void GeometryEngine::AddSwapCallback(std::function<void(const GPU3DScene& scene)> callback) {
+	swapCallbacks.push_back(callback);
+}
+
+#pragma region Command decoding
+
+// Returns the number of words taken : the CPU always gets its words in, a DMA stops at the first one that does not fit
+uint32_t GeometryEngine::WriteFIFO(const uint8_t* data, uint32_t words, bool fromDMA) {
+	// Packed commands : one word of up to 4 command numbers, then the parameters of each
+	uint32_t i = 0;
+	for (; i < words; i++) {
+		// Parameters received so far hold FIFO entries too
+		uint32_t entries = ((paramsNeeded != 0) ? paramCount : 0) + 1;
+		if (fromDMA && swapPending && !WaitForRoom(entries)) break;
+
+		uint32_t word;
+		memcpy(&word, data + i * 4, 4);
+
+		if (paramsNeeded == 0) {
+			packedCommands = word;
+			NextPackedCommand();
+		}
+		else {
+			params[paramCount++] = word;
+			if (paramCount == paramsNeeded) {
+				paramsNeeded = 0;
+				Submit(command, params);
+				NextPackedCommand();
+			}
+		}
+	}
+	UpdateIRQ();
+	return i;
+}
+
+void GeometryEngine::NextPackedCommand() {
+	// Commands without parameters run at once, the next word is a new packed word after the last one
+	while (packedCommands != 0) {
+		uint8_t cmd = packedCommands & 0xFF;
+		packedCommands >>= 8;
+		if (COMMANDS[cmd].params == 0) {
+			if (cmd != 0) Submit(cmd, nullptr);
+			continue;
+		}
+
+		command = cmd;
+		paramsNeeded = COMMANDS[cmd].params;
+		paramCount = 0;
+		return;
+	}
+}
+
+void GeometryEngine::WritePort(uint8_t portCmd, uint32_t value) {
+	if (COMMANDS[portCmd].params == 0) {
+		Submit(portCmd, nullptr);
+	}
+	else {
+		// Switching to another port drops the parameters of the previous one
+		if (portCmd != portCommand) {
+			portCommand = portCmd;
+			portParamCount = 0;
+		}
+		portParams[portParamCount++] = value;
+		if (portParamCount == COMMANDS[portCmd].params) {
+			portParamCount = 0;
+			Submit(portCmd, portParams);
+		}
+	}
+	UpdateIRQ();
+}
+
+void GeometryEngine::Submit(uint8_t cmd, const uint32_t* cmdParams) {
+	// One FIFO entry per parameter, one for commands without parameters
+	uint8_t count = COMMANDS[cmd].params;
+	uint32_t entries = std::max<uint32_t>(count, 1);
+	bool room = WaitForRoom(entries);
+
+	if (!swapPending) {
+		commandCycles = 0;
+		Execute(cmd, cmdParams);
+
+		// The engine starts after the previous command, or now if it was idle
+		busyUntil = std::max(busyUntil, scheduler->GetTimestamp()) + commandCycles;
+		running.push_back({ busyUntil, entries });
+		runningEntries += entries;
+		return;
+	}
+
+	// Waiting for VBlank. A write that does not fit stalls the CPU until the swap makes room.
+	if (count == 0) fifo.push_back({ cmd, 0 });
+	for (uint8_t i = 0; i < count; i++) fifo.push_back({ cmd, cmdParams[i] });
+	if (!room && !cpuStalled) {
+		cpuStalled = true;
+		stallCpu(true);
+	}
+}
+
+void GeometryEngine::Retire() {
+	uint64_t now = scheduler->GetTimestamp();
+	while (!running.empty() && (running.front().end <= now)) {
+		runningEntries -= running.front().entries;
+		running.pop_front();
+	}
+}
+
+// The writer waits for running commands to free enough entries, the time is charged to the scheduler like a DMA
+// holding the bus. Commands waiting for the swap only leave at VBlank : returns false if they leave no room.
+bool GeometryEngine::WaitForRoom(uint32_t entries) {
+	Retire();
+	while ((runningEntries + fifo.size() + entries > FIFO_SIZE) && !running.empty()) {
+		scheduler->AddCycles(running.front().end - scheduler->GetTimestamp());
+		Retire();
+	}
+	return runningEntries + fifo.size() + entries <= FIFO_SIZE;
+}
+
+void GeometryEngine::UpdateIRQ() {
+	// 1 : less than half full, 2 : empty
+	uint32_t mode = GetRegister(GXSTAT_ADDR)[3] >> 6;
+	if ((mode != 1) && (mode != 2)) return;
+	size_t limit = (mode == 1) ? FIFO_SIZE / 2 - 1 : 0;
+
+	Retire();
+	size_t entries = runningEntries + fifo.size();
+	if (entries <= limit) {
+		irq->Raise(IRQ_GXFIFO);
+		return;
+	}
+
+	// Check again when enough running commands are over. Commands waiting for the swap are checked at VBlank.
+	for (const RunningCommand& oldest : running) {
+		entries -= oldest.entries;
+		if (entries <= limit) {
+			scheduler->Schedule(EVENT_GXFIFO, oldest.end - scheduler->GetTimestamp());
+			return;
+		}
+	}
+}
+
+uint32_t GeometryEngine::ReadStatus() {
+	Retire();
+	uint32_t entries = static_cast<uint32_t>(std::min<size_t>(runningEntries + fifo.size(), FIFO_SIZE));
+	bool busy = swapPending || (scheduler->GetTimestamp() < busyUntil);
+
+	uint32_t status = boxTestResult ? 0x2 : 0;
+	status |= (positionSP & 0x1F) << 8;
+	status |= (projectionSP & 0x1) << 13;
+	if (stackOverflow) status |= 1 << 15;
+	status |= entries << 16;
+	if (entries < FIFO_SIZE / 2) status |= 1 << 25;
+	if (entries == 0) status |= 1 << 26;
+	if (busy) status |= 1 << 27;
+	status |= static_cast<uint32_t>(GetRegister(GXSTAT_ADDR)[3] & 0xC0) << 24;
+	return status;
+}
+
+void GeometryEngine::WriteStatus(uint32_t value, uint32_t mask) {
+	// Writing 1 to bit 15 acknowledges the stack error
+	if ((value & mask & (1 << 15)) != 0) {
+		stackOverflow = false;
+		projectionSP = 0;
+		textureSP = 0;
+	}
+	UpdateIRQ();
+}
+
+void GeometryEngine::Swap() {
+	GPU3DScene& finished = scenes[buildScene];
+	finished.manualTranslucentSort = (swapParam & 0x1) != 0;
+	finished.wBuffer = (swapParam & 0x2) != 0;
+	buildScene = 1 - buildScene;
+	scenes[buildScene].vertices.clear();
+	scenes[buildScene].polygons.clear();
+	sharedValid = false;
+	swapPending = false;
+
+	for (auto& callback : swapCallbacks) callback(finished);
+
+	// Run what waited in the FIFO, until the next SWAP_BUFFERS if any
+	replay.swap(fifo);
+	size_t i = 0;
+	while (i < replay.size()) {
+		uint8_t cmd = replay[i].command;
+		uint8_t count = COMMANDS[cmd].params;
+		uint32_t cmdParams[MAX_PARAMS];
+		for (uint8_t p = 0; (p < count) && (i + p < replay.size()); p++) cmdParams[p] = replay[i + p].param;
+		Submit(cmd, cmdParams);
+		i += std::max<uint8_t>(count, 1);
+	}
+	replay.clear();
+
+	// Writers waiting for room go on
+	if (fifo.size() < FIFO_SIZE) {
+		if (cpuStalled) {
+			cpuStalled = false;
+			stallCpu(false);
+		}
+		dma->Trigger(DMA_START_GXFIFO);
+	}
+	UpdateIRQ();
+}
+
+void GeometryEngine::Execute(uint8_t cmd, const uint32_t* p) {
+	commandCycles += COMMANDS[cmd].cycles * ARM7_CYCLE_LENGTH;
+
+	switch (cmd) {
+	case 0x10:	// MTX_MODE
+		matrixMode = static_cast<eMatrixMode>(p[0] & 0x3);
+		break;
+	case 0x11:	// MTX_PUSH
+		PushMatrix();
+		break;
+	case 0x12:	// MTX_POP
+		PopMatrix(p[0]);
+		break;
+	case 0x13:	// MTX_STORE
+		StoreMatrix(p[0]);
+		break;
+	case 0x14:	// MTX_RESTORE
+		RestoreMatrix(p[0]);
+		break;
+	case 0x15:	// MTX_IDENTITY
+		LoadMatrix(IDENTITY);
+		break;
+	case 0x16:	// MTX_LOAD_4x4
+	case 0x18: {	// MTX_MULT_4x4
+		int32_t m[16];
+		for (int i = 0; i < 16; i++) m[i] = static_cast<int32_t>(p[i]);
+		if (cmd == 0x16) LoadMatrix(m);
+		else MultiplyMatrix(m, false);
+		break;
+	}
+	case 0x17:	// MTX_LOAD_4x3
+	case 0x19: {	// MTX_MULT_4x3
+		int32_t m[16];
+		for (int row = 0; row < 4; row++) {
+			for (int column = 0; column < 3; column++) m[row * 4 + column] = static_cast<int32_t>(p[row * 3 + column]);
+			m[row * 4 + 3] = (row == 3) ? 0x1000 : 0;
+		}
+		if (cmd == 0x17) LoadMatrix(m);
+		else MultiplyMatrix(m, false);
+		break;
+	}
+	case 0x1A: {	// MTX_MULT_3x3
+		int32_t m[16];
+		memcpy(m, IDENTITY, sizeof(m));
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 3; column++) m[row * 4 + column] = static_cast<int32_t>(p[row * 3 + column]);
+		}
+		MultiplyMatrix(m, false);
+		break;
+	}
+	case 0x1B: {	// MTX_SCALE : not applied to the vector matrix
+		int32_t m[16];
+		memcpy(m, IDENTITY, sizeof(m));
+		for (int i = 0; i < 3; i++) m[i * 5] = static_cast<int32_t>(p[i]);
+		MultiplyMatrix(m, true);
+		break;
+	}
+	case 0x1C: {	// MTX_TRANS
+		int32_t m[16];
+		memcpy(m, IDENTITY, sizeof(m));
+		for (int i = 0; i < 3; i++) m[12 + i] = static_cast<int32_t>(p[i]);
+		MultiplyMatrix(m, false);
+		break;
+	}
+	case 0x20:	// COLOR
+		for (int i = 0; i < 3; i++) vertexColor[i] = ExpandColor((p[0] >> (i * 5)) & 0x1F);
+		break;
+	case 0x21:	// NORMAL
+		SetNormal(p[0]);
+		break;
+	case 0x22:	// TEXCOORD
+		SetTexCoord(p[0]);
+		break;
+	case 0x23:	// VTX_16
+		AddVertex(static_cast<int16_t>(p[0]), static_cast<int16_t>(p[0] >> 16), static_cast<int16_t>(p[1]));
+		break;
+	case 0x24:	// VTX_10 : 4.6 fixed point
+		AddVertex(static_cast<int16_t>((p[0] & 0x3FF) << 6), static_cast<int16_t>(((p[0] >> 10) & 0x3FF) << 6), static_cast<int16_t>(((p[0] >> 20) & 0x3FF) << 6));
+		break;
+	case 0x25:	// VTX_XY
+		AddVertex(static_cast<int16_t>(p[0]), static_cast<int16_t>(p[0] >> 16), lastVertex[2]);
+		break;
+	case 0x26:	// VTX_XZ
+		AddVertex(static_cast<int16_t>(p[0]), lastVertex[1], static_cast<int16_t>(p[0] >> 16));
+		break;
+	case 0x27:	// VTX_YZ
+		AddVertex(lastVertex[0], static_cast<int16_t>(p[0]), static_cast<int16_t>(p[0] >> 16));
+		break;
+	case 0x28:	// VTX_DIFF : signed 10bit offsets, in the same units as the coordinates
+		AddVertex(static_cast<int16_t>(lastVertex[0] + SignExtend(p[0], 10)), static_cast<int16_t>(lastVertex[1] + SignExtend(p[0] >> 10, 10)),
+			static_cast<int16_t>(lastVertex[2] + SignExtend(p[0] >> 20, 10)));
+		break;
+	case 0x29:	// POLYGON_ATTR, used from the next BEGIN_VTXS
+		pendingPolygonAttr = p[0];
+		break;
+	case 0x2A:	// TEXIMAGE_PARAM
+		texParam = p[0];
+		break;
+	case 0x2B:	// PLTT_BASE
+		paletteBase = p[0] & 0x1FFF;
+		break;
+	case 0x30:	// DIF_AMB
+		for (int i = 0; i < 3; i++) {
+			diffuse[i] = (p[0] >> (i * 5)) & 0x1F;
+			ambient[i] = (p[0] >> (16 + i * 5)) & 0x1F;
+		}
+		if ((p[0] & 0x8000) != 0) {
+			for (int i = 0; i < 3; i++) vertexColor[i] = ExpandColor(diffuse[i]);
+		}
+		break;
+	case 0x31:	// SPE_EMI
+		for (int i = 0; i < 3; i++) {
+			specular[i] = (p[0] >> (i * 5)) & 0x1F;
+			emission[i] = (p[0] >> (16 + i * 5)) & 0x1F;
+		}
+		shininessTable = (p[0] & 0x8000) != 0;
+		break;
+	case 0x32:	// LIGHT_VECTOR
+		SetLightVector(p[0]);
+		break;
+	case 0x33: {	// LIGHT_COLOR
+		int light = p[0] >> 30;
+		for (int i = 0; i < 3; i++) lightColor[light][i] = (p[0] >> (i * 5)) & 0x1F;
+		break;
+	}
+	case 0x34:	// SHININESS
+		for (int i = 0; i < 128; i++) shininess[i] = static_cast<uint8_t>(p[i / 4] >> ((i % 4) * 8));
+		break;
+	case 0x40:	// BEGIN_VTXS
+		primitive = static_cast<ePrimitive>(p[0] & 0x3);
+		polygonAttr = pendingPolygonAttr;
+		primitiveCount = 0;
+		stripPolygons = 0;
+		sharedValid = false;
+		break;
+	case 0x41:	// END_VTXS : nothing to do
+		break;
+	case 0x50:	// SWAP_BUFFERS
+		swapPending = true;
+		swapParam = p[0];
+		break;
+	case 0x60:	// VIEWPORT
+		for (int i = 0; i < 4; i++) viewport[i] = (p[0] >> (i * 8)) & 0xFF;
+		break;
+	case 0x70:	// BOX_TEST
+		BoxTest(p);
+		break;
+	case 0x71: {	// POS_TEST : also sets the current vertex
+		lastVertex[0] = static_cast<int16_t>(p[0]);
+		lastVertex[1] = static_cast<int16_t>(p[0] >> 16);
+		lastVertex[2] = static_cast<int16_t>(p[1]);
+		int32_t v[4] = { lastVertex[0], lastVertex[1], lastVertex[2], 0x1000 };
+		kernels->transform(v, GetClipMatrix(), v);
+		for (int i = 0; i < 4; i++) ARM_mem::SetWordAtPointer(GetRegister(POS_RESULT_ADDR + i * 4), static_cast<uint32_t>(v[i]));
+		break;
+	}
+	case 0x72: {	// VEC_TEST : 1.9 vector by the vector matrix, 4.12 results
+		int32_t v[4] = { SignExtend(p[0], 10) << 3, SignExtend(p[0] >> 10, 10) << 3, SignExtend(p[0] >> 20, 10) << 3, 0 };
+		kernels->transform(v, vector, v);
+		for (int i = 0; i < 3; i++) ARM_mem::SetHalfWordAtPointer(GetRegister(VEC_RESULT_ADDR + i * 2), static_cast<uint16_t>(SignExtend(v[i], 16)));
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+#pragma endregion
+
+#pragma region Matrices
+
+const int32_t* GeometryEngine::GetClipMatrix() {
+	if (clipDirty) {
+		kernels->multiply(position, projection, clip);
+		clipDirty = false;
+	}
+	return clip;
+}
+
+void GeometryEngine::LoadMatrix(const int32_t* m) {
+	switch (matrixMode) {
+	case MATRIX_PROJECTION:
+		memcpy(projection, m, sizeof(projection));
+		break;
+	case MATRIX_POSITION:
+		memcpy(position, m, sizeof(position));
+		break;
+	case MATRIX_POSITION_VECTOR:
+		memcpy(position, m, sizeof(position));
+		memcpy(vector, m, sizeof(vector));
+		break;
+	case MATRIX_TEXTURE:
+		memcpy(texture, m, sizeof(texture));
+		break;
+	}
+	clipDirty = true;
+}
+
+void GeometryEngine::MultiplyMatrix(const int32_t* m, bool positionOnly) {
+	// New matrices apply first : current = m * current
+	switch (matrixMode) {
+	case MATRIX_PROJECTION:
+		kernels->multiply(m, projection, projection);
+		break;
+	case MATRIX_POSITION:
+		kernels->multiply(m, position, position);
+		break;
+	case MATRIX_POSITION_VECTOR:
+		kernels->multiply(m, position, position);
+		if (!positionOnly) kernels->multiply(m, vector, vector);
+		break;
+	case MATRIX_TEXTURE:
+		kernels->multiply(m, texture, texture);
+		break;
+	}
+	clipDirty = true;
+}
+
+void GeometryEngine::PushMatrix() {
+	switch (matrixMode) {
+	case MATRIX_PROJECTION:
+		if (projectionSP > 0) {
+			stackOverflow = true;
+			break;
+		}
+		memcpy(projectionStack, projection, sizeof(projection));
+		projectionSP++;
+		break;
+	case MATRIX_TEXTURE:
+		if (textureSP > 0) {
+			stackOverflow = true;
+			break;
+		}
+		memcpy(textureStack, texture, sizeof(texture));
+		textureSP++;
+		break;
+	default:
+		if (positionSP > 30) stackOverflow = true;
+		memcpy(positionStack[positionSP & 0x1F], position, sizeof(position));
+		memcpy(vectorStack[positionSP & 0x1F], vector, sizeof(vector));
+		positionSP = (positionSP + 1) & 0x3F;
+		break;
+	}
+}
+
+void GeometryEngine::PopMatrix(uint32_t param) {
+	switch (matrixMode) {
+	case MATRIX_PROJECTION:
+		if (projectionSP <= 0) {
+			stackOverflow = true;
+			break;
+		}
+		projectionSP--;
+		memcpy(projection, projectionStack, sizeof(projection));
+		break;
+	case MATRIX_TEXTURE:
+		if (textureSP <= 0) {
+			stackOverflow = true;
+			break;
+		}
+		textureSP--;
+		memcpy(texture, textureStack, sizeof(texture));
+		break;
+	default:
+		// Signed 6bit number of entries
+		positionSP = (positionSP - SignExtend(param, 6)) & 0x3F;
+		if (positionSP > 30) stackOverflow = true;
+		memcpy(position, positionStack[positionSP & 0x1F], sizeof(position));
+		memcpy(vector, vectorStack[positionSP & 0x1F], sizeof(vector));
+		break;
+	}
+	clipDirty = true;
+}
+
+void GeometryEngine::StoreMatrix(uint32_t param) {
+	switch (matrixMode) {
+	case MATRIX_PROJECTION:
+		memcpy(projectionStack, projection, sizeof(projection));
+		break;
+	case MATRIX_TEXTURE:
+		memcpy(textureStack, texture, sizeof(texture));
+		break;
+	default: {
+		uint32_t index = param & 0x1F;
+		if (index == 31) stackOverflow = true;
+		memcpy(positionStack[index], position, sizeof(position));
+		memcpy(vectorStack[index], vector, sizeof(vector));
+		break;
+	}
+	}
+}
+
+void GeometryEngine::RestoreMatrix(uint32_t param) {
+	switch (matrixMode) {
+	case MATRIX_PROJECTION:
+		memcpy(projection, projectionStack, sizeof(projection));
+		break;
+	case MATRIX_TEXTURE:
+		memcpy(texture, textureStack, sizeof(texture));
+		break;
+	default: {
+		uint32_t index = param & 0x1F;
+		if (index == 31) stackOverflow = true;
+		memcpy(position, positionStack[index], sizeof(position));
+		memcpy(vector, vectorStack[index], sizeof(vector));
+		break;
+	}
+	}
+	clipDirty = true;
+}
+
+#pragma endregion
+
+#pragma region Vertices & lighting
+
+void GeometryEngine::SetTexCoord(uint32_t param) {
+	rawTexCoord[0] = static_cast<int16_t>(param);
+	rawTexCoord[1] = static_cast<int16_t>(param >> 16);
+
+	// Transformation mode 1 : (S T 1/16 1/16) * texture matrix, in 12.4 fixed point
+	if ((texParam >> 30) == 1) {
+		for (int i = 0; i < 2; i++) {
+			int64_t sum = static_cast<int64_t>(rawTexCoord[0]) * texture[i] + static_cast<int64_t>(rawTexCoord[1]) * texture[4 + i] + texture[8 + i] + texture[12 + i];
+			texCoord[i] = static_cast<int32_t>(sum >> 12);
+		}
+	}
+	else {
+		texCoord[0] = rawTexCoord[0];
+		texCoord[1] = rawTexCoord[1];
+	}
+}
+
+void GeometryEngine::SetLightVector(uint32_t param) {
+	int light = param >> 30;
+	int32_t v[4] = { SignExtend(param, 10) << 3, SignExtend(param >> 10, 10) << 3, SignExtend(param >> 20, 10) << 3, 0 };
+	kernels->transform(v, vector, v);
+	for (int i = 0; i < 3; i++) lightVector[light][i] = v[i];
+}
+
+void GeometryEngine::SetNormal(uint32_t param) {
+	int32_t raw[3] = { SignExtend(param, 10), SignExtend(param >> 10, 10), SignExtend(param >> 20, 10) };
+
+	// Transformation mode 2 : texture coordinates from the normal
+	if ((texParam >> 30) == 2) {
+		for (int i = 0; i < 2; i++) {
+			int64_t sum = static_cast<int64_t>(raw[0]) * texture[i] + static_cast<int64_t>(raw[1]) * texture[4 + i] + static_cast<int64_t>(raw[2]) * texture[8 + i];
+			texCoord[i] = static_cast<int32_t>(sum >> 21) + rawTexCoord[i];
+		}
+	}
+
+	uint32_t lights = polygonAttr & 0xF;
+	if (lights == 0) return;
+
+	int32_t normal[4] = { raw[0] << 3, raw[1] << 3, raw[2] << 3, 0 };
+	kernels->transform(normal, vector, normal);
+
+	// Emission + ambient, diffuse and specular parts of every enabled light, 5bit colors
+	int32_t color[3] = { emission[0], emission[1], emission[2] };
+	for (int light = 0; light < 4; light++) {
+		if ((lights & (1 << light)) == 0) continue;
+		commandCycles += ARM7_CYCLE_LENGTH;
+		const int32_t* l = lightVector[light];
+
+		int64_t dot = static_cast<int64_t>(l[0]) * normal[0] + static_cast<int64_t>(l[1]) * normal[1] + static_cast<int64_t>(l[2]) * normal[2];
+		int32_t diffuseLevel = std::clamp<int32_t>(static_cast<int32_t>(-dot >> 12), 0, 0x1000);
+
+		// Half way between the light and the line of sight (0, 0, -1)
+		int64_t half = static_cast<int64_t>(l[0]) * normal[0] + static_cast<int64_t>(l[1]) * normal[1] + static_cast<int64_t>(l[2] - 0x1000) * normal[2];
+		int32_t shine = std::clamp<int32_t>(static_cast<int32_t>(-half >> 13), 0, 0x1000);
+		shine = (shine * shine) >> 12;
+		if (shininessTable) shine = shininess[std::min(shine >> 5, 127)] << 4;
+
+		for (int i = 0; i < 3; i++) {
+			int32_t c = lightColor[light][i];
+			color[i] += (specular[i] * c * shine) >> 17;
+			color[i] += (diffuse[i] * c * diffuseLevel) >> 17;
+			color[i] += (ambient[i] * c) >> 5;
+		}
+	}
+	for (int i = 0; i < 3; i++) vertexColor[i] = ExpandColor(std::min(color[i], 31));
+}
+
+void GeometryEngine::AddVertex(int16_t x, int16_t y, int16_t z) {
+	lastVertex[0] = x;
+	lastVertex[1] = y;
+	lastVertex[2] = z;
+
+	// Transformation mode 3 : texture coordinates from the vertex
+	if ((texParam >> 30) == 3) {
+		for (int i = 0; i < 2; i++) {
+			int64_t sum = static_cast<int64_t>(x) * texture[i] + static_cast<int64_t>(y) * texture[4 + i] + static_cast<int64_t>(z) * texture[8 + i];
+			texCoord[i] = static_cast<int32_t>(sum >> 24) + rawTexCoord[i];
+		}
+	}
+
+	ClipVertex& vertex = primitiveVertices[primitiveCount++];
+	int32_t v[4] = { x, y, z, 0x1000 };
+	kernels->transform(v, GetClipMatrix(), vertex.position);
+	memcpy(vertex.color, vertexColor, sizeof(vertex.color));
+	memcpy(vertex.texCoord, texCoord, sizeof(vertex.texCoord));
+	vertex.id = ++nextVertexId;
+
+	ClipVertex* p = primitiveVertices;
+	switch (primitive) {
+	case PRIMITIVE_TRIANGLES:
+		if (primitiveCount < 3) return;
+		SubmitPolygon(std::array<const ClipVertex*, 3>{ &p[0], &p[1], &p[2] }.data(), 3);
+		primitiveCount = 0;
+		break;
+	case PRIMITIVE_QUADS:
+		if (primitiveCount < 4) return;
+		SubmitPolygon(std::array<const ClipVertex*, 4>{ &p[0], &p[1], &p[2], &p[3] }.data(), 4);
+		primitiveCount = 0;
+		break;
+	case PRIMITIVE_TRIANGLE_STRIP:
+		if (primitiveCount < 3) return;
+		// Every other triangle is reversed, so they all face the same way
+		if ((stripPolygons & 1) != 0) SubmitPolygon(std::array<const ClipVertex*, 3>{ &p[1], &p[0], &p[2] }.data(), 3);
+		else SubmitPolygon(std::array<const ClipVertex*, 3>{ &p[0], &p[1], &p[2] }.data(), 3);
+		stripPolygons++;
+		p[0] = p[1];
+		p[1] = p[2];
+		primitiveCount = 2;
+		break;
+	case PRIMITIVE_QUAD_STRIP:
+		if (primitiveCount < 4) return;
+		SubmitPolygon(std::array<const ClipVertex*, 4>{ &p[0], &p[1], &p[3], &p[2] }.data(), 4);
+		p[0] = p[2];
+		p[1] = p[3];
+		primitiveCount = 2;
+		break;
+	}
+}
+
+#pragma endregion
+
+#pragma region Polygons
+
+// Orientation of the first 3 vertices, from the determinant of their (x, y, w) : positive when counterclockwise on screen
+static bool IsFrontFacing(const int32_t* v0, const int32_t* v1, const int32_t* v2) {
+	// Drop low bits so the 3x3 determinant fits in 64 bits
+	int32_t maxValue = 0;
+	for (const int32_t* v : { v0, v1, v2 }) {
+		for (int i : { 0, 1, 3 }) maxValue = std::max(maxValue, std::abs(v[i]));
+	}
+	int shift = 0;
+	while ((maxValue >> shift) >= (1 << 20)) shift++;
+
+	int64_t a[3][3];
+	const int32_t* rows[3] = { v0, v1, v2 };
+	for (int r = 0; r < 3; r++) {
+		a[r][0] = rows[r][0] >> shift;
+		a[r][1] = rows[r][1] >> shift;
+		a[r][2] = rows[r][3] >> shift;
+	}
+	int64_t det = a[0][0] * (a[1][1] * a[2][2] - a[2][1] * a[1][2]) - a[0][1] * (a[1][0] * a[2][2] - a[2][0] * a[1][2]) + a[0][2] * (a[1][0] * a[2][1] - a[2][0] * a[1][1]);
+	return det >= 0;
+}
+
+void GeometryEngine::SubmitPolygon(const ClipVertex* const* vertices, int count) {
+	GPU3DScene& scene = scenes[buildScene];
+	if (scene.polygons.size() >= GPU3DScene::MAX_POLYGONS) return;
+
+	bool front = IsFrontFacing(vertices[0]->position, vertices[1]->position, vertices[2]->position);
+	if ((polygonAttr & (front ? 0x80 : 0x40)) == 0) {
+		sharedValid = false;
+		return;
+	}
+
+	ClipVertex clipped[GPU3DPolygon::MAX_VERTICES + 2];
+	for (int i = 0; i < count; i++) clipped[i] = *vertices[i];
+	bool farClipped = false;
+	int clippedCount = ClipPolygon(clipped, count, farClipped);
+
+	// Polygons crossing the far plane are hidden unless POLYGON_ATTR bit 12 is set
+	if ((clippedCount < 3) || (farClipped && ((polygonAttr & (1 << 12)) == 0))) {
+		sharedValid = false;
+		return;
+	}
+	if (scene.vertices.size() + clippedCount > GPU3DScene::MAX_VERTICES) return;
+
+	GPU3DPolygon polygon;
+	polygon.vertexCount = static_cast<uint8_t>(clippedCount);
+	polygon.frontFacing = front;
+	polygon.attributes = polygonAttr;
+	polygon.texParam = texParam;
+	polygon.paletteBase = paletteBase;
+	uint32_t alpha = (polygonAttr >> 16) & 0x1F;
+	uint32_t format = (texParam >> 26) & 0x7;
+	polygon.translucent = ((alpha != 0) && (alpha != 31)) || (format == 1) || (format == 6);
+
+	// Strips share the vertices of the previous polygon, unless clipping moved them
+	uint32_t ids[GPU3DPolygon::MAX_VERTICES];
+	int16_t yTop = INT16_MAX;
+	int16_t yBottom = INT16_MIN;
+	for (int i = 0; i < clippedCount; i++) {
+		uint16_t index = UINT16_MAX;
+		ids[i] = clipped[i].id;
+		if (sharedValid && (clipped[i].id != 0)) {
+			for (int s = 0; s < 2; s++) {
+				if (sharedIds[s] == clipped[i].id) index = sharedIndices[s];
+			}
+		}
+		if (index == UINT16_MAX) index = AddScreenVertex(clipped[i]);
+		polygon.vertices[i] = index;
+
+		int16_t y = static_cast<int16_t>(scene.vertices[index].y);
+		yTop = std::min(yTop, y);
+		yBottom = std::max(yBottom, y);
+	}
+	polygon.yTop = yTop;
+	polygon.yBottom = yBottom;
+	scene.polygons.push_back(polygon);
+
+	// The next polygon of a strip starts with the last 2 vertices of this one
+	sharedValid = (primitive == PRIMITIVE_TRIANGLE_STRIP) || (primitive == PRIMITIVE_QUAD_STRIP);
+	for (int s = 0; s < 2; s++) {
+		sharedIds[s] = 0;
+		for (int i = 0; i < clippedCount; i++) {
+			if (ids[i] == primitiveVertices[s + ((primitive == PRIMITIVE_QUAD_STRIP) ? 2 : 1)].id) {
+				sharedIds[s] = ids[i];
+				sharedIndices[s] = polygon.vertices[i];
+			}
+		}
+	}
+}
+
+int GeometryEngine::ClipPolygon(ClipVertex* vertices, int count, bool& farClipped) const {
+	// Sutherland-Hodgman against -w <= z <= w, then x, then y. New vertices have no id.
+	ClipVertex buffer[GPU3DPolygon::MAX_VERTICES + 2];
+	for (int plane = 0; plane < 6; plane++) {
+		int axis = (plane < 2) ? 2 : ((plane < 4) ? 0 : 1);
+		int32_t sign = ((plane & 1) == 0) ? 1 : -1;	// Inside when w + sign * v >= 0
+
+		int outCount = 0;
+		for (int i = 0; i < count; i++) {
+			const ClipVertex& a = vertices[i];
+			const ClipVertex& b = vertices[(i + 1) % count];
+			int64_t da = static_cast<int64_t>(a.position[3]) + sign * static_cast<int64_t>(a.position[axis]);
+			int64_t db = static_cast<int64_t>(b.position[3]) + sign * static_cast<int64_t>(b.position[axis]);
+
+			if (da >= 0) buffer[outCount++] = a;
+			if ((da >= 0) != (db >= 0)) {
+				if (plane == 1) farClipped = true;
+
+				// Intersection, 16bit fraction from a to b
+				int64_t factor = (da << 16) / (da - db);
+				ClipVertex& v = buffer[outCount++];
+				for (int c = 0; c < 4; c++) v.position[c] = static_cast<int32_t>(a.position[c] + (((static_cast<int64_t>(b.position[c]) - a.position[c]) * factor) >> 16));
+				for (int c = 0; c < 3; c++) v.color[c] = static_cast<int32_t>(a.color[c] + (((static_cast<int64_t>(b.color[c]) - a.color[c]) * factor) >> 16));
+				for (int c = 0; c < 2; c++) v.texCoord[c] = static_cast<int32_t>(a.texCoord[c] + (((static_cast<int64_t>(b.texCoord[c]) - a.texCoord[c]) * factor) >> 16));
+				v.id = 0;
+			}
+			if (outCount > GPU3DPolygon::MAX_VERTICES) return 0;
+		}
+
+		count = outCount;
+		memcpy(vertices, buffer, count * sizeof(ClipVertex));
+		if (count < 3) return count;
+	}
+	return count;
+}
+
+uint16_t GeometryEngine::AddScreenVertex(const ClipVertex& vertex) {
+	GPU3DScene& scene = scenes[buildScene];
+	int64_t x = vertex.position[0];
+	int64_t y = vertex.position[1];
+	int64_t z = vertex.position[2];
+	int64_t w = std::max(vertex.position[3], 1);
+
+	// Viewport : X1, Y1 is the bottom left corner
+	int64_t width = viewport[2] - viewport[0] + 1;
+	int64_t height = viewport[3] - viewport[1] + 1;
+
+	GPU3DVertex screen;
+	screen.x = static_cast<int32_t>(std::clamp<int64_t>(((x + w) * width) / (2 * w) + viewport[0], 0, 256));
+	screen.y = static_cast<int32_t>(std::clamp<int64_t>(((w - y) * height) / (2 * w) + (191 - viewport[3]), 0, 192));
+	screen.z = static_cast<int32_t>(std::clamp<int64_t>(((z * 0x4000) / w + 0x3FFF) * 0x200, 0, 0xFFFFFF));
+	screen.w = static_cast<int32_t>(w);
+	screen.s = static_cast<int16_t>(vertex.texCoord[0]);
+	screen.t = static_cast<int16_t>(vertex.texCoord[1]);
+	for (int i = 0; i < 3; i++) screen.color[i] = static_cast<uint8_t>(std::clamp(vertex.color[i], 0, 63));
+
+	scene.vertices.push_back(screen);
+	return static_cast<uint16_t>(scene.vertices.size() - 1);
+}
+
+void GeometryEngine::BoxTest(const uint32_t* p) {
+	// Box from a corner and its sizes, 4.12 fixed point : visible unless all corners are outside the same plane
+	int32_t corner[3] = { static_cast<int16_t>(p[0]), static_cast<int16_t>(p[0] >> 16), static_cast<int16_t>(p[1]) };
+	int32_t size[3] = { static_cast<int16_t>(p[1] >> 16), static_cast<int16_t>(p[2]), static_cast<int16_t>(p[2] >> 16) };
+	const int32_t* m = GetClipMatrix();
+
+	uint32_t outside = 0x3F;
+	for (int i = 0; i < 8; i++) {
+		int32_t v[4] = { corner[0] + ((i & 1) ? size[0] : 0), corner[1] + ((i & 2) ? size[1] : 0), corner[2] + ((i & 4) ? size[2] : 0), 0x1000 };
+		kernels->transform(v, m, v);
+
+		uint32_t planes = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			if (v[axis] < -v[3]) planes |= 1 << (axis * 2);
+			if (v[axis] > v[3]) planes |= 2 << (axis * 2);
+		}
+		outside &= planes;
+	}
+	boxTestResult = outside == 0;
+}
+
+#pragma endregion
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+#include "arm9_mem.h"
+#include "scheduler.h"
+#include "interrupts.h"
+#include "dma.h"
+#include "lcd.h"
+#include "gpu3d_matrix.h"
+
+/// <summary>
+/// Vertex of the polygon list, after clipping and viewport transform
+/// </summary>
+struct GPU3DVertex {
+	int32_t x;			// Screen position, in pixels (0 to 256, 0 to 192)
+	int32_t y;
+	int32_t z;			// Z buffer depth, 24 bits
+	int32_t w;			// Clip space W, for W buffering and perspective correct interpolation
+	int16_t s;			// Texture coordinates, 12.4 fixed point
+	int16_t t;
+	uint8_t color[3];	// R, G, B, 6 bits each
+};
+
+/// <summary>
+/// Polygon of the polygon list, with the attributes it was submitted with
+/// </summary>
+struct GPU3DPolygon {
+	static const int MAX_VERTICES = 10;	// A quad clipped by the 6 planes
+
+	uint16_t vertices[MAX_VERTICES];	// Indices in the vertex list, in submission order
+	uint8_t vertexCount;
+	bool frontFacing;
+	bool translucent;		// Alpha from 1 to 30, or A3I5 / A5I3 texture
+	uint32_t attributes;	// POLYGON_ATTR
+	uint32_t texParam;		// TEXIMAGE_PARAM
+	uint32_t paletteBase;	// PLTT_BASE
+	int16_t yTop;			// Lines covered, yTop included, yBottom excluded
+	int16_t yBottom;
+};
+
+/// <summary>
+/// Vertex and polygon lists of one frame, as swapped by SWAP_BUFFERS
+/// </summary>
+struct GPU3DScene {
+	static const size_t MAX_VERTICES = 6144;
+	static const size_t MAX_POLYGONS = 2048;
+
+	std::vector<GPU3DVertex> vertices;
+	std::vector<GPU3DPolygon> polygons;
+	bool manualTranslucentSort{ false };	// SWAP_BUFFERS bit 0
+	bool wBuffer{ false };					// SWAP_BUFFERS bit 1
+};
+
+/// <summary>
+/// ARM9 geometry engine : GXFIFO and command ports, matrix stacks, lighting, clipping and the polygon lists.
+/// Commands run as soon as their last parameter arrives, then hold their FIFO entries until their cycles are over :
+/// a writer finding the FIFO full waits for the oldest ones. After SWAP_BUFFERS, commands wait in the FIFO until
+/// VBlank. When it is full, the CPU is stalled and GXFIFO DMAs pause until the swap.
+/// </summary>
+class GeometryEngine {
+private:
+	static const int MAX_PARAMS = 32;
+	static const uint32_t FIFO_SIZE = 256;
+	static const int POSITION_STACK_SIZE = 32;	// The last entry can be reached, but sets the overflow error
+
+	enum eMatrixMode {
+		MATRIX_PROJECTION,
+		MATRIX_POSITION,
+		MATRIX_POSITION_VECTOR,
+		MATRIX_TEXTURE,
+	};
+
+	enum ePrimitive {
+		PRIMITIVE_TRIANGLES,
+		PRIMITIVE_QUADS,
+		PRIMITIVE_TRIANGLE_STRIP,
+		PRIMITIVE_QUAD_STRIP,
+	};
+
+	// Vertex in clip space, before the polygon is clipped
+	struct ClipVertex {
+		int32_t position[4];
+		int32_t color[3];
+		int32_t texCoord[2];
+		uint32_t id;		// Submission number, to share the screen vertex between polygons of a strip
+	};
+
+	struct FIFOEntry {
+		uint8_t command;
+		uint32_t param;
+	};
+
+	struct RunningCommand {
+		uint64_t end;		// Timestamp when its cycles are over
+		uint32_t entries;
+	};
+
+	Scheduler* scheduler{ nullptr };
+	InterruptController* irq{ nullptr };
+	DMA* dma{ nullptr };
+	std::function<void(bool stall)> stallCpu;
+	uint8_t* io{ nullptr };	// I/O memory at GXFIFO_ADDR
+	const GPU3DMatrixKernels* kernels{ nullptr };
+
+	// GXFIFO decoding : remaining commands of the packed word, and the command waiting for parameters
+	uint32_t packedCommands{ 0 };
+	uint8_t command{ 0 };
+	uint8_t paramsNeeded{ 0 };
+	uint8_t paramCount{ 0 };
+	uint32_t params[MAX_PARAMS]{};
+
+	// Command ports
+	uint8_t portCommand{ 0 };
+	uint8_t portParamCount{ 0 };
+	uint32_t portParams[MAX_PARAMS]{};
+
+	// SWAP_BUFFERS waits for VBlank, the following commands wait in the FIFO
+	bool swapPending{ false };
+	uint32_t swapParam{ 0 };
+	std::vector<FIFOEntry> fifo;
+	std::vector<FIFOEntry> replay;
+
+	// Commands that ran and still hold their FIFO entries, oldest first
+	std::deque<RunningCommand> running;
+	uint32_t runningEntries{ 0 };
+	uint64_t busyUntil{ 0 };
+	uint64_t commandCycles{ 0 };
+	bool cpuStalled{ false };
+
+	// GXSTAT
+	bool boxTestResult{ false };
+	bool stackOverflow{ false };
+
+	// Matrices
+	eMatrixMode matrixMode{ MATRIX_PROJECTION };
+	int32_t projection[16]{};
+	int32_t projectionStack[16]{};
+	int projectionSP{ 0 };
+	int32_t position[16]{};
+	int32_t vector[16]{};
+	int32_t positionStack[POSITION_STACK_SIZE][16]{};
+	int32_t vectorStack[POSITION_STACK_SIZE][16]{};
+	int positionSP{ 0 };
+	int32_t texture[16]{};
+	int32_t textureStack[16]{};
+	int textureSP{ 0 };
+	int32_t clip[16]{};
+	bool clipDirty{ true };
+
+	// Vertex attributes
+	int16_t lastVertex[3]{};
+	int32_t vertexColor[3]{};		// 6 bits
+	int16_t rawTexCoord[2]{};
+	int32_t texCoord[2]{};
+	uint32_t pendingPolygonAttr{ 0 };
+	uint32_t polygonAttr{ 0 };		// Latched by BEGIN_VTXS
+	uint32_t texParam{ 0 };
+	uint32_t paletteBase{ 0 };
+	int viewport[4]{ 0, 0, 255, 191 };	// X1, Y1 (bottom left), X2, Y2
+
+	// Lighting, colors are 5 bits per channel
+	int32_t diffuse[3]{};
+	int32_t ambient[3]{};
+	int32_t specular[3]{};
+	int32_t emission[3]{};
+	bool shininessTable{ false };
+	uint8_t shininess[128]{};
+	int32_t lightVector[4][3]{};	// Transformed by the vector matrix, 12 bits fraction
+	int32_t lightColor[4][3]{};
+
+	// Primitive being built
+	ePrimitive primitive{ PRIMITIVE_TRIANGLES };
+	ClipVertex primitiveVertices[4]{};
+	int primitiveCount{ 0 };
+	uint32_t stripPolygons{ 0 };
+	uint32_t nextVertexId{ 0 };
+	uint32_t sharedIds[2]{};		// Screen vertices of the last polygon that the next one of a strip may share
+	uint16_t sharedIndices[2]{};
+	bool sharedValid{ false };
+
+	GPU3DScene scenes[2];
+	int buildScene{ 0 };
+	std::vector<std::function<void(const GPU3DScene& scene)>> swapCallbacks;
+
+	uint8_t* GetRegister(uint32_t address) const {
+		return io + (address - GXFIFO_ADDR);
+	}
+
+	uint32_t WriteFIFO(const uint8_t* data, uint32_t words, bool fromDMA);
+	void WritePort(uint8_t portCmd, uint32_t value);
+	void NextPackedCommand();
+	void Submit(uint8_t cmd, const uint32_t* cmdParams);
+	void Execute(uint8_t cmd, const uint32_t* cmdParams);
+	void Retire();
+	bool WaitForRoom(uint32_t entries);
+	void UpdateIRQ();
+	void Swap();
+	uint32_t ReadStatus();
+	void WriteStatus(uint32_t value, uint32_t mask);
+
+	const int32_t* GetClipMatrix();
+	void LoadMatrix(const int32_t* m);
+	void MultiplyMatrix(const int32_t* m, bool positionOnly);
+	void PushMatrix();
+	void PopMatrix(uint32_t param);
+	void StoreMatrix(uint32_t param);
+	void RestoreMatrix(uint32_t param);
+
+	void SetNormal(uint32_t param);
+	void SetTexCoord(uint32_t param);
+	void SetLightVector(uint32_t param);
+	void AddVertex(int16_t x, int16_t y, int16_t z);
+	void SubmitPolygon(const ClipVertex* const* vertices, int count);
+	int ClipPolygon(ClipVertex* vertices, int count, bool& farClipped) const;
+	uint16_t AddScreenVertex(const ClipVertex& vertex);
+	void BoxTest(const uint32_t* cmdParams);
+
+public:
+	static const uint32_t GXFIFO_ADDR = 0x04000400;
+	static const uint32_t GXFIFO_MIRROR_SIZE = 0x40;
+	static const uint32_t GXSTAT_ADDR = 0x04000600;
+	static const uint32_t RAM_COUNT_ADDR = 0x04000604;
+	static const uint32_t POS_RESULT_ADDR = 0x04000620;
+	static const uint32_t VEC_RESULT_ADDR = 0x04000630;
+	static const uint32_t CLIPMTX_RESULT_ADDR = 0x04000640;
+	static const uint32_t VECMTX_RESULT_ADDR = 0x04000680;
+
+	/// <summary>
+	/// Map the GXFIFO, command ports and status registers into the ARM9 I/O table
+	/// </summary>
+	/// <param name="mem">ARM9 virtual memory</param>
+	/// <param name="sched">ARM9 scheduler</param>
+	/// <param name="irqCtrl">ARM9 interrupt controller (GXFIFO IRQ)</param>
+	/// <param name="dmaCtrl">ARM9 DMA controller, its GXFIFO transfers are decoded a block at a time</param>
+	/// <param name="lcd">ARM9 display timing, buffers are swapped at VBlank</param>
+	/// <param name="stallFunc">Stops (true) or restarts (false) the ARM9 while it waits for room in the FIFO</param>
+	void Attach(ARM9_mem& mem, Scheduler* sched, InterruptController* irqCtrl, DMA* dmaCtrl, LCD& lcd, std::function<void(bool stall)> stallFunc);
+
+	/// <summary>
+	/// Select the kernels used for matrix math, mainly to compare them
+	/// </summary>
+	void SetSIMDLevel(eSIMDLevel level) {
+		kernels = &GetGPU3DMatrixKernels(level);
+	}
+
+	const GPU3DMatrixKernels& GetKernels() const {
+		return *kernels;
+	}
+
+	/// <summary>
+	/// Register a function called at VBlank after SWAP_BUFFERS, with the lists to render for the next frame
+	/// </summary>
+	void AddSwapCallback(std::function<void(const GPU3DScene& scene)> callback);
+
+	/// <summary>
+	/// Get the lists swapped at the last VBlank
+	/// </summary>
+	const GPU3DScene& GetRenderScene() const {
+		return scenes[1 - buildScene];
+	}
+};
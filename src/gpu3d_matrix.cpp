@@ -0,0 +1,35 @@
+#include "gpu3d_matrix.h"
+#include <cstring>
+
+static void MultiplyScalar(const int32_t* a, const int32_t* b, int32_t* out) {
+	int32_t result[16];
+	for (int row = 0; row < 4; row++) {
+		for (int column = 0; column < 4; column++) {
+			int64_t sum = 0;
+			for (int k = 0; k < 4; k++) sum += static_cast<int64_t>(a[row * 4 + k]) * b[k * 4 + column];
+			result[row * 4 + column] = static_cast<int32_t>(sum >> 12);
+		}
+	}
+	memcpy(out, result, sizeof(result));
+}
+
+static void TransformScalar(const int32_t* v, const int32_t* m, int32_t* out) {
+	int32_t result[4];
+	for (int column = 0; column < 4; column++) {
+		int64_t sum = 0;
+		for (int k = 0; k < 4; k++) sum += static_cast<int64_t>(v[k]) * m[k * 4 + column];
+		result[column] = static_cast<int32_t>(sum >> 12);
+	}
+	memcpy(out, result, sizeof(result));
+}
+
+// No signed 32x32 to 64bit multiply before SSE4.1 : SSE2 hosts use the scalar kernels
+static const GPU3DMatrixKernels scalarKernels = { "scalar", MultiplyScalar, TransformScalar };
+
+const GPU3DMatrixKernels& GetGPU3DMatrixKernels(eSIMDLevel level) {
+#ifdef SIMD_HAS_X86_KERNELS
+	static const bool avx2 = HostSupportsAVX2();
+	if (((level == SIMD_BEST) || (level == SIMD_AVX2)) && avx2) return GetGPU3DMatrixKernelsAVX2();
+#endif
+	return scalarKernels;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include "simd.h"
+
+// Fixed point matrix math of the geometry engine. Matrices are 4x4, 20.12 fixed point, row major (m[row * 4 + column]),
+// and vectors are rows : v' = v * M. Products are summed on 64 bits, then shifted right by 12 and truncated to 32 bits.
+
+/// <summary>
+/// One implementation of the matrix operations. All implementations give the same results, bit for bit.
+/// </summary>
+struct GPU3DMatrixKernels {
+	const char* name;
+
+	/// <summary>
+	/// out = a * b, out may be a or b
+	/// </summary>
+	void (*multiply)(const int32_t* a, const int32_t* b, int32_t* out);
+
+	/// <summary>
+	/// out = v * m, 4 components, out may be v
+	/// </summary>
+	void (*transform)(const int32_t* v, const int32_t* m, int32_t* out);
+};
+
+/// <summary>
+/// Get the matrix kernels for a SIMD level, lowered to what the host CPU and the build support
+/// </summary>
+/// <param name="level">Requested level</param>
+/// <returns>Kernel table, valid until the end of the program</returns>
+const GPU3DMatrixKernels& GetGPU3DMatrixKernels(eSIMDLevel level = SIMD_BEST);
+
+#ifdef SIMD_HAS_X86_KERNELS
+const GPU3DMatrixKernels& GetGPU3DMatrixKernelsAVX2();
+#endif
@@ -0,0 +1,41 @@
+// Built with AVX2 enabled (see CMakeLists.txt), only called after checking the host CPU
+#include "gpu3d_matrix.h"
+
+#ifdef SIMD_HAS_X86_KERNELS
+#include <immintrin.h>
+
+// One row of the result : the sum of the rows of m, weighted by the components of v, in 4 64bit lanes.
+// There is no 64bit arithmetic shift : a logical one gives the same low 32 bits for shifts up to 32.
+static __m128i TransformRow(const int32_t* v, const __m256i* rows) {
+	__m256i sum = _mm256_mul_epi32(_mm256_set1_epi64x(v[0]), rows[0]);
+	sum = _mm256_add_epi64(sum, _mm256_mul_epi32(_mm256_set1_epi64x(v[1]), rows[1]));
+	sum = _mm256_add_epi64(sum, _mm256_mul_epi32(_mm256_set1_epi64x(v[2]), rows[2]));
+	sum = _mm256_add_epi64(sum, _mm256_mul_epi32(_mm256_set1_epi64x(v[3]), rows[3]));
+	sum = _mm256_srli_epi64(sum, 12);
+	return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(sum, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+}
+
+static void LoadRows(const int32_t* m, __m256i* rows) {
+	for (int k = 0; k < 4; k++) rows[k] = _mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(m + k * 4)));
+}
+
+static void MultiplyAVX2(const int32_t* a, const int32_t* b, int32_t* out) {
+	__m256i rows[4];
+	LoadRows(b, rows);
+	__m128i result[4];
+	for (int row = 0; row < 4; row++) result[row] = TransformRow(a + row * 4, rows);
+	for (int row = 0; row < 4; row++) _mm_storeu_si128(reinterpret_cast<__m128i*>(out + row * 4), result[row]);
+}
+
+static void TransformAVX2(const int32_t* v, const int32_t* m, int32_t* out) {
+	__m256i rows[4];
+	LoadRows(m, rows);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out), TransformRow(v, rows));
+}
+
+static const GPU3DMatrixKernels avx2Kernels = { "AVX2", MultiplyAVX2, TransformAVX2 };
+
+const GPU3DMatrixKernels& GetGPU3DMatrixKernelsAVX2() {
+	return avx2Kernels;
+}
+#endif
@@ -0,0 +1,530 @@
+#include "gpu3d_renderer.h"
+#include <algorithm>
+#include <cstring>
+
+// Unmapped texture slots read as 0
+static const uint8_t zeroPage[0x4000 + 4] = {};
+
+static uint32_t Channel(uint32_t color, int channel) {
+	return (color >> (channel * 8)) & ((channel == 3) ? 0x1F : 0x3F);
+}
+
+static uint16_t Read16(const uint8_t* ptr) {
+	return static_cast<uint16_t>(ptr[0] | (ptr[1] << 8));
+}
+
+void GPU3DRenderer::Attach(ARM9_mem& mem, VRAM& vramBanks, const GeometryEngine& geometryEngine) {
+	registers = mem.GetPointerFromAddr(DISP3DCNT_ADDR);
+	vram = &vramBanks;
+	banks = vramBanks.GetBanks();
+	geometry = &geometryEngine;
+	vramBanks.AddWriteWatch([this](uint32_t offset, uint32_t length) { textureCache.VRAMWritten(offset, length); });
+
+	top = std::make_unique<Pixel[]>(WIDTH * HEIGHT);
+	below = std::make_unique<Pixel[]>(WIDTH * HEIGHT);
+	stencil = std::make_unique<uint8_t[]>(WIDTH * HEIGHT);
+	output = std::make_unique<uint32_t[]>(WIDTH * HEIGHT);
+	std::fill(output.get(), output.get() + WIDTH * HEIGHT, 0);
+}
+
+GPU3DRenderer::~GPU3DRenderer() {
+	StopWorkers();
+}
+
+#pragma region Worker pool
+void GPU3DRenderer::SetThreadCount(int count) {
+	StopWorkers();
+	if (count <= 0) count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	count = std::min(count, BAND_COUNT);
+
+	stopWorkers = false;
+	for (int i = 1; i < count; i++) workers.emplace_back(&GPU3DRenderer::WorkerLoop, this, passNumber);
+}
+
+void GPU3DRenderer::StopWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopWorkers = true;
+	}
+	started.notify_all();
+	for (std::thread& worker : workers) worker.join();
+	workers.clear();
+}
+
+void GPU3DRenderer::WorkerLoop(uint64_t seen) {
+	// Passes are counted from the one before the thread was started, so that none is missed
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			started.wait(lock, [this, seen]() { return stopWorkers || (passNumber != seen); });
+			if (stopWorkers) return;
+			seen = passNumber;
+		}
+
+		RunBands();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busyWorkers--;
+		}
+		finished.notify_all();
+	}
+}
+
+void GPU3DRenderer::RunBands() {
+	while (true) {
+		int band = nextBand.fetch_add(1);
+		if (band >= BAND_COUNT) return;
+		for (int y = band * BAND_LINES; y < (band + 1) * BAND_LINES; y++) (this->*pass)(y);
+	}
+}
+
+void GPU3DRenderer::RunPass(void (GPU3DRenderer::*linePass)(int line)) {
+	pass = linePass;
+	nextBand = 0;
+	if (workers.empty()) {
+		RunBands();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		busyWorkers = static_cast<int>(workers.size());
+		passNumber++;
+	}
+	started.notify_all();
+	RunBands();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this]() { return busyWorkers == 0; });
+}
+#pragma endregion
+
+void GPU3DRenderer::Render() {
+	memcpy(latched, registers, REGISTERS_SIZE);
+
+	const uint32_t* textureView = vram->GetView(VRAM_VIEW_TEXTURE);
+	const uint32_t* texpalView = vram->GetView(VRAM_VIEW_TEXPAL);
+	for (int i = 0; i < static_cast<int>(TEXTURE_SIZE / VRAM::PAGE_SIZE); i++) {
+		texturePages[i] = (textureView[i] != VRAM::UNMAPPED) ? banks + textureView[i] : zeroPage;
+	}
+	textureCache.StartFrame(banks, textureView, texpalView);
+
+	const GPU3DScene& scene = geometry->GetRenderScene();
+	wBuffer = scene.wBuffer;
+	PreparePolygons(scene);
+
+	// Edge marking and anti-aliasing look at the lines above and below : every line is rasterized first
+	RunPass(&GPU3DRenderer::RasterizeLine);
+	RunPass(&GPU3DRenderer::FinishLine);
+}
+
+void GPU3DRenderer::PreparePolygons(const GPU3DScene& scene) {
+	polygons.clear();
+	bool texturing = (Get16(0) & 1) != 0;
+	for (const GPU3DPolygon& source : scene.polygons) {
+		if (source.yTop >= source.yBottom) continue;
+
+		Polygon polygon;
+		polygon.source = &source;
+		polygon.vertexCount = source.vertexCount;
+		polygon.yTop = source.yTop;
+		polygon.yBottom = source.yBottom;
+		polygon.texels = texturing ? textureCache.GetTexture(source.texParam, source.paletteBase) : nullptr;
+
+		// W values of a polygon are scaled together to 16 bits : only their ratios matter to perspective correction
+		int32_t maxW = 1;
+		for (int i = 0; i < polygon.vertexCount; i++) {
+			polygon.vertices[i] = &scene.vertices[source.vertices[i]];
+			maxW = std::max(maxW, polygon.vertices[i]->w);
+		}
+		int shiftDown = 0;
+		while ((maxW >> shiftDown) > 0xFFFF) shiftDown++;
+		int shiftUp = 0;
+		while ((shiftDown == 0) && ((maxW << shiftUp) <= 0x7FFF)) shiftUp++;
+		for (int i = 0; i < polygon.vertexCount; i++) {
+			polygon.w[i] = std::max(1, (polygon.vertices[i]->w >> shiftDown) << shiftUp);
+		}
+		polygons.push_back(polygon);
+	}
+
+	// Opaque polygons first, then translucent ones. Both sorted by their bottom then top line, unless translucent
+	// polygons are sorted manually (SWAP_BUFFERS bit 0).
+	bool manualSort = scene.manualTranslucentSort;
+	std::stable_sort(polygons.begin(), polygons.end(), [manualSort](const Polygon& a, const Polygon& b) {
+		if (a.source->translucent != b.source->translucent) return b.source->translucent;
+		if (a.source->translucent && manualSort) return false;
+		if (a.yBottom != b.yBottom) return a.yBottom < b.yBottom;
+		return a.yTop < b.yTop;
+	});
+}
+
+#pragma region Rasterization
+void GPU3DRenderer::ClearLine(int y) {
+	uint32_t disp3dcnt = Get16(0);
+	uint32_t clearColor = Get32(CLEAR_COLOR);
+	uint32_t clearDepth = Get16(CLEAR_DEPTH) & 0x7FFF;
+	uint32_t clearAttr = ((clearColor >> 24) & 0x3F) << ATTR_OPAQUE_ID_SHIFT;
+	Pixel* line = top.get() + y * WIDTH;
+
+	if ((disp3dcnt & (1 << 14)) != 0) {
+		// Rear plane bitmap : colors in texture slot 2, depths and fog flags in slot 3, scrolled by CLRIMAGE_OFFSET
+		uint16_t offset = Get16(CLRIMAGE_OFFSET);
+		uint32_t row = (y + (offset >> 8)) & 0xFF;
+		for (int x = 0; x < WIDTH; x++) {
+			uint32_t texel = (row * 256 + ((x + offset) & 0xFF)) * 2;
+			uint16_t color = Read16(TextureAddress(0x40000 + texel));
+			uint16_t depth = Read16(TextureAddress(0x60000 + texel));
+			uint32_t depth15 = depth & 0x7FFF;
+			line[x].color = GPU3DColorFrom555(color, ((color & 0x8000) != 0) ? 31 : 0);
+			line[x].depth = depth15 * 0x200 + ((depth15 == 0x7FFF) ? 0x1FF : 0);
+			line[x].attr = clearAttr | (((depth & 0x8000) != 0) ? ATTR_FOG : 0);
+		}
+	}
+	else {
+		Pixel clear;
+		clear.color = GPU3DColorFrom555(clearColor & 0x7FFF, (clearColor >> 16) & 0x1F);
+		clear.depth = clearDepth * 0x200 + ((clearDepth == 0x7FFF) ? 0x1FF : 0);
+		clear.attr = clearAttr | (((clearColor & 0x8000) != 0) ? ATTR_FOG : 0);
+		std::fill(line, line + WIDTH, clear);
+	}
+
+	memcpy(below.get() + y * WIDTH, line, WIDTH * sizeof(Pixel));
+	memset(stencil.get() + y * WIDTH, 0, WIDTH);
+}
+
+void GPU3DRenderer::RasterizeLine(int y) {
+	ClearLine(y);
+
+	for (const Polygon& polygon : polygons) {
+		if ((y < polygon.yTop) || (y >= polygon.yBottom)) continue;
+
+		Interpolated left, right;
+		int32_t edgeX[4];
+		if (FindSpan(polygon, y, left, right, edgeX)) DrawSpan(polygon, y, left, right, edgeX);
+	}
+}
+
+void GPU3DRenderer::InterpolateEdge(const Polygon& polygon, int from, int to, int32_t yFixed, Interpolated& result) const {
+	// From the top vertex to the bottom one : position and depth are linear on screen, the rest perspective correct
+	const GPU3DVertex& a = *polygon.vertices[from];
+	const GPU3DVertex& b = *polygon.vertices[to];
+	int64_t t = ((static_cast<int64_t>(yFixed) - (a.y << 16)) << 16) / ((b.y - a.y) << 16);
+	t = std::clamp<int64_t>(t, 0, 0x10000);
+
+	int64_t wa = polygon.w[from];
+	int64_t wb = polygon.w[to];
+	int64_t p = ((t * wa) << 16) / ((0x10000 - t) * wb + t * wa);
+
+	result.x = static_cast<int32_t>((a.x << 16) + (b.x - a.x) * t);
+	result.z = static_cast<int32_t>(a.z + (((static_cast<int64_t>(b.z) - a.z) * t) >> 16));
+	result.w = static_cast<int32_t>(wa + (((wb - wa) * p) >> 16));
+	result.depthW = static_cast<int32_t>(a.w + (((static_cast<int64_t>(b.w) - a.w) * p) >> 16));
+	for (int c = 0; c < 3; c++) result.color[c] = a.color[c] + static_cast<int32_t>(((b.color[c] - a.color[c]) * p) >> 16);
+	result.s = a.s + static_cast<int32_t>(((b.s - a.s) * p) >> 16);
+	result.t = a.t + static_cast<int32_t>(((b.t - a.t) * p) >> 16);
+}
+
+bool GPU3DRenderer::FindSpan(const Polygon& polygon, int y, Interpolated& left, Interpolated& right, int32_t edgeX[4]) const {
+	// Polygons are convex : exactly two edges cross the center of a line they cover
+	int edges[2][2];
+	int found = 0;
+	for (int i = 0; (i < polygon.vertexCount) && (found < 2); i++) {
+		int a = i;
+		int b = (i + 1) % polygon.vertexCount;
+		int ya = polygon.vertices[a]->y;
+		int yb = polygon.vertices[b]->y;
+		if (ya == yb) continue;
+		if (ya > yb) std::swap(a, b);
+		if ((y < polygon.vertices[a]->y) || (y >= polygon.vertices[b]->y)) continue;
+		edges[found][0] = a;
+		edges[found][1] = b;
+		found++;
+	}
+	if (found < 2) return false;
+
+	int32_t yCenter = (y << 16) + 0x8000;
+	InterpolateEdge(polygon, edges[0][0], edges[0][1], yCenter, left);
+	InterpolateEdge(polygon, edges[1][0], edges[1][1], yCenter, right);
+	bool swapped = left.x > right.x;
+	if (swapped) std::swap(left, right);
+
+	// Where each edge enters and leaves the line, for edge pixels
+	for (int e = 0; e < 2; e++) {
+		const GPU3DVertex& a = *polygon.vertices[edges[e][0]];
+		const GPU3DVertex& b = *polygon.vertices[edges[e][1]];
+		int64_t dy = b.y - a.y;
+		int64_t top = std::max<int64_t>(y, a.y);
+		int64_t bottom = std::min<int64_t>(y + 1, b.y);
+		int32_t x0 = static_cast<int32_t>((static_cast<int64_t>(a.x) << 16) + (((b.x - a.x) * ((top - a.y) << 16)) / dy));
+		int32_t x1 = static_cast<int32_t>((static_cast<int64_t>(a.x) << 16) + (((b.x - a.x) * ((bottom - a.y) << 16)) / dy));
+		int side = (e == 0) != swapped ? 0 : 2;
+		edgeX[side] = std::min(x0, x1);
+		edgeX[side + 1] = std::max(x0, x1);
+	}
+	return true;
+}
+
+void GPU3DRenderer::DrawSpan(const Polygon& polygon, int y, const Interpolated& left, const Interpolated& right, const int32_t edgeX[4]) {
+	const GPU3DPolygon& source = *polygon.source;
+	uint32_t attributes = source.attributes;
+	uint32_t disp3dcnt = Get16(0);
+	uint32_t polygonId = (attributes >> 24) & 0x3F;
+	uint32_t polygonAlpha = (attributes >> 16) & 0x1F;
+	bool wireframe = polygonAlpha == 0;
+	bool shadow = ((attributes >> 4) & 0x3) == 3;
+	bool depthEqual = (attributes & (1 << 14)) != 0;
+	uint32_t fogFlag = ((attributes & (1 << 15)) != 0) ? ATTR_FOG : 0;
+	uint32_t alphaRef = ((disp3dcnt & (1 << 2)) != 0) ? (Get16(ALPHA_TEST_REF) & 0x1F) : 0;
+	bool blending = (disp3dcnt & (1 << 3)) != 0;
+
+	// Pixels touched by the left and right edges within the line, at least one each
+	int leftStart = edgeX[0] >> 16;
+	int leftEnd = std::max(leftStart + 1, (edgeX[1] + 0xFFFF) >> 16);
+	int rightStart = edgeX[2] >> 16;
+	int rightEnd = std::max(rightStart + 1, (edgeX[3] + 0xFFFF) >> 16);
+	int xStart = std::max(0, std::min(leftStart, rightStart));
+	int xEnd = std::min(WIDTH, std::max(leftEnd, rightEnd));
+	bool edgeLine = (y == polygon.yTop) || (y == polygon.yBottom - 1);
+
+	// Position of the pixel centers in the span, 16bit fraction with 16 more bits while stepping
+	int64_t spanWidth = static_cast<int64_t>(right.x) - left.x;
+	int64_t tStep = (spanWidth > 0) ? (1LL << 48) / spanWidth : 0;
+	int64_t tPosition = (spanWidth > 0) ? ((((static_cast<int64_t>(xStart) << 16) + 0x8000) - left.x) << 32) / spanWidth : 0;
+	int64_t wl = left.w;
+	int64_t wr = right.w;
+	Pixel* line = top.get() + y * WIDTH;
+	Pixel* lineBelow = below.get() + y * WIDTH;
+	uint8_t* lineStencil = stencil.get() + y * WIDTH;
+
+	for (int x = xStart; x < xEnd; x++, tPosition += tStep) {
+		bool leftEdge = (x >= leftStart) && (x < leftEnd);
+		bool rightEdge = (x >= rightStart) && (x < rightEnd);
+		bool edge = leftEdge || rightEdge || edgeLine;
+		if (wireframe && !edge) continue;
+
+		// Screen space position, and perspective correct one (only needed for W buffering before the depth test)
+		int64_t t = std::clamp<int64_t>(tPosition >> 16, 0, 0x10000);
+		auto perspective = [t, wl, wr]() { return ((t * wl) << 16) / std::max<int64_t>(1, (0x10000 - t) * wr + t * wl); };
+		int64_t p = wBuffer ? perspective() : 0;
+
+		uint32_t depth;
+		if (wBuffer) depth = static_cast<uint32_t>(std::clamp<int64_t>(left.depthW + (((static_cast<int64_t>(right.depthW) - left.depthW) * p) >> 16), 0, 0xFFFFFF));
+		else depth = static_cast<uint32_t>(left.z + (((static_cast<int64_t>(right.z) - left.z) * t) >> 16));
+
+		Pixel& pixel = line[x];
+		bool depthPass = depthEqual ? ((depth >= pixel.depth ? depth - pixel.depth : pixel.depth - depth) <= 0x200) : (depth < pixel.depth);
+
+		// Shadow volumes : the mask (polygon ID 0) marks where it is hidden, shadows only draw there, over other polygons
+		if (shadow) {
+			if (polygonId == 0) {
+				if (!depthPass) lineStencil[x] = 1;
+				continue;
+			}
+			if ((lineStencil[x] == 0) || (((pixel.attr >> ATTR_OPAQUE_ID_SHIFT) & 0x3F) == polygonId)) continue;
+			lineStencil[x] = 0;
+		}
+		if (!depthPass) continue;
+		if (!wBuffer) p = perspective();
+
+		int32_t color[3];
+		for (int c = 0; c < 3; c++) color[c] = left.color[c] + static_cast<int32_t>(((right.color[c] - left.color[c]) * p) >> 16);
+		int32_t s = left.s + static_cast<int32_t>(((right.s - left.s) * p) >> 16);
+		int32_t tc = left.t + static_cast<int32_t>(((right.t - left.t) * p) >> 16);
+		uint32_t shaded = ShadePixel(polygon, color, s, tc);
+		uint32_t alpha = shaded >> 24;
+		if (wireframe) {
+			shaded |= 31u << 24;
+			alpha = 31;
+		}
+		if ((alpha == 0) || (alpha <= alphaRef)) continue;
+
+		if (alpha == 31) {
+			// Anti-aliasing coverage of edge pixels, from where the edge crosses the line
+			uint32_t coverage = 31;
+			if (leftEdge && !edgeLine) {
+				int n = leftEnd - leftStart;
+				coverage = (n == 1) ? static_cast<uint32_t>(std::clamp<int64_t>((static_cast<int64_t>(x + 1) << 16) - left.x, 0, 0xFFFF) >> 11)
+					: static_cast<uint32_t>((x - leftStart + 1) * 32 / (n + 1));
+			}
+			else if (rightEdge && !edgeLine) {
+				int n = rightEnd - rightStart;
+				coverage = (n == 1) ? static_cast<uint32_t>(std::clamp<int64_t>(right.x - (static_cast<int64_t>(x) << 16), 0, 0xFFFF) >> 11)
+					: static_cast<uint32_t>((rightEnd - x) * 32 / (n + 1));
+			}
+
+			lineBelow[x] = pixel;
+			pixel.color = shaded;
+			pixel.depth = depth;
+			pixel.attr = (polygonId << ATTR_OPAQUE_ID_SHIFT) | fogFlag | (edge ? (ATTR_EDGE | (coverage << ATTR_COVERAGE_SHIFT)) : 0);
+		}
+		else {
+			// A translucent polygon does not draw twice over the same pixel, nor over another one with its ID
+			if (((pixel.attr & ATTR_TRANSLUCENT) != 0) && (((pixel.attr >> ATTR_TRANSLUCENT_ID_SHIFT) & 0x3F) == polygonId)) continue;
+
+			uint32_t destAlpha = Channel(pixel.color, 3);
+			if (blending && (destAlpha != 0)) {
+				uint32_t blended = std::max(alpha, destAlpha) << 24;
+				for (int c = 0; c < 3; c++) blended |= ((Channel(shaded, c) * (alpha + 1) + Channel(pixel.color, c) * (31 - alpha)) >> 5) << (c * 8);
+				shaded = blended;
+			}
+			pixel.color = shaded;
+			if ((attributes & (1 << 11)) != 0) pixel.depth = depth;
+			pixel.attr = (pixel.attr & ~(ATTR_EDGE | ATTR_FOG | (0x3F << ATTR_TRANSLUCENT_ID_SHIFT))) | (pixel.attr & fogFlag)
+				| ATTR_TRANSLUCENT | (polygonId << ATTR_TRANSLUCENT_ID_SHIFT);
+		}
+	}
+}
+
+uint32_t GPU3DRenderer::ShadePixel(const Polygon& polygon, const int32_t vertexColor[3], int32_t s, int32_t t) const {
+	uint32_t disp3dcnt = Get16(0);
+	uint32_t attributes = polygon.source->attributes;
+	uint32_t mode = (attributes >> 4) & 0x3;
+	uint32_t polygonAlpha = (attributes >> 16) & 0x1F;
+	if (polygonAlpha == 0) polygonAlpha = 31;
+
+	// Toon shading replaces the vertex color by the toon table entry its red component selects, highlight shading adds it
+	uint32_t vertex[3] = { static_cast<uint32_t>(vertexColor[0]), static_cast<uint32_t>(vertexColor[1]), static_cast<uint32_t>(vertexColor[2]) };
+	uint32_t highlight = 0;
+	if (mode == 2) {
+		uint32_t toon = GPU3DColorFrom555(Get16(TOON_TABLE + (vertex[0] >> 1) * 2), 0);
+		if ((disp3dcnt & (1 << 1)) != 0) {
+			highlight = toon;
+			vertex[1] = vertex[2] = vertex[0];
+		}
+		else {
+			for (int c = 0; c < 3; c++) vertex[c] = Channel(toon, c);
+		}
+	}
+
+	uint32_t result = 0;
+	if (polygon.texels != nullptr) {
+		uint32_t texel = SampleTexture(polygon, s, t);
+		uint32_t texelAlpha = Channel(texel, 3);
+		if (mode == 1) {
+			// Decal : the texture over the vertex color, by texel alpha
+			for (int c = 0; c < 3; c++) result |= ((Channel(texel, c) * texelAlpha + vertex[c] * (31 - texelAlpha)) >> 5) << (c * 8);
+			if (texelAlpha == 31) result = texel & 0x3F3F3F;
+			result |= polygonAlpha << 24;
+		}
+		else {
+			for (int c = 0; c < 3; c++) result |= (((Channel(texel, c) + 1) * (vertex[c] + 1) - 1) >> 6) << (c * 8);
+			result |= (((texelAlpha + 1) * (polygonAlpha + 1) - 1) >> 5) << 24;
+		}
+	}
+	else {
+		result = vertex[0] | (vertex[1] << 8) | (vertex[2] << 16) | (polygonAlpha << 24);
+	}
+
+	if (highlight != 0) {
+		uint32_t added = result & 0xFF000000;
+		for (int c = 0; c < 3; c++) added |= std::min<uint32_t>(63, Channel(result, c) + Channel(highlight, c)) << (c * 8);
+		result = added;
+	}
+	return result;
+}
+
+uint32_t GPU3DRenderer::SampleTexture(const Polygon& polygon, int32_t s, int32_t t) const {
+	uint32_t param = polygon.source->texParam;
+	int32_t size[2] = { 8 << ((param >> 20) & 0x7), 8 << ((param >> 23) & 0x7) };
+	int32_t coord[2] = { s >> 4, t >> 4 };
+
+	// Repeat (bits 16-17), flipped every other time (bits 18-19), or clamp
+	for (int i = 0; i < 2; i++) {
+		if ((param & (1 << (16 + i))) != 0) {
+			if ((param & (1 << (18 + i))) != 0) {
+				coord[i] &= size[i] * 2 - 1;
+				if (coord[i] >= size[i]) coord[i] = size[i] * 2 - 1 - coord[i];
+			}
+			else {
+				coord[i] &= size[i] - 1;
+			}
+		}
+		else {
+			coord[i] = std::clamp(coord[i], 0, size[i] - 1);
+		}
+	}
+
+	// Texels were decoded by the texture cache when the polygons were prepared
+	return polygon.texels[coord[1] * size[0] + coord[0]];
+}
+#pragma endregion
+
+void GPU3DRenderer::FinishLine(int y) {
+	uint32_t disp3dcnt = Get16(0);
+	bool edgeMarking = (disp3dcnt & (1 << 5)) != 0;
+	bool antiAliasing = (disp3dcnt & (1 << 4)) != 0;
+	bool fog = (disp3dcnt & (1 << 7)) != 0;
+
+	// Outside of the frame, edges are compared with the clear plane
+	uint32_t clearId = (Get32(CLEAR_COLOR) >> 24) & 0x3F;
+	uint32_t clearDepth15 = Get16(CLEAR_DEPTH) & 0x7FFF;
+	uint32_t clearDepth = clearDepth15 * 0x200 + ((clearDepth15 == 0x7FFF) ? 0x1FF : 0);
+
+	uint32_t fogColor = GPU3DColorFrom555(Get16(FOG_COLOR) & 0x7FFF, (Get32(FOG_COLOR) >> 16) & 0x1F);
+	uint32_t fogOffset = Get16(FOG_OFFSET) & 0x7FFF;
+	int32_t fogStep = std::max(1, 0x400 >> ((disp3dcnt >> 8) & 0xF));
+	bool fogAlphaOnly = (disp3dcnt & (1 << 6)) != 0;
+
+	const Pixel* line = top.get() + y * WIDTH;
+	uint32_t* out = output.get() + y * WIDTH;
+	for (int x = 0; x < WIDTH; x++) {
+		const Pixel& pixel = line[x];
+		uint32_t color = pixel.color;
+
+		if (edgeMarking && ((pixel.attr & ATTR_EDGE) != 0)) {
+			// Edge of a polygon in front of another one
+			uint32_t id = (pixel.attr >> ATTR_OPAQUE_ID_SHIFT) & 0x3F;
+			static const int NEIGHBORS[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+			bool marked = false;
+			for (const auto& n : NEIGHBORS) {
+				int nx = x + n[0];
+				int ny = y + n[1];
+				bool inside = (nx >= 0) && (nx < WIDTH) && (ny >= 0) && (ny < HEIGHT);
+				const Pixel* neighbor = inside ? top.get() + ny * WIDTH + nx : nullptr;
+				uint32_t neighborId = inside ? (neighbor->attr >> ATTR_OPAQUE_ID_SHIFT) & 0x3F : clearId;
+				uint32_t neighborDepth = inside ? neighbor->depth : clearDepth;
+				if ((neighborId != id) && (pixel.depth < neighborDepth)) marked = true;
+			}
+			if (marked) color = GPU3DColorFrom555(Get16(EDGE_COLOR + (id >> 3) * 2), Channel(color, 3));
+		}
+
+		if (antiAliasing && ((pixel.attr & ATTR_EDGE) != 0)) {
+			// Blend edges with what they cover, by coverage
+			uint32_t coverage = (pixel.attr >> ATTR_COVERAGE_SHIFT) & 0x1F;
+			if (coverage < 31) {
+				uint32_t behind = below[y * WIDTH + x].color;
+				uint32_t blended = 0;
+				for (int c = 0; c < 4; c++) blended |= ((Channel(color, c) * coverage + Channel(behind, c) * (31 - coverage)) / 31) << (c * 8);
+				color = blended;
+			}
+		}
+
+		if (fog && ((pixel.attr & ATTR_FOG) != 0)) {
+			// Density from the fog table, interpolated between entries. Entries are FOG_OFFSET + n * step deep.
+			int32_t position = static_cast<int32_t>(pixel.depth >> 9) - static_cast<int32_t>(fogOffset);
+			int32_t index = (position < 0) ? 0 : position / fogStep;
+			int32_t density;
+			if (index >= 31) {
+				density = latched[FOG_TABLE + 31] & 0x7F;
+			}
+			else {
+				int32_t fraction = (position < 0) ? 0 : position % fogStep;
+				int32_t d0 = latched[FOG_TABLE + index] & 0x7F;
+				int32_t d1 = latched[FOG_TABLE + index + 1] & 0x7F;
+				density = (d0 * (fogStep - fraction) + d1 * fraction) / fogStep;
+			}
+			if (density == 127) density = 128;
+
+			uint32_t fogged = 0;
+			for (int c = 0; c < 4; c++) {
+				uint32_t value = Channel(color, c);
+				if (!fogAlphaOnly || (c == 3)) value = (Channel(fogColor, c) * density + value * (128 - density)) >> 7;
+				fogged |= value << (c * 8);
+			}
+			color = fogged;
+		}
+
+		out[x] = (Channel(color, 0) >> 1) | ((Channel(color, 1) >> 1) << 5) | ((Channel(color, 2) >> 1) << 10) | (Channel(color, 3) << 16);
+	}
+}
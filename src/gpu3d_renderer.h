@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "arm9_mem.h"
+#include "vram.h"
+#include "gpu3d_geometry.h"
+#include "gpu3d_texcache.h"
+
+/// <summary>
+/// ARM9 rendering engine : rasterizes the polygon lists swapped by the geometry engine into the frame shown as BG0.
+/// Lines are independent until edge marking, anti-aliasing and fog : both passes split the frame into bands of lines,
+/// rendered by a pool of worker threads. The output does not depend on the number of threads.
+/// </summary>
+class GPU3DRenderer {
+private:
+	static constexpr int WIDTH = 256;
+	static constexpr int HEIGHT = 192;
+	static constexpr int BAND_LINES = 8;
+	static constexpr int BAND_COUNT = HEIGHT / BAND_LINES;
+
+	// Registers, from DISP3DCNT
+	static const uint32_t DISP3DCNT_ADDR = 0x04000060;
+	static const uint32_t EDGE_COLOR = 0x330 - 0x60;
+	static const uint32_t ALPHA_TEST_REF = 0x340 - 0x60;
+	static const uint32_t CLEAR_COLOR = 0x350 - 0x60;
+	static const uint32_t CLEAR_DEPTH = 0x354 - 0x60;
+	static const uint32_t CLRIMAGE_OFFSET = 0x356 - 0x60;
+	static const uint32_t FOG_COLOR = 0x358 - 0x60;
+	static const uint32_t FOG_OFFSET = 0x35C - 0x60;
+	static const uint32_t FOG_TABLE = 0x360 - 0x60;
+	static const uint32_t TOON_TABLE = 0x380 - 0x60;
+	static const uint32_t REGISTERS_SIZE = 0x3C0 - 0x60;
+
+	static const uint32_t TEXTURE_SIZE = 0x80000;	// 4 slots of 128KB
+
+	// Pixel attributes
+	static const uint32_t ATTR_EDGE = 1 << 0;			// Edge of an opaque polygon
+	static const uint32_t ATTR_TRANSLUCENT = 1 << 1;	// A translucent polygon was drawn over the pixel
+	static const uint32_t ATTR_FOG = 1 << 2;
+	static const uint32_t ATTR_COVERAGE_SHIFT = 8;		// 5 bits, anti-aliasing of edge pixels
+	static const uint32_t ATTR_TRANSLUCENT_ID_SHIFT = 16;
+	static const uint32_t ATTR_OPAQUE_ID_SHIFT = 24;
+
+	// Colors are 6 bits per channel (R at bit 0, G at 8, B at 16) and alpha 5 bits (bit 24)
+	struct Pixel {
+		uint32_t color;
+		uint32_t depth;
+		uint32_t attr;
+	};
+
+	// Polygon prepared for rasterization
+	struct Polygon {
+		const GPU3DPolygon* source;
+		const GPU3DVertex* vertices[GPU3DPolygon::MAX_VERTICES];
+		int32_t w[GPU3DPolygon::MAX_VERTICES];	// Normalized to 16 bits, for perspective correction
+		const uint32_t* texels;					// Decoded texture, nullptr if not textured
+		int vertexCount;
+		int yTop;
+		int yBottom;
+	};
+
+	// Attributes interpolated along edges and spans
+	struct Interpolated {
+		int32_t x;		// 16.16, edges only
+		int32_t z;
+		int32_t w;		// Normalized
+		int32_t depthW;	// Clip space W, for W buffering
+		int32_t color[3];
+		int32_t s;
+		int32_t t;
+	};
+
+	const uint8_t* registers{ nullptr };
+	const VRAM* vram{ nullptr };
+	const uint8_t* banks{ nullptr };
+	const GeometryEngine* geometry{ nullptr };
+
+	// Frame state, latched before the passes
+	uint8_t latched[REGISTERS_SIZE]{};
+	std::vector<Polygon> polygons;
+	bool wBuffer{ false };
+	const uint8_t* texturePages[TEXTURE_SIZE / VRAM::PAGE_SIZE]{};
+	GPU3DTextureCache textureCache;
+
+	// Two layers per pixel : anti-aliasing blends edges with what they were drawn over
+	std::unique_ptr<Pixel[]> top;
+	std::unique_ptr<Pixel[]> below;
+	std::unique_ptr<uint8_t[]> stencil;
+	std::unique_ptr<uint32_t[]> output;
+
+	// Worker pool : every pass is split in bands, taken in turn by the workers and the rendering thread
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable started;
+	std::condition_variable finished;
+	uint64_t passNumber{ 0 };
+	int busyWorkers{ 0 };
+	bool stopWorkers{ false };
+	void (GPU3DRenderer::*pass)(int line){ nullptr };
+	std::atomic<int> nextBand{ 0 };
+
+	uint16_t Get16(uint32_t offset) const {
+		return static_cast<uint16_t>(latched[offset] | (latched[offset + 1] << 8));
+	}
+
+	uint32_t Get32(uint32_t offset) const {
+		return Get16(offset) | (static_cast<uint32_t>(Get16(offset + 2)) << 16);
+	}
+
+	const uint8_t* TextureAddress(uint32_t offset) const {
+		return texturePages[(offset >> VRAM::PAGE_SHIFT) % (TEXTURE_SIZE / VRAM::PAGE_SIZE)] + (offset & (VRAM::PAGE_SIZE - 1));
+	}
+
+	void StopWorkers();
+	void WorkerLoop(uint64_t seen);
+	void RunBands();
+	void RunPass(void (GPU3DRenderer::*linePass)(int line));
+
+	void PreparePolygons(const GPU3DScene& scene);
+	void RasterizeLine(int y);
+	void FinishLine(int y);
+	void ClearLine(int y);
+	bool FindSpan(const Polygon& polygon, int y, Interpolated& left, Interpolated& right, int32_t edgeX[4]) const;
+	void InterpolateEdge(const Polygon& polygon, int from, int to, int32_t yFixed, Interpolated& result) const;
+	void DrawSpan(const Polygon& polygon, int y, const Interpolated& left, const Interpolated& right, const int32_t edgeX[4]);
+	uint32_t SampleTexture(const Polygon& polygon, int32_t s, int32_t t) const;
+	uint32_t ShadePixel(const Polygon& polygon, const int32_t color[3], int32_t s, int32_t t) const;
+
+public:
+	/// <summary>
+	/// Bind the renderer to its registers, texture VRAM and the lists of the geometry engine
+	/// </summary>
+	/// <param name="mem">ARM9 memory</param>
+	/// <param name="vramBanks">VRAM bank controller, textures are read through the texture image and palette slots.
+	/// Its writes are watched to invalidate decoded textures.</param>
+	/// <param name="geometryEngine">Geometry engine, its last swapped lists are rendered</param>
+	void Attach(ARM9_mem& mem, VRAM& vramBanks, const GeometryEngine& geometryEngine);
+
+	~GPU3DRenderer();
+
+	/// <summary>
+	/// Set the number of threads rasterizing a frame, including the one calling Render
+	/// </summary>
+	/// <param name="count">Thread count, 0 for one per host core</param>
+	void SetThreadCount(int count);
+
+	int GetThreadCount() const {
+		return static_cast<int>(workers.size()) + 1;
+	}
+
+	/// <summary>
+	/// Render a frame from the swapped lists, the registers and the texture VRAM as they are now
+	/// </summary>
+	void Render();
+
+	const GPU3DTextureCache& GetTextureCache() const {
+		return textureCache;
+	}
+
+	/// <summary>
+	/// Get a line of the last rendered frame
+	/// </summary>
+	/// <param name="line">Line number (0 to 191)</param>
+	/// <returns>256 pixels, BGR555 in bits 0-14 and alpha (0 to 31) in bits 16-20</returns>
+	const uint32_t* GetLine(int line) const {
+		return output.get() + line * WIDTH;
+	}
+};
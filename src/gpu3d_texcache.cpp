@@ -0,0 +1,253 @@
+#include "gpu3d_texcache.h"
+#include <algorithm>
+
+// Unmapped slots read as 0
+static const uint8_t zeroPage[VRAM::PAGE_SIZE] = {};
+
+GPU3DTextureCache::GPU3DTextureCache() {
+	blockStamps = std::make_unique<uint64_t[]>(VRAM::BANKS_SIZE >> BLOCK_SHIFT);
+	std::fill(blockStamps.get(), blockStamps.get() + (VRAM::BANKS_SIZE >> BLOCK_SHIFT), 0);
+	std::fill(texturePages, texturePages + TEXTURE_PAGES, VRAM::UNMAPPED);
+	std::fill(texpalPages, texpalPages + TEXPAL_PAGES, VRAM::UNMAPPED);
+}
+
+void GPU3DTextureCache::Clear() {
+	entries.clear();
+	texelCount = 0;
+}
+
+void GPU3DTextureCache::VRAMWritten(uint32_t offset, uint32_t length) {
+	if ((length == 0) || (offset >= VRAM::BANKS_SIZE)) return;
+	uint32_t last = std::min(offset + length, VRAM::BANKS_SIZE) - 1;
+
+	writeSequence++;
+	for (uint32_t block = offset >> BLOCK_SHIFT; block <= (last >> BLOCK_SHIFT); block++) blockStamps[block] = writeSequence;
+}
+
+void GPU3DTextureCache::StartFrame(const uint8_t* vramBanks, const uint32_t* textureView, const uint32_t* texpalView) {
+	banks = vramBanks;
+	std::copy(textureView, textureView + TEXTURE_PAGES, texturePages);
+	std::copy(texpalView, texpalView + TEXPAL_PAGES, texpalPages);
+	frame++;
+}
+
+const uint8_t* GPU3DTextureCache::Address(bool palette, uint32_t offset) const {
+	offset %= palette ? TEXPAL_SIZE : TEXTURE_SIZE;
+	uint32_t bank = (palette ? texpalPages : texturePages)[offset >> VRAM::PAGE_SHIFT];
+	const uint8_t* page = (bank != VRAM::UNMAPPED) ? banks + bank : zeroPage;
+	return page + (offset & (VRAM::PAGE_SIZE - 1));
+}
+
+/// <summary>
+/// Split a range of slot memory at page boundaries, wrapping at the end of the slots
+/// </summary>
+/// <param name="fn">Called with the bank offset of every chunk (UNMAPPED if no bank is there) and its length</param>
+template <typename Fn>
+static void ForEachChunk(const uint32_t* pages, uint32_t size, uint32_t start, uint32_t length, Fn fn) {
+	uint32_t offset = start % size;
+	while (length > 0) {
+		uint32_t inPage = offset & (VRAM::PAGE_SIZE - 1);
+		uint32_t chunk = std::min(length, VRAM::PAGE_SIZE - inPage);
+		uint32_t bank = pages[offset >> VRAM::PAGE_SHIFT];
+		fn((bank != VRAM::UNMAPPED) ? bank + inPage : VRAM::UNMAPPED, chunk);
+		offset = (offset + chunk) % size;
+		length -= chunk;
+	}
+}
+
+uint64_t GPU3DTextureCache::MappingOf(const Entry& entry) const {
+	uint64_t hash = 1469598103934665603ULL;
+	for (int i = 0; i < entry.rangeCount; i++) {
+		const Range& range = entry.ranges[i];
+		ForEachChunk(range.palette ? texpalPages : texturePages, range.palette ? TEXPAL_SIZE : TEXTURE_SIZE, range.start, range.length, [&hash](uint32_t bank, uint32_t) {
+			hash = (hash ^ bank) * 1099511628211ULL;
+		});
+	}
+	return hash;
+}
+
+bool GPU3DTextureCache::IsValid(const Entry& entry) const {
+	if (MappingOf(entry) != entry.mapping) return false;
+
+	bool written = false;
+	for (int i = 0; (i < entry.rangeCount) && !written; i++) {
+		const Range& range = entry.ranges[i];
+		ForEachChunk(range.palette ? texpalPages : texturePages, range.palette ? TEXPAL_SIZE : TEXTURE_SIZE, range.start, range.length, [this, &entry, &written](uint32_t bank, uint32_t length) {
+			if (bank == VRAM::UNMAPPED) return;
+			for (uint32_t block = bank >> BLOCK_SHIFT; block <= ((bank + length - 1) >> BLOCK_SHIFT); block++) {
+				if (blockStamps[block] > entry.decodedAt) written = true;
+			}
+		});
+	}
+	return !written;
+}
+
+void GPU3DTextureCache::Evict() {
+	for (auto it = entries.begin(); it != entries.end();) {
+		if (it->second.checkedFrame != frame) {
+			texelCount -= it->second.texels.size();
+			it = entries.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+const uint32_t* GPU3DTextureCache::GetTexture(uint32_t texParam, uint32_t paletteBase) {
+	uint32_t format = (texParam >> 26) & 0x7;
+	if (format == 0) return nullptr;
+
+	// Repeat and flip bits only change sampling. Direct color textures have no palette.
+	uint64_t key = (texParam & 0x3FF0FFFF) | ((format != 7) ? static_cast<uint64_t>(paletteBase & 0x1FFF) << 32 : 0);
+	auto found = entries.find(key);
+	if (found != entries.end()) {
+		Entry& entry = found->second;
+		if ((entry.checkedFrame == frame) || IsValid(entry)) {
+			entry.checkedFrame = frame;
+			hits++;
+			return entry.texels.data();
+		}
+		texelCount -= entry.texels.size();
+		entries.erase(found);
+	}
+
+	misses++;
+	size_t size = static_cast<size_t>(8 << ((texParam >> 20) & 0x7)) * (8 << ((texParam >> 23) & 0x7));
+	if (texelCount + size > MAX_TEXELS) Evict();
+
+	Entry& entry = entries[key];
+	Decode(entry, texParam, paletteBase & 0x1FFF);
+	texelCount += entry.texels.size();
+	return entry.texels.data();
+}
+
+void GPU3DTextureCache::Decode(Entry& entry, uint32_t texParam, uint32_t paletteBase) {
+	uint32_t format = (texParam >> 26) & 0x7;
+	uint32_t width = 8 << ((texParam >> 20) & 0x7);
+	uint32_t height = 8 << ((texParam >> 23) & 0x7);
+	uint32_t count = width * height;
+	uint32_t base = (texParam & 0xFFFF) << 3;
+	uint32_t palette = paletteBase << ((format == 2) ? 3 : 4);
+	bool color0Transparent = (texParam & (1 << 29)) != 0;
+
+	entry.texels.resize(count);
+	uint32_t* out = entry.texels.data();
+	auto paletteColor = [this, palette](uint32_t index, uint32_t alpha) {
+		return GPU3DColorFrom555(Read16(true, palette + index * 2), alpha);
+	};
+	auto indexed = [&](uint32_t bits) {
+		uint32_t mask = (1 << bits) - 1;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t index = (Read8(base + i * bits / 8) >> ((i * bits) & 7)) & mask;
+			out[i] = paletteColor(index, (color0Transparent && (index == 0)) ? 0 : 31);
+		}
+		entry.ranges[0] = { false, base, count * bits / 8 };
+		entry.ranges[1] = { true, palette, (mask + 1) * 2 };
+		entry.rangeCount = 2;
+	};
+
+	switch (format) {
+	case 1:
+		// A3I5 : 3bit alpha scaled to 5 bits
+		for (uint32_t i = 0; i < count; i++) {
+			uint8_t value = Read8(base + i);
+			uint32_t alpha = value >> 5;
+			out[i] = paletteColor(value & 0x1F, alpha * 4 + alpha / 2);
+		}
+		entry.ranges[0] = { false, base, count };
+		entry.ranges[1] = { true, palette, 32 * 2 };
+		entry.rangeCount = 2;
+		break;
+
+	case 2:
+		indexed(2);
+		break;
+
+	case 3:
+		indexed(4);
+		break;
+
+	case 4:
+		indexed(8);
+		break;
+
+	case 5: {
+		// 4x4 blocks of 2bit texels in slot 0 or 2, with a palette selector per block in slot 1.
+		// The 4 colors of a block are worked out once for its 16 texels.
+		uint32_t paletteEnd = 0;
+		for (uint32_t by = 0; by < height / 4; by++) {
+			for (uint32_t bx = 0; bx < width / 4; bx++) {
+				uint32_t block = base + (by * (width / 4) + bx) * 4;
+				uint32_t selectorAddr = 0x20000 + ((block & 0x1FFFF) >> 1) + (((block >> 17) == 2) ? 0x10000 : 0);
+				uint16_t selector = Read16(false, selectorAddr);
+				uint32_t offset = (selector & 0x3FFF) * 4;
+				uint32_t mode = selector >> 14;
+				paletteEnd = std::max(paletteEnd, offset + 4 * 2);
+
+				uint16_t raw[4];
+				for (int i = 0; i < 4; i++) raw[i] = Read16(true, palette + offset + i * 2);
+				uint32_t colors[4] = { GPU3DColorFrom555(raw[0], 31), GPU3DColorFrom555(raw[1], 31), 0, 0 };
+				if (mode == 2) {
+					colors[2] = GPU3DColorFrom555(raw[2], 31);
+					colors[3] = GPU3DColorFrom555(raw[3], 31);
+				}
+				else {
+					// Mode 0 : color 2, mode 1 : halfway between colors 0 and 1, mode 3 : 3/8 and 5/8 of the way.
+					// Color 3 is transparent in modes 0 and 1.
+					for (uint32_t index = 2; index < 4; index++) {
+						if (mode == 0) {
+							colors[index] = (index == 2) ? GPU3DColorFrom555(raw[2], 31) : 0;
+							continue;
+						}
+						if ((mode == 1) && (index == 3)) continue;
+						uint32_t w0 = (mode == 1) ? 4 : ((index == 2) ? 5 : 3);
+						uint16_t mixed = 0;
+						for (int c = 0; c < 3; c++) {
+							uint32_t a = (raw[0] >> (c * 5)) & 0x1F;
+							uint32_t b = (raw[1] >> (c * 5)) & 0x1F;
+							mixed |= static_cast<uint16_t>(((a * w0 + b * (8 - w0)) / 8) << (c * 5));
+						}
+						colors[index] = GPU3DColorFrom555(mixed, 31);
+					}
+				}
+
+				for (uint32_t y = 0; y < 4; y++) {
+					uint8_t row = Read8(block + y);
+					uint32_t* line = out + (by * 4 + y) * width + bx * 4;
+					for (uint32_t x = 0; x < 4; x++) line[x] = colors[(row >> (x * 2)) & 0x3];
+				}
+			}
+		}
+		entry.ranges[0] = { false, base, count / 4 };
+		entry.ranges[1] = { false, 0x20000 + ((base & 0x1FFFF) >> 1) + (((base >> 17) == 2) ? 0x10000 : 0), count / 8 };
+		entry.ranges[2] = { true, palette, paletteEnd };
+		entry.rangeCount = 3;
+		break;
+	}
+
+	case 6:
+		// A5I3
+		for (uint32_t i = 0; i < count; i++) {
+			uint8_t value = Read8(base + i);
+			out[i] = paletteColor(value & 0x7, value >> 3);
+		}
+		entry.ranges[0] = { false, base, count };
+		entry.ranges[1] = { true, palette, 8 * 2 };
+		entry.rangeCount = 2;
+		break;
+
+	case 7:
+		for (uint32_t i = 0; i < count; i++) {
+			uint16_t value = Read16(false, base + i * 2);
+			out[i] = GPU3DColorFrom555(value, ((value & 0x8000) != 0) ? 31 : 0);
+		}
+		entry.ranges[0] = { false, base, count * 2 };
+		entry.rangeCount = 1;
+		break;
+	}
+
+	entry.decodedAt = writeSequence;
+	entry.mapping = MappingOf(entry);
+	entry.checkedFrame = frame;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "vram.h"
+
+/// <summary>
+/// Color of the 3D rendering engine : 6 bits per channel (R at bit 0, G at 8, B at 16) and 5 bits of alpha (bit 24).
+/// 5bit colors gain a low bit unless they are 0.
+/// </summary>
+inline uint32_t GPU3DColorFrom555(uint16_t color, uint32_t alpha) {
+	auto expand = [](uint32_t value) { return (value != 0) ? value * 2 + 1 : 0; };
+	return expand(color & 0x1F) | (expand((color >> 5) & 0x1F) << 8) | (expand((color >> 10) & 0x1F) << 16) | (alpha << 24);
+}
+
+/// <summary>
+/// Textures decoded to 3D engine colors, keyed by their address in the texture slots, format, size and palette.
+/// Writes stamp the 512 byte blocks of bank memory they touch. A texture is checked once per frame : it is decoded again
+/// if a block it was read from was written since, or if its slots are now backed by other banks.
+/// </summary>
+class GPU3DTextureCache {
+private:
+	static constexpr uint32_t BLOCK_SHIFT = 9;
+	static constexpr uint32_t TEXTURE_SIZE = 0x80000;	// 4 slots of 128KB
+	static constexpr uint32_t TEXPAL_SIZE = 0x18000;	// 6 slots of 16KB
+	static constexpr int TEXTURE_PAGES = TEXTURE_SIZE / VRAM::PAGE_SIZE;
+	static constexpr int TEXPAL_PAGES = TEXPAL_SIZE / VRAM::PAGE_SIZE;
+	static constexpr size_t MAX_TEXELS = 1 << 22;		// Beyond that, textures unused this frame are dropped
+
+	// Slot memory read by a texture : image, 4x4 palette selectors, palette
+	struct Range {
+		bool palette;
+		uint32_t start;
+		uint32_t length;
+	};
+
+	struct Entry {
+		std::vector<uint32_t> texels;
+		Range ranges[3];
+		int rangeCount;
+		uint64_t decodedAt;			// Write sequence number when decoded
+		uint64_t mapping;			// Banks backing its ranges when decoded
+		uint64_t checkedFrame;
+	};
+
+	const uint8_t* banks{ nullptr };
+	uint32_t texturePages[TEXTURE_PAGES]{};
+	uint32_t texpalPages[TEXPAL_PAGES]{};
+	std::unordered_map<uint64_t, Entry> entries;
+	size_t texelCount{ 0 };
+	std::unique_ptr<uint64_t[]> blockStamps;
+	uint64_t writeSequence{ 1 };
+	uint64_t frame{ 0 };
+
+	uint64_t hits{ 0 };
+	uint64_t misses{ 0 };
+
+	const uint8_t* Address(bool palette, uint32_t offset) const;
+	uint8_t Read8(uint32_t offset) const {
+		return *Address(false, offset);
+	}
+	uint16_t Read16(bool palette, uint32_t offset) const {
+		const uint8_t* ptr = Address(palette, offset);
+		return static_cast<uint16_t>(ptr[0] | (ptr[1] << 8));
+	}
+
+	uint64_t MappingOf(const Entry& entry) const;
+	bool IsValid(const Entry& entry) const;
+	void Decode(Entry& entry, uint32_t texParam, uint32_t paletteBase);
+	void Evict();
+
+public:
+	GPU3DTextureCache();
+
+	/// <summary>
+	/// Forget every decoded texture
+	/// </summary>
+	void Clear();
+
+	/// <summary>
+	/// Report written VRAM bank memory, or banks mapped elsewhere
+	/// </summary>
+	void VRAMWritten(uint32_t offset, uint32_t length);
+
+	/// <summary>
+	/// Latch the banks backing the texture image and palette slots, before the textures of a frame are looked up
+	/// </summary>
+	/// <param name="vramBanks">Bank memory, laid out as in LCDC mode</param>
+	/// <param name="textureView">Pages of VRAM_VIEW_TEXTURE</param>
+	/// <param name="texpalView">Pages of VRAM_VIEW_TEXPAL</param>
+	void StartFrame(const uint8_t* vramBanks, const uint32_t* textureView, const uint32_t* texpalView);
+
+	/// <summary>
+	/// Get a decoded texture, decoding it if needed. Stays valid until the next StartFrame.
+	/// </summary>
+	/// <param name="texParam">TEXIMAGE_PARAM : address, size, format and color 0 transparency</param>
+	/// <param name="paletteBase">PLTT_BASE</param>
+	/// <returns>Texels row by row, nullptr for format 0 (no texture)</returns>
+	const uint32_t* GetTexture(uint32_t texParam, uint32_t paletteBase);
+
+	uint64_t GetHits() const {
+		return hits;
+	}
+
+	uint64_t GetMisses() const {
+		return misses;
+	}
+};
@@ -0,0 +1,185 @@
+#include "gpu_thread.h"
+#include <algorithm>
+#include <cstring>
+
+GPURenderThread::GPURenderThread(ARM9_mem& mem, VRAM& vram, std::function<void(const GPULineJob& job)> renderLine,
+		std::function<void(uint32_t address, uint32_t length)> copiedWrites) : render(renderLine), copied(copiedWrites) {
+	AddRegion(ARM9_mem::PALETTES_ADDR, static_cast<uint32_t>(ARM9_mem::PALETTES_SIZE), mem.GetPointerFromAddr(ARM9_mem::PALETTES_ADDR));
+	AddRegion(ARM9_mem::OAMA_ADDR, static_cast<uint32_t>(ARM9_mem::OAM_SIZE), mem.GetPointerFromAddr(ARM9_mem::OAMA_ADDR));
+	AddRegion(ARM9_mem::OAMB_ADDR, static_cast<uint32_t>(ARM9_mem::OAM_SIZE), mem.GetPointerFromAddr(ARM9_mem::OAMB_ADDR));
+	AddRegion(ARM9_mem::VRAMLCDC_ADDR, VRAM::BANKS_SIZE, vram.GetBanks());
+
+	slots = std::make_unique<Slot[]>(QUEUE_SIZE);
+	thread = std::thread(&GPURenderThread::Run, this);
+}
+
+GPURenderThread::~GPURenderThread() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	changed.notify_all();
+	thread.join();
+}
+
+void GPURenderThread::AddRegion(uint32_t address, uint32_t size, const uint8_t* live) {
+	Region region;
+	region.address = address;
+	region.size = size;
+	region.live = live;
+	// 4 more bytes : palettes are read 32 bits at a time by the AVX2 kernels
+	region.copy = std::make_unique<uint8_t[]>(size + 4);
+	memcpy(region.copy.get(), region.live, size);
+	memset(region.copy.get() + size, 0, 4);
+	region.dirty.assign(((size >> BLOCK_SHIFT) + 63) / 64, 0);
+	region.anyDirty = false;
+	regions.push_back(std::move(region));
+}
+
+const uint8_t* GPURenderThread::GetPointer(uint32_t address) const {
+	for (const Region& region : regions) {
+		if ((address >= region.address) && (address - region.address < region.size)) return region.copy.get() + (address - region.address);
+	}
+	return nullptr;
+}
+
+void GPURenderThread::MarkWritten(uint32_t address, uint32_t length) {
+	for (Region& region : regions) {
+		uint64_t start = std::max<uint64_t>(address, region.address);
+		uint64_t end = std::min<uint64_t>(static_cast<uint64_t>(address) + length, static_cast<uint64_t>(region.address) + region.size);
+		if (start >= end) continue;
+
+		uint32_t first = static_cast<uint32_t>(start - region.address) >> BLOCK_SHIFT;
+		uint32_t last = static_cast<uint32_t>(end - 1 - region.address) >> BLOCK_SHIFT;
+		for (uint32_t block = first; block <= last; block++) region.dirty[block / 64] |= 1ULL << (block % 64);
+		region.anyDirty = true;
+	}
+}
+
+bool GPURenderThread::CollectWrites(Slot& slot) {
+	slot.rangeCount = 0;
+	size_t dataSize = 0;
+
+	for (uint32_t r = 0; r < regions.size(); r++) {
+		Region& region = regions[r];
+		if (!region.anyDirty) continue;
+
+		uint32_t blocks = region.size >> BLOCK_SHIFT;
+		uint32_t block = 0;
+		while (block < blocks) {
+			uint64_t word = region.dirty[block / 64] >> (block % 64);
+			if (word == 0) {
+				block = (block | 63) + 1;
+				continue;
+			}
+			if ((word & 1) == 0) {
+				block++;
+				continue;
+			}
+
+			// Run of written blocks
+			uint32_t end = block + 1;
+			while ((end < blocks) && ((region.dirty[end / 64] >> (end % 64)) & 1)) end++;
+
+			uint32_t offset = block << BLOCK_SHIFT;
+			uint32_t length = (end - block) << BLOCK_SHIFT;
+			if ((slot.rangeCount == LINE_MAX_RANGES) || (dataSize + length > LINE_DATA_SIZE)) return false;
+
+			slot.ranges[slot.rangeCount++] = { r, offset, length };
+			memcpy(slot.data + dataSize, region.live + offset, length);
+			dataSize += length;
+			block = end;
+		}
+	}
+
+	for (Region& region : regions) {
+		if (!region.anyDirty) continue;
+		std::fill(region.dirty.begin(), region.dirty.end(), 0);
+		region.anyDirty = false;
+	}
+	return true;
+}
+
+void GPURenderThread::CopyWrites() {
+	// Only while the render thread is idle
+	for (Region& region : regions) {
+		if (!region.anyDirty) continue;
+
+		for (uint32_t i = 0; i < region.dirty.size(); i++) {
+			uint64_t word = region.dirty[i];
+			while (word != 0) {
+				uint32_t bit = 0;
+				while (((word >> bit) & 1) == 0) bit++;
+				uint32_t offset = (i * 64 + bit) << BLOCK_SHIFT;
+				memcpy(region.copy.get() + offset, region.live + offset, 1 << BLOCK_SHIFT);
+				copied(region.address + offset, 1 << BLOCK_SHIFT);
+				word &= word - 1;
+			}
+			region.dirty[i] = 0;
+		}
+		region.anyDirty = false;
+	}
+}
+
+void GPURenderThread::Queue(const GPULineJob& job) {
+	bool idle;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this]() { return queued - rendered < QUEUE_SIZE; });
+		idle = (queued == rendered);
+	}
+
+	Slot& slot = slots[queued % QUEUE_SIZE];
+	slot.job = job;
+	slot.rangeCount = 0;
+	if (idle) {
+		// Nothing to overlap with : update the copy directly
+		CopyWrites();
+	}
+	else if (!CollectWrites(slot)) {
+		// Too much was written since the last line : let the render thread catch up first
+		Wait();
+		CopyWrites();
+		slot.rangeCount = 0;
+		synchronousLines++;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queued++;
+	}
+	changed.notify_all();
+}
+
+void GPURenderThread::Wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	changed.wait(lock, [this]() { return queued == rendered; });
+}
+
+void GPURenderThread::Run() {
+	while (true) {
+		uint64_t index;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this]() { return stop || (queued != rendered); });
+			if (queued == rendered) return;
+			index = rendered;
+		}
+
+		const Slot& slot = slots[index % QUEUE_SIZE];
+		size_t dataOffset = 0;
+		for (int i = 0; i < slot.rangeCount; i++) {
+			const Range& range = slot.ranges[i];
+			memcpy(regions[range.region].copy.get() + range.offset, slot.data + dataOffset, range.length);
+			copied(regions[range.region].address + range.offset, range.length);
+			dataOffset += range.length;
+		}
+		render(slot.job);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			rendered++;
+		}
+		changed.notify_all();
+	}
+}
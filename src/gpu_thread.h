@@ -0,0 +1,119 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "arm9_mem.h"
+#include "gpu2d.h"
+#include "vram.h"
+
+/// <summary>
+/// Registers of both 2D engines for one line, and where the line goes
+/// </summary>
+struct GPULineJob {
+	GPU2DLineState state[2];
+	uint16_t line;
+	int screen[2];		// Screen of each engine, 0 for the top one
+	uint32_t* output[2];
+	bool enabled[2];	// A disabled engine outputs black, its registers are not latched
+};
+
+/// <summary>
+/// Renders lines on another thread, while the emulation goes on.
+/// The render thread reads its own copy of video memory (palettes, OAM, VRAM banks) : every queued line carries the
+/// ranges written since the previous one, so a line sees video memory as it was when it was queued.
+/// Bank memory is identified by its LCDC address (06800000h), as it is laid out in LCDC mode.
+/// </summary>
+class GPURenderThread {
+private:
+	static const int QUEUE_SIZE = 32;				// Lines
+	static const uint32_t BLOCK_SHIFT = 6;			// Written ranges are tracked by 64 byte blocks
+	static const size_t LINE_DATA_SIZE = 0x2000;	// Written bytes carried by one line, above that the line is synchronous
+	static const int LINE_MAX_RANGES = 64;
+
+	struct Region {
+		uint32_t address;
+		uint32_t size;
+		const uint8_t* live;
+		std::unique_ptr<uint8_t[]> copy;
+		std::vector<uint64_t> dirty;
+		bool anyDirty;
+	};
+
+	struct Range {
+		uint32_t region;
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	struct Slot {
+		GPULineJob job;
+		int rangeCount;
+		Range ranges[LINE_MAX_RANGES];
+		uint8_t data[LINE_DATA_SIZE];
+	};
+
+	std::vector<Region> regions;
+	std::unique_ptr<Slot[]> slots;
+	std::function<void(const GPULineJob& job)> render;
+	std::function<void(uint32_t address, uint32_t length)> copied;
+
+	// Lines queued and rendered since the start, the queue holds the difference
+	uint64_t queued{ 0 };
+	uint64_t rendered{ 0 };
+	bool stop{ false };
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::thread thread;
+
+	uint64_t synchronousLines{ 0 };
+
+	void AddRegion(uint32_t address, uint32_t size, const uint8_t* live);
+	bool CollectWrites(Slot& slot);
+	void CopyWrites();
+	void Run();
+
+public:
+	/// <summary>
+	/// Copy video memory and start the render thread
+	/// </summary>
+	/// <param name="mem">ARM9 memory</param>
+	/// <param name="vram">VRAM banks</param>
+	/// <param name="renderLine">Function rendering a line, called on the render thread</param>
+	/// <param name="copiedWrites">Function told about every range updated in the copy, before the lines that see it</param>
+	GPURenderThread(ARM9_mem& mem, VRAM& vram, std::function<void(const GPULineJob& job)> renderLine,
+		std::function<void(uint32_t address, uint32_t length)> copiedWrites);
+	~GPURenderThread();
+
+	/// <summary>
+	/// Get the render thread copy of an ARM9 video memory address
+	/// </summary>
+	/// <returns>Host pointer, nullptr outside palettes, OAM and VRAM banks (from their LCDC address)</returns>
+	const uint8_t* GetPointer(uint32_t address) const;
+
+	/// <summary>
+	/// Record a write to video memory, to be carried by the next queued line (emulation thread)
+	/// </summary>
+	void MarkWritten(uint32_t address, uint32_t length);
+
+	/// <summary>
+	/// Queue a line, waiting if the render thread is too far behind (emulation thread)
+	/// </summary>
+	void Queue(const GPULineJob& job);
+
+	/// <summary>
+	/// Wait until every queued line has been rendered (emulation thread)
+	/// </summary>
+	void Wait();
+
+	/// <summary>
+	/// Get the number of lines that waited for the render thread, as they came after too many video memory writes
+	/// </summary>
+	uint64_t GetSynchronousLines() const {
+		return synchronousLines;
+	}
+};
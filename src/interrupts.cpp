@@ -0,0 +1,48 @@
+#include "interrupts.h"
+
+void InterruptController::Attach(ARM_mem& mem, Scheduler* sched, std::function<void()> wakeUpFunc) {
+	scheduler = sched;
+	wakeUp = wakeUpFunc;
+
+	mem.SetIOReadHandler(IME_ADDR, [this]() { return ime.load(std::memory_order_relaxed); });
+	mem.SetIOWriteHandler(IME_ADDR, [this](uint32_t value, uint32_t mask) {
+		if ((mask & 0x1) == 0) return;
+		ime.store(value & 0x1, std::memory_order_relaxed);
+		update();
+	});
+
+	mem.SetIOReadHandler(IE_ADDR, [this]() { return ie.load(std::memory_order_relaxed); });
+	mem.SetIOWriteHandler(IE_ADDR, [this](uint32_t value, uint32_t mask) {
+		uint32_t current = ie.load(std::memory_order_relaxed);
+		ie.store((current & ~mask) | (value & mask), std::memory_order_relaxed);
+		update();
+	});
+
+	// Writing 1 to an IF bit acknowledges the interrupt
+	mem.SetIOReadHandler(IF_ADDR, [this]() { return irf.load(std::memory_order_relaxed); });
+	mem.SetIOWriteHandler(IF_ADDR, [this](uint32_t value, uint32_t mask) {
+		irf.fetch_and(~(value & mask), std::memory_order_relaxed);
+		update();
+	});
+}
+
+void InterruptController::Raise(eIRQ irq) {
+	irf.fetch_or(1u << irq, std::memory_order_relaxed);
+	update();
+}
+
+void InterruptController::update() {
+	bool wake = false;
+	bool irqPending = false;
+	{
+		std::lock_guard<std::mutex> lock(updateMutex);
+		uint32_t requested = ie.load(std::memory_order_relaxed) & irf.load(std::memory_order_relaxed);
+		wake = (requested != 0);
+		irqPending = wake && (ime.load(std::memory_order_relaxed) != 0);
+		pending.store(irqPending, std::memory_order_relaxed);
+	}
+
+	// Halt is left on (IE & IF) != 0, whatever IME
+	if (wake && wakeUp) wakeUp();
+	if (irqPending && (scheduler != nullptr)) scheduler->BreakLoop();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include "arm_mem.h"
+#include "scheduler.h"
+
+enum eIRQ : uint32_t {
+	IRQ_VBLANK = 0,
+	IRQ_HBLANK = 1,
+	IRQ_VCOUNTER = 2,
+	IRQ_TIMER0 = 3,
+	IRQ_TIMER1 = 4,
+	IRQ_TIMER2 = 5,
+	IRQ_TIMER3 = 6,
+	IRQ_RTC = 7,				// ARM7 only
+	IRQ_DMA0 = 8,
+	IRQ_DMA1 = 9,
+	IRQ_DMA2 = 10,
+	IRQ_DMA3 = 11,
+	IRQ_KEYPAD = 12,
+	IRQ_GBASLOT = 13,
+	IRQ_IPCSYNC = 16,
+	IRQ_IPCSENDEMPTY = 17,
+	IRQ_IPCRECVNOTEMPTY = 18,
+	IRQ_CARDTRANSFER = 19,
+	IRQ_CARDIREQ = 20,
+	IRQ_GXFIFO = 21,			// ARM9 only
+	IRQ_LIDOPEN = 22,			// ARM7 only
+	IRQ_SPI = 23,				// ARM7 only
+	IRQ_WIFI = 24,				// ARM7 only
+};
+
+/// <summary>
+/// Interrupt controller of one CPU (IME / IE / IF)
+/// </summary>
+class InterruptController {
+private:
+	std::atomic<uint32_t> ime{ 0 };
+	std::atomic<uint32_t> ie{ 0 };
+	std::atomic<uint32_t> irf{ 0 };
+
+	// IME && (IE & IF), only recomputed when one of them changes
+	std::atomic<bool> pending{ false };
+	std::mutex updateMutex;
+
+	Scheduler* scheduler{ nullptr };
+	std::function<void()> wakeUp;
+
+	void update();
+
+public:
+	static const uint32_t IME_ADDR = 0x04000208;
+	static const uint32_t IE_ADDR = 0x04000210;
+	static const uint32_t IF_ADDR = 0x04000214;
+
+	/// <summary>
+	/// Map IME/IE/IF into the CPU I/O table
+	/// </summary>
+	/// <param name="mem">Virtual memory of the CPU</param>
+	/// <param name="sched">Scheduler of the CPU, its run loop is interrupted when an IRQ becomes pending</param>
+	/// <param name="wakeUpFunc">Called when (IE & IF) != 0, to leave the halted state</param>
+	void Attach(ARM_mem& mem, Scheduler* sched, std::function<void()> wakeUpFunc);
+
+	/// <summary>
+	/// Set an IF bit. Can be called from another thread.
+	/// </summary>
+	/// <param name="irq">Interrupt source</param>
+	void Raise(eIRQ irq);
+
+	/// <summary>
+	/// Returns true if an enabled interrupt is waiting (CPSR I bit is not checked)
+	/// </summary>
+	/// <returns></returns>
+	bool IsPending() const {
+		return pending.load(std::memory_order_relaxed);
+	}
+
+	uint32_t GetIE() const {
+		return ie.load(std::memory_order_relaxed);
+	}
+
+	uint32_t GetIF() const {
+		return irf.load(std::memory_order_relaxed);
+	}
+};
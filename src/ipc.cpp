@@ -0,0 +1,144 @@
+#include "ipc.h"
+#include <thread>
+
+#pragma region IPCFifo
+
+bool IPCFifo::Push(uint32_t value) {
+	uint32_t t = tail.load(std::memory_order_relaxed);
+	if (t - head.load(std::memory_order_acquire) >= SIZE) return false;
+
+	data[t % SIZE].store(value, std::memory_order_relaxed);
+	tail.store(t + 1, std::memory_order_release);
+	return true;
+}
+
+bool IPCFifo::Pop(uint32_t& value) {
+	uint32_t h = head.load(std::memory_order_acquire);
+	do {
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		value = data[h % SIZE].load(std::memory_order_relaxed);
+		// Head is also moved by Clear() on the producer side
+	} while (!head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel));
+	return true;
+}
+
+void IPCFifo::Clear() {
+	uint32_t t = tail.load(std::memory_order_relaxed);
+	uint32_t h = head.load(std::memory_order_acquire);
+	while (!head.compare_exchange_weak(h, t, std::memory_order_acq_rel)) {}
+}
+
+#pragma endregion
+
+void IPC::Connect(IPC& a, IPC& b) {
+	a.remote = &b;
+	b.remote = &a;
+}
+
+void IPC::Attach(ARM_mem& mem, Scheduler* sched, InterruptController* irqCtrl) {
+	scheduler = sched;
+	irq = irqCtrl;
+
+	mem.SetIOReadHandler(IPCSYNC_ADDR, [this]() { return ReadSync(); });
+	mem.SetIOWriteHandler(IPCSYNC_ADDR, [this](uint32_t value, uint32_t mask) { WriteSync(value, mask); });
+	mem.SetIOReadHandler(IPCFIFOCNT_ADDR, [this]() { return ReadFifoControl(); });
+	mem.SetIOWriteHandler(IPCFIFOCNT_ADDR, [this](uint32_t value, uint32_t mask) { WriteFifoControl(value, mask); });
+	mem.SetIOReadHandler(IPCFIFOSEND_ADDR, []() { return 0u; });
+	mem.SetIOWriteHandler(IPCFIFOSEND_ADDR, [this](uint32_t value, uint32_t mask) { WriteFifoSend(value); });
+	mem.SetIOReadHandler(IPCFIFORECV_ADDR, [this]() { return ReadFifoRecv(); });
+}
+
+uint32_t IPC::ReadSync() {
+	uint32_t input = remote->syncOutput.load(std::memory_order_relaxed);
+	uint32_t value = input | (syncOutput.load(std::memory_order_relaxed) << 8);
+	if (syncIRQEnabled.load(std::memory_order_relaxed)) value |= (1 << 14);
+	return value;
+}
+
+void IPC::WriteSync(uint32_t value, uint32_t mask) {
+	if ((mask & 0xFF00) == 0) return;
+
+	syncOutput.store((value >> 8) & 0xF, std::memory_order_relaxed);
+	syncIRQEnabled.store((value & (1 << 14)) != 0, std::memory_order_relaxed);
+
+	// Bit 13 : request an IRQ on the remote CPU
+	if (((value & (1 << 13)) != 0) && remote->syncIRQEnabled.load(std::memory_order_relaxed)) {
+		remote->irq->Raise(IRQ_IPCSYNC);
+	}
+}
+
+uint32_t IPC::ReadFifoControl() {
+	uint32_t value = fifoControl.load(std::memory_order_relaxed);
+
+	uint32_t sendCount = sendFifo.GetCount();
+	if (sendCount == 0) value |= FIFOCNT_SEND_EMPTY;
+	if (sendCount >= 16) value |= FIFOCNT_SEND_FULL;
+
+	uint32_t recvCount = GetRecvFifo().GetCount();
+	if (recvCount == 0) {
+		value |= FIFOCNT_RECV_EMPTY;
+		SyncWithRemote();
+	}
+	if (recvCount >= 16) value |= FIFOCNT_RECV_FULL;
+
+	return value;
+}
+
+void IPC::WriteFifoControl(uint32_t value, uint32_t mask) {
+	uint32_t control = fifoControl.load(std::memory_order_relaxed);
+	uint32_t writable = (FIFOCNT_SEND_EMPTY_IRQ | FIFOCNT_RECV_NOT_EMPTY_IRQ | FIFOCNT_ENABLE) & mask;
+	uint32_t newControl = (control & ~writable) | (value & writable);
+
+	// Writing 1 acknowledges the error flag
+	if ((value & mask & FIFOCNT_ERROR) != 0) newControl &= ~FIFOCNT_ERROR;
+	fifoControl.store(newControl, std::memory_order_relaxed);
+
+	if ((value & mask & FIFOCNT_SEND_CLEAR) != 0) sendFifo.Clear();
+
+	// IRQs are edge triggered, enabling them while the condition is already true raises them
+	if (((newControl & ~control) & FIFOCNT_SEND_EMPTY_IRQ) != 0 || ((value & mask & FIFOCNT_SEND_CLEAR) != 0)) {
+		if (((newControl & FIFOCNT_SEND_EMPTY_IRQ) != 0) && sendFifo.IsEmpty()) irq->Raise(IRQ_IPCSENDEMPTY);
+	}
+	if (((newControl & ~control) & FIFOCNT_RECV_NOT_EMPTY_IRQ) != 0) {
+		if (!GetRecvFifo().IsEmpty()) irq->Raise(IRQ_IPCRECVNOTEMPTY);
+	}
+}
+
+void IPC::WriteFifoSend(uint32_t value) {
+	if (!IsFifoControlSet(FIFOCNT_ENABLE)) return;
+
+	if (!sendFifo.Push(value)) {
+		fifoControl.fetch_or(FIFOCNT_ERROR, std::memory_order_relaxed);
+		return;
+	}
+
+	if ((sendFifo.GetCount() == 1) && remote->IsFifoControlSet(FIFOCNT_RECV_NOT_EMPTY_IRQ)) {
+		remote->irq->Raise(IRQ_IPCRECVNOTEMPTY);
+	}
+}
+
+uint32_t IPC::ReadFifoRecv() {
+	if (!IsFifoControlSet(FIFOCNT_ENABLE)) return lastReceived;
+
+	IPCFifo& recvFifo = GetRecvFifo();
+	uint32_t value = 0;
+	if (!recvFifo.Pop(value)) {
+		fifoControl.fetch_or(FIFOCNT_ERROR, std::memory_order_relaxed);
+		SyncWithRemote();
+		return lastReceived;
+	}
+	lastReceived = value;
+
+	if (recvFifo.IsEmpty() && remote->IsFifoControlSet(FIFOCNT_SEND_EMPTY_IRQ)) {
+		remote->irq->Raise(IRQ_IPCSENDEMPTY);
+	}
+
+	return value;
+}
+
+void IPC::SyncWithRemote() {
+	// Waiting on the other CPU : if this one is well ahead, give the host core to the other CPU thread
+	uint64_t local = scheduler->GetTimestamp();
+	uint64_t other = remote->scheduler->GetPublishedTimestamp();
+	if (local > other + SYNC_THRESHOLD_CYCLES) std::this_thread::yield();
+}
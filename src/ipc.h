@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include "arm_mem.h"
+#include "scheduler.h"
+#include "interrupts.h"
+
+/// <summary>
+/// Single-producer / single-consumer ring of 16 words, without locks.
+/// The producer thread owns tail, the consumer thread pops by moving head forward.
+/// </summary>
+class IPCFifo {
+private:
+	static const uint32_t SIZE = 16;
+
+	std::atomic<uint32_t> data[SIZE]{};
+	std::atomic<uint32_t> head{ 0 };
+	std::atomic<uint32_t> tail{ 0 };
+
+public:
+	uint32_t GetCount() const {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	bool IsEmpty() const {
+		return GetCount() == 0;
+	}
+
+	bool IsFull() const {
+		return GetCount() >= SIZE;
+	}
+
+	/// <summary>
+	/// Producer side : add a word
+	/// </summary>
+	/// <param name="value">Word to send</param>
+	/// <returns>false if the FIFO is full</returns>
+	bool Push(uint32_t value);
+
+	/// <summary>
+	/// Consumer side : remove the oldest word
+	/// </summary>
+	/// <param name="value">Received word</param>
+	/// <returns>false if the FIFO is empty</returns>
+	bool Pop(uint32_t& value);
+
+	/// <summary>
+	/// Producer side : drop every word not yet received
+	/// </summary>
+	void Clear();
+};
+
+/// <summary>
+/// IPC endpoint of one CPU : IPCSYNC, IPCFIFOCNT, IPCFIFOSEND and IPCFIFORECV
+/// </summary>
+class IPC {
+private:
+	IPCFifo sendFifo;
+	IPC* remote{ nullptr };
+
+	Scheduler* scheduler{ nullptr };
+	InterruptController* irq{ nullptr };
+
+	std::atomic<uint32_t> syncOutput{ 0 };
+	std::atomic<bool> syncIRQEnabled{ false };
+	std::atomic<uint32_t> fifoControl{ 0 };
+	uint32_t lastReceived{ 0 };
+
+	IPCFifo& GetRecvFifo() {
+		return remote->sendFifo;
+	}
+
+	bool IsFifoControlSet(uint32_t bit) const {
+		return (fifoControl.load(std::memory_order_relaxed) & bit) != 0;
+	}
+
+	uint32_t ReadSync();
+	void WriteSync(uint32_t value, uint32_t mask);
+	uint32_t ReadFifoControl();
+	void WriteFifoControl(uint32_t value, uint32_t mask);
+	void WriteFifoSend(uint32_t value);
+	uint32_t ReadFifoRecv();
+
+	void SyncWithRemote();
+
+public:
+	static const uint32_t IPCSYNC_ADDR = 0x04000180;
+	static const uint32_t IPCFIFOCNT_ADDR = 0x04000184;
+	static const uint32_t IPCFIFOSEND_ADDR = 0x04000188;
+	static const uint32_t IPCFIFORECV_ADDR = 0x04100000;
+
+	static const uint32_t FIFOCNT_SEND_EMPTY = 1 << 0;
+	static const uint32_t FIFOCNT_SEND_FULL = 1 << 1;
+	static const uint32_t FIFOCNT_SEND_EMPTY_IRQ = 1 << 2;
+	static const uint32_t FIFOCNT_SEND_CLEAR = 1 << 3;
+	static const uint32_t FIFOCNT_RECV_EMPTY = 1 << 8;
+	static const uint32_t FIFOCNT_RECV_FULL = 1 << 9;
+	static const uint32_t FIFOCNT_RECV_NOT_EMPTY_IRQ = 1 << 10;
+	static const uint32_t FIFOCNT_ERROR = 1 << 14;
+	static const uint32_t FIFOCNT_ENABLE = 1 << 15;
+
+	// A CPU reading an empty FIFO while being this far ahead of the other CPU lets it catch up
+	static const uint64_t SYNC_THRESHOLD_CYCLES = 4096;
+
+	/// <summary>
+	/// Link two endpoints : what one sends, the other receives
+	/// </summary>
+	static void Connect(IPC& a, IPC& b);
+
+	/// <summary>
+	/// Map the IPC registers into the CPU I/O table
+	/// </summary>
+	/// <param name="mem">Virtual memory of the CPU</param>
+	/// <param name="sched">Scheduler of the CPU</param>
+	/// <param name="irqCtrl">Interrupt controller of the CPU</param>
+	void Attach(ARM_mem& mem, Scheduler* sched, InterruptController* irqCtrl);
+};
@@ -0,0 +1,97 @@
+#include "key1.h"
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+
+static inline uint32_t ByteSwap(uint32_t value) {
+	return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+}
+
+Key1::Key1(const uint8_t* keyTable, uint32_t idCode, int level, int modulo) {
+	memcpy(keyBuffer, keyTable, sizeof(keyBuffer));
+
+	keyCode[0] = idCode;
+	keyCode[1] = idCode >> 1;
+	keyCode[2] = idCode << 1;
+	if (level >= 1) ApplyKeyCode(modulo);
+	if (level >= 2) ApplyKeyCode(modulo);
+	keyCode[1] <<= 1;
+	keyCode[2] >>= 1;
+	if (level >= 3) ApplyKeyCode(modulo);
+}
+
+void Key1::ApplyKeyCode(int modulo) {
+	Encrypt(&keyCode[1]);
+	Encrypt(&keyCode[0]);
+
+	for (int i = 0; i < 0x12; i++) keyBuffer[i] ^= ByteSwap(keyCode[i % (modulo / 4)]);
+
+	uint32_t scratch[2] = { 0, 0 };
+	for (int i = 0; i < 0x412; i += 2) {
+		Encrypt(scratch);
+		keyBuffer[i] = scratch[1];
+		keyBuffer[i + 1] = scratch[0];
+	}
+}
+
+void Key1::Encrypt(uint32_t* data) const {
+	uint32_t y = data[0];
+	uint32_t x = data[1];
+	for (int i = 0; i < 0x10; i++) {
+		uint32_t z = keyBuffer[i] ^ x;
+		x = keyBuffer[0x12 + (z >> 24)] + keyBuffer[0x112 + ((z >> 16) & 0xFF)];
+		x ^= keyBuffer[0x212 + ((z >> 8) & 0xFF)];
+		x += keyBuffer[0x312 + (z & 0xFF)];
+		x ^= y;
+		y = z;
+	}
+	data[0] = x ^ keyBuffer[0x10];
+	data[1] = y ^ keyBuffer[0x11];
+}
+
+void Key1::Decrypt(uint32_t* data) const {
+	uint32_t y = data[0];
+	uint32_t x = data[1];
+	for (int i = 0x11; i >= 0x2; i--) {
+		uint32_t z = keyBuffer[i] ^ x;
+		x = keyBuffer[0x12 + (z >> 24)] + keyBuffer[0x112 + ((z >> 16) & 0xFF)];
+		x ^= keyBuffer[0x212 + ((z >> 8) & 0xFF)];
+		x += keyBuffer[0x312 + (z & 0xFF)];
+		x ^= y;
+		y = z;
+	}
+	data[0] = x ^ keyBuffer[0x1];
+	data[1] = y ^ keyBuffer[0x0];
+}
+
+const Key1& Key1::GetCached(const uint8_t* keyTable, uint32_t gameCode, int level) {
+	// Key setup runs 0x209 encryptions per pass : keep every schedule, keyed by game code and level.
+	// Entries are never removed so the returned references stay valid.
+	static std::mutex mutex;
+	static std::map<uint64_t, std::unique_ptr<Key1>> cache;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::unique_ptr<Key1>& entry = cache[(static_cast<uint64_t>(gameCode) << 8) | level];
+	if (!entry) entry = std::make_unique<Key1>(keyTable, gameCode, level, 8);
+	return *entry;
+}
+
+bool DecryptSecureArea(uint8_t* secureArea, uint32_t gameCode, const uint8_t* keyTable) {
+	static const uint32_t ENCRYPTED_SIZE = 0x800;
+
+	uint32_t words[ENCRYPTED_SIZE / 4];
+	memcpy(words, secureArea, sizeof(words));
+
+	// The first 8 bytes are encrypted twice : with the level 2 key, then with the rest of the area
+	Key1::GetCached(keyTable, gameCode, 2).Decrypt(&words[0]);
+	const Key1& key = Key1::GetCached(keyTable, gameCode, 3);
+	for (uint32_t i = 0; i < ENCRYPTED_SIZE / 4; i += 2) key.Decrypt(&words[i]);
+
+	if (memcmp(words, "encryObj", 8) != 0) return false;
+
+	words[0] = 0xE7FFDEFF;
+	words[1] = 0xE7FFDEFF;
+	memcpy(secureArea, words, sizeof(words));
+	return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// KEY1 : Blowfish variant used by the cartridge protocol and the secure area encryption.
+// The initial key table is not in the ROM, it is read from the ARM7 BIOS.
+class Key1 {
+private:
+	static const int KEY_BUFFER_WORDS = 0x412;
+
+	uint32_t keyBuffer[KEY_BUFFER_WORDS];
+	uint32_t keyCode[3];
+
+	void ApplyKeyCode(int modulo);
+
+public:
+	static const uint32_t BIOS_KEY_TABLE_OFFSET = 0x30;
+	static const uint32_t BIOS_KEY_TABLE_SIZE = 0x1048;
+
+	/// <summary>
+	/// Derive a key schedule from the BIOS key table
+	/// </summary>
+	/// <param name="keyTable">BIOS_KEY_TABLE_SIZE bytes from the ARM7 BIOS at BIOS_KEY_TABLE_OFFSET</param>
+	/// <param name="idCode">Game code from the ROM header</param>
+	/// <param name="level">Number of key code passes (2 : secure area header, 3 : secure area and KEY1 commands)</param>
+	/// <param name="modulo">Key code length in bytes (8 for NDS cartridges)</param>
+	Key1(const uint8_t* keyTable, uint32_t idCode, int level, int modulo);
+
+	/// <summary>
+	/// Encrypt 64 bits in place
+	/// </summary>
+	/// <param name="data">Two words, low word first</param>
+	void Encrypt(uint32_t* data) const;
+
+	/// <summary>
+	/// Decrypt 64 bits in place
+	/// </summary>
+	/// <param name="data">Two words, low word first</param>
+	void Decrypt(uint32_t* data) const;
+
+	/// <summary>
+	/// Get the level 2 and level 3 schedules for a game. They are derived once per game code, then shared.
+	/// </summary>
+	/// <param name="keyTable">BIOS key table, only read the first time a game code is seen</param>
+	/// <param name="gameCode">Game code from the ROM header</param>
+	/// <param name="level">2 or 3</param>
+	/// <returns>Key schedule, valid until the end of the program</returns>
+	static const Key1& GetCached(const uint8_t* keyTable, uint32_t gameCode, int level);
+};
+
+/// <summary>
+/// Decrypt the first 2KB of the secure area and check its "encryObj" marker, replaced by E7FFDEFFh as done by the BIOS
+/// </summary>
+/// <param name="secureArea">Secure area data, decrypted in place</param>
+/// <param name="gameCode">Game code from the ROM header</param>
+/// <param name="keyTable">BIOS key table</param>
+/// <returns>false if the marker does not match (not encrypted, or wrong key table)</returns>
+bool DecryptSecureArea(uint8_t* secureArea, uint32_t gameCode, const uint8_t* keyTable);
@@ -0,0 +1,66 @@
+#include "lcd.h"
+
+void LCD::Attach(Scheduler* sched, ARM_mem& mem, InterruptController* irqCtrl) {
+	scheduler = sched;
+	irq = irqCtrl;
+	dispstat = mem.GetPointerFromAddr(DISPSTAT_ADDR);
+	vcount = mem.GetPointerFromAddr(VCOUNT_ADDR);
+
+	line = 0;
+	ARM_mem::SetHalfWordAtPointer(vcount, line);
+
+	scheduler->SetCallback(EVENT_LCD_HBLANK, [this]() { onHBlank(); });
+	scheduler->SetCallback(EVENT_LCD_LINE, [this]() { onLineEnd(); });
+	scheduler->Schedule(EVENT_LCD_HBLANK, HBLANK_START_CYCLES);
+	scheduler->Schedule(EVENT_LCD_LINE, LINE_CYCLES);
+}
+
+void LCD::AddCallback(eLCDCallback type, std::function<void(uint16_t)> callback) {
+	callbacks[type].push_back(callback);
+}
+
+void LCD::runCallbacks(eLCDCallback type) {
+	for (auto& callback : callbacks[type]) {
+		callback(line);
+	}
+}
+
+void LCD::onHBlank() {
+	uint16_t stat = ARM_mem::GetHalfWordAtPointer(dispstat);
+	ARM_mem::SetHalfWordAtPointer(dispstat, stat | DISPSTAT_HBLANK);
+	if ((stat & DISPSTAT_HBLANK_IRQ) != 0) irq->Raise(IRQ_HBLANK);
+	runCallbacks(LCD_CALLBACK_HBLANK);
+
+	scheduler->Reschedule(EVENT_LCD_HBLANK, LINE_CYCLES);
+}
+
+void LCD::onLineEnd() {
+	line = (line + 1) % TOTAL_LINES;
+	ARM_mem::SetHalfWordAtPointer(vcount, line);
+
+	uint16_t stat = ARM_mem::GetHalfWordAtPointer(dispstat);
+	stat &= ~DISPSTAT_HBLANK;
+
+	if (line == VISIBLE_LINES) {
+		stat |= DISPSTAT_VBLANK;
+		if ((stat & DISPSTAT_VBLANK_IRQ) != 0) irq->Raise(IRQ_VBLANK);
+	}
+	if (line == TOTAL_LINES - 1) stat &= ~DISPSTAT_VBLANK;
+
+	// LYC is DISPSTAT bits 8-15, with bit 8 of the line number at bit 7
+	uint16_t lyc = ((stat >> 8) & 0xFF) | ((stat & 0x80) << 1);
+	if (line == lyc) {
+		stat |= DISPSTAT_VCOUNTER;
+		if ((stat & DISPSTAT_VCOUNTER_IRQ) != 0) irq->Raise(IRQ_VCOUNTER);
+	}
+	else {
+		stat &= ~DISPSTAT_VCOUNTER;
+	}
+
+	ARM_mem::SetHalfWordAtPointer(dispstat, stat);
+
+	runCallbacks(LCD_CALLBACK_LINE_START);
+	if (line == VISIBLE_LINES) runCallbacks(LCD_CALLBACK_VBLANK);
+
+	scheduler->Reschedule(EVENT_LCD_LINE, LINE_CYCLES);
+}
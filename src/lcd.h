@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include "arm_mem.h"
+#include "scheduler.h"
+#include "interrupts.h"
+
+enum eLCDCallback : int {
+	LCD_CALLBACK_LINE_START,	// Called at the start of every line, with the new line number
+	LCD_CALLBACK_HBLANK,		// Called when entering HBlank, with the current line number
+	LCD_CALLBACK_VBLANK,		// Called when entering VBlank (line 192)
+	LCD_CALLBACK_COUNT
+};
+
+/// <summary>
+/// Display timing : scanline counter, HBlank & VBlank periods (DISPSTAT / VCOUNT)
+/// </summary>
+class LCD {
+private:
+	Scheduler* scheduler{ nullptr };
+	InterruptController* irq{ nullptr };
+	uint8_t* dispstat{ nullptr };
+	uint8_t* vcount{ nullptr };
+
+	uint16_t line{ 0 };
+
+	std::vector<std::function<void(uint16_t)>> callbacks[LCD_CALLBACK_COUNT];
+	void runCallbacks(eLCDCallback type);
+
+	void onHBlank();
+	void onLineEnd();
+
+public:
+	static const uint32_t DISPSTAT_ADDR = 0x04000004;
+	static const uint32_t VCOUNT_ADDR = 0x04000006;
+
+	static const uint16_t DISPSTAT_VBLANK = 0x1;
+	static const uint16_t DISPSTAT_HBLANK = 0x2;
+	static const uint16_t DISPSTAT_VCOUNTER = 0x4;
+	static const uint16_t DISPSTAT_VBLANK_IRQ = 0x8;
+	static const uint16_t DISPSTAT_HBLANK_IRQ = 0x10;
+	static const uint16_t DISPSTAT_VCOUNTER_IRQ = 0x20;
+
+	// One dot is 6 bus cycles, 12 scheduler cycles
+	static const uint64_t DOT_CYCLES = 12;
+	static const uint64_t LINE_CYCLES = 355 * DOT_CYCLES;
+	static const uint64_t HBLANK_START_CYCLES = 256 * DOT_CYCLES;
+	static const uint16_t VISIBLE_LINES = 192;
+	static const uint16_t TOTAL_LINES = 263;
+
+	/// <summary>
+	/// Bind display timing to a CPU scheduler and its IO registers, and start the first scanline
+	/// </summary>
+	/// <param name="sched">Scheduler of the CPU owning these registers</param>
+	/// <param name="mem">Virtual memory of the same CPU</param>
+	/// <param name="irqCtrl">Interrupt controller of the same CPU</param>
+	void Attach(Scheduler* sched, ARM_mem& mem, InterruptController* irqCtrl);
+
+	/// <summary>
+	/// Register a function called on a display timing event (DMA starts, rendering...)
+	/// </summary>
+	/// <param name="type">Timing event</param>
+	/// <param name="callback">Function receiving the current line number</param>
+	void AddCallback(eLCDCallback type, std::function<void(uint16_t)> callback);
+
+	uint16_t GetLine() const {
+		return line;
+	}
+};
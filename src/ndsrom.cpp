@@ -1,55 +1,160 @@
 #include "ndsrom.h"
+#include "crc16.h"
+#include "key1.h"
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 NDSRom::NDSRom(std::string filePath) {
-	file = OpenFile(filePath, &header);
+	if (OpenFile(filePath)) Validate();
 }
 
 NDSRom::~NDSRom() {
-	file.close();
+	CloseFile();
 }
 
-std::ifstream NDSRom::OpenFile(std::string filepath, NDSHeader* header) {
-	std::streampos size;
-	char* memblock = nullptr;
-
-	std::ifstream file(filepath, std::ios::in | std::ios::binary | std::ios::ate);
-	if (file.is_open())
-	{
-		size = file.tellg();
-		memblock = new char[size];
+bool NDSRom::OpenFile(const std::string& filepath) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
 
-		file.seekg(0, std::ios::beg);
-		file.read(memblock, size);
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart < static_cast<LONGLONG>(sizeof(NDSHeader)))) {
+		CloseHandle(file);
+		return false;
 	}
 
-	if (memblock != nullptr) {
-		if (size > sizeof(NDSHeader)) size = sizeof(NDSHeader);
-		memcpy(header, const_cast<const char *>(memblock), size);
+	// The view keeps the mapping (and the file) alive, both handles can be closed right away
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (mapping == nullptr) return false;
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (view == nullptr) return false;
+
+	size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int fd = open(filepath.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || (st.st_size < static_cast<off_t>(sizeof(NDSHeader)))) {
+		close(fd);
+		return false;
 	}
 
-	return file;
+	// The mapping stays valid once the descriptor is closed
+	void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED) return false;
+
+	size = static_cast<size_t>(st.st_size);
+#endif
+
+	data = static_cast<const uint8_t*>(view);
+	header = reinterpret_cast<const NDSHeader*>(data);
+	return true;
 }
 
-bool NDSRom::IsOpened() { return file.is_open(); }
+void NDSRom::CloseFile() {
+	if (data == nullptr) return;
 
-void NDSRom::WriteProgramToARM9Memory(ARM_mem& mem) {
-	uint8_t* ptr = mem.GetPointerFromAddr(header.ARM9_EntryAddress);
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(const_cast<uint8_t*>(data), size);
+#endif
+
+	data = nullptr;
+	header = nullptr;
+	size = 0;
+}
+
+static const uint32_t SECURE_AREA_START = 0x4000;
+static const uint32_t SECURE_AREA_END = 0x8000;
+
+void NDSRom::Validate() {
+	// Checksums are over the data as stored in the file, so an encrypted secure area is checked as is
+	validation.headerValid = CRC16(0xFFFF, data, offsetof(NDSHeader, HeaderChecksum)) == header->HeaderChecksum;
+	validation.logoValid = CRC16(0xFFFF, header->NintendoLogo, sizeof(header->NintendoLogo)) == header->NintendoLogoChecksum;
+
+	validation.hasSecureArea = (header->ARM9_ROMOffset >= SECURE_AREA_START) && (header->ARM9_ROMOffset < SECURE_AREA_END) && (size >= SECURE_AREA_END);
+	validation.secureAreaValid = validation.hasSecureArea
+		&& (CRC16(0xFFFF, data + SECURE_AREA_START, SECURE_AREA_END - SECURE_AREA_START) == header->SecureAreaChecksum);
+}
+
+bool NDSRom::DecryptSecureArea(const uint8_t* arm7Bios) {
+	if (!validation.hasSecureArea || (header->ARM9_ROMOffset != SECURE_AREA_START)) return false;
+
+	// Already decrypted dumps start with the marker the BIOS leaves after decryption
+	static const uint32_t DECRYPTED_MARKER = 0xE7FFDEFF;
+	uint32_t marker[2];
+	memcpy(marker, data + SECURE_AREA_START, sizeof(marker));
+	if ((marker[0] == DECRYPTED_MARKER) && (marker[1] == DECRYPTED_MARKER)) return false;
 
-	file.seekg(header.ARM9_ROMOffset, std::ios::beg);
-	file.read(reinterpret_cast<char*>(ptr), header.ARM9_Size);
+	uint32_t gameCode = static_cast<uint8_t>(header->GameCode[0]) | (static_cast<uint8_t>(header->GameCode[1]) << 8)
+		| (static_cast<uint8_t>(header->GameCode[2]) << 16) | (static_cast<uint32_t>(static_cast<uint8_t>(header->GameCode[3])) << 24);
+
+	std::vector<uint8_t> decrypted(data + SECURE_AREA_START, data + SECURE_AREA_END);
+	if (!::DecryptSecureArea(decrypted.data(), gameCode, arm7Bios + Key1::BIOS_KEY_TABLE_OFFSET)) return false;
+
+	secureArea = std::move(decrypted);
+	return true;
+}
+
+bool NDSRom::IsOpened() { return data != nullptr; }
+
+void NDSRom::Read(uint32_t offset, uint8_t* dst, size_t length) const {
+	size_t available = (offset < size) ? size - offset : 0;
+	if (available > length) available = length;
+
+	if (available > 0) memcpy(dst, data + offset, available);
+	if (available < length) memset(dst + available, 0xFF, length - available);
+
+	if (!secureArea.empty() && (offset < SECURE_AREA_END) && (offset + length > SECURE_AREA_START)) {
+		uint32_t start = std::max<uint32_t>(offset, SECURE_AREA_START);
+		uint32_t end = static_cast<uint32_t>(std::min<size_t>(offset + length, SECURE_AREA_END));
+		memcpy(dst + (start - offset), secureArea.data() + (start - SECURE_AREA_START), end - start);
+	}
+}
+
+void NDSRom::CopyToMemory(ARM_mem& mem, uint32_t offset, uint32_t address, uint32_t length) const {
+	// Memory regions are 4KB aligned : copy page by page so a program may span several of them
+	while (length > 0) {
+		uint32_t chunk = std::min<uint32_t>(length, 0x1000 - (address & 0xFFF));
+		uint8_t* ptr = mem.GetPointerFromAddr(address);
+		if (ptr != nullptr) Read(offset, ptr, chunk);
+
+		offset += chunk;
+		address += chunk;
+		length -= chunk;
+	}
+}
+
+void NDSRom::WriteProgramToARM9Memory(ARM_mem& mem) {
+	CopyToMemory(mem, header->ARM9_ROMOffset, header->ARM9_RamAddress, header->ARM9_Size);
 }
 
 uint32_t NDSRom::GetARM9StartAddress() {
-	return header.ARM9_EntryAddress;
+	return header->ARM9_EntryAddress;
 }
 
 void NDSRom::WriteProgramToARM7Memory(ARM_mem& mem) {
-	uint8_t* ptr = mem.GetPointerFromAddr(header.ARM7_EntryAddress);
-
-	file.seekg(header.ARM7_ROMOffset, std::ios::beg);
-	file.read(reinterpret_cast<char*>(ptr), header.ARM7_Size);
+	CopyToMemory(mem, header->ARM7_ROMOffset, header->ARM7_RamAddress, header->ARM7_Size);
 }
 
 uint32_t NDSRom::GetARM7StartAddress() {
-	return header.ARM7_EntryAddress;
+	return header->ARM7_EntryAddress;
 }
@@ -1,8 +1,8 @@
 #pragma once
 
 #include <cstdint>
-#include <iostream>
-#include <fstream>
+#include <string>
+#include <vector>
 #include "arm_mem.h"
 
 #pragma pack(push)
@@ -65,22 +65,41 @@ struct NDSHeader {
 };
 #pragma pack(pop)
 
+/// <summary>
+/// Result of the header CRC checks, computed when the ROM is opened
+/// </summary>
+struct NDSRomValidation {
+	bool headerValid{ false };
+	bool logoValid{ false };
+	bool hasSecureArea{ false };		// ARM9 binary starts in the secure area (0x4000-0x7FFF), false for most homebrew
+	bool secureAreaValid{ false };		// Only meaningful if hasSecureArea
+};
+
 class NDSRom {
 private:
-	NDSHeader header;
-	std::ifstream file;
+	// Read-only mapping of the whole .NDS file, shared with every other process mapping it
+	const uint8_t* data{ nullptr };
+	size_t size{ 0 };
+	const NDSHeader* header{ nullptr };
+	NDSRomValidation validation;
+	std::vector<uint8_t> secureArea;	// Decrypted copy of 0x4000-0x7FFF, empty if the file is used as is
 
-	std::ifstream OpenFile(std::string, NDSHeader *);
+	bool OpenFile(const std::string& filepath);
+	void CloseFile();
+	void Validate();
 
 public:
 	/// <summary>
-	/// Initialise a NDS ROM from a .NDS file
+	/// Initialise a NDS ROM from a .NDS file. The file is memory mapped, nothing is copied.
 	/// </summary>
 	/// <param name="filepath">Path to .NDS file</param>
 	NDSRom (std::string filepath);
 
 	~NDSRom();
 
+	NDSRom(const NDSRom&) = delete;
+	NDSRom& operator=(const NDSRom&) = delete;
+
 	/// <summary>
 	/// Returns whether or not ROM file is still opened.
 	/// </summary>
@@ -88,7 +107,65 @@ public:
 	bool IsOpened();
 
 	/// <summary>
-	/// Write ARM9 program into virtual ARM memory
+	/// Get the ROM header, parsed in place in the file mapping
+	/// </summary>
+	/// <returns>Header (only valid while the ROM is opened)</returns>
+	const NDSHeader& GetHeader() const {
+		return *header;
+	}
+
+	/// <summary>
+	/// Get the result of the header, logo and secure area checksum checks
+	/// </summary>
+	/// <returns></returns>
+	const NDSRomValidation& GetValidation() const {
+		return validation;
+	}
+
+	/// <summary>
+	/// Decrypt the secure area of a commercial dump, needed to boot without running the BIOS boot code.
+	/// Reads return the decrypted data afterwards, the file itself is left untouched.
+	/// </summary>
+	/// <param name="arm7Bios">ARM7 BIOS image, holds the KEY1 key table</param>
+	/// <returns>true if the secure area was encrypted and has been decrypted</returns>
+	bool DecryptSecureArea(const uint8_t* arm7Bios);
+
+	/// <summary>
+	/// Get the size of the ROM file
+	/// </summary>
+	/// <returns>Size in bytes</returns>
+	size_t GetSize() const {
+		return size;
+	}
+
+	/// <summary>
+	/// Get a pointer into the ROM mapping
+	/// </summary>
+	/// <param name="offset">Offset in ROM</param>
+	/// <returns>Pointer to the byte at offset, nullptr if out of the file</returns>
+	const uint8_t* GetPointer(uint32_t offset) const {
+		return (offset < size) ? data + offset : nullptr;
+	}
+
+	/// <summary>
+	/// Cartridge read : copy ROM bytes, bytes after the end of the file read as 0xFF
+	/// </summary>
+	/// <param name="offset">Offset in ROM</param>
+	/// <param name="dst">Destination buffer</param>
+	/// <param name="length">Number of bytes to copy</param>
+	void Read(uint32_t offset, uint8_t* dst, size_t length) const;
+
+	/// <summary>
+	/// Copy ROM bytes into virtual ARM memory
+	/// </summary>
+	/// <param name="mem">Reference to virtual memory</param>
+	/// <param name="offset">Offset in ROM</param>
+	/// <param name="address">Destination address in virtual ARM memory</param>
+	/// <param name="length">Number of bytes to copy</param>
+	void CopyToMemory(ARM_mem& mem, uint32_t offset, uint32_t address, uint32_t length) const;
+
+	/// <summary>
+	/// Write ARM9 program into virtual ARM memory, at its RAM address
 	/// </summary>
 	/// <param name="mem">Reference to ARM9 virtual memory</param>
 	void WriteProgramToARM9Memory(ARM_mem &mem);
@@ -100,7 +177,7 @@ public:
 	uint32_t GetARM9StartAddress();
 
 	/// <summary>
-	/// Write ARM7 program into virtual ARM memory
+	/// Write ARM7 program into virtual ARM memory, at its RAM address
 	/// </summary>
 	/// <param name="mem">Reference to ARM7 virtual memory</param>
 	void WriteProgramToARM7Memory(ARM_mem& mem);
@@ -0,0 +1,158 @@
+#include "nitrofs.h"
+#include <algorithm>
+#include <cstring>
+
+NitroFS::NitroFS(const NDSRom& ndsRom) : rom(ndsRom) {
+	if (!LoadFAT()) return;
+	if (!LoadFNT()) {
+		files.clear();
+		filePaths.clear();
+		pathIndex.clear();
+		return;
+	}
+
+	const NDSHeader& header = rom.GetHeader();
+	LoadOverlays(header.ARM9_OverlayOffset, header.ARM9_OverlaySize, arm9Overlays);
+	LoadOverlays(header.ARM7_OverlayOffset, header.ARM7_OverlaySize, arm7Overlays);
+}
+
+bool NitroFS::LoadFAT() {
+	const NDSHeader& header = rom.GetHeader();
+	const uint8_t* fat = rom.GetPointer(header.FAT_Offset);
+	if ((fat == nullptr) || (header.FAT_Size == 0) || (static_cast<uint64_t>(header.FAT_Offset) + header.FAT_Size > rom.GetSize())) return false;
+
+	// 8 bytes per file : start and end offsets in ROM
+	uint32_t count = header.FAT_Size / 8;
+	files.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t start = ARM_mem::GetWordAtPointer(const_cast<uint8_t*>(fat + i * 8));
+		uint32_t end = ARM_mem::GetWordAtPointer(const_cast<uint8_t*>(fat + i * 8 + 4));
+		files[i].Offset = start;
+		files[i].Size = (end > start) ? end - start : 0;
+	}
+
+	filePaths.resize(count);
+	return true;
+}
+
+bool NitroFS::LoadFNT() {
+	const NDSHeader& header = rom.GetHeader();
+	const uint8_t* fnt = rom.GetPointer(header.FNT_Offset);
+	uint32_t fntSize = header.FNT_Size;
+	if ((fnt == nullptr) || (fntSize < 8) || (static_cast<uint64_t>(header.FNT_Offset) + fntSize > rom.GetSize())) return false;
+
+	// Main table : 8 bytes per directory, the root entry holds the number of directories
+	uint32_t dirCount = fnt[6] | (fnt[7] << 8);
+	if ((dirCount == 0) || (dirCount > 0x1000) || (dirCount * 8 > fntSize)) return false;
+
+	pathIndex.reserve(files.size());
+
+	// Walk directories breadth first from the root, building their path prefix once
+	std::vector<std::string> dirPaths(dirCount);
+	std::vector<bool> visited(dirCount, false);
+	std::vector<uint16_t> pending{ 0 };
+	visited[0] = true;
+
+	for (size_t p = 0; p < pending.size(); p++) {
+		uint16_t dir = pending[p];
+		const uint8_t* entry = fnt + dir * 8;
+		uint32_t subTableOffset = ARM_mem::GetWordAtPointer(const_cast<uint8_t*>(entry));
+		uint32_t fileId = entry[4] | (entry[5] << 8);
+
+		uint32_t pos = subTableOffset;
+		while (pos < fntSize) {
+			uint8_t type = fnt[pos++];
+			if (type == 0) break;
+
+			uint32_t nameLength = type & 0x7F;
+			if (pos + nameLength > fntSize) return false;
+			std::string path = dirPaths[dir] + std::string(reinterpret_cast<const char*>(fnt + pos), nameLength);
+			pos += nameLength;
+
+			if ((type & 0x80) == 0) {
+				// File
+				if (fileId < files.size()) {
+					pathIndex.emplace(path, static_cast<uint16_t>(fileId));
+					filePaths[fileId] = std::move(path);
+				}
+				fileId++;
+			}
+			else {
+				// Sub directory
+				if (pos + 2 > fntSize) return false;
+				uint32_t subDir = (fnt[pos] | (fnt[pos + 1] << 8)) - ROOT_DIR_ID;
+				pos += 2;
+				if ((subDir < dirCount) && !visited[subDir]) {
+					visited[subDir] = true;
+					dirPaths[subDir] = path + "/";
+					pending.push_back(static_cast<uint16_t>(subDir));
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+void NitroFS::LoadOverlays(uint32_t offset, uint32_t size, std::vector<NDSOverlay>& overlays) {
+	const uint8_t* table = rom.GetPointer(offset);
+	if ((table == nullptr) || (size == 0) || (static_cast<uint64_t>(offset) + size > rom.GetSize())) return;
+
+	overlays.resize(size / sizeof(NDSOverlay));
+	memcpy(overlays.data(), table, overlays.size() * sizeof(NDSOverlay));
+}
+
+uint32_t NitroFS::FindFile(std::string_view path) const {
+	while (!path.empty() && (path.front() == '/')) path.remove_prefix(1);
+
+	auto it = pathIndex.find(path);
+	return (it != pathIndex.end()) ? it->second : INVALID_FILE;
+}
+
+const uint8_t* NitroFS::GetFileData(uint32_t id) const {
+	const NitroFile* file = GetFile(id);
+	if ((file == nullptr) || (static_cast<uint64_t>(file->Offset) + file->Size > rom.GetSize())) return nullptr;
+	return rom.GetPointer(file->Offset);
+}
+
+size_t NitroFS::Read(uint32_t id, uint32_t offset, uint8_t* dst, size_t length) const {
+	const NitroFile* file = GetFile(id);
+	if ((file == nullptr) || (offset >= file->Size)) return 0;
+
+	length = std::min<size_t>(length, file->Size - offset);
+	rom.Read(file->Offset + offset, dst, length);
+	return length;
+}
+
+bool NitroFS::Extract(uint32_t id, std::vector<uint8_t>& data) const {
+	const NitroFile* file = GetFile(id);
+	if (file == nullptr) return false;
+
+	data.resize(file->Size);
+	if (file->Size > 0) rom.Read(file->Offset, data.data(), file->Size);
+	return true;
+}
+
+bool NitroFS::Stream(uint32_t id, const std::function<void(const uint8_t*, size_t)>& sink, size_t chunkSize) const {
+	const NitroFile* file = GetFile(id);
+	if ((file == nullptr) || (chunkSize == 0)) return false;
+
+	const uint8_t* data = GetFileData(id);
+	if (data == nullptr) {
+		// Truncated ROM : go through a buffer so the missing part reads as padding
+		std::vector<uint8_t> buffer;
+		Extract(id, buffer);
+		data = buffer.data();
+		for (size_t pos = 0; pos < buffer.size(); pos += chunkSize) sink(data + pos, std::min(chunkSize, buffer.size() - pos));
+		return true;
+	}
+
+	for (size_t pos = 0; pos < file->Size; pos += chunkSize) sink(data + pos, std::min<size_t>(chunkSize, file->Size - pos));
+	return true;
+}
+
+void NitroFS::ForEachFile(const std::function<void(uint32_t, const std::string&)>& callback) const {
+	for (uint32_t id = 0; id < filePaths.size(); id++) {
+		if (!filePaths[id].empty()) callback(id, filePaths[id]);
+	}
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include "ndsrom.h"
+
+#pragma pack(push)
+#pragma pack(1)	// https://problemkaputt.de/gbatek.htm#dscartridgenitroromandnitroarcfilesystems
+struct NDSOverlay {
+	uint32_t OverlayId;
+	uint32_t RamAddress;
+	uint32_t RamSize;
+	uint32_t BssSize;
+	uint32_t StaticInitStart;
+	uint32_t StaticInitEnd;
+	uint32_t FileId;
+	uint32_t Flags;								// bits 0-23 : compressed size / bit 24 : compressed
+};
+#pragma pack(pop)
+
+struct NitroFile {
+	uint32_t Offset;							// Offset in ROM
+	uint32_t Size;
+};
+
+/// <summary>
+/// Read only view of the NitroFS file system of a ROM.
+/// FNT and FAT are parsed once, paths are then looked up in a hash table.
+/// </summary>
+class NitroFS {
+private:
+	struct PathHash {
+		using is_transparent = void;
+		size_t operator()(std::string_view path) const { return std::hash<std::string_view>{}(path); }
+	};
+
+	const NDSRom& rom;
+	std::vector<NitroFile> files;
+	std::vector<std::string> filePaths;		// Indexed by file id, empty for unnamed files (overlays)
+	std::unordered_map<std::string, uint16_t, PathHash, std::equal_to<>> pathIndex;
+	std::vector<NDSOverlay> arm9Overlays;
+	std::vector<NDSOverlay> arm7Overlays;
+
+	bool LoadFAT();
+	bool LoadFNT();
+	void LoadOverlays(uint32_t offset, uint32_t size, std::vector<NDSOverlay>& overlays);
+
+public:
+	static const uint16_t ROOT_DIR_ID = 0xF000;
+	static const uint32_t INVALID_FILE = UINT32_MAX;
+	static const size_t STREAM_CHUNK_SIZE = 0x10000;
+
+	/// <summary>
+	/// Build the file index of a ROM
+	/// </summary>
+	/// <param name="ndsRom">Opened ROM, must outlive the file system</param>
+	NitroFS(const NDSRom& ndsRom);
+
+	/// <summary>
+	/// Returns whether or not FNT and FAT were valid
+	/// </summary>
+	/// <returns></returns>
+	bool IsLoaded() const {
+		return !files.empty();
+	}
+
+	size_t GetFileCount() const {
+		return files.size();
+	}
+
+	/// <summary>
+	/// Find a file by path ("dir/sub/file.bin", leading '/' allowed)
+	/// </summary>
+	/// <param name="path">Path relative to the root directory</param>
+	/// <returns>File id, INVALID_FILE if not found</returns>
+	uint32_t FindFile(std::string_view path) const;
+
+	/// <summary>
+	/// Get offset and size of a file in the ROM
+	/// </summary>
+	/// <param name="id">File id</param>
+	/// <returns>File entry, nullptr for an invalid id</returns>
+	const NitroFile* GetFile(uint32_t id) const {
+		return (id < files.size()) ? &files[id] : nullptr;
+	}
+
+	/// <summary>
+	/// Get the path of a file
+	/// </summary>
+	/// <param name="id">File id</param>
+	/// <returns>Full path, empty for unnamed files</returns>
+	const std::string& GetPath(uint32_t id) const {
+		return filePaths[id];
+	}
+
+	/// <summary>
+	/// Get the file data inside the ROM mapping, without any copy
+	/// </summary>
+	/// <param name="id">File id</param>
+	/// <returns>Pointer to the first byte, nullptr if the file is not fully inside the ROM</returns>
+	const uint8_t* GetFileData(uint32_t id) const;
+
+	/// <summary>
+	/// Copy part of a file
+	/// </summary>
+	/// <param name="id">File id</param>
+	/// <param name="offset">Offset in file</param>
+	/// <param name="dst">Destination buffer</param>
+	/// <param name="length">Maximum number of bytes to copy</param>
+	/// <returns>Number of bytes copied</returns>
+	size_t Read(uint32_t id, uint32_t offset, uint8_t* dst, size_t length) const;
+
+	/// <summary>
+	/// Copy a whole file
+	/// </summary>
+	/// <param name="id">File id</param>
+	/// <param name="data">Receives the file content</param>
+	/// <returns>false for an invalid id</returns>
+	bool Extract(uint32_t id, std::vector<uint8_t>& data) const;
+
+	/// <summary>
+	/// Pass a file to a consumer chunk by chunk, straight from the ROM mapping
+	/// </summary>
+	/// <param name="id">File id</param>
+	/// <param name="sink">Function receiving each chunk</param>
+	/// <param name="chunkSize">Maximum chunk size, at least 1</param>
+	/// <returns>false for an invalid id or a zero chunk size</returns>
+	bool Stream(uint32_t id, const std::function<void(const uint8_t*, size_t)>& sink, size_t chunkSize = STREAM_CHUNK_SIZE) const;
+
+	/// <summary>
+	/// Call a function for every named file
+	/// </summary>
+	/// <param name="callback">Function receiving file id and path</param>
+	void ForEachFile(const std::function<void(uint32_t, const std::string&)>& callback) const;
+
+	const std::vector<NDSOverlay>& GetARM9Overlays() const {
+		return arm9Overlays;
+	}
+
+	const std::vector<NDSOverlay>& GetARM7Overlays() const {
+		return arm7Overlays;
+	}
+};
@@ -0,0 +1,448 @@
+#include "savememory.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SaveMemory::~SaveMemory() {
+	Close();
+}
+
+bool SaveMemory::Open(const std::string& filePath, eSaveType saveType, size_t saveSize) {
+	Close();
+	path = filePath;
+	type = saveType;
+
+	// An existing save file gives the chip size, and the type when not forced
+	size_t fileSize = 0;
+	if (!path.empty()) {
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes)) {
+			fileSize = (static_cast<size_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+		}
+#else
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0) fileSize = static_cast<size_t>(st.st_size);
+#endif
+	}
+	if (saveSize == 0) saveSize = fileSize;
+
+	if (saveSize == 0) {
+		// Blank chip : reads return FFh whatever the chip is, the type can wait for the first addressed command
+		detecting = true;
+		return true;
+	}
+
+	if (type == SAVE_AUTO) {
+		if (saveSize == 0x8000) type = SAVE_FRAM;
+		else if (saveSize <= 0x20000) type = SAVE_EEPROM;
+		else type = SAVE_FLASH;
+	}
+	int addrBytes = ((type == SAVE_FLASH) || (saveSize > 0x10000)) ? 3 : ((saveSize <= 0x200) ? 1 : 2);
+	SetStorage(type, addrBytes, saveSize);
+	return (fileSize == 0) || mapped;
+}
+
+void SaveMemory::Close() {
+	if (flushThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(flushMutex);
+			flushStop = true;
+		}
+		flushCondition.notify_one();
+		flushThread.join();
+	}
+	flushStop = false;
+	flushRequested = false;
+
+	Flush();
+	UnmapFile();
+	memoryBuffer.clear();
+	memoryBuffer.shrink_to_fit();
+	dirtyPages.reset();
+	dirtyWords = 0;
+
+	data = nullptr;
+	size = 0;
+	addressMask = 0;
+	addressBytes = 0;
+	selected = false;
+	writeEnable = false;
+	detecting = false;
+	detectBuffer.clear();
+}
+
+#pragma region Storage
+
+void SaveMemory::SetStorage(eSaveType saveType, int addrBytes, size_t storageSize) {
+	type = saveType;
+	addressBytes = addrBytes;
+	size = storageSize;
+	addressMask = static_cast<uint32_t>(storageSize - 1);
+
+	size_t pages = ((storageSize - 1) >> DIRTY_PAGE_SHIFT) + 1;
+	dirtyWords = (pages + 63) / 64;
+	dirtyPages = std::make_unique<std::atomic<uint64_t>[]>(dirtyWords);
+	for (size_t i = 0; i < dirtyWords; i++) dirtyPages[i].store(0, std::memory_order_relaxed);
+
+	if (!path.empty() && MapFile(storageSize)) {
+		flushThread = std::thread(&SaveMemory::FlushLoop, this);
+		return;
+	}
+
+	// No save file, or it can't be mapped : keep the save in memory
+	memoryBuffer.assign(storageSize, 0xFF);
+	data = memoryBuffer.data();
+}
+
+bool SaveMemory::MapFile(size_t fileSize) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	bool created = (GetLastError() != ERROR_ALREADY_EXISTS);
+
+	LARGE_INTEGER currentSize;
+	if (!GetFileSizeEx(file, &currentSize)) {
+		CloseHandle(file);
+		return false;
+	}
+	created = created || (currentSize.QuadPart == 0);
+
+	// The mapping extends the file to the chip size if needed
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(fileSize) >> 32), static_cast<DWORD>(fileSize), nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, fileSize);
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	// Both handles are kept : FlushFileBuffers needs the file one
+	fileHandle = file;
+	mappingHandle = mapping;
+#else
+	int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	bool created = (st.st_size == 0);
+
+	if ((static_cast<size_t>(st.st_size) < fileSize) && (ftruncate(fd, static_cast<off_t>(fileSize)) != 0)) {
+		close(fd);
+		return false;
+	}
+
+	// MAP_SHARED : stores land in the page cache, msync only has to write the dirty pages back
+	void* view = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED) return false;
+#endif
+
+	data = static_cast<uint8_t*>(view);
+	mapped = true;
+
+	// A new chip is erased, not zeroed
+	if (created) {
+		memset(data, 0xFF, fileSize);
+		MarkDirty(0, static_cast<uint32_t>(fileSize));
+	}
+	return true;
+}
+
+void SaveMemory::UnmapFile() {
+	if (!mapped) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(static_cast<HANDLE>(mappingHandle));
+	CloseHandle(static_cast<HANDLE>(fileHandle));
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	munmap(data, size);
+#endif
+
+	mapped = false;
+}
+
+#pragma endregion
+
+#pragma region Dirty pages
+
+void SaveMemory::MarkDirty(uint32_t addr, uint32_t length) {
+	uint32_t first = addr >> DIRTY_PAGE_SHIFT;
+	uint32_t last = (addr + length - 1) >> DIRTY_PAGE_SHIFT;
+	for (uint32_t page = first; page <= last; page++) {
+		std::atomic<uint64_t>& word = dirtyPages[page / 64];
+		uint64_t bit = 1ull << (page % 64);
+		// Most writes hit a page already dirty : avoid the locked instruction
+		if ((word.load(std::memory_order_relaxed) & bit) == 0) word.fetch_or(bit, std::memory_order_release);
+	}
+}
+
+void SaveMemory::RequestFlush() {
+	if (!flushThread.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(flushMutex);
+		flushRequested = true;
+	}
+	flushCondition.notify_one();
+}
+
+void SaveMemory::Flush() {
+	FlushDirtyPages();
+}
+
+void SaveMemory::FlushDirtyPages() {
+	if (!mapped) return;
+
+	for (size_t i = 0; i < dirtyWords; i++) {
+		uint64_t bits = dirtyPages[i].exchange(0, std::memory_order_acquire);
+
+		// One sync per run of consecutive dirty pages
+		while (bits != 0) {
+			int start = 0;
+			while (((bits >> start) & 0x1) == 0) start++;
+			int end = start;
+			while ((end < 64) && (((bits >> end) & 0x1) != 0)) end++;
+			bits &= (end < 64) ? ~((1ull << end) - 1) : 0;
+
+			size_t offset = (i * 64 + start) << DIRTY_PAGE_SHIFT;
+			size_t length = std::min<size_t>(static_cast<size_t>(end - start) << DIRTY_PAGE_SHIFT, size - offset);
+#ifdef _WIN32
+			FlushViewOfFile(data + offset, length);
+#else
+			msync(data + offset, length, MS_SYNC);
+#endif
+		}
+	}
+
+#ifdef _WIN32
+	// FlushViewOfFile does not wait for the disk
+	FlushFileBuffers(static_cast<HANDLE>(fileHandle));
+#endif
+}
+
+void SaveMemory::FlushLoop() {
+	std::unique_lock<std::mutex> lock(flushMutex);
+	while (true) {
+		flushCondition.wait(lock, [this]() { return flushRequested || flushStop; });
+		if (flushStop) return;
+
+		// Games save with many small transactions : let them finish, then write everything at once
+		flushCondition.wait_for(lock, std::chrono::milliseconds(FLUSH_DELAY_MS), [this]() { return flushStop; });
+		flushRequested = false;
+
+		lock.unlock();
+		FlushDirtyPages();
+		lock.lock();
+	}
+}
+
+#pragma endregion
+
+#pragma region SPI protocol
+
+bool SaveMemory::IsAddressedCommand(uint8_t cmd) const {
+	switch (cmd) {
+	case CMD_READ:
+	case CMD_READ_HIGH:
+	case CMD_WRITE:
+	case CMD_WRITE_HIGH:
+	case CMD_PAGE_ERASE:
+	case CMD_SECTOR_ERASE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void SaveMemory::Detect() {
+	// Bytes after the command : address, then data. Data is usually a multiple of 4 bytes,
+	// so the address size is the one leaving a multiple of 4 (2 if none does).
+	size_t count = detectBuffer.size() - 1;
+	if (count == 0) return;
+
+	int addrBytes = 2;
+	if (count <= 3) addrBytes = static_cast<int>(count);
+	else if (((count - 3) & 0x3) == 0) addrBytes = 3;
+	else if (((count - 1) & 0x3) == 0) addrBytes = 1;
+
+	switch (addrBytes) {
+	case 1:		SetStorage(SAVE_EEPROM, 1, 0x200); break;
+	case 2:		SetStorage(SAVE_EEPROM, 2, 0x10000); break;
+	default:	SetStorage(SAVE_FLASH, 3, 0x80000); break;
+	}
+	detecting = false;
+
+	// Run the transaction again, now that it can be decoded
+	std::vector<uint8_t> transaction;
+	transaction.swap(detectBuffer);
+	for (uint8_t value : transaction) Transfer(value);
+	Deselect();
+}
+
+uint8_t SaveMemory::Transfer(uint8_t value) {
+	if (!selected) {
+		selected = true;
+		command = value;
+		position = 0;
+		address = 0;
+		written = false;
+
+		// Only FLASH chips answer the ID command
+		if (detecting && (command == CMD_RDID)) {
+			SetStorage(SAVE_FLASH, 3, 0x80000);
+			detecting = false;
+		}
+
+		switch (command) {
+		case CMD_WREN:
+			writeEnable = true;
+			break;
+		case CMD_WRDI:
+			writeEnable = false;
+			break;
+		case CMD_CHIP_ERASE:
+			if ((type == SAVE_FLASH) && writeEnable && !detecting) {
+				Erase(0, static_cast<uint32_t>(size));
+				written = true;
+			}
+			break;
+		default:
+			break;
+		}
+
+		if (detecting && IsAddressedCommand(command)) detectBuffer.assign(1, value);
+		return 0xFF;
+	}
+
+	position++;
+	if (detecting) {
+		if (!detectBuffer.empty()) {
+			detectBuffer.push_back(value);
+			return 0xFF;
+		}
+		return (command == CMD_RDSR) ? (writeEnable ? STATUS_WRITE_ENABLE : 0x00) : 0xFF;
+	}
+	return TransferData(value);
+}
+
+uint8_t SaveMemory::TransferData(uint8_t value) {
+	switch (command) {
+	case CMD_RDSR:
+		return writeEnable ? STATUS_WRITE_ENABLE : 0x00;
+
+	case CMD_RDID: {
+		if (type != SAVE_FLASH) return 0xFF;
+		// Manufacturer, memory type, capacity as a power of 2
+		int capacity = 0;
+		while ((static_cast<size_t>(1) << capacity) < size) capacity++;
+		const uint8_t id[3] = { 0x20, 0x40, static_cast<uint8_t>(capacity) };
+		return id[(position - 1) % 3];
+	}
+
+	case CMD_READ:
+	case CMD_READ_HIGH:
+	case CMD_WRITE:
+	case CMD_WRITE_HIGH:
+	case CMD_PAGE_ERASE:
+	case CMD_SECTOR_ERASE:
+		if (position <= static_cast<uint32_t>(addressBytes)) {
+			address = (address << 8) | value;
+			if (position < static_cast<uint32_t>(addressBytes)) return 0xFF;
+
+			// 512 bytes EEPROM : bit 3 of the command is address bit 8
+			if ((addressBytes == 1) && ((command & 0x8) != 0)) address |= 0x100;
+
+			if ((type == SAVE_FLASH) && writeEnable) {
+				if (command == CMD_PAGE_ERASE) {
+					Erase(address & ~(FLASH_PAGE_SIZE - 1), FLASH_PAGE_SIZE);
+					written = true;
+				}
+				else if (command == CMD_SECTOR_ERASE) {
+					Erase(address & ~(FLASH_SECTOR_SIZE - 1), FLASH_SECTOR_SIZE);
+					written = true;
+				}
+			}
+			return 0xFF;
+		}
+
+		switch (command) {
+		case CMD_READ_HIGH:
+			// FLASH fast read : one dummy byte after the address
+			if ((type == SAVE_FLASH) && (position == static_cast<uint32_t>(addressBytes) + 1)) return 0xFF;
+			[[fallthrough]];
+		case CMD_READ:
+			return data[address++ & addressMask];
+
+		case CMD_WRITE:
+		case CMD_WRITE_HIGH:
+			if (writeEnable) {
+				// FLASH page program can only clear bits, page write replaces them
+				WriteByte(address, value, (type == SAVE_FLASH) && (command == CMD_WRITE));
+				written = true;
+			}
+			address++;
+			return 0xFF;
+
+		default:
+			return 0xFF;
+		}
+
+	default:
+		return 0xFF;
+	}
+}
+
+void SaveMemory::WriteByte(uint32_t addr, uint8_t value, bool program) {
+	addr &= addressMask;
+	data[addr] = program ? (data[addr] & value) : value;
+	MarkDirty(addr, 1);
+}
+
+void SaveMemory::Erase(uint32_t addr, uint32_t length) {
+	addr &= addressMask;
+	length = std::min<uint32_t>(length, static_cast<uint32_t>(size) - addr);
+	memset(data + addr, 0xFF, length);
+	MarkDirty(addr, length);
+}
+
+void SaveMemory::Deselect() {
+	if (!selected) return;
+	selected = false;
+
+	if (detecting) {
+		if (!detectBuffer.empty()) Detect();
+		return;
+	}
+
+	// Write enable is cleared once a write or erase is done
+	if (written) {
+		writeEnable = false;
+		RequestFlush();
+	}
+}
+
+#pragma endregion
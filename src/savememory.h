@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum eSaveType {
+	SAVE_AUTO,		// Detected from the file size, or from the first addressed command of the game
+	SAVE_EEPROM,	// 1 (512 bytes), 2 (8KB / 64KB) or 3 (128KB) address bytes
+	SAVE_FRAM,		// 32KB, same commands as 2 address bytes EEPROM
+	SAVE_FLASH,		// 256KB to 8MB, 3 address bytes
+};
+
+/// <summary>
+/// Cartridge save chip on the AUXSPI bus. The save data is a shared memory mapping of the save file :
+/// the emulation thread only writes to memory and marks pages dirty, a background thread writes dirty pages back with msync.
+/// </summary>
+class SaveMemory {
+private:
+	static const uint8_t CMD_WRSR = 0x01;
+	static const uint8_t CMD_WRITE = 0x02;		// EEPROM / FRAM write, FLASH page program
+	static const uint8_t CMD_READ = 0x03;
+	static const uint8_t CMD_WRDI = 0x04;
+	static const uint8_t CMD_RDSR = 0x05;
+	static const uint8_t CMD_WREN = 0x06;
+	static const uint8_t CMD_WRITE_HIGH = 0x0A;	// 512 bytes EEPROM : write upper half, FLASH : page write
+	static const uint8_t CMD_READ_HIGH = 0x0B;	// 512 bytes EEPROM : read upper half, FLASH : fast read
+	static const uint8_t CMD_RDID = 0x9F;
+	static const uint8_t CMD_CHIP_ERASE = 0xC7;
+	static const uint8_t CMD_SECTOR_ERASE = 0xD8;
+	static const uint8_t CMD_PAGE_ERASE = 0xDB;
+
+	static const uint8_t STATUS_WRITE_ENABLE = 0x02;
+
+	static const uint32_t FLASH_PAGE_SIZE = 0x100;
+	static const uint32_t FLASH_SECTOR_SIZE = 0x10000;
+
+	// Dirty pages are tracked at the granularity of msync
+	static const uint32_t DIRTY_PAGE_SHIFT = 12;
+	static constexpr int FLUSH_DELAY_MS = 500;
+
+	eSaveType type{ SAVE_AUTO };
+	int addressBytes{ 0 };
+	std::string path;
+
+	uint8_t* data{ nullptr };
+	size_t size{ 0 };
+	uint32_t addressMask{ 0 };
+	std::vector<uint8_t> memoryBuffer;	// Storage when there is no save file
+	bool mapped{ false };
+#ifdef _WIN32
+	void* fileHandle{ nullptr };
+	void* mappingHandle{ nullptr };
+#endif
+
+	// Current SPI transaction
+	bool selected{ false };
+	uint8_t command{ 0 };
+	uint32_t position{ 0 };
+	uint32_t address{ 0 };
+	bool writeEnable{ false };
+	bool written{ false };
+
+	// Auto detection : the first addressed transaction is buffered, then replayed once the address size is known
+	bool detecting{ false };
+	std::vector<uint8_t> detectBuffer;
+
+	// Background flush
+	std::unique_ptr<std::atomic<uint64_t>[]> dirtyPages;
+	size_t dirtyWords{ 0 };
+	std::thread flushThread;
+	std::mutex flushMutex;
+	std::condition_variable flushCondition;
+	bool flushRequested{ false };
+	bool flushStop{ false };
+
+	bool MapFile(size_t fileSize);
+	void UnmapFile();
+	void SetStorage(eSaveType saveType, int addrBytes, size_t storageSize);
+	void Detect();
+	bool IsAddressedCommand(uint8_t cmd) const;
+	uint8_t TransferData(uint8_t value);
+	void WriteByte(uint32_t addr, uint8_t value, bool program);
+	void Erase(uint32_t addr, uint32_t length);
+	void MarkDirty(uint32_t addr, uint32_t length);
+	void RequestFlush();
+	void FlushDirtyPages();
+	void FlushLoop();
+
+public:
+	~SaveMemory();
+
+	/// <summary>
+	/// Open or create a save file. Without a path the save only lives in memory.
+	/// </summary>
+	/// <param name="filePath">Save file, created on first use if it does not exist</param>
+	/// <param name="saveType">Chip type, SAVE_AUTO to detect it</param>
+	/// <param name="saveSize">Chip size in bytes, 0 to detect it</param>
+	/// <returns>false if the file exists but can't be mapped</returns>
+	bool Open(const std::string& filePath, eSaveType saveType = SAVE_AUTO, size_t saveSize = 0);
+
+	/// <summary>
+	/// Write every dirty page back and close the save file
+	/// </summary>
+	void Close();
+
+	/// <summary>
+	/// Exchange one byte with the chip, selecting it if needed
+	/// </summary>
+	/// <param name="value">Byte sent by the CPU</param>
+	/// <returns>Byte returned by the chip</returns>
+	uint8_t Transfer(uint8_t value);
+
+	/// <summary>
+	/// Release the chip select line, ending the current command
+	/// </summary>
+	void Deselect();
+
+	/// <summary>
+	/// Write dirty pages back now, on the calling thread
+	/// </summary>
+	void Flush();
+
+	eSaveType GetType() const {
+		return type;
+	}
+
+	size_t GetSize() const {
+		return size;
+	}
+};
@@ -0,0 +1,74 @@
+#include "scheduler.h"
+
+void Scheduler::Reset() {
+	timestamp = 0;
+	publishedTimestamp.store(0, std::memory_order_relaxed);
+	for (int i = 0; i < EVENT_COUNT; i++) {
+		events[i].active = false;
+		events[i].time = 0;
+	}
+	breakRequested.store(false, std::memory_order_relaxed);
+	updateNextEventTime();
+}
+
+void Scheduler::SetCallback(eSchedulerEvent id, std::function<void()> callback) {
+	events[id].callback = callback;
+}
+
+void Scheduler::Schedule(eSchedulerEvent id, uint64_t delay) {
+	events[id].active = true;
+	events[id].time = timestamp + delay;
+	updateNextEventTime();
+}
+
+void Scheduler::Reschedule(eSchedulerEvent id, uint64_t delay) {
+	events[id].active = true;
+	events[id].time += delay;
+	updateNextEventTime();
+}
+
+void Scheduler::Cancel(eSchedulerEvent id) {
+	if (!events[id].active) return;
+
+	events[id].active = false;
+	updateNextEventTime();
+}
+
+void Scheduler::updateNextEventTime() {
+	nextEventTime = NO_EVENT;
+	for (int i = 0; i < EVENT_COUNT; i++) {
+		if (events[i].active && (events[i].time < nextEventTime)) nextEventTime = events[i].time;
+	}
+}
+
+void Scheduler::RunEvents() {
+	breakRequested.store(false, std::memory_order_relaxed);
+	publishedTimestamp.store(timestamp, std::memory_order_relaxed);
+
+	while (timestamp >= nextEventTime) {
+		// Run the earliest event first, callbacks may schedule new ones
+		int id = 0;
+		for (int i = 0; i < EVENT_COUNT; i++) {
+			if (events[i].active && (events[i].time == nextEventTime)) {
+				id = i;
+				break;
+			}
+		}
+
+		events[id].active = false;
+		updateNextEventTime();
+		if (events[id].callback) events[id].callback();
+	}
+}
+
+uint64_t Scheduler::SkipToNextEvent() {
+	if (nextEventTime == NO_EVENT) return 0;
+
+	uint64_t skipped = 0;
+	if (nextEventTime > timestamp) {
+		skipped = nextEventTime - timestamp;
+		timestamp = nextEventTime;
+	}
+	RunEvents();
+	return skipped;
+}
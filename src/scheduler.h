@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <functional>
+
+// Scheduler timestamps are counted in ARM9 clock cycles (~67.03MHz).
+// The ARM7 and the system bus run at half this rate.
+constexpr auto ARM9_CLOCK_HZ = 67027964;
+constexpr auto ARM7_CYCLE_LENGTH = 2;
+
+enum eSchedulerEvent : int {
+	EVENT_LCD_HBLANK,
+	EVENT_LCD_LINE,
+	EVENT_TIMER0,
+	EVENT_TIMER1,
+	EVENT_TIMER2,
+	EVENT_TIMER3,
+	EVENT_DIV,
+	EVENT_SQRT,
+	EVENT_GXFIFO,
+	EVENT_COUNT
+};
+
+class Scheduler {
+private:
+	struct Event {
+		bool active{ false };
+		uint64_t time{ 0 };
+		std::function<void()> callback;
+	};
+
+	uint64_t timestamp{ 0 };
+	uint64_t nextEventTime{ NO_EVENT };
+	std::atomic<bool> breakRequested{ false };
+	std::atomic<uint64_t> publishedTimestamp{ 0 };
+	Event events[EVENT_COUNT];
+
+	void updateNextEventTime();
+
+public:
+	static const uint64_t NO_EVENT = UINT64_MAX;
+
+	/// <summary>
+	/// Remove all scheduled events and set the timestamp back to 0. Callbacks are kept.
+	/// </summary>
+	void Reset();
+
+	/// <summary>
+	/// Set the function called when an event is due
+	/// </summary>
+	/// <param name="id">Event identifier</param>
+	/// <param name="callback">Function to call</param>
+	void SetCallback(eSchedulerEvent id, std::function<void()> callback);
+
+	/// <summary>
+	/// Schedule an event relative to the current timestamp. Replaces any pending occurence of the same event.
+	/// </summary>
+	/// <param name="id">Event identifier</param>
+	/// <param name="delay">Cycles from now</param>
+	void Schedule(eSchedulerEvent id, uint64_t delay);
+
+	/// <summary>
+	/// Schedule an event relative to its previous due time, so periodic events do not drift
+	/// </summary>
+	/// <param name="id">Event identifier</param>
+	/// <param name="delay">Cycles from previous due time</param>
+	void Reschedule(eSchedulerEvent id, uint64_t delay);
+
+	/// <summary>
+	/// Remove an event from the schedule
+	/// </summary>
+	/// <param name="id">Event identifier</param>
+	void Cancel(eSchedulerEvent id);
+
+	bool IsScheduled(eSchedulerEvent id) const {
+		return events[id].active;
+	}
+
+	uint64_t GetEventTime(eSchedulerEvent id) const {
+		return events[id].time;
+	}
+
+	uint64_t GetTimestamp() const {
+		return timestamp;
+	}
+
+	/// <summary>
+	/// Timestamp as of the last RunEvents() call, safe to read from another thread
+	/// </summary>
+	/// <returns></returns>
+	uint64_t GetPublishedTimestamp() const {
+		return publishedTimestamp.load(std::memory_order_relaxed);
+	}
+
+	uint64_t GetNextEventTime() const {
+		return nextEventTime;
+	}
+
+	void AddCycles(uint64_t cycles) {
+		timestamp += cycles;
+	}
+
+	/// <summary>
+	/// Returns true when the run loop must stop executing instructions, either because an event is due or a break has been requested
+	/// </summary>
+	/// <returns></returns>
+	bool IsEventDue() const {
+		return (timestamp >= nextEventTime) || breakRequested.load(std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Ask the run loop to leave its current block as soon as possible. Can be called from another thread.
+	/// </summary>
+	void BreakLoop() {
+		breakRequested.store(true, std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Run every event due at the current timestamp, and clear any break request
+	/// </summary>
+	void RunEvents();
+
+	/// <summary>
+	/// Move the timestamp forward to the next scheduled event and run it
+	/// </summary>
+	/// <returns>Number of cycles skipped, 0 if no event is scheduled</returns>
+	uint64_t SkipToNextEvent();
+};
@@ -0,0 +1,24 @@
+#include "simd.h"
+
+#ifdef SIMD_HAS_X86_KERNELS
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+bool HostSupportsAVX2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+
+	// AVX enabled by the OS (OSXSAVE, YMM state saved), then AVX2
+	__cpuid(info, 1);
+	if (((info[2] & (1 << 27)) == 0) || ((info[2] & (1 << 28)) == 0)) return false;
+	if ((_xgetbv(0) & 0x6) != 0x6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
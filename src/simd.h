@@ -0,0 +1,20 @@
+#pragma once
+
+// SIMD levels shared by the 2D kernels and the geometry engine matrix kernels
+
+enum eSIMDLevel {
+	SIMD_SCALAR,
+	SIMD_SSE2,
+	SIMD_AVX2,
+	SIMD_BEST,	// Best level supported by the host CPU
+};
+
+#if defined(_M_X64) || defined(__x86_64__)
+// SSE2 is always there on x86-64, AVX2 kernels are built in their own files and picked at runtime
+#define SIMD_HAS_X86_KERNELS
+
+/// <summary>
+/// Returns true if the host CPU and OS support AVX2
+/// </summary>
+bool HostSupportsAVX2();
+#endif
@@ -0,0 +1,102 @@
+#include "timers.h"
+
+void Timers::Attach(ARM_mem& mem, Scheduler* sched, InterruptController* irqCtrl) {
+	scheduler = sched;
+	irq = irqCtrl;
+
+	for (int id = 0; id < 4; id++) {
+		timers[id] = Timer();
+		uint32_t addr = TIMER_BASE_ADDR + id * 4;
+		mem.SetIOReadHandler(addr, [this, id]() {
+			return static_cast<uint32_t>(GetCounter(id)) | (static_cast<uint32_t>(timers[id].control) << 16);
+		});
+		mem.SetIOWriteHandler(addr, [this, id](uint32_t value, uint32_t mask) {
+			if ((mask & 0xFFFF) != 0) timers[id].reload = static_cast<uint16_t>(value);
+			if ((mask & 0xFFFF0000) != 0) WriteControl(id, static_cast<uint16_t>(value >> 16));
+		});
+		scheduler->SetCallback(static_cast<eSchedulerEvent>(EVENT_TIMER0 + id), [this, id]() { Overflow(id); });
+	}
+}
+
+bool Timers::IsTicking(int id) const {
+	// Timer 0 can't count up, its count-up bit is ignored
+	const Timer& t = timers[id];
+	return ((t.control & CNT_ENABLE) != 0) && ((id == 0) || ((t.control & CNT_COUNT_UP) == 0));
+}
+
+uint16_t Timers::GetCounter(int id) const {
+	const Timer& t = timers[id];
+	if (!IsTicking(id)) return t.counter;
+
+	uint64_t ticks = (scheduler->GetTimestamp() - t.startTime) >> t.shift;
+	uint64_t toOverflow = 0x10000 - t.counter;
+	if (ticks < toOverflow) return static_cast<uint16_t>(t.counter + ticks);
+
+	// Overflow is due but its event has not run yet
+	return static_cast<uint16_t>(t.reload + (ticks - toOverflow) % (0x10000 - t.reload));
+}
+
+void Timers::Start(int id, uint16_t counter) {
+	Timer& t = timers[id];
+	t.counter = counter;
+	t.startTime = scheduler->GetTimestamp();
+	if (IsTicking(id)) {
+		ScheduleOverflow(id);
+	}
+	else {
+		scheduler->Cancel(static_cast<eSchedulerEvent>(EVENT_TIMER0 + id));
+	}
+}
+
+void Timers::ScheduleOverflow(int id) {
+	Timer& t = timers[id];
+	uint64_t overflowTime = t.startTime + (static_cast<uint64_t>(0x10000 - t.counter) << t.shift);
+	uint64_t now = scheduler->GetTimestamp();
+	scheduler->Schedule(static_cast<eSchedulerEvent>(EVENT_TIMER0 + id), (overflowTime > now) ? overflowTime - now : 0);
+}
+
+void Timers::WriteControl(int id, uint16_t value) {
+	Timer& t = timers[id];
+	uint16_t current = GetCounter(id);
+	bool wasEnabled = (t.control & CNT_ENABLE) != 0;
+
+	t.control = value & 0xC7;
+	t.shift = PRESCALER_SHIFTS[value & 0x3];
+
+	if ((value & CNT_ENABLE) == 0) {
+		// Stopped timers keep their value
+		t.counter = current;
+		scheduler->Cancel(static_cast<eSchedulerEvent>(EVENT_TIMER0 + id));
+	}
+	else {
+		// Reload on enable, otherwise keep counting with the new settings
+		Start(id, wasEnabled ? current : t.reload);
+	}
+}
+
+void Timers::Overflow(int id) {
+	Timer& t = timers[id];
+	eSchedulerEvent event = static_cast<eSchedulerEvent>(EVENT_TIMER0 + id);
+
+	// Restart from the exact overflow time so periodic timers do not drift
+	t.counter = t.reload;
+	t.startTime = scheduler->GetEventTime(event);
+	scheduler->Reschedule(event, static_cast<uint64_t>(0x10000 - t.reload) << t.shift);
+
+	if ((t.control & CNT_IRQ) != 0) irq->Raise(static_cast<eIRQ>(IRQ_TIMER0 + id));
+	if (id < 3) CountUp(id + 1);
+}
+
+void Timers::CountUp(int id) {
+	Timer& t = timers[id];
+	if (((t.control & CNT_ENABLE) == 0) || IsTicking(id)) return;
+
+	if (t.counter != 0xFFFF) {
+		t.counter++;
+		return;
+	}
+
+	t.counter = t.reload;
+	if ((t.control & CNT_IRQ) != 0) irq->Raise(static_cast<eIRQ>(IRQ_TIMER0 + id));
+	if (id < 3) CountUp(id + 1);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include "arm_mem.h"
+#include "scheduler.h"
+#include "interrupts.h"
+
+/// <summary>
+/// The four timers of one CPU (TMxCNT_L / TMxCNT_H).
+/// Counters are never ticked : their value is derived from the scheduler timestamp when read,
+/// and only overflows are scheduled as events.
+/// </summary>
+class Timers {
+private:
+	struct Timer {
+		uint16_t reload{ 0 };
+		uint16_t control{ 0 };
+		uint16_t counter{ 0 };		// Value at startTime (running timers) or current value (stopped / count-up)
+		uint64_t startTime{ 0 };
+		uint32_t shift{ 0 };		// Prescaler, as a shift of scheduler cycles
+	};
+
+	Scheduler* scheduler{ nullptr };
+	InterruptController* irq{ nullptr };
+	Timer timers[4];
+
+	bool IsTicking(int id) const;
+	uint16_t GetCounter(int id) const;
+	void Start(int id, uint16_t counter);
+	void ScheduleOverflow(int id);
+	void Overflow(int id);
+	void CountUp(int id);
+	void WriteControl(int id, uint16_t value);
+
+public:
+	static const uint32_t TIMER_BASE_ADDR = 0x04000100;
+
+	static const uint16_t CNT_COUNT_UP = 1 << 2;
+	static const uint16_t CNT_IRQ = 1 << 6;
+	static const uint16_t CNT_ENABLE = 1 << 7;
+
+	// Timers run on the 33.51MHz bus clock, prescalers are 1, 64, 256 and 1024
+	static constexpr uint32_t PRESCALER_SHIFTS[4] = { 1, 7, 9, 11 };
+
+	/// <summary>
+	/// Map the timer registers into the CPU I/O table and register the overflow events
+	/// </summary>
+	/// <param name="mem">Virtual memory of the CPU</param>
+	/// <param name="sched">Scheduler of the CPU</param>
+	/// <param name="irqCtrl">Interrupt controller of the CPU</param>
+	void Attach(ARM_mem& mem, Scheduler* sched, InterruptController* irqCtrl);
+};
@@ -0,0 +1,186 @@
+#include "vram.h"
+#include <algorithm>
+
+const VRAM::ViewInfo VRAM::VIEWS[VRAM_VIEW_COUNT] = {
+	{ 32, 0x000, 0x80 },	// ABG, mirrored up to 061FFFFFh
+	{ 8, 0x080, 0x80 },		// BBG, mirrored up to 063FFFFFh
+	{ 16, 0x100, 0x80 },	// AOBJ, mirrored up to 065FFFFFh
+	{ 8, 0x180, 0x80 },		// BOBJ, mirrored up to 067FFFFFh
+	{ 41, 0x200, 41 },		// LCDC
+	{ 16, -1, 0 },			// ARM7
+	{ 32, -1, 0 },			// Texture
+	{ 6, -1, 0 },			// Texture palette
+	{ 2, -1, 0 },			// ABG extended palettes
+	{ 1, -1, 0 },			// AOBJ extended palette
+	{ 2, -1, 0 },			// BBG extended palettes
+	{ 1, -1, 0 },			// BOBJ extended palette
+};
+
+const uint32_t VRAM::BANK_OFFSETS[BANK_COUNT] = { 0x00000, 0x20000, 0x40000, 0x60000, 0x80000, 0x90000, 0x94000, 0x98000, 0xA0000 };
+const uint32_t VRAM::BANK_SIZES[BANK_COUNT] = { 0x20000, 0x20000, 0x20000, 0x20000, 0x10000, 0x4000, 0x4000, 0x8000, 0x4000 };
+
+void VRAM::Attach(ARM9_mem& mem9, ARM7_mem& mem7) {
+	banks = std::make_unique<uint8_t[]>(BANKS_SIZE + 4);
+	for (int view = 0; view < VRAM_VIEW_COUNT; view++) {
+		pages[view].assign(VIEWS[view].pages, UNMAPPED);
+		pageBanks[view].assign(VIEWS[view].pages, 0);
+	}
+	for (auto& page : arm7Pages) page.store(nullptr);
+
+	mem9.SetVRAMPages(cpuPages);
+	mem7.SetVRAMPages(arm7Pages);
+	vramStat = mem7.GetPointerFromAddr(VRAMSTAT_ADDR);
+
+	// VRAMCNT_A to D, then E to G (the last byte is WRAMCNT), then H and I
+	mem9.SetIOWriteHandler(VRAMCNT_ADDR, [this](uint32_t value, uint32_t mask) {
+		for (int i = 0; i < 4; i++) if ((mask >> (i * 8)) & 0xFF) SetControl(i, static_cast<uint8_t>(value >> (i * 8)));
+	});
+	mem9.SetIOWriteHandler(VRAMCNT_ADDR + 4, [this](uint32_t value, uint32_t mask) {
+		for (int i = 0; i < 3; i++) if ((mask >> (i * 8)) & 0xFF) SetControl(4 + i, static_cast<uint8_t>(value >> (i * 8)));
+	});
+	mem9.SetIOWriteHandler(VRAMCNT_ADDR + 8, [this](uint32_t value, uint32_t mask) {
+		for (int i = 0; i < 2; i++) if ((mask >> (i * 8)) & 0xFF) SetControl(7 + i, static_cast<uint8_t>(value >> (i * 8)));
+	});
+
+	mem9.AddWriteWatch(0x06000000, 0x01000000, [this](uint32_t address, uint32_t length) { OnCPUWrite(address, length); });
+}
+
+bool VRAM::GetMapping(int bank, uint8_t value, Mapping& mapping) {
+	if ((value & 0x80) == 0) return false;
+
+	uint8_t mst = value & ((bank < 2) ? 0x3 : 0x7);
+	int ofs = (value >> 3) & 0x3;
+	int bankPages = static_cast<int>(BANK_SIZES[bank] >> PAGE_SHIFT);
+	int smallOffset = (ofs & 1) + (ofs >> 1) * 4;	// Banks F and G : 16KB steps, then 64KB steps
+	mapping = { VRAM_VIEW_LCDC, static_cast<int>(BANK_OFFSETS[bank] >> PAGE_SHIFT), bankPages };
+	if (mst == 0) return true;
+
+	switch (bank) {
+	case 0:
+	case 1:
+	case 2:
+	case 3:
+		// A to D : 128KB
+		switch (mst) {
+		case 1: mapping = { VRAM_VIEW_ABG, ofs * 8, 8 }; return true;
+		case 2:
+			if (bank < 2) mapping = { VRAM_VIEW_AOBJ, (ofs & 1) * 8, 8 };
+			else mapping = { VRAM_VIEW_ARM7, (ofs & 1) * 8, 8 };
+			return true;
+		case 3: mapping = { VRAM_VIEW_TEXTURE, ofs * 8, 8 }; return true;
+		case 4: mapping = { (bank == 2) ? VRAM_VIEW_BBG : VRAM_VIEW_BOBJ, 0, 8 }; return bank >= 2;
+		default: return false;
+		}
+
+	case 4:
+		// E : 64KB, only the first 32KB as extended palettes
+		switch (mst) {
+		case 1: mapping = { VRAM_VIEW_ABG, 0, 4 }; return true;
+		case 2: mapping = { VRAM_VIEW_AOBJ, 0, 4 }; return true;
+		case 3: mapping = { VRAM_VIEW_TEXPAL, 0, 4 }; return true;
+		case 4: mapping = { VRAM_VIEW_ABG_EXTPAL, 0, 2 }; return true;
+		default: return false;
+		}
+
+	case 5:
+	case 6:
+		// F and G : 16KB
+		switch (mst) {
+		case 1: mapping = { VRAM_VIEW_ABG, smallOffset, 1 }; return true;
+		case 2: mapping = { VRAM_VIEW_AOBJ, smallOffset, 1 }; return true;
+		case 3: mapping = { VRAM_VIEW_TEXPAL, smallOffset, 1 }; return true;
+		case 4: mapping = { VRAM_VIEW_ABG_EXTPAL, ofs & 1, 1 }; return true;
+		case 5: mapping = { VRAM_VIEW_AOBJ_EXTPAL, 0, 1 }; return true;
+		default: return false;
+		}
+
+	case 7:
+		// H : 32KB
+		switch (mst) {
+		case 1: mapping = { VRAM_VIEW_BBG, 0, 2 }; return true;
+		case 2: mapping = { VRAM_VIEW_BBG_EXTPAL, 0, 2 }; return true;
+		default: return false;
+		}
+
+	default:
+		// I : 16KB
+		switch (mst) {
+		case 1: mapping = { VRAM_VIEW_BBG, 2, 1 }; return true;
+		case 2: mapping = { VRAM_VIEW_BOBJ, 0, 1 }; return true;
+		case 3: mapping = { VRAM_VIEW_BOBJ_EXTPAL, 0, 1 }; return true;
+		default: return false;
+		}
+	}
+}
+
+void VRAM::SetControl(int bank, uint8_t value) {
+	if (control[bank] == value) return;
+
+	Mapping previous;
+	bool wasMapped = GetMapping(bank, control[bank], previous);
+	Mapping next;
+	bool isMapped = GetMapping(bank, value, next);
+	control[bank] = value;
+
+	if (wasMapped) {
+		int end = std::min(previous.firstPage + previous.pageCount, VIEWS[previous.view].pages);
+		for (int page = previous.firstPage; page < end; page++) {
+			pageBanks[previous.view][page] &= ~(1 << bank);
+			UpdatePage(previous.view, page);
+		}
+	}
+	if (isMapped) {
+		mappings[bank] = next;
+		int end = std::min(next.firstPage + next.pageCount, VIEWS[next.view].pages);
+		for (int page = next.firstPage; page < end; page++) {
+			pageBanks[next.view][page] |= 1 << bank;
+			UpdatePage(next.view, page);
+		}
+	}
+
+	// Banks C and D mapped to the ARM7 are written behind the ARM9 watches : they have changed for the views they join
+	if (wasMapped && (previous.view == VRAM_VIEW_ARM7) && !(isMapped && (next.view == VRAM_VIEW_ARM7))) {
+		for (auto& watch : writeWatches) watch(BANK_OFFSETS[bank], BANK_SIZES[bank]);
+	}
+
+	if (bank == 2 || bank == 3) {
+		bool arm7 = isMapped && (next.view == VRAM_VIEW_ARM7);
+		uint8_t bit = 1 << (bank - 2);
+		*vramStat = arm7 ? (*vramStat | bit) : (*vramStat & ~bit);
+	}
+}
+
+void VRAM::UpdatePage(eVRAMView view, int page) {
+	// Overlapping banks : the first one wins (the hardware would OR them)
+	uint16_t mask = pageBanks[view][page];
+	uint32_t offset = UNMAPPED;
+	if (mask != 0) {
+		int bank = 0;
+		while (((mask >> bank) & 1) == 0) bank++;
+		offset = BANK_OFFSETS[bank] + static_cast<uint32_t>(page - mappings[bank].firstPage) * PAGE_SIZE;
+	}
+	pages[view][page] = offset;
+
+	uint8_t* ptr = (offset != UNMAPPED) ? banks.get() + offset : nullptr;
+	const ViewInfo& info = VIEWS[view];
+	if (info.cpuFirstPage >= 0) {
+		for (int mirror = page; mirror < info.cpuBlockPages; mirror += info.pages) cpuPages[info.cpuFirstPage + mirror] = ptr;
+	}
+	else if (view == VRAM_VIEW_ARM7) {
+		arm7Pages[page].store(ptr, std::memory_order_release);
+	}
+}
+
+void VRAM::OnCPUWrite(uint32_t address, uint32_t length) {
+	uint64_t end = std::min<uint64_t>(static_cast<uint64_t>(address) + length, 0x07000000);
+	uint64_t current = std::max<uint32_t>(address, 0x06000000);
+	while (current < end) {
+		uint32_t chunk = static_cast<uint32_t>(std::min<uint64_t>(end - current, PAGE_SIZE - (current & (PAGE_SIZE - 1))));
+		uint8_t* page = cpuPages[(current >> PAGE_SHIFT) & (CPU_PAGES - 1)];
+		if (page != nullptr) {
+			uint32_t offset = static_cast<uint32_t>(page - banks.get()) + static_cast<uint32_t>(current & (PAGE_SIZE - 1));
+			for (auto& watch : writeWatches) watch(offset, chunk);
+		}
+		current += chunk;
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "arm9_mem.h"
+#include "arm7_mem.h"
+
+/// <summary>
+/// Places where VRAM banks can be mapped. The first ones are seen by the ARM9 (and the 2D engines), the others only by the ARM7 or the renderers.
+/// </summary>
+enum eVRAMView {
+	VRAM_VIEW_ABG,			// 06000000h, 512KB
+	VRAM_VIEW_BBG,			// 06200000h, 128KB
+	VRAM_VIEW_AOBJ,			// 06400000h, 256KB
+	VRAM_VIEW_BOBJ,			// 06600000h, 128KB
+	VRAM_VIEW_LCDC,			// 06800000h, 656KB
+	VRAM_VIEW_ARM7,			// ARM7 06000000h, 256KB
+	VRAM_VIEW_TEXTURE,		// 3D texture image slots, 4 x 128KB
+	VRAM_VIEW_TEXPAL,		// 3D texture palette slots, 6 x 16KB
+	VRAM_VIEW_ABG_EXTPAL,	// Engine A BG extended palette slots, 4 x 8KB
+	VRAM_VIEW_AOBJ_EXTPAL,	// Engine A OBJ extended palette, 8KB
+	VRAM_VIEW_BBG_EXTPAL,	// Engine B BG extended palette slots, 4 x 8KB
+	VRAM_VIEW_BOBJ_EXTPAL,	// Engine B OBJ extended palette, 8KB
+	VRAM_VIEW_COUNT,
+};
+
+/// <summary>
+/// The nine VRAM banks (A to I) and their mapping, set by VRAMCNT.
+/// Every view is a table of 16KB pages holding offsets in bank memory, bank memory being laid out as in LCDC mode (A at 0, I at 0A0000h).
+/// A VRAMCNT write only rebuilds the pages the bank leaves and the pages it enters.
+/// </summary>
+class VRAM {
+private:
+	static const int BANK_COUNT = 9;
+	static const int CPU_PAGES = 0x400;	// 06000000h to 06FFFFFFh
+	static const int ARM7_PAGES = 0x10;	// 256KB, mirrored from 06000000h to 06FFFFFFh
+
+	struct ViewInfo {
+		int pages;
+		int cpuFirstPage;	// -1 : not seen by the ARM9
+		int cpuBlockPages;	// Mirrored over this many pages
+	};
+	static const ViewInfo VIEWS[VRAM_VIEW_COUNT];
+	static const uint32_t BANK_OFFSETS[BANK_COUNT];
+	static const uint32_t BANK_SIZES[BANK_COUNT];
+
+	struct Mapping {
+		eVRAMView view;
+		int firstPage;
+		int pageCount;
+	};
+
+	std::unique_ptr<uint8_t[]> banks;
+	uint8_t control[BANK_COUNT]{};
+	Mapping mappings[BANK_COUNT]{};
+
+	// Pages of every view, and for each page the banks mapped on it
+	std::vector<uint32_t> pages[VRAM_VIEW_COUNT];
+	std::vector<uint16_t> pageBanks[VRAM_VIEW_COUNT];
+
+	uint8_t* cpuPages[CPU_PAGES]{};
+	std::atomic<uint8_t*> arm7Pages[ARM7_PAGES]{};
+	uint8_t* vramStat{ nullptr };
+
+	std::vector<std::function<void(uint32_t offset, uint32_t length)>> writeWatches;
+
+	static bool GetMapping(int bank, uint8_t value, Mapping& mapping);
+	void SetControl(int bank, uint8_t value);
+	void UpdatePage(eVRAMView view, int page);
+	void OnCPUWrite(uint32_t address, uint32_t length);
+
+public:
+	static constexpr uint32_t UNMAPPED = 0xFFFFFFFF;
+	static constexpr uint32_t PAGE_SHIFT = 14;
+	static constexpr uint32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+	static constexpr uint32_t BANKS_SIZE = 0xA4000;
+
+	static const uint32_t VRAMCNT_ADDR = 0x04000240;	// A to D, E to G at +4, H and I at +8
+	static const uint32_t VRAMSTAT_ADDR = 0x04000240;	// ARM7
+
+	/// <summary>
+	/// Allocate the banks, all unmapped, and map VRAM for both CPUs
+	/// </summary>
+	/// <param name="mem9">ARM9 memory, receiving the VRAMCNT registers</param>
+	/// <param name="mem7">ARM7 memory, for banks C and D mapped as ARM7 work RAM</param>
+	void Attach(ARM9_mem& mem9, ARM7_mem& mem7);
+
+	/// <summary>
+	/// Get bank memory, laid out as in LCDC mode. There are 4 readable bytes after the last bank.
+	/// </summary>
+	uint8_t* GetBanks() {
+		return banks.get();
+	}
+
+	/// <summary>
+	/// Get the pages of a view
+	/// </summary>
+	/// <returns>Offset in bank memory of every 16KB page, UNMAPPED if no bank is mapped there</returns>
+	const uint32_t* GetView(eVRAMView view) const {
+		return pages[view].data();
+	}
+
+	static int GetViewPages(eVRAMView view) {
+		return VIEWS[view].pages;
+	}
+
+	/// <summary>
+	/// Register a function called after bank memory has been written by the ARM9, or has changed under a view
+	/// </summary>
+	/// <param name="handler">Function receiving the offset in bank memory and the length</param>
+	void AddWriteWatch(std::function<void(uint32_t offset, uint32_t length)> handler) {
+		writeWatches.push_back(handler);
+	}
+};